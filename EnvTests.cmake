@@ -20,7 +20,7 @@ include(CheckMembers)
 include(Libraries)
 
 set(INCLUDES arpa/inet.h fcntl.h inttypes.h limits.h netdb.h netinet/in.h stddef.h stdlib.h string.h sys/resource.h
-    sys/rusage.h sys/socket.h sys/statvfs.h sys/time.h syslog.h unistd.h stdbool.h)
+    sys/rusage.h sys/socket.h sys/statvfs.h sys/time.h syslog.h unistd.h stdbool.h linux/io_uring.h)
 check_includes("${INCLUDES}")
 
 TEST_BIG_ENDIAN(BIG_ENDIAN)
@@ -51,8 +51,8 @@ set(REQUIRED_FUNCTIONS atexit bzero ftruncate getaddrinfo getpass
   strtoul ftello fseeko)
 check_functions("${REQUIRED_FUNCTIONS}" TRUE)
 
-set(OPTIONAL_FUNCTIONS strerror perror pread pwrite readv writev getrusage
-  setitimer)
+set(OPTIONAL_FUNCTIONS strerror perror pread pwrite readv writev preadv sendfile
+  getrusage setitimer)
 check_functions("${OPTIONAL_FUNCTIONS}" false)
 
 set(CMAKE_REQUIRED_INCLUDES "sys/mman.h")
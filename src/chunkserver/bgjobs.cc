@@ -18,6 +18,7 @@
 
 #include "config.h"
 
+#include <stddef.h>
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
@@ -26,17 +27,28 @@
 #include <limits.h>
 #include <pthread.h>
 #include <errno.h>
+#include <sys/time.h>
+#include <sys/uio.h>
 
 #include "pcqueue.h"
 #include "datapack.h"
 #include "massert.h"
+#include "slogger.h"
 
+#include "bgjobs.h"
 #include "hddspacemgr.h"
 #include "replicator.h"
+#include "uring.h"
 
 #define JHASHSIZE 0x400
 #define JHASHPOS(id) ((id)&0x3FF)
 
+// io_uring engine: size of the ring = limit of reads in flight on all disks (one entry is used for wakeup pipe)
+#define URING_ENTRIES 1024
+#define URING_WAKEUP 0
+// workers reading again (under chunk lock) blocks which io_uring engine couldn't read or verify
+#define URING_RETRY_WORKERS 2
+
 enum {
 	JSTATE_DISABLED,
 	JSTATE_ENABLED,
@@ -49,7 +61,11 @@ enum {
 	OP_CHUNKOP,
 	OP_OPEN,
 	OP_CLOSE,
+	OP_FLUSH,
 	OP_READ,
+	OP_READ_BLOCKS,
+	OP_READ_FD,
+	OP_SENDFILE,
 	OP_WRITE,
 	OP_REPLICATE
 };
@@ -61,7 +77,7 @@ typedef struct _chunk_op_args {
 	uint32_t length;
 } chunk_op_args;
 
-// for OP_OPEN and OP_CLOSE
+// for OP_OPEN, OP_CLOSE and OP_FLUSH
 typedef struct _chunk_oc_args {
 	uint64_t chunkid;
 } chunk_oc_args;
@@ -76,6 +92,33 @@ typedef struct _chunk_rd_args {
 	uint8_t *crcbuff;
 } chunk_rd_args;
 
+// for OP_READ_BLOCKS (followed by blocks*buffer pointers and blocks*crcbuff pointers)
+typedef struct _chunk_rb_args {
+	uint64_t chunkid;
+	uint32_t version;
+	uint16_t blocknum;
+	uint16_t blocks;
+} chunk_rb_args;
+
+// for OP_READ_FD
+typedef struct _chunk_rf_args {
+	uint64_t chunkid;
+	uint32_t version;
+	uint16_t blocknum;
+	uint16_t *blocks;
+	int *fd;
+	uint64_t *fileoffset;
+	uint8_t *crcbuff;
+} chunk_rf_args;
+
+// for OP_SENDFILE
+typedef struct _chunk_sf_args {
+	int sock;
+	int fd;
+	uint64_t *fileoffset;
+	uint32_t *bytes;
+} chunk_sf_args;
+
 // for OP_WRITE
 typedef struct _chunk_wr_args {
 	uint64_t chunkid;
@@ -98,17 +141,68 @@ typedef struct _job {
 	void *extra;
 	void *args;
 	uint8_t jstate;
+	uint32_t diskid;	// folder of job put into disk queue (queue stats) ; 0 - job is not in disk queue
+	uint64_t qts;	// time of putting into disk queue
+	struct _jobpool *jp;	// status goes to this pool (disk queues are shared by all pools)
 	struct _job *next;
 } job;
 
-typedef struct _jobpool {
-	int rpipe,wpipe;
+// job queue with its own workers - one common for each pool and one for each disk (device) shared by all pools
+typedef struct _jobqueue {
+	uint64_t devid;	// 0 - common queue
+	void *queue;
+	uint32_t limit;	// disk queues: new jobs are refused above this length (main thread never waits for dying disk)
 	uint8_t workers;
 	pthread_t *workerthreads;
+	struct _jobqueue *next;
+} jobqueue;
+
+// whole blocks read by io_uring engine
+typedef struct _uring_read {
+	uint32_t jobid;
+	struct _job *jptr;
+	uint32_t diskid;
+	uint8_t **buffers;
+	uint8_t **crcbuffs;
+	uint16_t rblocks;
+	int fd;
+	uint64_t fileoffset;
+	uint64_t ts;
+	struct _uring_disk *disk;
+	struct _uring_read *next;
+	struct iovec iov[1];	// rblocks elements
+} uring_read;
+
+typedef struct _uring_disk {
+	uint64_t diskid;
+	uint32_t inflight;
+	uring_read *pendinghead,**pendingtail;
+	struct _uring_disk *next;
+} uring_disk;
+
+// by device - folders removed and added again use the same queue
+static jobqueue *diskqueues = NULL;
+static uint32_t diskqueuesusers = 0;	// pools with disk workers
+static pthread_mutex_t diskqueueslock = PTHREAD_MUTEX_INITIALIZER;
+
+typedef struct _jobpool {
+	int rpipe,wpipe;
+	uint8_t diskworkers;
+	uint32_t jobs;
 	pthread_mutex_t pipelock;
 	pthread_mutex_t jobslock;
-	void *jobqueue;
+	jobqueue *common;
+	uint32_t diskjobs;	// jobs of this pool put into disk queues and not finished yet
+	pthread_cond_t diskjobscond;
 	void *statusqueue;
+	void *uring;	// NULL - io_uring engine is not used
+	uint32_t uringdepth;
+	pthread_t uringthread;
+	void *uringqueue;
+	jobqueue *uringretry;	// without size limit - uring thread never waits
+	int uringrpipe,uringwpipe;
+	uint8_t uringwakeup;
+	pthread_mutex_t uringlock;
 	job* jobhash[JHASHSIZE];
 	uint32_t nextjobid;
 } jobpool;
@@ -140,30 +234,47 @@ static inline int job_receive_status(jobpool *jp,uint32_t *jobid,uint8_t *status
 #define opargs ((chunk_op_args*)(jptr->args))
 #define ocargs ((chunk_oc_args*)(jptr->args))
 #define rdargs ((chunk_rd_args*)(jptr->args))
+#define rbargs ((chunk_rb_args*)(jptr->args))
+#define rfargs ((chunk_rf_args*)(jptr->args))
+#define sfargs ((chunk_sf_args*)(jptr->args))
 #define wrargs ((chunk_wr_args*)(jptr->args))
 #define rpargs ((chunk_rp_args*)(jptr->args))
+static inline uint64_t get_usectime() {
+	struct timeval tv;
+	gettimeofday(&tv,NULL);
+	return ((uint64_t)(tv.tv_sec))*1000000+tv.tv_usec;
+}
+
 void* job_worker(void *th_arg) {
-	jobpool *jp = (jobpool*)th_arg;
+	jobqueue *jq = (jobqueue*)th_arg;
+	jobpool *jp;
 	job *jptr;
 	uint8_t *jptrarg;
-	uint8_t status,jstate;
+	uint8_t status,jstate,diskjob;
 	uint32_t jobid;
 	uint32_t op;
+	uint64_t rachunkid;
 
-//	syslog(LOG_NOTICE,"worker %p started (jobqueue: %p ; jptr:%p ; jptrarg:%p ; status:%p )",(void*)pthread_self(),jp->jobqueue,(void*)&jptr,(void*)&jptrarg,(void*)&status);
+//	syslog(LOG_NOTICE,"worker %p started (jobqueue: %p ; jptr:%p ; jptrarg:%p ; status:%p )",(void*)pthread_self(),jq->queue,(void*)&jptr,(void*)&jptrarg,(void*)&status);
 	for (;;) {
-		queue_get(jp->jobqueue,&jobid,&op,&jptrarg,NULL);
+		queue_get(jq->queue,&jobid,&op,&jptrarg,NULL);
 		jptr = (job*)jptrarg;
+		if (jptr==NULL) {	// OP_EXIT
+//			syslog(LOG_NOTICE,"worker %p exiting (jobqueue: %p)",(void*)pthread_self(),jq->queue);
+			return NULL;
+		}
+		jp = jptr->jp;
+		diskjob = (jptr->diskid>0)?1:0;
+		if (diskjob) {
+			hdd_stats_queue_start(jptr->diskid,get_usectime()-jptr->qts);
+		}
 		zassert(pthread_mutex_lock(&(jp->jobslock)));
-		if (jptr!=NULL) {
-			jstate=jptr->jstate;
-			if (jptr->jstate==JSTATE_ENABLED) {
-				jptr->jstate=JSTATE_INPROGRESS;
-			}
-		} else {
-			jstate=JSTATE_DISABLED;
+		jstate=jptr->jstate;
+		if (jptr->jstate==JSTATE_ENABLED) {
+			jptr->jstate=JSTATE_INPROGRESS;
 		}
 		zassert(pthread_mutex_unlock(&(jp->jobslock)));
+		rachunkid = 0;
 		switch (op) {
 			case OP_INVAL:
 				status = ERROR_EINVAL;
@@ -189,11 +300,42 @@ void* job_worker(void *th_arg) {
 					status = hdd_close(ocargs->chunkid);
 				}
 				break;
+			case OP_FLUSH:
+				if (jstate==JSTATE_DISABLED) {
+					status = ERROR_NOTDONE;
+				} else {
+					status = hdd_flush(ocargs->chunkid);
+				}
+				break;
 			case OP_READ:
 				if (jstate==JSTATE_DISABLED) {
 					status = ERROR_NOTDONE;
 				} else {
 					status = hdd_read(rdargs->chunkid,rdargs->version,rdargs->blocknum,rdargs->buffer,rdargs->offset,rdargs->size,rdargs->crcbuff);
+					rachunkid = (status==STATUS_OK)?rdargs->chunkid:0;
+				}
+				break;
+			case OP_READ_BLOCKS:
+				if (jstate==JSTATE_DISABLED) {
+					status = ERROR_NOTDONE;
+				} else {
+					uint8_t **buffers = (uint8_t**)(((uint8_t*)(jptr->args))+sizeof(chunk_rb_args));
+					status = hdd_read_blocks(rbargs->chunkid,rbargs->version,rbargs->blocknum,rbargs->blocks,buffers,buffers+rbargs->blocks);
+					rachunkid = (status==STATUS_OK)?rbargs->chunkid:0;
+				}
+				break;
+			case OP_READ_FD:
+				if (jstate==JSTATE_DISABLED) {
+					status = ERROR_NOTDONE;
+				} else {
+					status = hdd_read_fd(rfargs->chunkid,rfargs->version,rfargs->blocknum,rfargs->blocks,rfargs->fd,rfargs->fileoffset,rfargs->crcbuff);
+				}
+				break;
+			case OP_SENDFILE:
+				if (jstate==JSTATE_DISABLED) {
+					status = ERROR_NOTDONE;
+				} else {
+					status = hdd_sendfile(sfargs->sock,sfargs->fd,sfargs->fileoffset,sfargs->bytes);
 				}
 				break;
 			case OP_WRITE:
@@ -210,18 +352,259 @@ void* job_worker(void *th_arg) {
 					status = replicate(rpargs->chunkid,rpargs->version,rpargs->srccnt,((uint8_t*)(jptr->args))+sizeof(chunk_rp_args));
 				}
 				break;
-			default: // OP_EXIT
-//				syslog(LOG_NOTICE,"worker %p exiting (jobqueue: %p)",(void*)pthread_self(),jp->jobqueue);
-				return NULL;
+			default:
+				status = ERROR_EINVAL;
+		}
+		job_send_status(jp,jobid,status);	// job may be freed by main thread from now on
+		if (rachunkid>0) {	// client doesn't wait for blocks read ahead
+			hdd_readahead(rachunkid);
+		}
+		if (diskjob) {
+			zassert(pthread_mutex_lock(&(jp->jobslock)));
+			jp->diskjobs--;
+			if (jp->diskjobs==0) {
+				zassert(pthread_cond_broadcast(&(jp->diskjobscond)));
+			}
+			zassert(pthread_mutex_unlock(&(jp->jobslock)));
+		}
+	}
+}
+
+static inline void job_uring_put(jobpool *jp,uint32_t jobid,uint32_t op,job *jptr) {
+	zassert(pthread_mutex_lock(&(jp->uringlock)));
+	if (jp->uringwakeup==0) {
+		eassert(write(jp->uringwpipe,&(jp->uringwakeup),1)==1);
+		jp->uringwakeup = 1;
+	}
+	queue_put(jp->uringqueue,jobid,op,(uint8_t*)jptr,1);
+	zassert(pthread_mutex_unlock(&(jp->uringlock)));
+}
+
+static uring_disk* job_uring_disk(uring_disk **disks,uint64_t diskid) {
+	uring_disk *d;
+	for (d=*disks ; d ; d=d->next) {
+		if (d->diskid==diskid) {
+			return d;
 		}
+	}
+	d = (uring_disk*) malloc(sizeof(uring_disk));
+	passert(d);
+	d->diskid = diskid;
+	d->inflight = 0;
+	d->pendinghead = NULL;
+	d->pendingtail = &(d->pendinghead);
+	d->next = *disks;
+	*disks = d;
+	return d;
+}
+
+// submits pending reads of the disk up to its queue depth
+static void job_uring_dispatch(jobpool *jp,uring_disk *d,uint32_t *inflight) {
+	uring_read *ur;
+	while ((ur=d->pendinghead)!=NULL && d->inflight<jp->uringdepth && *inflight<URING_ENTRIES-1) {
+		d->pendinghead = ur->next;
+		if (d->pendinghead==NULL) {
+			d->pendingtail = &(d->pendinghead);
+		}
+		ur->ts = get_usectime();
+		sassert(uring_readv(jp->uring,ur->fd,ur->iov,ur->rblocks,ur->fileoffset,(uint64_t)(uintptr_t)ur)==0);
+		d->inflight++;
+		(*inflight)++;
+	}
+}
+
+static void job_uring_start(jobpool *jp,uring_disk **disks,uint32_t jobid,job *jptr) {
+	uint8_t **buffers,jstate;
+	uring_read *ur;
+	uint16_t rblocks,i;
+	int fd;
+	uint64_t fileoffset,devid;
+	uint32_t diskid;
+	uint8_t status;
+
+	zassert(pthread_mutex_lock(&(jp->jobslock)));
+	jstate=jptr->jstate;
+	if (jptr->jstate==JSTATE_ENABLED) {
+		jptr->jstate=JSTATE_INPROGRESS;
+	}
+	zassert(pthread_mutex_unlock(&(jp->jobslock)));
+	if (jstate==JSTATE_DISABLED) {
+		job_send_status(jp,jobid,ERROR_NOTDONE);
+		return;
+	}
+	buffers = (uint8_t**)(((uint8_t*)(jptr->args))+sizeof(chunk_rb_args));
+	status = hdd_aread_begin(rbargs->chunkid,rbargs->version,rbargs->blocknum,rbargs->blocks,buffers,buffers+rbargs->blocks,&rblocks,&fd,&fileoffset,&devid,&diskid);
+	if (status==ERROR_LOCKED) {	// chunk is used by other thread
+		queue_put(jp->uringretry->queue,jobid,OP_READ_BLOCKS,(uint8_t*)jptr,1);
+		return;
+	}
+	if (status!=STATUS_OK || rblocks==0) {
 		job_send_status(jp,jobid,status);
+		return;
+	}
+	ur = (uring_read*) malloc(offsetof(uring_read,iov)+rblocks*sizeof(struct iovec));
+	passert(ur);
+	ur->jobid = jobid;
+	ur->jptr = jptr;
+	ur->diskid = diskid;
+	ur->buffers = buffers;
+	ur->crcbuffs = buffers+rbargs->blocks;
+	ur->rblocks = rblocks;
+	ur->fd = fd;
+	ur->fileoffset = fileoffset;
+	for (i=0 ; i<rblocks ; i++) {
+		ur->iov[i].iov_base = buffers[i];
+		ur->iov[i].iov_len = MFSBLOCKSIZE;
+	}
+	ur->disk = job_uring_disk(disks,devid);
+	ur->next = NULL;
+	*(ur->disk->pendingtail) = ur;
+	ur->disk->pendingtail = &(ur->next);
+}
+
+// io_uring engine - starts whole block reads from uringqueue, at most 'uringdepth' per disk
+void* job_uring_worker(void *th_arg) {
+	jobpool *jp = (jobpool*)th_arg;
+	uring_disk *disks,*d,*dn;
+	uring_read *ur;
+	uint8_t *jptrarg;
+	uint8_t exiting,pollarmed,pending,b;
+	uint32_t jobid,op,inflight;
+	uint64_t userdata;
+	int32_t result;
+
+	disks = NULL;
+	inflight = 0;
+	exiting = 0;
+	pollarmed = 0;
+	for (;;) {
+		while (queue_tryget(jp->uringqueue,&jobid,&op,&jptrarg,NULL)==0) {
+			if (op==OP_EXIT) {
+				exiting = 1;
+			} else {
+				job_uring_start(jp,&disks,jobid,(job*)jptrarg);
+			}
+		}
+		pending = 0;
+		for (d=disks ; d ; d=d->next) {
+			job_uring_dispatch(jp,d,&inflight);
+			if (d->pendinghead) {
+				pending = 1;
+			}
+		}
+		if (exiting && inflight==0 && pending==0) {
+			break;
+		}
+		if (pollarmed==0 && exiting==0) {
+			sassert(uring_poll(jp->uring,jp->uringrpipe,URING_WAKEUP)==0);
+			pollarmed = 1;
+		}
+		if (uring_submit(jp->uring,1)<0 && errno!=EINTR) {
+			mfs_errlog_silent(LOG_WARNING,"io_uring submit error");
+			usleep(10000);
+		}
+		while (uring_complete(jp->uring,&userdata,&result)) {
+			if (userdata==URING_WAKEUP) {
+				zassert(pthread_mutex_lock(&(jp->uringlock)));
+				eassert(read(jp->uringrpipe,&b,1)==1);
+				jp->uringwakeup = 0;
+				zassert(pthread_mutex_unlock(&(jp->uringlock)));
+				pollarmed = 0;
+				continue;
+			}
+			ur = (uring_read*)(uintptr_t)userdata;
+			close(ur->fd);
+			if (hdd_aread_end(ur->diskid,ur->rblocks,ur->buffers,ur->crcbuffs,result,get_usectime()-ur->ts)==STATUS_OK) {
+				job_send_status(jp,ur->jobid,STATUS_OK);
+			} else {	// read error or blocks changed during reading - worker reads them again and reports real damage
+				queue_put(jp->uringretry->queue,ur->jobid,OP_READ_BLOCKS,(uint8_t*)(ur->jptr),1);
+			}
+			ur->disk->inflight--;
+			inflight--;
+			free(ur);
+		}
+	}
+	for (d=disks ; d ; d=dn) {
+		dn = d->next;
+		free(d);
+	}
+	return NULL;
+}
+
+static jobqueue* job_queue_new(uint64_t devid,uint8_t workers,uint32_t jobs) {
+	jobqueue *jq;
+	pthread_attr_t thattr;
+	uint32_t i;
+
+	jq = (jobqueue*) malloc(sizeof(jobqueue));
+	passert(jq);
+	jq->devid = devid;
+	jq->queue = queue_new((devid==0)?jobs:0);	// disk queue never blocks - see job_new
+	jq->limit = jobs;
+	jq->workers = workers;
+	jq->workerthreads = (pthread_t*) malloc(sizeof(pthread_t)*workers);
+	passert(jq->workerthreads);
+	jq->next = NULL;
+	zassert(pthread_attr_init(&thattr));
+	zassert(pthread_attr_setstacksize(&thattr,0x100000));
+	zassert(pthread_attr_setdetachstate(&thattr,PTHREAD_CREATE_JOINABLE));
+	for (i=0 ; i<workers ; i++) {
+		zassert(pthread_create(jq->workerthreads+i,&thattr,job_worker,jq));
+	}
+	zassert(pthread_attr_destroy(&thattr));
+	return jq;
+}
+
+static void job_queue_delete(jobqueue *jq) {
+	uint32_t i;
+	for (i=0 ; i<jq->workers ; i++) {
+		queue_put(jq->queue,0,OP_EXIT,NULL,1);
+	}
+	for (i=0 ; i<jq->workers ; i++) {
+		zassert(pthread_join(jq->workerthreads[i],NULL));
 	}
+	sassert(queue_isempty(jq->queue));
+//	syslog(LOG_NOTICE,"deleting jobqueue: %p",jq->queue);
+	queue_delete(jq->queue);
+	free(jq->workerthreads);
+	free(jq);
 }
 
-static inline uint32_t job_new(jobpool *jp,uint32_t op,void *args,void (*callback)(uint8_t status,void *extra),void *extra) {
+// jobs of chunks that already exist go to queue of their disk, so slow disk doesn't stop workers of other disks
+// queues are kept per device (not per folder, which gets new id when it is added again), so their number is limited
+// they are shared by all pools (workers of the pool which used the device first)
+static inline jobqueue* job_queue_find(jobpool *jp,uint64_t chunkid,uint32_t *diskid) {
+	jobqueue *jq;
+	uint64_t devid;
+	*diskid = 0;
+	if (jp->diskworkers==0 || chunkid==0) {
+		return jp->common;
+	}
+	*diskid = hdd_chunk_diskid(chunkid,&devid);
+	if (*diskid==0 || devid==0) {
+		*diskid = 0;
+		return jp->common;
+	}
+	zassert(pthread_mutex_lock(&diskqueueslock));
+	for (jq=diskqueues ; jq ; jq=jq->next) {
+		if (jq->devid==devid) {
+			break;
+		}
+	}
+	if (jq==NULL) {
+		jq = job_queue_new(devid,jp->diskworkers,jp->jobs);
+		jq->next = diskqueues;
+		diskqueues = jq;
+	}
+	zassert(pthread_mutex_unlock(&diskqueueslock));
+	return jq;
+}
+
+static inline uint32_t job_new(jobpool *jp,uint32_t op,uint64_t chunkid,void *args,void (*callback)(uint8_t status,void *extra),void *extra) {
 	uint32_t jobid = jp->nextjobid;
 	uint32_t jhpos = JHASHPOS(jobid);
 	job *jptr;
+	jobqueue *jq;
 	jptr = (job*) malloc(sizeof(job));
 	passert(jptr);
 	jptr->jobid = jobid;
@@ -229,9 +612,28 @@ static inline uint32_t job_new(jobpool *jp,uint32_t op,void *args,void (*callbac
 	jptr->extra = extra;
 	jptr->args = args;
 	jptr->jstate = JSTATE_ENABLED;
+	jptr->diskid = 0;
+	jptr->jp = jp;
 	jptr->next = jp->jobhash[jhpos];
 	jp->jobhash[jhpos] = jptr;
-	queue_put(jp->jobqueue,jobid,op,(uint8_t*)jptr,1);
+	if (jp->uring && op==OP_READ_BLOCKS) {	// job_read of a whole block comes here as OP_READ_BLOCKS too
+		job_uring_put(jp,jobid,op,jptr);
+	} else {
+		jq = job_queue_find(jp,chunkid,&(jptr->diskid));
+		if (jptr->diskid==0) {
+			queue_put(jq->queue,jobid,op,(uint8_t*)jptr,1);
+		} else if (op!=OP_CLOSE && queue_elements(jq->queue)>=jq->limit) {	// disk doesn't keep up (or is dying) - fail instead of blocking main thread ; close is never refused
+			jptr->diskid = 0;
+			job_send_status(jp,jobid,ERROR_CHUNKBUSY);
+		} else {
+			jptr->qts = get_usectime();
+			hdd_stats_queue_add(jptr->diskid);
+			zassert(pthread_mutex_lock(&(jp->jobslock)));
+			jp->diskjobs++;
+			zassert(pthread_mutex_unlock(&(jp->jobslock)));
+			queue_put(jq->queue,jobid,op,(uint8_t*)jptr,1);
+		}
+	}
 	jp->nextjobid++;
 	if (jp->nextjobid==0) {
 		jp->nextjobid=1;
@@ -241,10 +643,9 @@ static inline uint32_t job_new(jobpool *jp,uint32_t op,void *args,void (*callbac
 
 /* interface */
 
-void* job_pool_new(uint8_t workers,uint32_t jobs,int *wakeupdesc) {
+void* job_pool_new(uint8_t workers,uint8_t diskworkers,uint32_t jobs,int *wakeupdesc) {
 	int fd[2];
 	uint32_t i;
-	pthread_attr_t thattr;
 	jobpool* jp;
 
 	if (pipe(fd)<0) {
@@ -256,31 +657,69 @@ void* job_pool_new(uint8_t workers,uint32_t jobs,int *wakeupdesc) {
 	*wakeupdesc = fd[0];
 	jp->rpipe = fd[0];
 	jp->wpipe = fd[1];
-	jp->workers = workers;
-	jp->workerthreads = (pthread_t*) malloc(sizeof(pthread_t)*workers);
-	passert(jp->workerthreads);
+	jp->diskworkers = diskworkers;
+	jp->jobs = jobs;
 	zassert(pthread_mutex_init(&(jp->pipelock),NULL));
 	zassert(pthread_mutex_init(&(jp->jobslock),NULL));
-	jp->jobqueue = queue_new(jobs);
-//	syslog(LOG_WARNING,"new jobqueue: %p",jp->jobqueue);
+	zassert(pthread_cond_init(&(jp->diskjobscond),NULL));
+	jp->diskjobs = 0;
 	jp->statusqueue = queue_new(0);
 	for (i=0 ; i<JHASHSIZE ; i++) {
 		jp->jobhash[i]=NULL;
 	}
 	jp->nextjobid = 1;
+	jp->uring = NULL;
+	jp->common = job_queue_new(0,workers,jobs);
+	if (diskworkers>0) {
+		zassert(pthread_mutex_lock(&diskqueueslock));
+		diskqueuesusers++;
+		zassert(pthread_mutex_unlock(&diskqueueslock));
+	}
+//	syslog(LOG_WARNING,"new jobqueue: %p",jp->common->queue);
+	return jp;
+}
+
+int job_pool_start_uring(void *jpool,uint32_t depth) {
+	jobpool* jp = (jobpool*)jpool;
+	int fd[2];
+	pthread_attr_t thattr;
+
+	jp->uring = uring_new(URING_ENTRIES);
+	if (jp->uring==NULL) {
+		return -1;
+	}
+	if (pipe(fd)<0) {
+		uring_delete(jp->uring);
+		jp->uring = NULL;
+		return -1;
+	}
+	jp->uringrpipe = fd[0];
+	jp->uringwpipe = fd[1];
+	jp->uringwakeup = 0;
+	jp->uringdepth = (depth>0)?depth:1;
+	jp->uringqueue = queue_new(0);
+	jp->uringretry = job_queue_new(0,URING_RETRY_WORKERS,0);
+	zassert(pthread_mutex_init(&(jp->uringlock),NULL));
 	zassert(pthread_attr_init(&thattr));
 	zassert(pthread_attr_setstacksize(&thattr,0x100000));
 	zassert(pthread_attr_setdetachstate(&thattr,PTHREAD_CREATE_JOINABLE));
-	for (i=0 ; i<workers ; i++) {
-		zassert(pthread_create(jp->workerthreads+i,&thattr,job_worker,jp));
-	}
+	zassert(pthread_create(&(jp->uringthread),&thattr,job_uring_worker,jp));
 	zassert(pthread_attr_destroy(&thattr));
-	return jp;
+	return 0;
 }
 
 uint32_t job_pool_jobs_count(void *jpool) {
 	jobpool* jp = (jobpool*)jpool;
-	return queue_elements(jp->jobqueue);
+	uint32_t count;
+	count = queue_elements(jp->common->queue);
+	zassert(pthread_mutex_lock(&(jp->jobslock)));
+	count += jp->diskjobs;
+	zassert(pthread_mutex_unlock(&(jp->jobslock)));
+	if (jp->uring) {
+		count += queue_elements(jp->uringqueue);
+		count += queue_elements(jp->uringretry->queue);
+	}
+	return count;
 }
 
 void job_pool_disable_and_change_callback_all(void *jpool,void (*callback)(uint8_t status,void *extra)) {
@@ -357,24 +796,44 @@ void job_pool_check_jobs(void *jpool) {
 
 void job_pool_delete(void *jpool) {
 	jobpool* jp = (jobpool*)jpool;
-	uint32_t i;
-//	syslog(LOG_WARNING,"deleting pool of workers (%p:%" PRIu8 ")",(void*)jp,jp->workers);
-	for (i=0 ; i<jp->workers ; i++) {
-		queue_put(jp->jobqueue,0,OP_EXIT,NULL,1);
+	jobqueue *jq,*jqn;
+//	syslog(LOG_WARNING,"deleting pool of workers (%p:%" PRIu8 ")",(void*)jp,jp->common->workers);
+	job_queue_delete(jp->common);
+	zassert(pthread_mutex_lock(&(jp->jobslock)));
+	while (jp->diskjobs>0) {	// disk workers are shared - wait only for own jobs
+		zassert(pthread_cond_wait(&(jp->diskjobscond),&(jp->jobslock)));
 	}
-	for (i=0 ; i<jp->workers ; i++) {
-		zassert(pthread_join(jp->workerthreads[i],NULL));
+	zassert(pthread_mutex_unlock(&(jp->jobslock)));
+	if (jp->diskworkers>0) {
+		zassert(pthread_mutex_lock(&diskqueueslock));
+		diskqueuesusers--;
+		if (diskqueuesusers==0) {
+			for (jq=diskqueues ; jq ; jq=jqn) {
+				jqn = jq->next;
+				job_queue_delete(jq);
+			}
+			diskqueues = NULL;
+		}
+		zassert(pthread_mutex_unlock(&diskqueueslock));
+	}
+	if (jp->uring) {
+		job_uring_put(jp,0,OP_EXIT,NULL);
+		zassert(pthread_join(jp->uringthread,NULL));
+		sassert(queue_isempty(jp->uringqueue));
+		queue_delete(jp->uringqueue);
+		job_queue_delete(jp->uringretry);
+		zassert(pthread_mutex_destroy(&(jp->uringlock)));
+		close(jp->uringrpipe);
+		close(jp->uringwpipe);
+		uring_delete(jp->uring);
 	}
-	sassert(queue_isempty(jp->jobqueue));
 	if (!queue_isempty(jp->statusqueue)) {
 		job_pool_check_jobs(jp);
 	}
-//	syslog(LOG_NOTICE,"deleting jobqueue: %p",jp->jobqueue);
-	queue_delete(jp->jobqueue);
 	queue_delete(jp->statusqueue);
 	zassert(pthread_mutex_destroy(&(jp->pipelock)));
+	zassert(pthread_cond_destroy(&(jp->diskjobscond)));
 	zassert(pthread_mutex_destroy(&(jp->jobslock)));
-	free(jp->workerthreads);
 	close(jp->rpipe);
 	close(jp->wpipe);
 	free(jp);
@@ -382,7 +841,7 @@ void job_pool_delete(void *jpool) {
 
 uint32_t job_inval(void *jpool,void (*callback)(uint8_t status,void *extra),void *extra) {
 	jobpool* jp = (jobpool*)jpool;
-	return job_new(jp,OP_INVAL,NULL,callback,extra);
+	return job_new(jp,OP_INVAL,0,NULL,callback,extra);
 }
 
 uint32_t job_chunkop(void *jpool,void (*callback)(uint8_t status,void *extra),void *extra,uint64_t chunkid,uint32_t version,uint32_t newversion,uint64_t copychunkid,uint32_t copyversion,uint32_t length) {
@@ -396,7 +855,7 @@ uint32_t job_chunkop(void *jpool,void (*callback)(uint8_t status,void *extra),vo
 	args->copychunkid = copychunkid;
 	args->copyversion = copyversion;
 	args->length = length;
-	return job_new(jp,OP_CHUNKOP,args,callback,extra);
+	return job_new(jp,OP_CHUNKOP,chunkid,args,callback,extra);
 }
 
 uint32_t job_open(void *jpool,void (*callback)(uint8_t status,void *extra),void *extra,uint64_t chunkid) {
@@ -405,7 +864,7 @@ uint32_t job_open(void *jpool,void (*callback)(uint8_t status,void *extra),void
 	args = (chunk_oc_args*) malloc(sizeof(chunk_oc_args));
 	passert(args);
 	args->chunkid = chunkid;
-	return job_new(jp,OP_OPEN,args,callback,extra);
+	return job_new(jp,OP_OPEN,chunkid,args,callback,extra);
 }
 
 uint32_t job_close(void *jpool,void (*callback)(uint8_t status,void *extra),void *extra,uint64_t chunkid) {
@@ -414,12 +873,24 @@ uint32_t job_close(void *jpool,void (*callback)(uint8_t status,void *extra),void
 	args = (chunk_oc_args*) malloc(sizeof(chunk_oc_args));
 	passert(args);
 	args->chunkid = chunkid;
-	return job_new(jp,OP_CLOSE,args,callback,extra);
+	return job_new(jp,OP_CLOSE,chunkid,args,callback,extra);
+}
+
+uint32_t job_flush(void *jpool,void (*callback)(uint8_t status,void *extra),void *extra,uint64_t chunkid) {
+	jobpool* jp = (jobpool*)jpool;
+	chunk_oc_args *args;
+	args = (chunk_oc_args*) malloc(sizeof(chunk_oc_args));
+	passert(args);
+	args->chunkid = chunkid;
+	return job_new(jp,OP_FLUSH,chunkid,args,callback,extra);
 }
 
 uint32_t job_read(void *jpool,void (*callback)(uint8_t status,void *extra),void *extra,uint64_t chunkid,uint32_t version,uint16_t blocknum,uint8_t *buffer,uint32_t offset,uint32_t size,uint8_t *crcbuff) {
 	jobpool* jp = (jobpool*)jpool;
 	chunk_rd_args *args;
+	if (jp->uring && offset==0 && size==MFSBLOCKSIZE) {	// whole blocks are read by io_uring engine
+		return job_read_blocks(jpool,callback,extra,chunkid,version,blocknum,1,&buffer,&crcbuff);
+	}
 	args = (chunk_rd_args*) malloc(sizeof(chunk_rd_args));
 	passert(args);
 	args->chunkid = chunkid;
@@ -429,7 +900,51 @@ uint32_t job_read(void *jpool,void (*callback)(uint8_t status,void *extra),void
 	args->offset = offset;
 	args->size = size;
 	args->crcbuff = crcbuff;
-	return job_new(jp,OP_READ,args,callback,extra);
+	return job_new(jp,OP_READ,chunkid,args,callback,extra);
+}
+
+uint32_t job_read_blocks(void *jpool,void (*callback)(uint8_t status,void *extra),void *extra,uint64_t chunkid,uint32_t version,uint16_t blocknum,uint16_t blocks,uint8_t **buffers,uint8_t **crcbuffs) {
+	jobpool* jp = (jobpool*)jpool;
+	chunk_rb_args *args;
+	uint8_t *ptr;
+	ptr = (uint8_t*) malloc(sizeof(chunk_rb_args)+2*blocks*sizeof(uint8_t*));
+	passert(ptr);
+	args = (chunk_rb_args*)ptr;
+	ptr += sizeof(chunk_rb_args);
+	args->chunkid = chunkid;
+	args->version = version;
+	args->blocknum = blocknum;
+	args->blocks = blocks;
+	memcpy(ptr,buffers,blocks*sizeof(uint8_t*));
+	memcpy(ptr+blocks*sizeof(uint8_t*),crcbuffs,blocks*sizeof(uint8_t*));
+	return job_new(jp,OP_READ_BLOCKS,chunkid,args,callback,extra);
+}
+
+uint32_t job_read_fd(void *jpool,void (*callback)(uint8_t status,void *extra),void *extra,uint64_t chunkid,uint32_t version,uint16_t blocknum,uint16_t *blocks,int *fd,uint64_t *fileoffset,uint8_t *crcbuff) {
+	jobpool* jp = (jobpool*)jpool;
+	chunk_rf_args *args;
+	args = (chunk_rf_args*) malloc(sizeof(chunk_rf_args));
+	passert(args);
+	args->chunkid = chunkid;
+	args->version = version;
+	args->blocknum = blocknum;
+	args->blocks = blocks;
+	args->fd = fd;
+	args->fileoffset = fileoffset;
+	args->crcbuff = crcbuff;
+	return job_new(jp,OP_READ_FD,chunkid,args,callback,extra);
+}
+
+uint32_t job_sendfile(void *jpool,void (*callback)(uint8_t status,void *extra),void *extra,uint64_t chunkid,int sock,int fd,uint64_t *fileoffset,uint32_t *bytes) {
+	jobpool* jp = (jobpool*)jpool;
+	chunk_sf_args *args;
+	args = (chunk_sf_args*) malloc(sizeof(chunk_sf_args));
+	passert(args);
+	args->sock = sock;
+	args->fd = fd;
+	args->fileoffset = fileoffset;
+	args->bytes = bytes;
+	return job_new(jp,OP_SENDFILE,chunkid,args,callback,extra);
 }
 
 uint32_t job_write(void *jpool,void (*callback)(uint8_t status,void *extra),void *extra,uint64_t chunkid,uint32_t version,uint16_t blocknum,const uint8_t *buffer,uint32_t offset,uint32_t size,const uint8_t *crcbuff) {
@@ -444,7 +959,7 @@ uint32_t job_write(void *jpool,void (*callback)(uint8_t status,void *extra),void
 	args->offset = offset;
 	args->size = size;
 	args->crcbuff = crcbuff;
-	return job_new(jp,OP_WRITE,args,callback,extra);
+	return job_new(jp,OP_WRITE,chunkid,args,callback,extra);
 }
 
 uint32_t job_replicate(void *jpool,void (*callback)(uint8_t status,void *extra),void *extra,uint64_t chunkid,uint32_t version,uint8_t srccnt,const uint8_t *srcs) {
@@ -459,7 +974,7 @@ uint32_t job_replicate(void *jpool,void (*callback)(uint8_t status,void *extra),
 	args->version = version;
 	args->srccnt = srccnt;
 	memcpy(ptr,srcs,srccnt*18);
-	return job_new(jp,OP_REPLICATE,args,callback,extra);
+	return job_new(jp,OP_REPLICATE,0,args,callback,extra);
 }
 
 uint32_t job_replicate_simple(void *jpool,void (*callback)(uint8_t status,void *extra),void *extra,uint64_t chunkid,uint32_t version,uint32_t ip,uint16_t port) {
@@ -477,5 +992,5 @@ uint32_t job_replicate_simple(void *jpool,void (*callback)(uint8_t status,void *
 	put32bit(&ptr,version);
 	put32bit(&ptr,ip);
 	put16bit(&ptr,port);
-	return job_new(jp,OP_REPLICATE,args,callback,extra);
+	return job_new(jp,OP_REPLICATE,0,args,callback,extra);
 }
@@ -21,7 +21,11 @@
 
 #include <inttypes.h>
 
-void* job_pool_new(uint8_t workers,uint32_t jobs,int *wakeupdesc);
+/* workers - threads of common queue ; diskworkers - threads of each disk queue (0 - all jobs go to common queue)
+   disk queues are shared by all pools ; when disk queue has 'jobs' elements new jobs for this disk end with ERROR_CHUNKBUSY */
+void* job_pool_new(uint8_t workers,uint8_t diskworkers,uint32_t jobs,int *wakeupdesc);
+/* reads whole blocks with io_uring (at most 'depth' reads in flight per disk) - returns -1 when io_uring is not available */
+int job_pool_start_uring(void *jpool,uint32_t depth);
 uint32_t job_pool_jobs_count(void *jpool);
 void job_pool_disable_and_change_callback_all(void *jpool,void (*callback)(uint8_t status,void *extra));
 void job_pool_disable_job(void *jpool,uint32_t jobid);
@@ -43,7 +47,15 @@ uint32_t job_chunkop(void *jpool,void (*callback)(uint8_t status,void *extra),vo
 
 uint32_t job_open(void *jpool,void (*callback)(uint8_t status,void *extra),void *extra,uint64_t chunkid);
 uint32_t job_close(void *jpool,void (*callback)(uint8_t status,void *extra),void *extra,uint64_t chunkid);
+/* writes blocks collected by earlier writes (see hdd_flush) */
+uint32_t job_flush(void *jpool,void (*callback)(uint8_t status,void *extra),void *extra,uint64_t chunkid);
 uint32_t job_read(void *jpool,void (*callback)(uint8_t status,void *extra),void *extra,uint64_t chunkid,uint32_t version,uint16_t blocknum,uint8_t *buffer,uint32_t offset,uint32_t size,uint8_t *crcbuff);
+/* buffers, crcbuffs: blocks * pointers (each buffer - MFSBLOCKSIZE bytes, each crcbuff - 4 bytes) */
+uint32_t job_read_blocks(void *jpool,void (*callback)(uint8_t status,void *extra),void *extra,uint64_t chunkid,uint32_t version,uint16_t blocknum,uint16_t blocks,uint8_t **buffers,uint8_t **crcbuffs);
+/* see hdd_read_fd - results are stored in blocks, fd, fileoffset and crcbuff (4*blocks bytes) when job is done */
+uint32_t job_read_fd(void *jpool,void (*callback)(uint8_t status,void *extra),void *extra,uint64_t chunkid,uint32_t version,uint16_t blocknum,uint16_t *blocks,int *fd,uint64_t *fileoffset,uint8_t *crcbuff);
+/* see hdd_sendfile - goes to queue of the disk with given chunk ; fileoffset and bytes are updated when job is done */
+uint32_t job_sendfile(void *jpool,void (*callback)(uint8_t status,void *extra),void *extra,uint64_t chunkid,int sock,int fd,uint64_t *fileoffset,uint32_t *bytes);
 uint32_t job_write(void *jpool,void (*callback)(uint8_t status,void *extra),void *extra,uint64_t chunkid,uint32_t version,uint16_t blocknum,const uint8_t *buffer,uint32_t offset,uint32_t size,const uint8_t *crcbuff);
 
 /* srcs: srccnt * (chunkid:64 version:32 ip:32 port:16) */
@@ -0,0 +1,374 @@
+/*
+   Copyright 2005-2010 Jakub Kruszona-Zawadzki, Gemius SA.
+
+   This file is part of MooseFS.
+
+   MooseFS is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, version 3.
+
+   MooseFS is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with MooseFS.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "config.h"
+
+#include <inttypes.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+
+#include "MFSCommunication.h"
+#include "massert.h"
+#include "blockcache.h"
+
+/* ARC (Megiddo, Modha) - T1: blocks used once, T2: blocks used more than once, B1/B2: ghosts
+ * (keys only) of blocks recently evicted from T1/T2 ; 'target' is the wanted size of T1 */
+#define BC_T1 0
+#define BC_T2 1
+#define BC_B1 2
+#define BC_B2 3
+#define BC_LISTS 4
+
+#define BC_HASHPOS(sh,chunkid,blocknum) ((((uint32_t)(chunkid))*0x9E3779B1+(blocknum))&((sh)->hashsize-1))
+
+/* cache is split by chunkid into independent shards (each with its own lock and ARC lists), so
+ * workers reading different chunks don't wait for each other ; small caches use less shards */
+#define BC_MAXSHARDS 16
+#define BC_SHARDMINBLOCKS 256
+#define BC_SHARDPOS(chunkid,cnt) (((((uint32_t)(chunkid))*0x9E3779B1)>>16)&((cnt)-1))
+
+typedef struct _bcentry {
+	uint64_t chunkid;
+	uint32_t version;
+	uint16_t blocknum;
+	uint8_t list;
+	uint8_t prefetched;
+	uint8_t *data;	// NULL in ghosts
+	struct _bcentry *lrunext,*lruprev;
+	struct _bcentry *hashnext;
+} bcentry;
+
+typedef struct _bcshard {
+	pthread_mutex_t lock;
+	bcentry **hashtab;
+	uint32_t hashsize;
+	bcentry *lruhead[BC_LISTS];	// least recently used
+	bcentry *lrutail[BC_LISTS];	// most recently used
+	uint32_t lrucount[BC_LISTS];
+	uint32_t capacity;	// in blocks
+	uint32_t target;
+	uint32_t stats_hits;
+	uint32_t stats_misses;
+} bcshard;
+
+static bcshard shardtab[BC_MAXSHARDS];
+static uint32_t shardcnt = 1;	// changed only with all shards locked
+static uint32_t capacity = 0;	// whole cache (in blocks)
+
+static pthread_once_t bconce = PTHREAD_ONCE_INIT;
+static pthread_mutex_t bcsizelock = PTHREAD_MUTEX_INITIALIZER;
+
+static void bcache_init(void) {
+	uint32_t i;
+	for (i=0 ; i<BC_MAXSHARDS ; i++) {
+		memset(shardtab+i,0,sizeof(bcshard));
+		zassert(pthread_mutex_init(&(shardtab[i].lock),NULL));
+	}
+}
+
+// returns locked shard of the chunk
+static inline bcshard* bcache_shard_lock(uint64_t chunkid) {
+	bcshard *sh;
+	zassert(pthread_once(&bconce,bcache_init));
+	for (;;) {
+		sh = shardtab+BC_SHARDPOS(chunkid,__atomic_load_n(&shardcnt,__ATOMIC_ACQUIRE));
+		zassert(pthread_mutex_lock(&(sh->lock)));
+		if (sh==shardtab+BC_SHARDPOS(chunkid,shardcnt)) {	// number of shards can't change now
+			return sh;
+		}
+		zassert(pthread_mutex_unlock(&(sh->lock)));
+	}
+}
+
+static inline void bcache_list_remove(bcshard *sh,bcentry *e) {
+	if (e->lruprev) {
+		e->lruprev->lrunext = e->lrunext;
+	} else {
+		sh->lruhead[e->list] = e->lrunext;
+	}
+	if (e->lrunext) {
+		e->lrunext->lruprev = e->lruprev;
+	} else {
+		sh->lrutail[e->list] = e->lruprev;
+	}
+	sh->lrucount[e->list]--;
+}
+
+static inline void bcache_list_append(bcshard *sh,bcentry *e,uint8_t list) {
+	e->list = list;
+	e->lrunext = NULL;
+	e->lruprev = sh->lrutail[list];
+	if (sh->lrutail[list]) {
+		sh->lrutail[list]->lrunext = e;
+	} else {
+		sh->lruhead[list] = e;
+	}
+	sh->lrutail[list] = e;
+	sh->lrucount[list]++;
+}
+
+static inline bcentry* bcache_find(bcshard *sh,uint64_t chunkid,uint32_t version,uint16_t blocknum) {
+	bcentry *e;
+	for (e=sh->hashtab[BC_HASHPOS(sh,chunkid,blocknum)] ; e ; e=e->hashnext) {
+		if (e->chunkid==chunkid && e->blocknum==blocknum && e->version==version) {
+			return e;
+		}
+	}
+	return NULL;
+}
+
+static inline void bcache_hash_remove(bcshard *sh,bcentry *e) {
+	bcentry **ep;
+	ep = sh->hashtab+BC_HASHPOS(sh,e->chunkid,e->blocknum);
+	while (*ep!=e) {
+		ep = &((*ep)->hashnext);
+	}
+	*ep = e->hashnext;
+}
+
+// removes entry completely and returns its data buffer (to be reused or freed by caller)
+static inline uint8_t* bcache_entry_delete(bcshard *sh,bcentry *e) {
+	uint8_t *data;
+	bcache_list_remove(sh,e);
+	bcache_hash_remove(sh,e);
+	data = e->data;
+	free(e);
+	return data;
+}
+
+// moves one block from T1 or T2 to ghost list, returns its data buffer
+static uint8_t* bcache_replace(bcshard *sh,uint8_t inb2) {
+	bcentry *e;
+	uint8_t *data;
+	if (sh->lrucount[BC_T1]+sh->lrucount[BC_T2]<sh->capacity) {
+		return NULL;
+	}
+	if (sh->lrucount[BC_T1]>0 && (sh->lrucount[BC_T1]>sh->target || (inb2 && sh->lrucount[BC_T1]==sh->target) || sh->lrucount[BC_T2]==0)) {
+		e = sh->lruhead[BC_T1];
+		bcache_list_remove(sh,e);
+		bcache_list_append(sh,e,BC_B1);
+	} else {
+		e = sh->lruhead[BC_T2];
+		bcache_list_remove(sh,e);
+		bcache_list_append(sh,e,BC_B2);
+	}
+	data = e->data;
+	e->data = NULL;
+	return data;
+}
+
+static void bcache_clear(bcshard *sh) {
+	uint8_t l;
+	while (sh->lruhead[BC_T1] || sh->lruhead[BC_T2] || sh->lruhead[BC_B1] || sh->lruhead[BC_B2]) {
+		for (l=0 ; l<BC_LISTS ; l++) {
+			if (sh->lruhead[l]) {
+				free(bcache_entry_delete(sh,sh->lruhead[l]));
+			}
+		}
+	}
+	sh->target = 0;
+}
+
+void bcache_setsize(uint64_t size) {
+	uint32_t newcapacity,newhashsize,cnt,i;
+	bcshard *sh;
+	zassert(pthread_once(&bconce,bcache_init));
+	zassert(pthread_mutex_lock(&bcsizelock));
+	for (i=0 ; i<BC_MAXSHARDS ; i++) {
+		zassert(pthread_mutex_lock(&(shardtab[i].lock)));
+	}
+	size /= MFSBLOCKSIZE;
+	newcapacity = (size>0x1000000)?0x1000000:size;
+	for (cnt=BC_MAXSHARDS ; cnt>1 && newcapacity/cnt<BC_SHARDMINBLOCKS ; cnt>>=1) {}
+	for (i=0 ; i<BC_MAXSHARDS ; i++) {
+		sh = shardtab+i;
+		if (sh->hashtab) {
+			bcache_clear(sh);
+			free(sh->hashtab);
+			sh->hashtab = NULL;
+		}
+		sh->capacity = (i<cnt)?(newcapacity/cnt+((i<newcapacity%cnt)?1:0)):0;
+		if (sh->capacity>0) {
+			// resident blocks and ghosts together are at most 2*capacity
+			for (newhashsize=1024 ; newhashsize<2*sh->capacity ; newhashsize<<=1) {}
+			sh->hashsize = newhashsize;
+			sh->hashtab = (bcentry**) calloc(sh->hashsize,sizeof(bcentry*));
+			passert(sh->hashtab);
+		} else {
+			sh->hashsize = 0;
+		}
+	}
+	__atomic_store_n(&shardcnt,cnt,__ATOMIC_RELEASE);
+	__atomic_store_n(&capacity,newcapacity,__ATOMIC_RELEASE);
+	for (i=0 ; i<BC_MAXSHARDS ; i++) {
+		zassert(pthread_mutex_unlock(&(shardtab[i].lock)));
+	}
+	zassert(pthread_mutex_unlock(&bcsizelock));
+}
+
+uint8_t bcache_enabled(void) {
+	return (__atomic_load_n(&capacity,__ATOMIC_ACQUIRE)>0)?1:0;
+}
+
+uint8_t bcache_get(uint64_t chunkid,uint32_t version,uint16_t blocknum,uint8_t *buffer,uint32_t offset,uint32_t size) {
+	bcshard *sh;
+	bcentry *e;
+	sh = bcache_shard_lock(chunkid);
+	if (sh->capacity==0) {
+		zassert(pthread_mutex_unlock(&(sh->lock)));
+		return 0;
+	}
+	e = bcache_find(sh,chunkid,version,blocknum);
+	if (e==NULL || e->data==NULL) {
+		sh->stats_misses++;
+		zassert(pthread_mutex_unlock(&(sh->lock)));
+		return 0;
+	}
+	sh->stats_hits++;
+	memcpy(buffer,e->data+offset,size);
+	bcache_list_remove(sh,e);
+	if (e->list==BC_T1 && e->prefetched) {	// first use of block read ahead - still used once
+		e->prefetched = 0;
+		bcache_list_append(sh,e,BC_T1);
+	} else {
+		bcache_list_append(sh,e,BC_T2);
+	}
+	zassert(pthread_mutex_unlock(&(sh->lock)));
+	return 1;
+}
+
+uint8_t bcache_contains(uint64_t chunkid,uint32_t version,uint16_t blocknum) {
+	bcshard *sh;
+	bcentry *e;
+	uint8_t ret;
+	sh = bcache_shard_lock(chunkid);
+	ret = 0;
+	if (sh->capacity>0) {
+		e = bcache_find(sh,chunkid,version,blocknum);
+		ret = (e!=NULL && e->data!=NULL)?1:0;
+	}
+	zassert(pthread_mutex_unlock(&(sh->lock)));
+	return ret;
+}
+
+void bcache_put(uint64_t chunkid,uint32_t version,uint16_t blocknum,const uint8_t *block,uint8_t prefetched) {
+	bcshard *sh;
+	bcentry *e;
+	uint8_t *data,*olddata;
+	uint32_t delta,l1,total;
+
+	if (bcache_enabled()==0) {
+		return;
+	}
+	// block is copied before locking - other threads can use the shard meanwhile
+	data = (uint8_t*) malloc(MFSBLOCKSIZE);
+	passert(data);
+	memcpy(data,block,MFSBLOCKSIZE);
+	sh = bcache_shard_lock(chunkid);
+	if (sh->capacity==0) {
+		zassert(pthread_mutex_unlock(&(sh->lock)));
+		free(data);
+		return;
+	}
+	e = bcache_find(sh,chunkid,version,blocknum);
+	if (e!=NULL && e->data!=NULL) {	// already cached (read by two threads at once)
+		zassert(pthread_mutex_unlock(&(sh->lock)));
+		free(data);
+		return;
+	}
+	if (e!=NULL && e->list==BC_B1) {	// recently evicted block used once - T1 should be bigger
+		delta = (sh->lrucount[BC_B2]>sh->lrucount[BC_B1])?sh->lrucount[BC_B2]/sh->lrucount[BC_B1]:1;
+		sh->target = (sh->target+delta>sh->capacity)?sh->capacity:sh->target+delta;
+		olddata = bcache_replace(sh,0);
+		bcache_list_remove(sh,e);
+		bcache_list_append(sh,e,BC_T2);
+	} else if (e!=NULL) {	// BC_B2 - recently evicted frequent block - T2 should be bigger
+		delta = (sh->lrucount[BC_B1]>sh->lrucount[BC_B2])?sh->lrucount[BC_B1]/sh->lrucount[BC_B2]:1;
+		sh->target = (sh->target>delta)?sh->target-delta:0;
+		olddata = bcache_replace(sh,1);
+		bcache_list_remove(sh,e);
+		bcache_list_append(sh,e,BC_T2);
+	} else {
+		olddata = NULL;
+		l1 = sh->lrucount[BC_T1]+sh->lrucount[BC_B1];
+		total = l1+sh->lrucount[BC_T2]+sh->lrucount[BC_B2];
+		if (l1>=sh->capacity) {
+			if (sh->lrucount[BC_T1]<sh->capacity) {
+				free(bcache_entry_delete(sh,sh->lruhead[BC_B1]));
+				olddata = bcache_replace(sh,0);
+			} else {
+				olddata = bcache_entry_delete(sh,sh->lruhead[BC_T1]);
+			}
+		} else if (total>=sh->capacity) {
+			if (total>=2*sh->capacity) {
+				free(bcache_entry_delete(sh,sh->lruhead[BC_B2]));
+			}
+			olddata = bcache_replace(sh,0);
+		}
+		e = (bcentry*) malloc(sizeof(bcentry));
+		passert(e);
+		e->chunkid = chunkid;
+		e->version = version;
+		e->blocknum = blocknum;
+		e->hashnext = sh->hashtab[BC_HASHPOS(sh,chunkid,blocknum)];
+		sh->hashtab[BC_HASHPOS(sh,chunkid,blocknum)] = e;
+		bcache_list_append(sh,e,BC_T1);
+	}
+	e->data = data;
+	e->prefetched = prefetched;
+	zassert(pthread_mutex_unlock(&(sh->lock)));
+	if (olddata) {
+		free(olddata);
+	}
+}
+
+void bcache_invalidate(uint64_t chunkid,uint16_t blocknum) {
+	bcshard *sh;
+	bcentry *e,*en;
+	sh = bcache_shard_lock(chunkid);
+	if (sh->capacity>0) {
+		for (e=sh->hashtab[BC_HASHPOS(sh,chunkid,blocknum)] ; e ; e=en) {
+			en = e->hashnext;
+			if (e->chunkid==chunkid && e->blocknum==blocknum) {
+				free(bcache_entry_delete(sh,e));
+			}
+		}
+	}
+	zassert(pthread_mutex_unlock(&(sh->lock)));
+}
+
+void bcache_stats(uint32_t *hits,uint32_t *misses) {
+	uint32_t i;
+	zassert(pthread_once(&bconce,bcache_init));
+	*hits = 0;
+	*misses = 0;
+	for (i=0 ; i<BC_MAXSHARDS ; i++) {
+		zassert(pthread_mutex_lock(&(shardtab[i].lock)));
+		*hits += shardtab[i].stats_hits;
+		*misses += shardtab[i].stats_misses;
+		shardtab[i].stats_hits = 0;
+		shardtab[i].stats_misses = 0;
+		zassert(pthread_mutex_unlock(&(shardtab[i].lock)));
+	}
+}
+
+void bcache_term(void) {
+	bcache_setsize(0);
+}
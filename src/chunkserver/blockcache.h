@@ -0,0 +1,43 @@
+/*
+   Copyright 2005-2010 Jakub Kruszona-Zawadzki, Gemius SA.
+
+   This file is part of MooseFS.
+
+   MooseFS is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, version 3.
+
+   MooseFS is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with MooseFS.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _BLOCKCACHE_H_
+#define _BLOCKCACHE_H_
+
+#include <inttypes.h>
+
+/* shared cache of whole chunk blocks keyed by (chunkid,version,blocknum) - ARC replacement
+ * (recently used blocks and blocks used at least twice are kept on separate lists, whose
+ * sizes adapt to ghost hits), so one sequential pass over big files doesn't flush hot blocks ;
+ * chunks are spread over shards with separate locks and lists, so workers don't wait for each other */
+
+/* sets cache size in bytes (0 - cache disabled) ; all cached blocks are dropped */
+void bcache_setsize(uint64_t size);
+uint8_t bcache_enabled(void);
+/* copies 'size' bytes from 'offset' of cached block to buffer ; returns 1 on hit, 0 on miss */
+uint8_t bcache_get(uint64_t chunkid,uint32_t version,uint16_t blocknum,uint8_t *buffer,uint32_t offset,uint32_t size);
+/* checks presence of block without counting it as use */
+uint8_t bcache_contains(uint64_t chunkid,uint32_t version,uint16_t blocknum);
+/* stores block (data has to be already checked) ; 'prefetched' - block read ahead of client, its first use doesn't make it frequent */
+void bcache_put(uint64_t chunkid,uint32_t version,uint16_t blocknum,const uint8_t *block,uint8_t prefetched);
+/* drops block (all versions) - has to be called when block is modified */
+void bcache_invalidate(uint64_t chunkid,uint16_t blocknum);
+void bcache_stats(uint32_t *hits,uint32_t *misses);
+void bcache_term(void);
+
+#endif
@@ -0,0 +1,73 @@
+#include "blockcache.h"
+
+#include <vector>
+#include <gtest/gtest.h>
+
+#include "MFSCommunication.h"
+
+static std::vector<uint8_t> block(uint8_t fill) {
+	return std::vector<uint8_t>(MFSBLOCKSIZE, fill);
+}
+
+TEST(BlockCacheTests, GetPutInvalidate) {
+	std::vector<uint8_t> buffer(MFSBLOCKSIZE);
+	bcache_setsize(16 * MFSBLOCKSIZE);
+	EXPECT_EQ(0, bcache_get(1, 1, 0, buffer.data(), 0, MFSBLOCKSIZE));
+	bcache_put(1, 1, 0, block(7).data(), 0);
+	EXPECT_EQ(1, bcache_get(1, 1, 0, buffer.data(), 0, MFSBLOCKSIZE));
+	EXPECT_EQ(block(7), buffer);
+	EXPECT_EQ(1, bcache_get(1, 1, 0, buffer.data(), 100, 10));
+	EXPECT_EQ(7, buffer[0]);
+	// other version of the same block is a different block
+	EXPECT_EQ(0, bcache_contains(1, 2, 0));
+	bcache_invalidate(1, 0);
+	EXPECT_EQ(0, bcache_contains(1, 1, 0));
+	bcache_term();
+}
+
+TEST(BlockCacheTests, ScanDoesNotFlushFrequentBlocks) {
+	std::vector<uint8_t> buffer(MFSBLOCKSIZE);
+	bcache_setsize(16 * MFSBLOCKSIZE);
+	// hot blocks are used twice
+	for (uint16_t b = 0; b < 8; b++) {
+		bcache_put(1, 1, b, block(b).data(), 0);
+		EXPECT_EQ(1, bcache_get(1, 1, b, buffer.data(), 0, MFSBLOCKSIZE));
+	}
+	// one pass over a big chunk, read ahead and then used once
+	for (uint16_t b = 0; b < 1000; b++) {
+		bcache_put(2, 1, b, block(1).data(), 1);
+		EXPECT_EQ(1, bcache_get(2, 1, b, buffer.data(), 0, MFSBLOCKSIZE));
+	}
+	for (uint16_t b = 0; b < 8; b++) {
+		EXPECT_EQ(1, bcache_contains(1, 1, b));
+	}
+	bcache_term();
+}
+
+TEST(BlockCacheTests, ManyChunksInShards) {
+	std::vector<uint8_t> buffer(MFSBLOCKSIZE);
+	bcache_setsize(4096 * MFSBLOCKSIZE);
+	for (uint64_t chunkid = 1; chunkid <= 64; chunkid++) {
+		for (uint16_t b = 0; b < 16; b++) {
+			bcache_put(chunkid, 1, b, block(chunkid + b).data(), 0);
+		}
+	}
+	for (uint64_t chunkid = 1; chunkid <= 64; chunkid++) {
+		for (uint16_t b = 0; b < 16; b++) {
+			EXPECT_EQ(1, bcache_get(chunkid, 1, b, buffer.data(), 0, MFSBLOCKSIZE));
+			EXPECT_EQ(block(chunkid + b), buffer);
+		}
+	}
+	bcache_invalidate(7, 3);
+	EXPECT_EQ(0, bcache_contains(7, 1, 3));
+	EXPECT_EQ(1, bcache_contains(8, 1, 3));
+	bcache_term();
+}
+
+TEST(BlockCacheTests, Disabled) {
+	std::vector<uint8_t> buffer(MFSBLOCKSIZE);
+	bcache_setsize(0);
+	EXPECT_EQ(0, bcache_enabled());
+	bcache_put(1, 1, 0, block(7).data(), 0);
+	EXPECT_EQ(0, bcache_get(1, 1, 0, buffer.data(), 0, MFSBLOCKSIZE));
+}
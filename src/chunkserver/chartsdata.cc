@@ -35,6 +35,7 @@
 #include "csserv.h"
 #include "masterconn.h"
 #include "hddspacemgr.h"
+#include "blockcache.h"
 #include "replicator.h"
 
 #define CHARTS_FILENAME "csstats.mfs"
@@ -69,8 +70,16 @@
 #define CHARTS_TEST 27
 #define CHARTS_CHUNKIOJOBS 28
 #define CHARTS_CHUNKOPJOBS 29
+#define CHARTS_WBATCHES 30
+#define CHARTS_WBATCHBLOCKS 31
+#define CHARTS_FSYNCBATCHES 32
+#define CHARTS_FSYNCCHUNKS 33
+#define CHARTS_CRCHITS 34
+#define CHARTS_CRCMISSES 35
+#define CHARTS_BLOCKHITS 36
+#define CHARTS_BLOCKMISSES 37
 
-#define CHARTS 30
+#define CHARTS 38
 
 /* name , join mode , percent , scale , multiplier , divisor */
 #define STATDEFS { \
@@ -104,10 +113,23 @@
 	{"test"         ,CHARTS_MODE_ADD,0,CHARTS_SCALE_NONE ,   1, 1}, \
 	{"chunkiojobs"  ,CHARTS_MODE_MAX,0,CHARTS_SCALE_NONE ,   1, 1}, \
 	{"chunkopjobs"  ,CHARTS_MODE_MAX,0,CHARTS_SCALE_NONE ,   1, 1}, \
+	{"wbatches"     ,CHARTS_MODE_ADD,0,CHARTS_SCALE_NONE ,   1, 1}, \
+	{"wbatchblocks" ,CHARTS_MODE_ADD,0,CHARTS_SCALE_NONE ,   1, 1}, \
+	{"fsyncbatches" ,CHARTS_MODE_ADD,0,CHARTS_SCALE_NONE ,   1, 1}, \
+	{"fsyncchunks"  ,CHARTS_MODE_ADD,0,CHARTS_SCALE_NONE ,   1, 1}, \
+	{"crchits"      ,CHARTS_MODE_ADD,0,CHARTS_SCALE_NONE ,   1, 1}, \
+	{"crcmisses"    ,CHARTS_MODE_ADD,0,CHARTS_SCALE_NONE ,   1, 1}, \
+	{"blockhits"    ,CHARTS_MODE_ADD,0,CHARTS_SCALE_NONE ,   1, 1}, \
+	{"blockmisses"  ,CHARTS_MODE_ADD,0,CHARTS_SCALE_NONE ,   1, 1}, \
 	{NULL           ,0              ,0,0                 ,   0, 0}  \
 };
 
+/* average write batch (blocks) and group fsync batch (chunks) in 1/1000 ; crc cache and block cache hit rates in 1/1000 of percent */
 #define CALCDEFS { \
+	CHARTS_CALCDEF(CHARTS_DIV(CHARTS_MUL(CHARTS_CONST(1000),CHARTS_WBATCHBLOCKS),CHARTS_WBATCHES)), \
+	CHARTS_CALCDEF(CHARTS_DIV(CHARTS_MUL(CHARTS_CONST(1000),CHARTS_FSYNCCHUNKS),CHARTS_FSYNCBATCHES)), \
+	CHARTS_CALCDEF(CHARTS_DIV(CHARTS_MUL(CHARTS_CONST(100000),CHARTS_CRCHITS),CHARTS_ADD(CHARTS_CRCHITS,CHARTS_CRCMISSES))), \
+	CHARTS_CALCDEF(CHARTS_DIV(CHARTS_MUL(CHARTS_CONST(100000),CHARTS_BLOCKHITS),CHARTS_ADD(CHARTS_BLOCKHITS,CHARTS_BLOCKMISSES))), \
 	CHARTS_DEFS_END \
 };
 
@@ -121,6 +143,10 @@
 	{CHARTS_DIRECT(CHARTS_LLOPR)       ,CHARTS_DIRECT(CHARTS_DATALLOPR)   ,CHARTS_NONE                       ,CHARTS_MODE_ADD,0,CHARTS_SCALE_NONE ,   1, 1}, \
 	{CHARTS_DIRECT(CHARTS_LLOPW)       ,CHARTS_DIRECT(CHARTS_DATALLOPW)   ,CHARTS_NONE                       ,CHARTS_MODE_ADD,0,CHARTS_SCALE_NONE ,   1, 1}, \
 	{CHARTS_DIRECT(CHARTS_CHUNKOPJOBS) ,CHARTS_DIRECT(CHARTS_CHUNKIOJOBS) ,CHARTS_NONE                       ,CHARTS_MODE_ADD,0,CHARTS_SCALE_NONE ,   1, 1}, \
+	{CHARTS_CALC(0)                    ,CHARTS_NONE                       ,CHARTS_NONE                       ,CHARTS_MODE_MAX,0,CHARTS_SCALE_MILI ,   1, 1}, \
+	{CHARTS_CALC(1)                    ,CHARTS_NONE                       ,CHARTS_NONE                       ,CHARTS_MODE_MAX,0,CHARTS_SCALE_MILI ,   1, 1}, \
+	{CHARTS_CALC(2)                    ,CHARTS_NONE                       ,CHARTS_NONE                       ,CHARTS_MODE_MAX,1,CHARTS_SCALE_MILI ,   1, 1}, \
+	{CHARTS_CALC(3)                    ,CHARTS_NONE                       ,CHARTS_NONE                       ,CHARTS_MODE_MAX,1,CHARTS_SCALE_MILI ,   1, 1}, \
 	{CHARTS_NONE                       ,CHARTS_NONE                       ,CHARTS_NONE                       ,0              ,0,0                 ,   0, 0}  \
 };
 
@@ -136,6 +162,8 @@ void chartsdata_refresh(void) {
 	uint32_t i,opr,opw,dbr,dbw,dopr,dopw,repl;
 	uint32_t op_cr,op_de,op_ve,op_du,op_tr,op_dt,op_te;
 	uint32_t csservjobs,masterjobs;
+	uint32_t wbatches,wbatchblocks,fsyncbatches,fsyncchunks;
+	uint32_t crchits,crcmisses,blockhits,blockmisses;
 	struct itimerval uc,pc;
 	uint32_t ucusec,pcusec;
 
@@ -203,6 +231,17 @@ void chartsdata_refresh(void) {
 	data[CHARTS_TRUNCATE]=op_tr;
 	data[CHARTS_DUPTRUNC]=op_dt;
 	data[CHARTS_TEST]=op_te;
+	hdd_batch_stats(&wbatches,&wbatchblocks,&fsyncbatches,&fsyncchunks);
+	data[CHARTS_WBATCHES]=wbatches;
+	data[CHARTS_WBATCHBLOCKS]=wbatchblocks;
+	data[CHARTS_FSYNCBATCHES]=fsyncbatches;
+	data[CHARTS_FSYNCCHUNKS]=fsyncchunks;
+	hdd_cache_stats(&crchits,&crcmisses);
+	data[CHARTS_CRCHITS]=crchits;
+	data[CHARTS_CRCMISSES]=crcmisses;
+	bcache_stats(&blockhits,&blockmisses);
+	data[CHARTS_BLOCKHITS]=blockhits;
+	data[CHARTS_BLOCKMISSES]=blockmisses;
 
 	charts_add(data,main_time()-60);
 }
@@ -32,6 +32,9 @@
 #include <errno.h>
 #include <inttypes.h>
 #include <netinet/in.h>
+#if defined(HAVE_SENDFILE) && defined(__linux__)
+#define USE_SENDFILE 1
+#endif
 
 #include "MFSCommunication.h"
 
@@ -56,6 +59,9 @@
 
 #define MaxPacketSize 100000
 
+// whole blocks read by one read job (one preadv)
+#define READ_MAXBLOCKS 16
+
 //csserventry.mode
 enum {HEADER,DATA};
 //csserventry.state
@@ -68,11 +74,20 @@ typedef struct writestatus {
 } writestatus;
 #endif
 
+// chunk file descriptor shared by all packets of one job_read_fd (closed with the last of them)
+typedef struct packetfile {
+	int fd;
+	uint32_t refcount;
+} packetfile;
+
 typedef struct packetstruct {
 	struct packetstruct *next;
 	uint8_t *startptr;
 	uint32_t bytesleft;
 	uint8_t *packet;
+	packetfile *file;		// data sent from file after 'packet' (NULL - none)
+	uint64_t foffset;
+	uint32_t fbytesleft;
 } packetstruct;
 
 typedef struct csserventry {
@@ -104,13 +119,23 @@ typedef struct csserventry {
 	uint32_t wjobid;
 	uint32_t wjobwriteid;
 	writestatus *todolist;
+	writestatus *delayedhead,**delayedtail;	// blocks written by jobs but not in chunk file yet (HDD_WRITE_BATCH_BLOCKS) - acknowledged after job_flush
 
 	/* read */
 	uint32_t rjobid;
 	uint8_t todocnt;		// R (read finished + send finished)
+#ifdef USE_SENDFILE
+	uint8_t rnofile;		// R: remaining blocks are read into memory
+	uint16_t rfblocks;		// R: job_read_fd results
+	int rfd;
+	uint64_t rfoffset;
+	uint8_t rfcrc[4*READ_MAXBLOCKS];
+	uint32_t sjobid;		// job_sendfile sending data of the first output packet (main thread doesn't write to socket meanwhile)
+	uint32_t sjobbytes;
+#endif
 
 	/* common for read and write but meaning is different !!! */
-	void *rpacket;
+	void *rpacket;		// R: list of packets (linked by 'next')
 	void *wpacket;
 #endif
 
@@ -145,6 +170,7 @@ static uint32_t stats_maxjobscnt=0;
 // from config
 static char *ListenHost;
 static char *ListenPort;
+static uint8_t SendfileReads;
 
 void csserv_stats(uint64_t *bin,uint64_t *bout,uint32_t *hlopr,uint32_t *hlopw,uint32_t *maxjobscnt) {
 	*bin = stats_bytesin;
@@ -174,24 +200,68 @@ void* csserv_create_detached_packet(uint32_t type,uint32_t size) {
 	put32bit(&ptr,type);
 	put32bit(&ptr,size);
 	outpacket->startptr = (uint8_t*)(outpacket->packet);
+	outpacket->file = NULL;
+	outpacket->foffset = 0;
+	outpacket->fbytesleft = 0;
 	outpacket->next = NULL;
 	return outpacket;
 }
 
+#ifdef USE_SENDFILE
+// packet with 'fleng' bytes of data sent directly from file (released when packet is deleted) after 'size' bytes of normal data
+void* csserv_create_detached_file_packet(uint32_t type,uint32_t size,packetfile *file,uint64_t foffset,uint32_t fleng) {
+	packetstruct *outpacket;
+	uint8_t *ptr;
+
+	outpacket = (packetstruct*)csserv_create_detached_packet(type,size+fleng);
+	outpacket->bytesleft -= fleng;
+	outpacket->file = file;
+	file->refcount++;
+	outpacket->foffset = foffset;
+	outpacket->fbytesleft = fleng;
+	ptr = outpacket->packet+4;
+	put32bit(&ptr,size+fleng);
+	return outpacket;
+}
+#endif
+
+static inline void csserv_free_packet(packetstruct *outpacket) {
+	if (outpacket->packet) {
+		free(outpacket->packet);
+	}
+	if (outpacket->file) {
+		outpacket->file->refcount--;
+		if (outpacket->file->refcount==0) {
+			close(outpacket->file->fd);
+			free(outpacket->file);
+		}
+	}
+	free(outpacket);
+}
+
 uint8_t* csserv_get_packet_data(void *packet) {
 	packetstruct *outpacket = (packetstruct*)packet;
 	return outpacket->packet+8;
 }
 
+// deletes also all packets linked to given one
 void csserv_delete_packet(void *packet) {
 	packetstruct *outpacket = (packetstruct*)packet;
-	free(outpacket->packet);
-	free(outpacket);
+	packetstruct *next;
+	while (outpacket) {
+		next = outpacket->next;
+		csserv_free_packet(outpacket);
+		outpacket = next;
+	}
 }
 
+// attaches also all packets linked to given one
 void csserv_attach_packet(csserventry *eptr,void *packet) {
 	packetstruct *outpacket = (packetstruct*)packet;
 	*(eptr->outputtail) = outpacket;
+	while (outpacket->next) {
+		outpacket = outpacket->next;
+	}
 	eptr->outputtail = &(outpacket->next);
 }
 
@@ -223,6 +293,9 @@ uint8_t* csserv_create_attached_packet(csserventry *eptr,uint32_t type,uint32_t
 	put32bit(&ptr,type);
 	put32bit(&ptr,size);
 	outpacket->startptr = (uint8_t*)(outpacket->packet);
+	outpacket->file = NULL;
+	outpacket->foffset = 0;
+	outpacket->fbytesleft = 0;
 	outpacket->next = NULL;
 	*(eptr->outputtail) = outpacket;
 	eptr->outputtail = &(outpacket->next);
@@ -322,9 +395,32 @@ void csserv_delayed_close(uint8_t status,void *e) {
 		job_close(jpool,NULL,NULL,eptr->chunkid);
 		eptr->chunkisopen=0;
 	}
+	eptr->rjobid = 0;
+	eptr->wjobid = 0;
+#ifdef USE_SENDFILE
+	if (eptr->rfd>=0) {	// this was job_read_fd
+		close(eptr->rfd);
+		eptr->rfd = -1;
+	}
+	if (eptr->sjobid>0) {	// socket is still used by job_sendfile
+		return;
+	}
+#endif
 	eptr->state = CLOSED;
 }
 
+#ifdef USE_SENDFILE
+// job_sendfile finished after connection was closed
+void csserv_sendfile_closed(uint8_t status,void *e) {
+	csserventry *eptr = (csserventry*)e;
+	(void)status;
+	eptr->sjobid = 0;
+	if (eptr->rjobid==0 && eptr->wjobid==0) {	// other job (if any) has already finished
+		eptr->state = CLOSED;
+	}
+}
+#endif
+
 
 // bg reading
 
@@ -353,6 +449,47 @@ void csserv_read_finished(uint8_t status,void *e) {
 	}
 }
 
+#ifdef USE_SENDFILE
+// whole blocks are sent directly from chunk file (client checks crc of each block)
+void csserv_read_fd_finished(uint8_t status,void *e) {
+	csserventry *eptr = (csserventry*)e;
+	uint16_t blocknum,i;
+	uint8_t *ptr;
+	void **rpacketp;
+	packetfile *file;
+
+	if (status==STATUS_OK && eptr->rfblocks==0) {	// behind the end of chunk file or chunk is being written
+		eptr->rjobid = 0;
+		eptr->todocnt--;
+		eptr->rnofile = 1;
+		csserv_read_continue(eptr);
+		return;
+	}
+	if (status==STATUS_OK) {
+		blocknum = (eptr->offset)>>MFSBLOCKBITS;
+		file = (packetfile*)malloc(sizeof(packetfile));
+		passert(file);
+		file->fd = eptr->rfd;
+		file->refcount = 0;
+		rpacketp = &(eptr->rpacket);
+		for (i=0 ; i<eptr->rfblocks ; i++) {
+			*rpacketp = csserv_create_detached_file_packet(CSTOCL_READ_DATA,8+2+2+4+4,file,eptr->rfoffset+(((uint32_t)i)<<MFSBLOCKBITS),MFSBLOCKSIZE);
+			ptr = csserv_get_packet_data(*rpacketp);
+			put64bit(&ptr,eptr->chunkid);
+			put16bit(&ptr,blocknum+i);
+			put16bit(&ptr,0);
+			put32bit(&ptr,MFSBLOCKSIZE);
+			memcpy(ptr,eptr->rfcrc+4*i,4);
+			rpacketp = (void**)&(((packetstruct*)(*rpacketp))->next);
+		}
+		eptr->rfd = -1;
+		eptr->offset+=((uint32_t)(eptr->rfblocks))<<MFSBLOCKBITS;
+		eptr->size-=((uint32_t)(eptr->rfblocks))<<MFSBLOCKBITS;
+	}
+	csserv_read_finished(status,eptr);
+}
+#endif
+
 void csserv_send_finished(csserventry *eptr) {
 	eptr->todocnt--;
 	if (eptr->todocnt==0) {
@@ -363,13 +500,19 @@ void csserv_send_finished(csserventry *eptr) {
 void csserv_read_continue(csserventry *eptr) {
 	uint16_t blocknum;
 	uint16_t blockoffset;
+	uint16_t blocks,i;
 	uint32_t size;
 	uint8_t *ptr;
+	packetstruct *p;
+	uint8_t *buffers[READ_MAXBLOCKS],*crcbuffs[READ_MAXBLOCKS];
+	void **rpacketp;
 
 	if (eptr->rpacket) {
+		for (p=(packetstruct*)(eptr->rpacket) ; p ; p=p->next) {	// each packet is counted when it's sent
+			eptr->todocnt++;
+		}
 		csserv_attach_packet(eptr,eptr->rpacket);
 		eptr->rpacket=NULL;
-		eptr->todocnt++;
 	}
 	if (eptr->size==0) {	// everything have been read
 		ptr = csserv_create_attached_packet(eptr,CSTOCL_READ_STATUS,8+1);
@@ -381,18 +524,55 @@ void csserv_read_continue(csserventry *eptr) {
 	} else {
 		blocknum = (eptr->offset)>>MFSBLOCKBITS;
 		blockoffset = (eptr->offset)&MFSBLOCKMASK;
-		if (((eptr->offset+eptr->size-1)>>MFSBLOCKBITS) == blocknum) {	// last block
-			size = eptr->size;
+#ifdef USE_SENDFILE
+		if (SendfileReads && eptr->rnofile==0 && blockoffset==0 && eptr->size>=MFSBLOCKSIZE) {
+			eptr->rfblocks = eptr->size>>MFSBLOCKBITS;
+			if (eptr->rfblocks>READ_MAXBLOCKS) {
+				eptr->rfblocks = READ_MAXBLOCKS;
+			}
+			eptr->rfd = -1;
+			eptr->rjobid = job_read_fd(jpool,csserv_read_fd_finished,eptr,eptr->chunkid,eptr->version,blocknum,&(eptr->rfblocks),&(eptr->rfd),&(eptr->rfoffset),eptr->rfcrc);
+			if (eptr->rjobid==0) {
+				eptr->state = CLOSE;
+				return;
+			}
+			eptr->todocnt++;
+			return;
+		}
+#endif
+		if (blockoffset==0 && eptr->size>=2*MFSBLOCKSIZE) {	// at least two whole blocks - read them at once
+			blocks = eptr->size>>MFSBLOCKBITS;
+			if (blocks>READ_MAXBLOCKS) {
+				blocks = READ_MAXBLOCKS;
+			}
+			rpacketp = &(eptr->rpacket);
+			for (i=0 ; i<blocks ; i++) {
+				*rpacketp = csserv_create_detached_packet(CSTOCL_READ_DATA,8+2+2+4+4+MFSBLOCKSIZE);
+				ptr = csserv_get_packet_data(*rpacketp);
+				put64bit(&ptr,eptr->chunkid);
+				put16bit(&ptr,blocknum+i);
+				put16bit(&ptr,0);
+				put32bit(&ptr,MFSBLOCKSIZE);
+				crcbuffs[i] = ptr;
+				buffers[i] = ptr+4;
+				rpacketp = (void**)&(((packetstruct*)(*rpacketp))->next);
+			}
+			size = ((uint32_t)blocks)<<MFSBLOCKBITS;
+			eptr->rjobid = job_read_blocks(jpool,csserv_read_finished,eptr,eptr->chunkid,eptr->version,blocknum,blocks,buffers,crcbuffs);
 		} else {
-			size = MFSBLOCKSIZE-blockoffset;
+			if (((eptr->offset+eptr->size-1)>>MFSBLOCKBITS) == blocknum) {	// last block
+				size = eptr->size;
+			} else {
+				size = MFSBLOCKSIZE-blockoffset;
+			}
+			eptr->rpacket = csserv_create_detached_packet(CSTOCL_READ_DATA,8+2+2+4+4+size);
+			ptr = csserv_get_packet_data(eptr->rpacket);
+			put64bit(&ptr,eptr->chunkid);
+			put16bit(&ptr,blocknum);
+			put16bit(&ptr,blockoffset);
+			put32bit(&ptr,size);
+			eptr->rjobid = job_read(jpool,csserv_read_finished,eptr,eptr->chunkid,eptr->version,blocknum,ptr+4,blockoffset,size,ptr);
 		}
-		eptr->rpacket = csserv_create_detached_packet(CSTOCL_READ_DATA,8+2+2+4+4+size);
-		ptr = csserv_get_packet_data(eptr->rpacket);
-		put64bit(&ptr,eptr->chunkid);
-		put16bit(&ptr,blocknum);
-		put16bit(&ptr,blockoffset);
-		put32bit(&ptr,size);
-		eptr->rjobid = job_read(jpool,csserv_read_finished,eptr,eptr->chunkid,eptr->version,blocknum,ptr+4,blockoffset,size,ptr);
 		if (eptr->rjobid==0) {
 			eptr->state = CLOSE;
 			return;
@@ -453,43 +633,34 @@ void csserv_read_init(csserventry *eptr,const uint8_t *data,uint32_t length) {
 	eptr->state = READ;
 	eptr->todocnt = 0;
 	eptr->rjobid = 0;
+#ifdef USE_SENDFILE
+	eptr->rnofile = 0;
+#endif
 	csserv_read_continue(eptr);
 }
 
 // bg writing
 
-void csserv_write_finished(uint8_t status,void *e) {
-	csserventry *eptr = (csserventry*)e;
+// block 'writeid' is in chunk file - status is sent now or (when forwarding) after status from next chunkserver
+void csserv_write_done(csserventry *eptr,uint32_t writeid) {
 	uint8_t *ptr;
 	writestatus **wpptr,*wptr;
-//	syslog(LOG_NOTICE,"write job finished (jobid:%" PRIu32 ",chunkid:%" PRIu64 ",writeid:%" PRIu32 ",status:%" PRIu8 ")",eptr->wjobid,eptr->chunkid,eptr->wjobwriteid,status);
-	eptr->wjobid = 0;
-	if (status!=STATUS_OK) {
-		ptr = csserv_create_attached_packet(eptr,CSTOCL_WRITE_STATUS,8+4+1);
-		put64bit(&ptr,eptr->chunkid);
-		put32bit(&ptr,eptr->wjobwriteid);
-		put8bit(&ptr,status);
-		eptr->state = WRITEFINISH;
-		return;
-	}
-	if (eptr->wjobwriteid==0) {
-		eptr->chunkisopen = 1;
-	}
 	if (eptr->state==WRITELAST) {
 		ptr = csserv_create_attached_packet(eptr,CSTOCL_WRITE_STATUS,8+4+1);
 		put64bit(&ptr,eptr->chunkid);
-		put32bit(&ptr,eptr->wjobwriteid);
+		put32bit(&ptr,writeid);
 		put8bit(&ptr,STATUS_OK);
 	} else {
 		wpptr = &(eptr->todolist);
 		while ((wptr=*wpptr)) {
-			if (wptr->writeid==eptr->wjobwriteid) { // found - it means that it was added by status_receive
+			if (wptr->writeid==writeid) { // found - it means that it was added by status_receive
 				ptr = csserv_create_attached_packet(eptr,CSTOCL_WRITE_STATUS,8+4+1);
 				put64bit(&ptr,eptr->chunkid);
-				put32bit(&ptr,eptr->wjobwriteid);
+				put32bit(&ptr,writeid);
 				put8bit(&ptr,STATUS_OK);
 				*wpptr = wptr->next;
 				free(wptr);
+				return;
 			} else {
 				wpptr = &(wptr->next);
 			}
@@ -497,11 +668,89 @@ void csserv_write_finished(uint8_t status,void *e) {
 		// not found - so add it
 		wptr = (writestatus*) malloc(sizeof(writestatus));
 		passert(wptr);
-		wptr->writeid = eptr->wjobwriteid;
+		wptr->writeid = writeid;
 		wptr->next = eptr->todolist;
 		eptr->todolist = wptr;
 	}
+}
+
+void csserv_write_free_delayed(csserventry *eptr) {
+	writestatus *wptr,*waptr;
+	wptr = eptr->delayedhead;
+	while (wptr) {
+		waptr = wptr;
+		wptr = wptr->next;
+		free(waptr);
+	}
+	eptr->delayedhead = NULL;
+	eptr->delayedtail = &(eptr->delayedhead);
+}
+
+// error is sent for the first block which hasn't been acknowledged yet
+void csserv_write_error(csserventry *eptr,uint32_t writeid,uint8_t status) {
+	uint8_t *ptr;
+	ptr = csserv_create_attached_packet(eptr,CSTOCL_WRITE_STATUS,8+4+1);
+	put64bit(&ptr,eptr->chunkid);
+	put32bit(&ptr,(eptr->delayedhead)?eptr->delayedhead->writeid:writeid);
+	put8bit(&ptr,status);
+	csserv_write_free_delayed(eptr);
+	eptr->state = WRITEFINISH;
+}
+
+void csserv_write_flushed(uint8_t status,void *e);
+
+// next block is processed only when it's already received - otherwise collected blocks are written now, so client gets their statuses
+void csserv_write_next(csserventry *eptr) {
 	csserv_check_nextpacket(eptr);
+	if (eptr->delayedhead && eptr->wjobid==0 && (eptr->state==WRITELAST || eptr->state==WRITEFWD)) {
+		eptr->wjobid = job_flush(jpool,csserv_write_flushed,eptr,eptr->chunkid);
+	}
+}
+
+void csserv_write_flushed(uint8_t status,void *e) {
+	csserventry *eptr = (csserventry*)e;
+	writestatus *wptr;
+	eptr->wjobid = 0;
+	if (status!=STATUS_OK) {
+		csserv_write_error(eptr,eptr->wjobwriteid,status);
+		return;
+	}
+	for (wptr=eptr->delayedhead ; wptr ; wptr=wptr->next) {
+		csserv_write_done(eptr,wptr->writeid);
+	}
+	csserv_write_free_delayed(eptr);
+	csserv_write_next(eptr);
+}
+
+void csserv_write_finished(uint8_t status,void *e) {
+	csserventry *eptr = (csserventry*)e;
+	writestatus *wptr;
+//	syslog(LOG_NOTICE,"write job finished (jobid:%" PRIu32 ",chunkid:%" PRIu64 ",writeid:%" PRIu32 ",status:%" PRIu8 ")",eptr->wjobid,eptr->chunkid,eptr->wjobwriteid,status);
+	eptr->wjobid = 0;
+	if (status==ERROR_DELAYED) {	// block isn't in file yet - it's acknowledged after flush
+		wptr = (writestatus*) malloc(sizeof(writestatus));
+		passert(wptr);
+		wptr->writeid = eptr->wjobwriteid;
+		wptr->next = NULL;
+		*(eptr->delayedtail) = wptr;
+		eptr->delayedtail = &(wptr->next);
+		csserv_write_next(eptr);
+		return;
+	}
+	if (status!=STATUS_OK) {
+		csserv_write_error(eptr,eptr->wjobwriteid,status);
+		return;
+	}
+	if (eptr->wjobwriteid==0) {
+		eptr->chunkisopen = 1;
+	}
+	// this write ended batch - all collected blocks are in file too
+	for (wptr=eptr->delayedhead ; wptr ; wptr=wptr->next) {
+		csserv_write_done(eptr,wptr->writeid);
+	}
+	csserv_write_free_delayed(eptr);
+	csserv_write_done(eptr,eptr->wjobwriteid);
+	csserv_write_next(eptr);
 }
 
 void csserv_write_init(csserventry *eptr,const uint8_t *data,uint32_t length) {
@@ -882,6 +1131,9 @@ void csserv_write_data(csserventry *eptr,const uint8_t *data,uint32_t length) {
 		return;
 	}
 	status = hdd_write(chunkid,eptr->version,blocknum,data+4,offset,size,data);
+	if (status==ERROR_DELAYED) {	// block has to be in file before it's acknowledged
+		status = hdd_flush(chunkid);
+	}
 	if (status!=STATUS_OK) {
 		ptr = csserv_create_attached_packet(eptr,CSTOCL_WRITE_STATUS,8+4+1);
 		put64bit(&ptr,chunkid);
@@ -1106,6 +1358,12 @@ void csserv_outputcheck(csserventry *eptr) {
 
 void csserv_close(csserventry *eptr) {
 #ifdef BGJOBS
+#ifdef USE_SENDFILE
+	if (eptr->sjobid>0) {	// connection can't be freed before job_sendfile stops using its socket
+		job_pool_disable_job(jpool,eptr->sjobid);
+		job_pool_change_callback(jpool,eptr->sjobid,csserv_sendfile_closed,eptr);
+	}
+#endif
 	if (eptr->rjobid>0) {
 		job_pool_disable_job(jpool,eptr->rjobid);
 		job_pool_change_callback(jpool,eptr->rjobid,csserv_delayed_close,eptr);
@@ -1121,6 +1379,11 @@ void csserv_close(csserventry *eptr) {
 		}
 		eptr->state = CLOSED;
 	}
+#ifdef USE_SENDFILE
+	if (eptr->sjobid>0) {
+		eptr->state = CLOSEWAIT;
+	}
+#endif
 #else /* BGJOBS */
 	if (eptr->chunkisopen) {
 		hdd_close(eptr->chunkid);
@@ -1253,15 +1516,13 @@ void csserv_term(void) {
 			wptr = wptr->next;
 			free(waptr);
 		}
+		csserv_write_free_delayed(eptr);
 #endif
 		pptr = eptr->outputhead;
 		while (pptr) {
-			if (pptr->packet) {
-				free(pptr->packet);
-			}
 			paptr = pptr;
 			pptr = pptr->next;
-			free(paptr);
+			csserv_free_packet(paptr);
 		}
 		eaptr = eptr;
 		eptr = eptr->next;
@@ -1622,9 +1883,43 @@ void csserv_read(csserventry *eptr) {
 	}
 }
 
+#ifdef USE_SENDFILE
+void csserv_write(csserventry *eptr);
+
+// job_sendfile sent (part of) file data of the first output packet
+void csserv_sendfile_finished(uint8_t status,void *e) {
+	csserventry *eptr = (csserventry*)e;
+	packetstruct *pack;
+	eptr->sjobid = 0;
+	pack = eptr->outputhead;
+	stats_bytesout += eptr->sjobbytes-pack->fbytesleft;
+	if (status!=STATUS_OK) {
+		eptr->state = CLOSE;
+		return;
+	}
+	if (pack->fbytesleft>0) {	// socket buffer is full - continue when socket is writable
+		return;
+	}
+	eptr->outputhead = pack->next;
+	if (eptr->outputhead==NULL) {
+		eptr->outputtail = &(eptr->outputhead);
+	}
+	csserv_free_packet(pack);
+	csserv_outputcheck(eptr);
+	if (eptr->state==IDLE || eptr->state==READ) {
+		csserv_write(eptr);
+	}
+}
+#endif
+
 void csserv_write(csserventry *eptr) {
 	packetstruct *pack;
 	int32_t i;
+#ifdef USE_SENDFILE
+	if (eptr->sjobid>0) {
+		return;
+	}
+#endif
 	for (;;) {
 		pack = eptr->outputhead;
 		if (pack==NULL) {
@@ -1649,16 +1944,35 @@ void csserv_write(csserventry *eptr) {
 		if (pack->bytesleft>0) {
 			return;
 		}
-		free(pack->packet);
+#ifdef USE_SENDFILE
+		if (pack->fbytesleft>0) {	// file pages could be evicted meanwhile - sendfile can wait for disk, so it's done by worker
+			eptr->sjobbytes = pack->fbytesleft;
+			eptr->sjobid = job_sendfile(jpool,csserv_sendfile_finished,eptr,eptr->chunkid,eptr->sock,pack->file->fd,&(pack->foffset),&(pack->fbytesleft));
+			if (eptr->sjobid==0) {
+				eptr->state = CLOSE;
+			}
+			return;
+		}
+#endif
 		eptr->outputhead = pack->next;
 		if (eptr->outputhead==NULL) {
 			eptr->outputtail = &(eptr->outputhead);
 		}
-		free(pack);
+		csserv_free_packet(pack);
 		csserv_outputcheck(eptr);
 	}
 }
 
+// there are packets to send and socket isn't used by job_sendfile
+static inline int csserv_output_waiting(csserventry *eptr) {
+#ifdef USE_SENDFILE
+	if (eptr->sjobid>0) {
+		return 0;
+	}
+#endif
+	return (eptr->outputhead!=NULL)?1:0;
+}
+
 void csserv_desc(struct pollfd *pdesc,uint32_t *ndesc) {
 	uint32_t pos = *ndesc;
 	csserventry *eptr;
@@ -1686,7 +2000,7 @@ void csserv_desc(struct pollfd *pdesc,uint32_t *ndesc) {
 				if (eptr->inputpacket.bytesleft>0) {
 					pdesc[pos].events |= POLLIN;
 				}
-				if (eptr->outputhead!=NULL) {
+				if (csserv_output_waiting(eptr)) {
 					pdesc[pos].events |= POLLOUT;
 				}
 				pos++;
@@ -1720,13 +2034,13 @@ void csserv_desc(struct pollfd *pdesc,uint32_t *ndesc) {
 				if (eptr->inputpacket.bytesleft>0) {
 					pdesc[pos].events |= POLLIN;
 				}
-				if (eptr->outputhead!=NULL) {
+				if (csserv_output_waiting(eptr)) {
 					pdesc[pos].events |= POLLOUT;
 				}
 				pos++;
 				break;
 			case WRITEFINISH:
-				if (eptr->outputhead!=NULL) {
+				if (csserv_output_waiting(eptr)) {
 					pdesc[pos].fd = eptr->sock;
 					pdesc[pos].events = POLLOUT;
 					eptr->pdescpos = pos;
@@ -1789,9 +2103,17 @@ void csserv_serve(struct pollfd *pdesc) {
 				eptr->wjobid = 0;
 				eptr->wjobwriteid = 0;
 				eptr->todolist = NULL;
+				eptr->delayedhead = NULL;
+				eptr->delayedtail = &(eptr->delayedhead);
 
 				eptr->rjobid = 0;
 				eptr->todocnt = 0;
+#ifdef USE_SENDFILE
+				eptr->rnofile = 0;
+				eptr->rfd = -1;
+				eptr->sjobid = 0;
+				eptr->sjobbytes = 0;
+#endif
 
 				eptr->rpacket = NULL;
 				eptr->wpacket = NULL;
@@ -1898,15 +2220,13 @@ void csserv_serve(struct pollfd *pdesc) {
 				wptr = wptr->next;
 				free(waptr);
 			}
+			csserv_write_free_delayed(eptr);
 #endif
 			pptr = eptr->outputhead;
 			while (pptr) {
-				if (pptr->packet) {
-					free(pptr->packet);
-				}
 				paptr = pptr;
 				pptr = pptr->next;
-				free(paptr);
+				csserv_free_packet(paptr);
 			}
 			*kptr = eptr->next;
 			free(eptr);
@@ -1932,6 +2252,7 @@ void csserv_reload(void) {
 	oldListenPort = ListenPort;
 	ListenHost = cfg_getstr("CSSERV_LISTEN_HOST","*");
 	ListenPort = cfg_getstr("CSSERV_LISTEN_PORT","9422");
+	SendfileReads = cfg_getuint8("CSSERV_SENDFILE",0);
 	if (strcmp(oldListenHost,ListenHost)==0 && strcmp(oldListenPort,ListenPort)==0) {
 		free(oldListenHost);
 		free(oldListenPort);
@@ -1973,6 +2294,7 @@ void csserv_reload(void) {
 int csserv_init(void) {
 	ListenHost = cfg_getstr("CSSERV_LISTEN_HOST","*");
 	ListenPort = cfg_getstr("CSSERV_LISTEN_PORT","9422");
+	SendfileReads = cfg_getuint8("CSSERV_SENDFILE",0);
 
 	lsock = tcpsocket();
 	if (lsock<0) {
@@ -1998,7 +2320,14 @@ int csserv_init(void) {
 	main_pollregister(csserv_desc,csserv_serve);
 
 #ifdef BGJOBS
-	jpool = job_pool_new(10,BGJOBSCNT,&jobfd);
+	jpool = job_pool_new(10,cfg_getuint8("HDD_WORKERS_PER_DISK",4),BGJOBSCNT,&jobfd);
+	if (cfg_getuint8("HDD_IO_URING",0)) {
+		if (job_pool_start_uring(jpool,cfg_getuint32("HDD_IO_URING_DEPTH",32))<0) {
+			mfs_syslog(LOG_NOTICE,"main server module: io_uring is not available - using threads for all disk operations");
+		} else {
+			mfs_syslog(LOG_NOTICE,"main server module: reading whole blocks with io_uring");
+		}
+	}
 #endif
 
 	return 0;
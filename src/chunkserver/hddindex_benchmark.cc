@@ -0,0 +1,168 @@
+// Compares the old chunkserver chunk index (32768 buckets behind one mutex) with the sharded
+// index of hddspacemgr.cc (64 independently locked, growing hash tables).
+// Usage: hddindex_benchmark [chunks [lookups [maxthreads]]]
+// Every thread does 'lookups' random finds on a population of 'chunks' chunks (default 4M),
+// each one locking the chunk and releasing it again - the sharded index is exercised through
+// hdd_chunk_find / hdd_chunk_release themselves (hdd_test_chunk_find_release).
+// Thread count is doubled from 1 up to maxthreads (default 16) ; total finds per second are printed.
+
+#include "config.h"
+
+#include <inttypes.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+
+#include "hddspacemgr.h"
+#include "main.h"
+
+#define OLDHASHSIZE 32768
+#define OLDHASHPOS(chunkid) ((chunkid)&0x7FFF)
+
+#define CH_AVAIL 0
+#define CH_LOCKED 1
+
+typedef struct _chunk {
+	uint64_t chunkid;
+	uint32_t version;
+	uint8_t state;
+	struct _chunk *next;
+} chunk;
+
+static chunk *oldhashtab[OLDHASHSIZE];
+static pthread_mutex_t oldhashlock = PTHREAD_MUTEX_INITIALIZER;
+
+static uint32_t nchunks;
+static uint32_t lookups;
+static uint8_t sharded;
+
+// main.cc isn't linked here - hddspacemgr only registers its callbacks in hdd_init
+void main_destructregister (void (*fun)(void)) {
+	(void)fun;
+}
+
+void main_reloadregister (void (*fun)(void)) {
+	(void)fun;
+}
+
+void* main_timeregister (int mode,uint32_t seconds,uint32_t offset,void (*fun)(void)) {
+	(void)mode;
+	(void)seconds;
+	(void)offset;
+	(void)fun;
+	return NULL;
+}
+
+static uint64_t now_usec(void) {
+	struct timeval tv;
+	gettimeofday(&tv,NULL);
+	return tv.tv_sec*UINT64_C(1000000)+tv.tv_usec;
+}
+
+static inline uint32_t next_random(uint64_t *state) {
+	*state = *state * UINT64_C(6364136223846793005) + UINT64_C(1442695040888963407);
+	return *state >> 32;
+}
+
+static uint8_t old_find_release(uint64_t chunkid) {
+	chunk *c;
+	pthread_mutex_lock(&oldhashlock);
+	for (c=oldhashtab[OLDHASHPOS(chunkid)] ; c && c->chunkid!=chunkid ; c=c->next) {}
+	if (c) {
+		c->state = CH_LOCKED;
+	}
+	pthread_mutex_unlock(&oldhashlock);
+	if (c==NULL) {
+		return 0;
+	}
+	pthread_mutex_lock(&oldhashlock);
+	c->state = CH_AVAIL;
+	pthread_mutex_unlock(&oldhashlock);
+	return 1;
+}
+
+static void* worker(void *arg) {
+	uint64_t rnd;
+	uint32_t i,found;
+	rnd = (uintptr_t)arg;
+	found = 0;
+	for (i=0 ; i<lookups ; i++) {
+		if (sharded) {
+			found += hdd_test_chunk_find_release(next_random(&rnd)%nchunks+1);
+		} else {
+			found += old_find_release(next_random(&rnd)%nchunks+1);
+		}
+	}
+	return (void*)(uintptr_t)found;
+}
+
+static double run(uint32_t threads) {
+	pthread_t *th;
+	uint64_t start,usec;
+	uint32_t i;
+	void *res;
+	th = (pthread_t*)malloc(sizeof(pthread_t)*threads);
+	start = now_usec();
+	for (i=0 ; i<threads ; i++) {
+		if (pthread_create(th+i,NULL,worker,(void*)(uintptr_t)(i+1))!=0) {
+			fprintf(stderr,"can't create thread\n");
+			exit(1);
+		}
+	}
+	for (i=0 ; i<threads ; i++) {
+		pthread_join(th[i],&res);
+		if ((uintptr_t)res!=lookups) {
+			fprintf(stderr,"lookup error\n");
+			exit(1);
+		}
+	}
+	usec = now_usec()-start;
+	free(th);
+	return (double)lookups*threads*1000000.0/(usec?usec:1);
+}
+
+int main(int argc,char **argv) {
+	uint32_t maxthreads,threads,i,pos;
+	chunk *oldchunks;
+	double oldrate,shardedrate;
+
+	nchunks = (argc>1)?strtoul(argv[1],NULL,10):4*1024*1024;
+	lookups = (argc>2)?strtoul(argv[2],NULL,10):2000000;
+	maxthreads = (argc>3)?strtoul(argv[3],NULL,10):16;
+	if (nchunks==0 || lookups==0 || maxthreads==0) {
+		fprintf(stderr,"arguments have to be positive\n");
+		return 1;
+	}
+	oldchunks = (chunk*)malloc(sizeof(chunk)*nchunks);
+	if (oldchunks==NULL) {
+		fprintf(stderr,"out of memory\n");
+		return 1;
+	}
+	memset(oldhashtab,0,sizeof(oldhashtab));
+	hdd_test_index_init();
+	// chunk ids are consecutive like those created by master
+	for (i=0 ; i<nchunks ; i++) {
+		oldchunks[i].chunkid = i+1;
+		oldchunks[i].version = 1;
+		oldchunks[i].state = CH_AVAIL;
+		pos = OLDHASHPOS(oldchunks[i].chunkid);
+		oldchunks[i].next = oldhashtab[pos];
+		oldhashtab[pos] = oldchunks+i;
+		hdd_test_chunk_add(oldchunks[i].chunkid,oldchunks[i].version);
+	}
+	printf("chunks: %" PRIu32 " ; old chain length: %" PRIu32 "\n",nchunks,(nchunks+OLDHASHSIZE-1)/OLDHASHSIZE);
+	for (threads=1 ; threads<=maxthreads ; threads*=2) {
+		sharded = 0;
+		oldrate = run(threads);
+		sharded = 1;
+		shardedrate = run(threads);
+		printf("threads: %3" PRIu32 " ; single lock: %12.0f finds/s ; sharded: %12.0f finds/s (x%.1f)\n",threads,oldrate,shardedrate,shardedrate/(oldrate>0.0?oldrate:1.0));
+		if (threads>UINT32_MAX/2) {
+			break;
+		}
+	}
+	free(oldchunks);
+	return 0;
+}
@@ -37,9 +37,13 @@
 #include <limits.h>
 #include <math.h>
 #include <pthread.h>
-#ifdef MMAP_ALLOC
+#include <sys/uio.h>
+#if defined(MMAP_ALLOC) || defined(__linux__)
 #include <sys/mman.h>
 #endif
+#if defined(HAVE_SENDFILE) && defined(__linux__)
+#include <sys/sendfile.h>
+#endif
 
 #include "MFSCommunication.h"
 #include "cfg.h"
@@ -49,25 +53,31 @@
 #include "slogger.h"
 #include "massert.h"
 #include "random.h"
-
-#define PRESERVE_BLOCK 1
+#include "blockcache.h"
 
 #if defined(HAVE_PREAD) && defined(HAVE_PWRITE)
 #define USE_PIO 1
 #endif
 
-/* system every DELAYEDSTEP seconds searches opened/crc_loaded chunk list for chunks to be closed/free crc */
+#ifdef HAVE_PREADV
+#define USE_PREADV 1
+#endif
+
+/* system every DELAYEDSTEP seconds trims idle chunk cache (opened descriptors + loaded crc) to its limits */
 #define DELAYEDSTEP 2
 
-#define OPENDELAY 5
-#define CRCDELAY 100
-#define OPENSTEPS (OPENDELAY/DELAYEDSTEP)+1
-#define CRCSTEPS (CRCDELAY/DELAYEDSTEP)+1
+/* memory charged to idle chunk in cache (HDD_CRC_CACHE_SIZE) - crc only / crc + descriptor */
+#define LRUCRCCOST 4096
+#define LRUFDCOST 4096
+/* maximal number of busy chunks skipped by one inline trim (hdd_io_end) */
+#define LRUTRIMSTEPS 8
 
-#ifdef PRESERVE_BLOCK
-#define PRESERVEDELAY 10
-#define PRESERVESTEPS (PRESERVEDELAY/DELAYEDSTEP)+1
-#endif
+/* maximal number of adjacent whole blocks merged into one write (HDD_WRITE_BATCH_BLOCKS) */
+#define WRITEBATCH_MAXBLOCKS 16
+/* maximal group fsync window in miliseconds (HDD_FSYNC_WINDOW) */
+#define FSYNCWINDOW_MAX 1000
+/* maximal number of blocks read ahead to block cache (HDD_READAHEAD_BLOCKS) */
+#define READAHEAD_MAXBLOCKS 64
 
 #define LOSTCHUNKSBLOCKSIZE 1024
 #define NEWCHUNKSBLOCKSIZE 4096
@@ -81,11 +91,11 @@
 #define LASTERRSIZE 30
 #define LASTERRTIME 60
 
-#define HASHSIZE 32768
-#define HASHPOS(chunkid) ((chunkid)&0x7FFF)
-
-#define DHASHSIZE 64
-#define DHASHPOS(chunkid) ((chunkid)&0x3F)
+// chunk index is split into independently locked shards, each one has its own growing hash table
+#define HASHSHARDS 64
+#define HASHSHARDINITSIZE 512
+#define HASHSHARD(chunkid) ((chunkid)&(HASHSHARDS-1))
+#define HASHPOS(chunkid,size) (((chunkid)>>6)&((size)-1))
 
 #define CH_NEW_NONE 0
 #define CH_NEW_AUTO 1
@@ -111,11 +121,6 @@ typedef struct newchunk {
 	struct newchunk *next;
 } newchunk;
 
-typedef struct dopchunk {
-	uint64_t chunkid;
-	struct dopchunk *next;
-} dopchunk;
-
 struct folder;
 
 typedef struct ioerror {
@@ -137,9 +142,8 @@ typedef struct chunk {
 	uint32_t version;
 	uint16_t blocks;
 	uint16_t crcrefcount;
-	uint8_t opensteps;
-	uint8_t crcsteps;
 	uint8_t crcchanged;
+	uint8_t wopen;	// written since it was opened - cleared when it's closed by all its users
 #define CH_AVAIL 0
 #define CH_LOCKED 1
 #define CH_DELETED 2
@@ -147,15 +151,24 @@ typedef struct chunk {
 	uint8_t state;	// CH_AVAIL,CH_LOCKED,CH_DELETED
 	cntcond *ccond;
 	uint8_t *crc;
+	uint8_t *vblocks;	// bitmap of blocks with crc checked by hdd_read_fd (freed with crc)
 	int fd;
 
-#ifdef PRESERVE_BLOCK
-	uint8_t *block;
-	uint16_t blockno;	// 0xFFFF == invalid
-	uint8_t blocksteps;
-#endif
+	uint8_t *wbuff;	// whole blocks written by client but not by us yet (write coalescing)
+	uint16_t wbfirst;
+	uint16_t wbblocks;
+	uint16_t wbsize;
+	uint8_t wberror;	// delayed write failed - reported by next write or close
+	uint16_t rdnext;	// block expected by sequential reader (readahead)
+	uint16_t rafirst;	// blocks to be read ahead by hdd_readahead (after reply is sent)
+	uint16_t rablocks;
 	uint8_t validattr;
 	uint8_t todel;
+#define LRU_NONE 0
+#define LRU_FD 1
+#define LRU_CRC 2
+	uint8_t lrulist;	// idle chunk cache list (LRU_FD - descriptor and crc, LRU_CRC - crc only)
+	struct chunk *lrunext,**lruprev;
 	struct chunk *testnext,**testprev;
 	struct chunk *next;
 } chunk;
@@ -172,8 +185,19 @@ typedef struct hddstats {
 	uint32_t usecreadmax;
 	uint32_t usecwritemax;
 	uint32_t usecfsyncmax;
+	uint64_t usecqueuesum;	// time spent by jobs in disk queue
+	uint32_t queueops;
+	uint32_t usecqueuemax;
 } hddstats;
 
+typedef struct fsyncreq {
+	int fd;
+	int status;
+	int errornumber;
+	uint8_t done;
+	struct fsyncreq *next;
+} fsyncreq;
+
 typedef struct folder {
 	char *path;
 #define SCST_SCANNEEDED 0
@@ -182,11 +206,13 @@ typedef struct folder {
 #define SCST_SCANFINISHED 3
 #define SCST_SENDNEEDED 4
 #define SCST_WORKING 5
+#define SCST_VERIFYING 6	// chunks loaded from inventory - folder is used while it is scanned in background
 	unsigned int scanstate:3;
 	unsigned int needrefresh:1;
 	unsigned int todel:2;
 	unsigned int damaged:1;
 	unsigned int toremove:2;
+	unsigned int chunksknown:1;	// all chunks of this folder are in chunk index (scan completed or inventory loaded)
 	uint8_t scanprogress;
 	uint64_t sizelimit;
 	uint64_t leavefree;
@@ -203,6 +229,12 @@ typedef struct folder {
 	ino_t lockinode;
 	int lfd;
 	double carry;
+	uint32_t diskid;	// index in disktab
+	uint32_t queuedjobs;	// jobs waiting in disk queue (bgjobs)
+	pthread_mutex_t fsynclock;	// group fsync
+	pthread_cond_t fsynccond;
+	fsyncreq *fsynchead;
+	uint8_t fsyncleader;
 	pthread_t scanthread;
 	struct chunk *testhead,**testtail;
 	struct folder *next;
@@ -210,17 +242,32 @@ typedef struct folder {
 
 static uint32_t HDDTestFreq = 10;
 static uint64_t LeaveFree;
+static uint32_t WriteBatchBlocks = 1;
+static uint32_t FsyncWindow = 0;	// usec
+static uint64_t CrcCacheSize;
+static uint32_t FdCacheMax;
+static uint64_t BlockCacheSize = 0;
+static uint32_t ReadAheadBlocks;
 
 /* folders data */
 static folder *folderhead = NULL;
 
-/* chunk hash */
-static chunk* hashtab[HASHSIZE];
+/* chunk index */
+typedef struct _hashshard {
+	pthread_mutex_t lock;	// protects tab, chunk states (and other fields not changed by the chunk owner) and cclist
+	chunk **tab;
+	uint32_t size;
+	uint32_t count;
+	cntcond *cclist;
+} hashshard;
 
-/* extra chunk info */
-static dopchunk *dophashtab[DHASHSIZE];
-//static dopchunk *dopchunks = NULL;
-static dopchunk *newdopchunks = NULL;
+static hashshard hashshards[HASHSHARDS];
+
+/* idle chunk cache - oldest chunks first */
+static chunk *lruhead[3] = {NULL,NULL,NULL};
+static chunk **lrutail[3] = {NULL,lruhead+LRU_FD,lruhead+LRU_CRC};
+static uint64_t lrusize = 0;
+static uint32_t lrufds = 0;
 
 // master reports
 static damagedchunk *damagedchunks = NULL;
@@ -240,30 +287,56 @@ static pthread_mutex_t termlock = PTHREAD_MUTEX_INITIALIZER;
 // stats_X
 static pthread_mutex_t statslock = PTHREAD_MUTEX_INITIALIZER;
 
-// newdopchunks + dophashtab
-static pthread_mutex_t doplock = PTHREAD_MUTEX_INITIALIZER;
-static pthread_mutex_t ndoplock = PTHREAD_MUTEX_INITIALIZER;
+// lruhead + lrutail + lrusize + lrufds + lru fields in chunks ; lock order: shard lock -> lrulock
+static pthread_mutex_t lrulock = PTHREAD_MUTEX_INITIALIZER;
 
 // master reports = damaged chunks, lost chunks, errorcounter, hddspacechanged
 static pthread_mutex_t dclock = PTHREAD_MUTEX_INITIALIZER;
 
-// hashtab - only hash tab, chunks have their own separate locks
-static pthread_mutex_t hashlock = PTHREAD_MUTEX_INITIALIZER;
-static cntcond *cclist = NULL;
-
 // folderhead + all data in structures
 static pthread_mutex_t folderlock = PTHREAD_MUTEX_INITIALIZER;
 
+// hashshards (chunk index) ; lock order: folderlock -> shard locks (ascending) -> lrulock, testlock
+
 // chunk tester
 static pthread_mutex_t testlock = PTHREAD_MUTEX_INITIALIZER;
 
-#ifndef PRESERVE_BLOCK
+// folders by diskid (ids are never reused, removed folders are NULL) - protected by statslock
+static folder **disktab = NULL;
+static uint32_t disktabsize = 0;
+static uint32_t nextdiskid = 1;
+
 static pthread_key_t hdrbufferkey;
 static pthread_key_t blockbufferkey;
-#endif
 
 static uint32_t emptyblockcrc;
 
+static inline uint8_t* hdd_get_blockbuffer(void) {
+	uint8_t *blockbuffer;
+	blockbuffer = (uint8_t*)pthread_getspecific(blockbufferkey);
+	if (blockbuffer==NULL) {
+#ifdef MMAP_ALLOC
+		blockbuffer = (uint8_t*)mmap(NULL,MFSBLOCKSIZE,PROT_READ | PROT_WRITE, MAP_ANON | MAP_PRIVATE,-1,0);
+#else
+		blockbuffer = (uint8_t*)malloc(MFSBLOCKSIZE);
+#endif
+		passert(blockbuffer);
+		zassert(pthread_setspecific(blockbufferkey,blockbuffer));
+	}
+	return blockbuffer;
+}
+
+static inline uint8_t* hdd_get_hdrbuffer(void) {
+	uint8_t *hdrbuffer;
+	hdrbuffer = (uint8_t*)pthread_getspecific(hdrbufferkey);
+	if (hdrbuffer==NULL) {
+		hdrbuffer = (uint8_t*)malloc(CHUNKHDRSIZE);
+		passert(hdrbuffer);
+		zassert(pthread_setspecific(hdrbufferkey,hdrbuffer));
+	}
+	return hdrbuffer;
+}
+
 static uint64_t stats_bytesr = 0;
 static uint64_t stats_bytesw = 0;
 static uint32_t stats_opr = 0;
@@ -283,6 +356,14 @@ static uint32_t stats_duplicate = 0;
 static uint32_t stats_truncate = 0;
 static uint32_t stats_duptrunc = 0;
 
+static uint32_t stats_wbatches = 0;
+static uint32_t stats_wbatchblocks = 0;
+static uint32_t stats_fsyncbatches = 0;
+static uint32_t stats_fsyncchunks = 0;
+
+static uint32_t stats_cachehits = 0;
+static uint32_t stats_cachemisses = 0;
+
 static inline void hdd_stats_clear(hddstats *r) {
 	memset(r,0,sizeof(hddstats));
 }
@@ -305,6 +386,11 @@ static inline void hdd_stats_add(hddstats *dst,hddstats *src) {
 	if (src->usecfsyncmax>dst->usecfsyncmax) {
 		dst->usecfsyncmax = src->usecfsyncmax;
 	}
+	dst->usecqueuesum += src->usecqueuesum;
+	dst->queueops += src->queueops;
+	if (src->usecqueuemax>dst->usecqueuemax) {
+		dst->usecqueuemax = src->usecqueuemax;
+	}
 }
 
 /* size: 64 */
@@ -322,6 +408,13 @@ static inline void hdd_stats_binary_pack(uint8_t **buff,hddstats *r) {
 	put32bit(buff,r->usecfsyncmax);
 }
 
+/* size: 16 */
+static inline void hdd_stats_queue_pack(uint8_t **buff,hddstats *r) {
+	put64bit(buff,r->usecqueuesum);
+	put32bit(buff,r->queueops);
+	put32bit(buff,r->usecqueuemax);
+}
+
 void hdd_report_damaged_chunk(uint64_t chunkid) {
 	damagedchunk *dc;
 	zassert(pthread_mutex_lock(&dclock));
@@ -535,6 +628,28 @@ void hdd_op_stats(uint32_t *op_create,uint32_t *op_delete,uint32_t *op_version,u
 	zassert(pthread_mutex_unlock(&statslock));
 }
 
+void hdd_batch_stats(uint32_t *wbatches,uint32_t *wbatchblocks,uint32_t *fsyncbatches,uint32_t *fsyncchunks) {
+	zassert(pthread_mutex_lock(&statslock));
+	*wbatches = stats_wbatches;
+	*wbatchblocks = stats_wbatchblocks;
+	*fsyncbatches = stats_fsyncbatches;
+	*fsyncchunks = stats_fsyncchunks;
+	stats_wbatches = 0;
+	stats_wbatchblocks = 0;
+	stats_fsyncbatches = 0;
+	stats_fsyncchunks = 0;
+	zassert(pthread_mutex_unlock(&statslock));
+}
+
+void hdd_cache_stats(uint32_t *hits,uint32_t *misses) {
+	zassert(pthread_mutex_lock(&statslock));
+	*hits = stats_cachehits;
+	*misses = stats_cachemisses;
+	stats_cachehits = 0;
+	stats_cachemisses = 0;
+	zassert(pthread_mutex_unlock(&statslock));
+}
+
 static inline void hdd_stats_read(uint32_t size) {
 	zassert(pthread_mutex_lock(&statslock));
 	stats_opr++;
@@ -549,11 +664,8 @@ static inline void hdd_stats_write(uint32_t size) {
 	zassert(pthread_mutex_unlock(&statslock));
 }
 
-static inline void hdd_stats_dataread(folder *f,uint32_t size,int64_t rtime) {
-	if (rtime<=0) {
-		return;
-	}
-	zassert(pthread_mutex_lock(&statslock));
+// statslock has to be held
+static inline void hdd_stats_dataread_locked(folder *f,uint32_t size,int64_t rtime) {
 	stats_dataopr++;
 	stats_databytesr += size;
 	stats_rtime += rtime;
@@ -563,6 +675,119 @@ static inline void hdd_stats_dataread(folder *f,uint32_t size,int64_t rtime) {
 	if (rtime>f->cstat.usecreadmax) {
 		f->cstat.usecreadmax = rtime;
 	}
+}
+
+static inline void hdd_stats_dataread(folder *f,uint32_t size,int64_t rtime) {
+	if (rtime<=0) {
+		return;
+	}
+	zassert(pthread_mutex_lock(&statslock));
+	hdd_stats_dataread_locked(f,size,rtime);
+	zassert(pthread_mutex_unlock(&statslock));
+}
+
+/* chunk index */
+
+static inline hashshard* hdd_hash_shard(uint64_t chunkid) {
+	return hashshards+HASHSHARD(chunkid);
+}
+
+// shard has to be locked
+static inline chunk* hdd_hash_find(hashshard *hs,uint64_t chunkid) {
+	chunk *c;
+	for (c=hs->tab[HASHPOS(chunkid,hs->size)] ; c && c->chunkid!=chunkid ; c=c->next) {}
+	return c;
+}
+
+// shard has to be locked ; table is doubled when average chain gets longer than 2
+static void hdd_hash_add(hashshard *hs,chunk *c) {
+	chunk **newtab,*cn;
+	uint32_t i,newsize,pos;
+	if (hs->count>=2*hs->size && hs->size<0x80000000) {
+		newsize = hs->size*2;
+		newtab = (chunk**) calloc(newsize,sizeof(chunk*));
+		if (newtab!=NULL) {	// when there is no memory, just keep longer chains
+			for (i=0 ; i<hs->size ; i++) {
+				while (hs->tab[i]) {
+					cn = hs->tab[i];
+					hs->tab[i] = cn->next;
+					pos = HASHPOS(cn->chunkid,newsize);
+					cn->next = newtab[pos];
+					newtab[pos] = cn;
+				}
+			}
+			free(hs->tab);
+			hs->tab = newtab;
+			hs->size = newsize;
+		}
+	}
+	pos = HASHPOS(c->chunkid,hs->size);
+	c->next = hs->tab[pos];
+	hs->tab[pos] = c;
+	hs->count++;
+}
+
+uint32_t hdd_chunk_diskid(uint64_t chunkid,uint64_t *devid) {
+	hashshard *hs;
+	chunk *c;
+	uint32_t diskid;
+	diskid = 0;
+	*devid = 0;
+	hs = hdd_hash_shard(chunkid);
+	zassert(pthread_mutex_lock(&(hs->lock)));
+	c = hdd_hash_find(hs,chunkid);
+	if (c && c->owner && c->state!=CH_DELETED && c->state!=CH_TOBEDELETED) {
+		diskid = c->owner->diskid;
+		*devid = c->owner->devid;
+	}
+	zassert(pthread_mutex_unlock(&(hs->lock)));
+	return diskid;
+}
+
+void hdd_stats_queue_add(uint32_t diskid) {
+	zassert(pthread_mutex_lock(&statslock));
+	if (diskid<disktabsize && disktab[diskid]) {
+		disktab[diskid]->queuedjobs++;
+	}
+	zassert(pthread_mutex_unlock(&statslock));
+}
+
+void hdd_stats_queue_start(uint32_t diskid,uint64_t qtime) {
+	folder *f;
+	zassert(pthread_mutex_lock(&statslock));
+	if (diskid<disktabsize && (f=disktab[diskid])!=NULL) {
+		if (f->queuedjobs>0) {
+			f->queuedjobs--;
+		}
+		f->cstat.queueops++;
+		f->cstat.usecqueuesum += qtime;
+		if (qtime>f->cstat.usecqueuemax) {
+			f->cstat.usecqueuemax = qtime;
+		}
+	}
+	zassert(pthread_mutex_unlock(&statslock));
+}
+
+// called when folder is freed
+static void hdd_disktab_remove(folder *f) {
+	zassert(pthread_mutex_lock(&statslock));
+	if (f->diskid<disktabsize) {
+		disktab[f->diskid] = NULL;
+	}
+	zassert(pthread_mutex_unlock(&statslock));
+}
+
+static void hdd_disktab_add(folder *f) {
+	zassert(pthread_mutex_lock(&statslock));
+	if (nextdiskid>=disktabsize) {
+		disktabsize = (disktabsize>0)?disktabsize*2:64;
+		disktab = (folder**)realloc(disktab,sizeof(folder*)*disktabsize);
+		passert(disktab);
+		memset(disktab+nextdiskid,0,sizeof(folder*)*(disktabsize-nextdiskid));
+	}
+	f->diskid = nextdiskid++;
+	f->queuedjobs = 0;
+	disktab[f->diskid] = f;
 	zassert(pthread_mutex_unlock(&statslock));
 }
 
@@ -583,6 +808,30 @@ static inline void hdd_stats_datawrite(folder *f,uint32_t size,int64_t wtime) {
 	zassert(pthread_mutex_unlock(&statslock));
 }
 
+static inline void hdd_stats_writebatch(uint32_t blocks) {
+	zassert(pthread_mutex_lock(&statslock));
+	stats_wbatches++;
+	stats_wbatchblocks += blocks;
+	zassert(pthread_mutex_unlock(&statslock));
+}
+
+static inline void hdd_stats_fsyncbatch(uint32_t chunks) {
+	zassert(pthread_mutex_lock(&statslock));
+	stats_fsyncbatches++;
+	stats_fsyncchunks += chunks;
+	zassert(pthread_mutex_unlock(&statslock));
+}
+
+static inline void hdd_stats_crccache(uint8_t hit) {
+	zassert(pthread_mutex_lock(&statslock));
+	if (hit) {
+		stats_cachehits++;
+	} else {
+		stats_cachemisses++;
+	}
+	zassert(pthread_mutex_unlock(&statslock));
+}
+
 static inline void hdd_stats_datafsync(folder *f,int64_t fsynctime) {
 	if (fsynctime<=0) {
 		return;
@@ -655,7 +904,7 @@ uint32_t hdd_diskinfo_v2_size() {
 		if (sl>255) {
 			sl = 255;
 		}
-		s += 2+226+sl;
+		s += 2+278+sl;
 	}
 	return s;
 }
@@ -671,13 +920,13 @@ void hdd_diskinfo_v2_data(uint8_t *buff) {
 		for (f=folderhead ; f ; f=f->next ) {
 			sl = strlen(f->path);
 			if (sl>255) {
-				put16bit(&buff,226+255);	// size of this entry
+				put16bit(&buff,278+255);	// size of this entry
 				put8bit(&buff,255);
 				memcpy(buff,"(...)",5);
 				memcpy(buff+5,f->path+(sl-250),250);
 				buff += 255;
 			} else {
-				put16bit(&buff,226+sl);	// size of this entry
+				put16bit(&buff,278+sl);	// size of this entry
 				put8bit(&buff,sl);
 				if (sl>0) {
 					memcpy(buff,f->path,sl);
@@ -706,6 +955,18 @@ void hdd_diskinfo_v2_data(uint8_t *buff) {
 				hdd_stats_add(&s,&(f->stats[(f->statspos+pos)%STATSHISTORY]));
 			}
 			hdd_stats_binary_pack(&buff,&s);	// 64B
+			// disk queue: current length and wait times (min,hour,day)
+			put32bit(&buff,f->queuedjobs);
+			s = f->stats[f->statspos];
+			hdd_stats_queue_pack(&buff,&s);	// 16B
+			for (pos=1 ; pos<60 ; pos++) {
+				hdd_stats_add(&s,&(f->stats[(f->statspos+pos)%STATSHISTORY]));
+			}
+			hdd_stats_queue_pack(&buff,&s);	// 16B
+			for (pos=60 ; pos<24*60 ; pos++) {
+				hdd_stats_add(&s,&(f->stats[(f->statspos+pos)%STATSHISTORY]));
+			}
+			hdd_stats_queue_pack(&buff,&s);	// 16B
 		}
 		zassert(pthread_mutex_unlock(&statslock));
 	}
@@ -729,13 +990,60 @@ void hdd_diskinfo_movestats(void) {
 	zassert(pthread_mutex_unlock(&folderlock));
 }
 
+// lrulock has to be locked
+static inline void hdd_lru_append(chunk *c,uint8_t list) {
+	c->lrulist = list;
+	c->lrunext = NULL;
+	c->lruprev = lrutail[list];
+	*(c->lruprev) = c;
+	lrutail[list] = &(c->lrunext);
+	if (list==LRU_FD) {
+		lrusize += LRUFDCOST;
+		lrufds++;
+	} else {
+		lrusize += LRUCRCCOST;
+	}
+}
+
+// lrulock has to be locked
+static inline void hdd_lru_detach(chunk *c) {
+	if (c->lruprev==NULL) {
+		return;
+	}
+	if (c->lrunext) {
+		c->lrunext->lruprev = c->lruprev;
+	} else {
+		lrutail[c->lrulist] = c->lruprev;
+	}
+	*(c->lruprev) = c->lrunext;
+	if (c->lrulist==LRU_FD) {
+		lrusize -= LRUFDCOST;
+		lrufds--;
+	} else {
+		lrusize -= LRUCRCCOST;
+	}
+	c->lrunext = NULL;
+	c->lruprev = NULL;
+	c->lrulist = LRU_NONE;
+}
+
+static inline void hdd_lru_remove(chunk *c) {
+	zassert(pthread_mutex_lock(&lrulock));
+	hdd_lru_detach(c);
+	zassert(pthread_mutex_unlock(&lrulock));
+}
+
+// shard of chunk has to be locked
 static inline void hdd_chunk_remove(chunk *c) {
 	chunk **cptr,*cp;
-	uint32_t hashpos = HASHPOS(c->chunkid);
-	cptr = &(hashtab[hashpos]);
+	hashshard *hs;
+	hs = hdd_hash_shard(c->chunkid);
+	cptr = &(hs->tab[HASHPOS(c->chunkid,hs->size)]);
 	while ((cp=*cptr)) {
 		if (c==cp) {
 			*cptr = cp->next;
+			hs->count--;
+			hdd_lru_remove(cp);
 			if (cp->fd>=0) {
 				close(cp->fd);
 			}
@@ -746,15 +1054,12 @@ static inline void hdd_chunk_remove(chunk *c) {
 				free(cp->crc);
 #endif
 			}
-#ifdef PRESERVE_BLOCK
-			if (cp->block!=NULL) {
-# ifdef MMAP_ALLOC
-				munmap((void*)(cp->block),MFSBLOCKSIZE);
-# else
-				free(cp->block);
-# endif
+			if (cp->vblocks!=NULL) {
+				free(cp->vblocks);
+			}
+			if (cp->wbuff!=NULL) {
+				free(cp->wbuff);
 			}
-#endif /* PRESERVE_BLOCK */
 			if (cp->filename!=NULL) {
 				free(cp->filename);
 			}
@@ -776,7 +1081,9 @@ static inline void hdd_chunk_remove(chunk *c) {
 }
 
 static void hdd_chunk_release(chunk *c) {
-	zassert(pthread_mutex_lock(&hashlock));
+	hashshard *hs;
+	hs = hdd_hash_shard(c->chunkid);
+	zassert(pthread_mutex_lock(&(hs->lock)));
 //	syslog(LOG_WARNING,"hdd_chunk_release got chunk: %016" PRIX64 " (c->state:%u)",c->chunkid,c->state);
 	if (c->state==CH_LOCKED) {
 		c->state = CH_AVAIL;
@@ -786,6 +1093,7 @@ static void hdd_chunk_release(chunk *c) {
 		}
 	} else if (c->state==CH_TOBEDELETED) {
 		if (c->ccond) {
+			hdd_lru_remove(c);
 			c->state = CH_DELETED;
 //			printf("wake up one thread waiting for DELETED chunk: %" PRIu64 " on ccond:%p\n",c->chunkid,c->ccond);
 			zassert(pthread_cond_signal(&(c->ccond->cond)));
@@ -793,7 +1101,7 @@ static void hdd_chunk_release(chunk *c) {
 			hdd_chunk_remove(c);
 		}
 	}
-	zassert(pthread_mutex_unlock(&hashlock));
+	zassert(pthread_mutex_unlock(&(hs->lock)));
 }
 
 static int hdd_chunk_getattr(chunk *c) {
@@ -813,10 +1121,11 @@ static int hdd_chunk_getattr(chunk *c) {
 }
 
 static chunk* hdd_chunk_tryfind(uint64_t chunkid) {
-	uint32_t hashpos = HASHPOS(chunkid);
+	hashshard *hs;
 	chunk *c;
-	zassert(pthread_mutex_lock(&hashlock));
-	for (c=hashtab[hashpos] ; c && c->chunkid!=chunkid ; c=c->next) {}
+	hs = hdd_hash_shard(chunkid);
+	zassert(pthread_mutex_lock(&(hs->lock)));
+	c = hdd_hash_find(hs,chunkid);
 	if (c!=NULL) {
 		if (c->state==CH_LOCKED) {
 			c = (chunk*) CHUNKLOCKED;
@@ -829,18 +1138,19 @@ static chunk* hdd_chunk_tryfind(uint64_t chunkid) {
 //	if (c!=NULL && c!=CHUNKLOCKED) {
 //		syslog(LOG_WARNING,"hdd_chunk_tryfind returns chunk: %016" PRIX64 " (c->state:%u)",c->chunkid,c->state);
 //	}
-	zassert(pthread_mutex_unlock(&hashlock));
+	zassert(pthread_mutex_unlock(&(hs->lock)));
 	return c;
 }
 
 static void hdd_chunk_delete(chunk *c);
 
 static chunk* hdd_chunk_get(uint64_t chunkid,uint8_t cflag) {
-	uint32_t hashpos = HASHPOS(chunkid);
+	hashshard *hs;
 	chunk *c;
 	cntcond *cc;
-	zassert(pthread_mutex_lock(&hashlock));
-	for (c=hashtab[hashpos] ; c && c->chunkid!=chunkid ; c=c->next) {}
+	hs = hdd_hash_shard(chunkid);
+	zassert(pthread_mutex_lock(&(hs->lock)));
+	c = hdd_hash_find(hs,chunkid);
 	if (c==NULL) {
 		if (cflag!=CH_NEW_NONE) {
 			c = (chunk*) malloc(sizeof(chunk));
@@ -851,32 +1161,37 @@ static chunk* hdd_chunk_get(uint64_t chunkid,uint8_t cflag) {
 			c->filename = NULL;
 			c->blocks = 0;
 			c->crcrefcount = 0;
-			c->opensteps = 0;
-			c->crcsteps = 0;
 			c->crcchanged = 0;
+			c->wopen = 0;
 			c->fd = -1;
 			c->crc = NULL;
+			c->vblocks = NULL;
 			c->state = CH_LOCKED;
 			c->ccond = NULL;
-#ifdef PRESERVE_BLOCK
-			c->block = NULL;
-			c->blockno = 0xFFFF;
-			c->blocksteps = 0;
-#endif
+			c->wbuff = NULL;
+			c->wbfirst = 0;
+			c->wbblocks = 0;
+			c->wbsize = 0;
+			c->wberror = 0;
+			c->rdnext = 0;
+			c->rafirst = 0;
+			c->rablocks = 0;
 			c->validattr = 0;
 			c->todel = 0;
+			c->lrulist = LRU_NONE;
+			c->lrunext = NULL;
+			c->lruprev = NULL;
 			c->testnext = NULL;
 			c->testprev = NULL;
-			c->next = hashtab[hashpos];
-			hashtab[hashpos] = c;
+			hdd_hash_add(hs,c);
 		}
 //		syslog(LOG_WARNING,"hdd_chunk_get returns chunk: %016" PRIX64 " (c->state:%u)",c->chunkid,c->state);
-		zassert(pthread_mutex_unlock(&hashlock));
+		zassert(pthread_mutex_unlock(&(hs->lock)));
 		return c;
 	}
 	if (cflag==CH_NEW_EXCLUSIVE) {
 		if (c->state==CH_AVAIL || c->state==CH_LOCKED) {
-			zassert(pthread_mutex_unlock(&hashlock));
+			zassert(pthread_mutex_unlock(&(hs->lock)));
 			return NULL;
 		}
 	}
@@ -885,7 +1200,7 @@ static chunk* hdd_chunk_get(uint64_t chunkid,uint8_t cflag) {
 		case CH_AVAIL:
 			c->state = CH_LOCKED;
 //			syslog(LOG_WARNING,"hdd_chunk_get returns chunk: %016" PRIX64 " (c->state:%u)",c->chunkid,c->state);
-			zassert(pthread_mutex_unlock(&hashlock));
+			zassert(pthread_mutex_unlock(&(hs->lock)));
 			if (c->validattr==0) {
 				if (hdd_chunk_getattr(c)) {
 					hdd_report_damaged_chunk(c->chunkid);
@@ -897,6 +1212,7 @@ static chunk* hdd_chunk_get(uint64_t chunkid,uint8_t cflag) {
 			return c;
 		case CH_DELETED:
 			if (cflag!=CH_NEW_NONE) {
+				hdd_lru_remove(c);
 				if (c->fd>=0) {
 					close(c->fd);
 				}
@@ -907,15 +1223,9 @@ static chunk* hdd_chunk_get(uint64_t chunkid,uint8_t cflag) {
 					free(c->crc);
 #endif
 				}
-#ifdef PRESERVE_BLOCK
-				if (c->block!=NULL) {
-# ifdef MMAP_ALLOC
-					munmap((void*)(c->crc),MFSBLOCKSIZE);
-# else
-					free(c->block);
-# endif
+				if (c->vblocks!=NULL) {
+					free(c->vblocks);
 				}
-#endif /* PRESERVE_BLOCK */
 				if (c->filename!=NULL) {
 					free(c->filename);
 				}
@@ -934,21 +1244,27 @@ static chunk* hdd_chunk_get(uint64_t chunkid,uint8_t cflag) {
 				c->filename = NULL;
 				c->blocks = 0;
 				c->crcrefcount = 0;
-				c->opensteps = 0;
-				c->crcsteps = 0;
 				c->crcchanged = 0;
+				c->wopen = 0;
 				c->fd = -1;
 				c->crc = NULL;
-#ifdef PRESERVE_BLOCK
-				c->block = NULL;
-				c->blockno = 0xFFFF;
-				c->blocksteps = 0;
-#endif /* PRESERVE_BLOCK */
+				c->vblocks = NULL;
+				if (c->wbuff!=NULL) {
+					free(c->wbuff);
+				}
+				c->wbuff = NULL;
+				c->wbfirst = 0;
+				c->wbblocks = 0;
+				c->wbsize = 0;
+				c->wberror = 0;
+				c->rdnext = 0;
+				c->rafirst = 0;
+				c->rablocks = 0;
 				c->validattr = 0;
 				c->todel = 0;
 				c->state = CH_LOCKED;
 //				syslog(LOG_WARNING,"hdd_chunk_get returns chunk: %016" PRIX64 " (c->state:%u)",c->chunkid,c->state);
-				zassert(pthread_mutex_unlock(&hashlock));
+				zassert(pthread_mutex_unlock(&(hs->lock)));
 				return c;
 			}
 			if (c->ccond==NULL) {	// no more waiting threads - remove
@@ -957,25 +1273,25 @@ static chunk* hdd_chunk_get(uint64_t chunkid,uint8_t cflag) {
 //				printf("wake up one thread waiting for DELETED chunk: %" PRIu64 " on ccond:%p\n",c->chunkid,c->ccond);
 				zassert(pthread_cond_signal(&(c->ccond->cond)));
 			}
-			zassert(pthread_mutex_unlock(&hashlock));
+			zassert(pthread_mutex_unlock(&(hs->lock)));
 			return NULL;
 		case CH_TOBEDELETED:
 		case CH_LOCKED:
 			if (c->ccond==NULL) {
-				for (cc=cclist ; cc && cc->wcnt ; cc=cc->next) {}
+				for (cc=hs->cclist ; cc && cc->wcnt ; cc=cc->next) {}
 				if (cc==NULL) {
 					cc = (cntcond*) malloc(sizeof(cntcond));
 					passert(cc);
 					zassert(pthread_cond_init(&(cc->cond),NULL));
 					cc->wcnt = 0;
-					cc->next = cclist;
-					cclist = cc;
+					cc->next = hs->cclist;
+					hs->cclist = cc;
 				}
 				c->ccond = cc;
 			}
 			c->ccond->wcnt++;
 //			printf("wait for %s chunk: %" PRIu64 " on ccond:%p\n",(c->state==CH_LOCKED)?"LOCKED":"TOBEDELETED",c->chunkid,c->ccond);
-			zassert(pthread_cond_wait(&(c->ccond->cond),&hashlock));
+			zassert(pthread_cond_wait(&(c->ccond->cond),&(hs->lock)));
 //			printf("%s chunk: %" PRIu64 " woke up on ccond:%p\n",(c->state==CH_LOCKED)?"LOCKED":(c->state==CH_DELETED)?"DELETED":(c->state==CH_AVAIL)?"AVAIL":"TOBEDELETED",c->chunkid,c->ccond);
 			c->ccond->wcnt--;
 			if (c->ccond->wcnt==0) {
@@ -986,17 +1302,20 @@ static chunk* hdd_chunk_get(uint64_t chunkid,uint8_t cflag) {
 }
 
 static void hdd_chunk_delete(chunk *c) {
+	hashshard *hs;
 	folder *f;
-	zassert(pthread_mutex_lock(&hashlock));
+	hs = hdd_hash_shard(c->chunkid);
+	zassert(pthread_mutex_lock(&(hs->lock)));
 	f = c->owner;
 	if (c->ccond) {
+		hdd_lru_remove(c);
 		c->state = CH_DELETED;
 //		printf("wake up one thread waiting for DELETED chunk: %" PRIu64 " ccond:%p\n",c->chunkid,c->ccond);
 		zassert(pthread_cond_signal(&(c->ccond->cond)));
 	} else {
 		hdd_chunk_remove(c);
 	}
-	zassert(pthread_mutex_unlock(&hashlock));
+	zassert(pthread_mutex_unlock(&(hs->lock)));
 	zassert(pthread_mutex_lock(&folderlock));
 	f->chunkcount--;
 	f->needrefresh = 1;
@@ -1029,8 +1348,6 @@ static chunk* hdd_chunk_create(folder *f,uint64_t chunkid,uint32_t version) {
 	return c;
 }
 
-#define hdd_chunk_find(chunkid) hdd_chunk_get(chunkid,CH_NEW_NONE)
-
 static void hdd_chunk_testmove(chunk *c) {
 	zassert(pthread_mutex_lock(&testlock));
 	if (c->testnext) {
@@ -1053,7 +1370,7 @@ static inline void hdd_refresh_usage(folder *f) {
 		chunk *c;
 		knownblocks = 0;
 		knowncount = 0;
-		zassert(pthread_mutex_lock(&hashlock));
+		// only an estimate - testlock keeps chunks on the list, their states are read without shard locks
 		zassert(pthread_mutex_lock(&testlock));
 		for (c=f->testhead ; c ; c=c->testnext) {
 			if (c->state==CH_AVAIL && c->validattr==1) {
@@ -1062,7 +1379,6 @@ static inline void hdd_refresh_usage(folder *f) {
 			}
 		}
 		zassert(pthread_mutex_unlock(&testlock));
-		zassert(pthread_mutex_unlock(&hashlock));
 		if (knowncount>0) {
 			calcsize = knownblocks;
 			calcsize *= f->chunkcount;
@@ -1106,7 +1422,7 @@ static inline folder* hdd_getfolder() {
 	bf = NULL;
 	ok = 0;
 	for (f=folderhead ; f ; f=f->next) {
-		if (f->damaged || f->todel || f->total==0 || f->avail==0 || f->scanstate!=SCST_WORKING) {
+		if (f->damaged || f->todel || f->total==0 || f->avail==0 || (f->scanstate!=SCST_WORKING && f->scanstate!=SCST_VERIFYING)) {
 			continue;
 		}
 		if (f->carry >= maxcarry) {
@@ -1140,7 +1456,7 @@ static inline folder* hdd_getfolder() {
 	d = maxavail-s;
 	maxcarry = 1.0;
 	for (f=folderhead ; f ; f=f->next) {
-		if (f->damaged || f->todel || f->total==0 || f->avail==0 || f->scanstate!=SCST_WORKING) {
+		if (f->damaged || f->todel || f->total==0 || f->avail==0 || (f->scanstate!=SCST_WORKING && f->scanstate!=SCST_VERIFYING)) {
 			continue;
 		}
 		pavail = (double)(f->avail)/(double)(f->total);
@@ -1159,66 +1475,69 @@ static inline folder* hdd_getfolder() {
 }
 
 void hdd_senddata(folder *f,int rmflag) {
-	uint32_t i;
+	uint32_t s,i;
 	uint8_t todel;
+	hashshard *hs;
 	chunk **cptr,*c;
 
 	todel = f->todel;
-	zassert(pthread_mutex_lock(&hashlock));
-	zassert(pthread_mutex_lock(&testlock));
-	for (i=0 ; i<HASHSIZE ; i++) {
-		cptr = &(hashtab[i]);
-		while ((c=*cptr)) {
-			if (c->owner==f) {
-				c->todel = todel;
-				if (rmflag) {
-					hdd_report_lost_chunk(c->chunkid);
-					if (c->state==CH_AVAIL) {
-						*cptr = c->next;
-						if (c->fd>=0) {
-							close(c->fd);
-						}
-						if (c->crc!=NULL) {
+	for (s=0 ; s<HASHSHARDS ; s++) {
+		hs = hashshards+s;
+		zassert(pthread_mutex_lock(&(hs->lock)));
+		zassert(pthread_mutex_lock(&testlock));
+		for (i=0 ; i<hs->size ; i++) {
+			cptr = &(hs->tab[i]);
+			while ((c=*cptr)) {
+				if (c->owner==f) {
+					c->todel = todel;
+					if (rmflag) {
+						hdd_report_lost_chunk(c->chunkid);
+						if (c->state==CH_AVAIL) {
+							*cptr = c->next;
+							hs->count--;
+							hdd_lru_remove(c);
+							if (c->fd>=0) {
+								close(c->fd);
+							}
+							if (c->crc!=NULL) {
 #ifdef MMAP_ALLOC
-							munmap((void*)(c->crc),4096);
+								munmap((void*)(c->crc),4096);
 #else
-							free(c->crc);
+								free(c->crc);
 #endif
+							}
+							if (c->vblocks!=NULL) {
+								free(c->vblocks);
+							}
+							if (c->wbuff!=NULL) {
+								free(c->wbuff);
+							}
+							if (c->filename) {
+								free(c->filename);
+							}
+							if (c->testnext) {
+								c->testnext->testprev = c->testprev;
+							} else {
+								c->owner->testtail = c->testprev;
+							}
+							*(c->testprev) = c->testnext;
+							free(c);
+						} else if (c->state==CH_LOCKED) {
+							cptr = &(c->next);
+							c->state = CH_TOBEDELETED;
 						}
-#ifdef PRESERVE_BLOCK
-						if (c->block!=NULL) {
-# ifdef MMAP_ALLOC
-							munmap((void*)(c->block),MFSBLOCKSIZE);
-# else
-							free(c->block);
-# endif
-						}
-#endif /* PRESERVE_BLOCK */
-						if (c->filename) {
-							free(c->filename);
-						}
-						if (c->testnext) {
-							c->testnext->testprev = c->testprev;
-						} else {
-							c->owner->testtail = c->testprev;
-						}
-						*(c->testprev) = c->testnext;
-						free(c);
-					} else if (c->state==CH_LOCKED) {
+					} else {
+						hdd_report_new_chunk(c->chunkid,c->version|((c->todel)?0x80000000:0));
 						cptr = &(c->next);
-						c->state = CH_TOBEDELETED;
 					}
 				} else {
-					hdd_report_new_chunk(c->chunkid,c->version|((c->todel)?0x80000000:0));
 					cptr = &(c->next);
 				}
-			} else {
-				cptr = &(c->next);
 			}
 		}
+		zassert(pthread_mutex_unlock(&testlock));
+		zassert(pthread_mutex_unlock(&(hs->lock)));
 	}
-	zassert(pthread_mutex_unlock(&testlock));
-	zassert(pthread_mutex_unlock(&hashlock));
 }
 
 void* hdd_folder_scan(void *arg);
@@ -1250,6 +1569,7 @@ void hdd_check_folders() {
 		if (f->toremove) {
 			switch (f->scanstate) {
 			case SCST_SCANINPROGRESS:
+			case SCST_VERIFYING:
 				f->scanstate = SCST_SCANTERMINATE;
 				break;
 			case SCST_SCANFINISHED:
@@ -1271,6 +1591,9 @@ void hdd_check_folders() {
 				if (f->lfd>=0) {
 					close(f->lfd);
 				}
+				hdd_disktab_remove(f);
+				zassert(pthread_cond_destroy(&(f->fsynccond)));
+				zassert(pthread_mutex_destroy(&(f->fsynclock)));
 				free(f->path);
 				free(f);
 				testerreset = 1;
@@ -1306,6 +1629,14 @@ void hdd_check_folders() {
 			f->lastrefresh = now;
 			changed = 1;
 			break;
+		case SCST_VERIFYING:	// scan thread still adds and removes chunks - only refresh usage
+			if (f->needrefresh || f->lastrefresh+60<now) {
+				hdd_refresh_usage(f);
+				f->needrefresh = 0;
+				f->lastrefresh = now;
+				changed = 1;
+			}
+			break;
 		case SCST_WORKING:
 			err = 0;
 			for (i=0 ; i<LASTERRSIZE; i++) {
@@ -1360,30 +1691,96 @@ static inline void hdd_error_occured(chunk *c) {
 	errno = errmem;
 }
 
+static inline uint64_t get_usectime() {
+	struct timeval tv;
+	gettimeofday(&tv,NULL);
+	return ((uint64_t)(tv.tv_sec))*1000000+tv.tv_usec;
+}
+
+/* writes whole blocks collected by hdd_write (chunk is locked by caller) ; on error also sets wberror - so writer gets it from next hdd_write, hdd_flush or close */
+static int hdd_chunk_flush(chunk *c) {
+	uint32_t size;
+	uint64_t ts,te;
+	int ret;
+
+	if (c->wbblocks==0) {
+		return STATUS_OK;
+	}
+	size = ((uint32_t)(c->wbblocks))<<MFSBLOCKBITS;
+	ts = get_usectime();
+#ifdef USE_PIO
+	ret = pwrite(c->fd,c->wbuff,size,CHUNKHDRSIZE+(((uint32_t)(c->wbfirst))<<MFSBLOCKBITS));
+#else /* USE_PIO */
+	lseek(c->fd,CHUNKHDRSIZE+(((uint32_t)(c->wbfirst))<<MFSBLOCKBITS),SEEK_SET);
+	ret = write(c->fd,c->wbuff,size);
+#endif /* USE_PIO */
+	te = get_usectime();
+	hdd_stats_datawrite(c->owner,size,te-ts);
+	hdd_stats_writebatch(c->wbblocks);
+	c->wbblocks = 0;
+	if (ret!=(int)size) {
+		int errmem = errno;
+		mfs_arg_errlog_silent(LOG_WARNING,"hdd_chunk_flush: file:%s - write error",c->filename);
+		errno = errmem;
+		c->wberror = 1;
+		return ERROR_IO;
+	}
+	return STATUS_OK;
+}
+
+/* for operations which need blocks collected by hdd_write in chunk file - on error chunk is reported as damaged and released (caller returns ERROR_IO) */
+static int hdd_chunk_flush_or_release(chunk *c) {
+	if (hdd_chunk_flush(c)==STATUS_OK) {
+		return STATUS_OK;
+	}
+	hdd_error_occured(c);	// uses and preserves errno !!!
+	hdd_report_damaged_chunk(c->chunkid);
+	hdd_chunk_release(c);
+	return ERROR_IO;
+}
+
+static inline chunk* hdd_chunk_find(uint64_t chunkid) {
+	return hdd_chunk_get(chunkid,CH_NEW_NONE);
+}
+
 
 /* interface */
 
 #define CHUNKS_CUT_COUNT 10000
+static uint32_t hdd_get_chunks_shard;
 static uint32_t hdd_get_chunks_pos;
 
+// whole index is locked (shards in ascending order) for the time of sending chunk list
 void hdd_get_chunks_begin() {
-	zassert(pthread_mutex_lock(&hashlock));
+	uint32_t s;
+	for (s=0 ; s<HASHSHARDS ; s++) {
+		zassert(pthread_mutex_lock(&(hashshards[s].lock)));
+	}
+	hdd_get_chunks_shard = 0;
 	hdd_get_chunks_pos = 0;
 }
 
 void hdd_get_chunks_end() {
-	zassert(pthread_mutex_unlock(&hashlock));
+	uint32_t s;
+	for (s=HASHSHARDS ; s>0 ; s--) {
+		zassert(pthread_mutex_unlock(&(hashshards[s-1].lock)));
+	}
 }
 
 uint32_t hdd_get_chunks_next_list_count() {
 	uint32_t res = 0;
-	uint32_t i = 0;
+	uint32_t s = hdd_get_chunks_shard;
+	uint32_t i = hdd_get_chunks_pos;
 	chunk *c;
-	while (res<CHUNKS_CUT_COUNT && hdd_get_chunks_pos+i<HASHSIZE) {
-		for (c=hashtab[hdd_get_chunks_pos+i] ; c ; c=c->next) {
+	while (res<CHUNKS_CUT_COUNT && s<HASHSHARDS) {
+		for (c=hashshards[s].tab[i] ; c ; c=c->next) {
 			res++;
 		}
 		i++;
+		if (i>=hashshards[s].size) {
+			s++;
+			i = 0;
+		}
 	}
 	return res;
 }
@@ -1392,8 +1789,8 @@ void hdd_get_chunks_next_list_data(uint8_t *buff) {
 	uint32_t res = 0;
 	uint32_t v;
 	chunk *c;
-	while (res<CHUNKS_CUT_COUNT && hdd_get_chunks_pos<HASHSIZE) {
-		for (c=hashtab[hdd_get_chunks_pos] ; c ; c=c->next) {
+	while (res<CHUNKS_CUT_COUNT && hdd_get_chunks_shard<HASHSHARDS) {
+		for (c=hashshards[hdd_get_chunks_shard].tab[hdd_get_chunks_pos] ; c ; c=c->next) {
 			put64bit(&buff,c->chunkid);
 			v = c->version;
 			if (c->todel) {
@@ -1403,6 +1800,10 @@ void hdd_get_chunks_next_list_data(uint8_t *buff) {
 			res++;
 		}
 		hdd_get_chunks_pos++;
+		if (hdd_get_chunks_pos>=hashshards[hdd_get_chunks_shard].size) {
+			hdd_get_chunks_shard++;
+			hdd_get_chunks_pos = 0;
+		}
 	}
 }
 
@@ -1419,13 +1820,13 @@ void hdd_get_space(uint64_t *usedspace,uint64_t *totalspace,uint32_t *chunkcount
 			continue;
 		}
 		if (f->todel==0) {
-			if (f->scanstate==SCST_WORKING) {
+			if (f->scanstate==SCST_WORKING || f->scanstate==SCST_VERIFYING) {
 				avail += f->avail;
 				total += f->total;
 			}
 			chunks += f->chunkcount;
 		} else {
-			if (f->scanstate==SCST_WORKING) {
+			if (f->scanstate==SCST_WORKING || f->scanstate==SCST_VERIFYING) {
 				tdavail += f->avail;
 				tdtotal += f->total;
 			}
@@ -1522,6 +1923,10 @@ static inline void chunk_freecrc(chunk *c) {
 	free(c->crc);
 #endif
 	c->crc = NULL;
+	if (c->vblocks!=NULL) {	// checked against this crc table
+		free(c->vblocks);
+		c->vblocks = NULL;
+	}
 }
 
 static inline int chunk_writecrc(chunk *c) {
@@ -1545,187 +1950,176 @@ static inline int chunk_writecrc(chunk *c) {
 	return STATUS_OK;
 }
 
+static void hdd_hash_init(void) {
+	uint32_t s;
+	for (s=0 ; s<HASHSHARDS ; s++) {
+		zassert(pthread_mutex_init(&(hashshards[s].lock),NULL));
+		hashshards[s].tab = (chunk**) calloc(HASHSHARDINITSIZE,sizeof(chunk*));
+		passert(hashshards[s].tab);
+		hashshards[s].size = HASHSHARDINITSIZE;
+		hashshards[s].count = 0;
+		hashshards[s].cclist = NULL;
+	}
+}
+
+void hdd_test_index_init(void) {
+	hdd_hash_init();
+}
+
+void hdd_test_chunk_add(uint64_t chunkid,uint32_t version) {
+	chunk *c;
+	c = hdd_chunk_get(chunkid,CH_NEW_AUTO);
+	if (c!=NULL) {
+		c->version = version;
+		c->validattr = 1;	// there is no file to stat
+		hdd_chunk_release(c);
+	}
+}
+
+int hdd_test_chunk_find_release(uint64_t chunkid) {
+	chunk *c;
+	c = hdd_chunk_find(chunkid);
+	if (c==NULL) {
+		return 0;
+	}
+	hdd_chunk_release(c);
+	return 1;
+}
+
 void hdd_test_show_chunks(void) {
-	uint32_t hashpos;
+	uint32_t s,hashpos;
 	chunk *c;
-	zassert(pthread_mutex_lock(&hashlock));
-	for (hashpos=0 ; hashpos<HASHSIZE ; hashpos++) {
-		for (c=hashtab[hashpos] ; c ; c=c->next) {
-			printf("chunk id:%" PRIu64 " version:%" PRIu32 " state:%" PRIu8 "\n",c->chunkid,c->version,c->state);
+	for (s=0 ; s<HASHSHARDS ; s++) {
+		zassert(pthread_mutex_lock(&(hashshards[s].lock)));
+		for (hashpos=0 ; hashpos<hashshards[s].size ; hashpos++) {
+			for (c=hashshards[s].tab[hashpos] ; c ; c=c->next) {
+				printf("chunk id:%" PRIu64 " version:%" PRIu32 " state:%" PRIu8 "\n",c->chunkid,c->version,c->state);
+			}
 		}
+		zassert(pthread_mutex_unlock(&(hashshards[s].lock)));
 	}
-	zassert(pthread_mutex_unlock(&hashlock));
 }
 
 void hdd_test_show_openedchunks(void) {
-	dopchunk *cc,*tcc;
-	uint32_t dhashpos;
+	uint8_t list;
 	chunk *c;
 
-	printf("lock doplock\n");
-	if (pthread_mutex_lock(&doplock)<0) {
+	printf("lock lrulock\n");
+	if (pthread_mutex_lock(&lrulock)<0) {
 		printf("lock error: %u\n",errno);
 	}
-	printf("lock ndoplock\n");
-	if (pthread_mutex_lock(&ndoplock)<0) {
-		printf("lock error: %u\n",errno);
-	}
-/* append new chunks */
-	cc = newdopchunks;
-	while (cc) {
-		dhashpos = DHASHPOS(cc->chunkid);
-		for (tcc=dophashtab[dhashpos] ; tcc && tcc->chunkid!=cc->chunkid ; tcc=tcc->next) {}
-		if (tcc) {	// found - ignore
-			tcc = cc;
-			cc = cc->next;
-			free(tcc);
-		} else {	// not found - add
-			tcc = cc;
-			cc = cc->next;
-			tcc->next = dophashtab[dhashpos];
-			dophashtab[dhashpos] = tcc;
-		}
-	}
-	newdopchunks = NULL;
-	printf("unlock ndoplock\n");
-	if (pthread_mutex_unlock(&ndoplock)<0) {
-		printf("unlock error: %u\n",errno);
-	}
-/* show all */
-	for (dhashpos=0 ; dhashpos<DHASHSIZE ; dhashpos++) {
-		for (cc=dophashtab[dhashpos]; cc ; cc=cc->next) {
-			c = hdd_chunk_find(cc->chunkid);
-			if (c==NULL) {	// no chunk - delete entry
-				printf("id: %" PRIu64 " - chunk doesn't exist\n",cc->chunkid);
-			} else if (c->crcrefcount>0) {	// io in progress - skip entry
-				printf("id: %" PRIu64 " - chunk in use (refcount:%u)\n",cc->chunkid,c->crcrefcount);
-				hdd_chunk_release(c);
-			} else {
-#ifdef PRESERVE_BLOCK
-				printf("id: %" PRIu64 " - fd:%d (steps:%u) crc:%p (steps:%u) block:%p,blockno:%u (steps:%u)\n",cc->chunkid,c->fd,c->opensteps,c->crc,c->crcsteps,c->block,c->blockno,c->blocksteps);
-#else /* PRESERVE_BLOCK */
-				printf("id: %" PRIu64 " - fd:%d (steps:%u) crc:%p (steps:%u)\n",cc->chunkid,c->fd,c->opensteps,c->crc,c->crcsteps);
-#endif /* PRESERVE_BLOCK */
-				hdd_chunk_release(c);
-			}
+	printf("cache size: %" PRIu64 " (limit: %" PRIu64 ") ; descriptors: %" PRIu32 " (limit: %" PRIu32 ")\n",lrusize,CrcCacheSize,lrufds,FdCacheMax);
+/* show all (oldest first) - chunks in cache are not used, so they can be shown without locking them */
+	for (list=LRU_FD ; list<=LRU_CRC ; list++) {
+		for (c=lruhead[list] ; c ; c=c->lrunext) {
+			printf("id: %" PRIu64 " - fd:%d crc:%p\n",c->chunkid,c->fd,c->crc);
 		}
 	}
-	printf("unlock doplock\n");
-	if (pthread_mutex_unlock(&doplock)<0) {
+	printf("unlock lrulock\n");
+	if (pthread_mutex_unlock(&lrulock)<0) {
 		printf("unlock error: %u\n",errno);
 	}
 }
 
-void hdd_delayed_ops() {
-	dopchunk **ccp,*cc,*tcc;
-	uint32_t dhashpos;
+/* idle chunk cache - chunks with crcrefcount==0 keep their crc table (and descriptor) ; chunks with descriptor are on LRU_FD list (at most FdCacheMax of them), when descriptor is closed chunk goes to LRU_CRC list ; whole cache is limited to CrcCacheSize bytes (oldest crc-only chunks are freed first) */
+
+// chunk has to be locked and not used
+static void hdd_lru_add(chunk *c) {
+	if (c->fd<0 && c->crc==NULL) {
+		return;
+	}
+	zassert(pthread_mutex_lock(&lrulock));
+	hdd_lru_append(c,(c->fd>=0)?LRU_FD:LRU_CRC);
+	zassert(pthread_mutex_unlock(&lrulock));
+}
+
+/* frees resources of oldest chunks until cache fits its limits ; busy chunks are moved to the end of their list and skipped (at most 'maxskip' of them) */
+static void hdd_lru_trim(uint32_t maxskip) {
 	chunk *c;
-	zassert(pthread_mutex_lock(&doplock));
-	zassert(pthread_mutex_lock(&ndoplock));
-/* append new chunks */
-	cc = newdopchunks;
-	while (cc) {
-		dhashpos = DHASHPOS(cc->chunkid);
-		for (tcc=dophashtab[dhashpos] ; tcc && tcc->chunkid!=cc->chunkid ; tcc=tcc->next) {}
-		if (tcc) {	// found - ignore
-			tcc = cc;
-			cc = cc->next;
-			free(tcc);
-		} else {	// not found - add
-			tcc = cc;
-			cc = cc->next;
-			tcc->next = dophashtab[dhashpos];
-			dophashtab[dhashpos] = tcc;
-		}
-	}
-	newdopchunks = NULL;
-	zassert(pthread_mutex_unlock(&ndoplock));
-/* check all */
-	for (dhashpos=0 ; dhashpos<DHASHSIZE ; dhashpos++) {
-		ccp = dophashtab+dhashpos;
-		while ((cc=*ccp)) {
-//			printf("find chunk: %llu\n",cc->chunkid);
-			c = hdd_chunk_tryfind(cc->chunkid);
-//			if (c!=NULL && c!=CHUNKLOCKED) {
-//				printf("found chunk: %llu (c->state:%u c->crcrefcount:%u)\n",cc->chunkid,c->state,c->crcrefcount);
-//			}
-			if (c==NULL) {	// no chunk - delete entry
-				*ccp = cc->next;
-				free(cc);
-			} else if (c==CHUNKLOCKED) {	// locked chunk - just ignore
-				ccp = &(cc->next);
-			} else if (c->crcrefcount>0) {	// io in progress - skip entry
-				hdd_chunk_release(c);
-				ccp = &(cc->next);
-			} else {
-#ifdef PRESERVE_BLOCK
-				if (c->blocksteps>0) {
-					c->blocksteps--;
-				} else if (c->block!=NULL) {
-# ifdef MMAP_ALLOC
-					munmap((void*)(c->block),MFSBLOCKSIZE);
-# else
-					free(c->block);
-# endif
-					c->block = NULL;
-					c->blockno = 0xFFFF;
-				}
-#endif /* PRESERVE_BLOCK */
-				if (c->opensteps>0) {	// decrease counter
-					c->opensteps--;
-				} else if (c->fd>=0) {	// close descriptor
-					if (close(c->fd)<0) {
-						hdd_error_occured(c);	// uses and preserves errno !!!
-						mfs_arg_errlog_silent(LOG_WARNING,"hdd_delayed_ops: file:%s - close error",c->filename);
-						hdd_report_damaged_chunk(c->chunkid);
-					}
-					c->fd = -1;
-				}
-				if (c->crcsteps>0) {	// decrease counter
-					c->crcsteps--;
-				} else if (c->crc!=NULL) {	// free crc block
-					if (c->crcchanged) {
-						syslog(LOG_ERR,"serious error: crc changes lost (chunk:%016" PRIX64 "_%08" PRIX32 ")",c->chunkid,c->version);
-					}
-//					printf("chunk %llu - free crc record\n",c->chunkid);
-					chunk_freecrc(c);
+	uint64_t chunkid;
+	uint8_t list,closefd,freecrc;
+
+	for (;;) {
+		zassert(pthread_mutex_lock(&lrulock));
+		if (lrusize>CrcCacheSize && (lruhead[LRU_CRC] || lruhead[LRU_FD])) {
+			list = (lruhead[LRU_CRC])?LRU_CRC:LRU_FD;
+		} else if (lrufds>FdCacheMax && lruhead[LRU_FD]) {
+			list = LRU_FD;
+		} else {
+			zassert(pthread_mutex_unlock(&lrulock));
+			return;
+		}
+		// chunk can't be locked here (lock order), so take it from the head and lock it by id
+		c = lruhead[list];
+		chunkid = c->chunkid;
+		hdd_lru_detach(c);
+		hdd_lru_append(c,list);
+		zassert(pthread_mutex_unlock(&lrulock));
+		c = hdd_chunk_tryfind(chunkid);
+		if (c==NULL || c==CHUNKLOCKED) {
+			if (maxskip==0) {
+				return;
+			}
+			maxskip--;
+			continue;
+		}
+		closefd = 0;
+		freecrc = 0;
+		if (c->crcrefcount==0) {	// still idle
+			zassert(pthread_mutex_lock(&lrulock));
+			if (c->lrulist!=LRU_NONE && lrusize>CrcCacheSize) {
+				hdd_lru_detach(c);
+				closefd = 1;
+				freecrc = 1;
+			} else if (c->lrulist==LRU_FD && lrufds>FdCacheMax) {
+				hdd_lru_detach(c);
+				if (c->crc!=NULL) {
+					hdd_lru_append(c,LRU_CRC);
 				}
-#ifdef PRESERVE_BLOCK
-				if (c->fd<0 && c->crc==NULL && c->block==NULL) {
-#else /* PRESERVE_BLOCK */
-				if (c->fd<0 && c->crc==NULL) {
-#endif /* PRESERVE_BLOCK */
-					*ccp = cc->next;
-					free(cc);
-				} else {
-					ccp = &(cc->next);
+				closefd = 1;
+			}
+			zassert(pthread_mutex_unlock(&lrulock));
+		}
+		if (closefd) {
+			if (c->fd>=0) {
+				if (close(c->fd)<0) {
+					hdd_error_occured(c);	// uses and preserves errno !!!
+					mfs_arg_errlog_silent(LOG_WARNING,"hdd_lru_trim: file:%s - close error",c->filename);
+					hdd_report_damaged_chunk(c->chunkid);
 				}
-				hdd_chunk_release(c);
+				c->fd = -1;
+			}
+		}
+		if (freecrc && c->crc!=NULL) {
+			if (c->crcchanged) {
+				syslog(LOG_ERR,"serious error: crc changes lost (chunk:%016" PRIX64 "_%08" PRIX32 ")",c->chunkid,c->version);
 			}
+			chunk_freecrc(c);
 		}
+		hdd_chunk_release(c);
 	}
-	zassert(pthread_mutex_unlock(&doplock));
 }
 
-static inline uint64_t get_usectime() {
-	struct timeval tv;
-	gettimeofday(&tv,NULL);
-	return ((uint64_t)(tv.tv_sec))*1000000+tv.tv_usec;
+void hdd_delayed_ops() {
+	uint32_t entries;
+	zassert(pthread_mutex_lock(&lrulock));
+	entries = lrufds + (lrusize - (uint64_t)lrufds*LRUFDCOST) / LRUCRCCOST;
+	zassert(pthread_mutex_unlock(&lrulock));
+	hdd_lru_trim(entries);
 }
 
 static int hdd_io_begin(chunk *c,int newflag) {
-	dopchunk *cc;
 	int status;
-	int add;
+	int opened;
 
 //	syslog(LOG_NOTICE,"chunk: %" PRIu64 " - before io",c->chunkid);
 	hdd_chunk_testmove(c);
 	if (c->crcrefcount==0) {
-#ifdef PRESERVE_BLOCK
-		add = (c->fd<0 && c->crc==NULL && c->block==NULL);
-#else /* PRESERVE_BLOCK */
-		add = (c->fd<0 && c->crc==NULL);
-#endif /* PRESERVE_BLOCK */
+		hdd_lru_remove(c);
+		if (newflag==0) {
+			hdd_stats_crccache(c->crc!=NULL);
+		}
+		opened = 0;
 		if (c->fd<0) {
 			if (newflag) {
 				c->fd = open(c->filename,O_RDWR | O_TRUNC | O_CREAT,0666);
@@ -1740,8 +2134,10 @@ static int hdd_io_begin(chunk *c,int newflag) {
 				int errmem = errno;
 				mfs_arg_errlog_silent(LOG_WARNING,"hdd_io_begin: file:%s - open error",c->filename);
 				errno = errmem;
+				hdd_lru_add(c);
 				return ERROR_IO;
 			}
+			opened = 1;
 		}
 		if (c->crc==NULL) {
 			if (newflag) {
@@ -1750,10 +2146,11 @@ static int hdd_io_begin(chunk *c,int newflag) {
 				status = chunk_readcrc(c);
 				if (status!=STATUS_OK) {
 					int errmem = errno;
-					if (add) {
+					if (opened) {
 						close(c->fd);
 						c->fd=-1;
 					}
+					hdd_lru_add(c);
 					mfs_arg_errlog_silent(LOG_WARNING,"hdd_io_begin: file:%s - read error",c->filename);
 					errno = errmem;
 					return status;
@@ -1761,38 +2158,72 @@ static int hdd_io_begin(chunk *c,int newflag) {
 			}
 			c->crcchanged = 0;
 		}
-#ifdef PRESERVE_BLOCK
-		if (c->block==NULL) {
-# ifdef MMAP_ALLOC
-			c->block = (uint8_t*)mmap(NULL,MFSBLOCKSIZE,PROT_READ | PROT_WRITE, MAP_ANON | MAP_PRIVATE,-1,0);
-# else
-			c->block = (uint8_t*)malloc(MFSBLOCKSIZE);
-# endif
-//			syslog(LOG_WARNING,"chunk: %016" PRIX64 ", block:%p",c->chunkid,c->block);
-			passert(c->block);
-			c->blockno = 0xFFFF;
-		}
-#endif /* PRESERVE_BLOCK */
-		if (add) {
-			cc = (dopchunk*) malloc(sizeof(dopchunk));
-			passert(cc);
-			cc->chunkid = c->chunkid;
-			zassert(pthread_mutex_lock(&ndoplock));
-			cc->next = newdopchunks;
-			newdopchunks = cc;
-			zassert(pthread_mutex_unlock(&ndoplock));
-		}
 	}
 	c->crcrefcount++;
 	errno = 0;
 	return STATUS_OK;
 }
 
+/* group fsync - chunks closed on the same folder within FsyncWindow are synced by one thread (the first one) while others wait for the result ; one fsync makes the filesystem commit its journal, so the following ones are cheap */
+static int hdd_group_fsync(folder *f,int fd) {
+	fsyncreq r,*rp,*rn,*batch;
+	uint32_t n;
+	uint64_t ts,te;
+
+	r.fd = fd;
+	r.status = 0;
+	r.errornumber = 0;
+	r.done = 0;
+	zassert(pthread_mutex_lock(&(f->fsynclock)));
+	r.next = f->fsynchead;
+	f->fsynchead = &r;
+	while (r.done==0) {
+		if (f->fsyncleader==0) {
+			f->fsyncleader = 1;
+			zassert(pthread_mutex_unlock(&(f->fsynclock)));
+			usleep(FsyncWindow);
+			zassert(pthread_mutex_lock(&(f->fsynclock)));
+			batch = f->fsynchead;
+			f->fsynchead = NULL;
+			zassert(pthread_mutex_unlock(&(f->fsynclock)));
+			n = 0;
+			ts = get_usectime();
+			for (rp=batch ; rp ; rp=rp->next) {
+#ifdef F_FULLFSYNC
+				rp->status = fcntl(rp->fd,F_FULLFSYNC);
+#else
+				rp->status = fsync(rp->fd);
+#endif
+				rp->errornumber = errno;
+				n++;
+			}
+			te = get_usectime();
+			hdd_stats_datafsync(f,te-ts);
+			hdd_stats_fsyncbatch(n);
+			zassert(pthread_mutex_lock(&(f->fsynclock)));
+			for (rp=batch ; rp ; rp=rn) {
+				rn = rp->next;
+				rp->done = 1;
+			}
+			f->fsyncleader = 0;
+			zassert(pthread_cond_broadcast(&(f->fsynccond)));
+		} else {
+			zassert(pthread_cond_wait(&(f->fsynccond),&(f->fsynclock)));
+		}
+	}
+	zassert(pthread_mutex_unlock(&(f->fsynclock)));
+	errno = r.errornumber;
+	return r.status;
+}
+
 static int hdd_io_end(chunk *c) {
-	int status;
+	int status,wbstatus;
 	uint64_t ts,te;
 
 //	syslog(LOG_NOTICE,"chunk: %" PRIu64 " - after io",c->chunkid);
+	hdd_chunk_flush(c);
+	wbstatus = (c->wberror)?ERROR_IO:STATUS_OK;
+	c->wberror = 0;
 	if (c->crcchanged) {
 		status = chunk_writecrc(c);
 		c->crcchanged = 0;
@@ -1802,46 +2233,47 @@ static int hdd_io_end(chunk *c) {
 			errno = errmem;
 			return status;
 		}
-		ts = get_usectime();
+		if (FsyncWindow>0) {
+			if (hdd_group_fsync(c->owner,c->fd)<0) {
+				int errmem = errno;
+				mfs_arg_errlog_silent(LOG_WARNING,"hdd_io_end: file:%s - group fsync error",c->filename);
+				errno = errmem;
+				return ERROR_IO;
+			}
+		} else {
+			ts = get_usectime();
 #ifdef F_FULLFSYNC
-		if (fcntl(c->fd,F_FULLFSYNC)<0) {
-			int errmem = errno;
-			mfs_arg_errlog_silent(LOG_WARNING,"hdd_io_end: file:%s - fsync (via fcntl) error",c->filename);
-			errno = errmem;
-			return ERROR_IO;
-		}
+			if (fcntl(c->fd,F_FULLFSYNC)<0) {
+				int errmem = errno;
+				mfs_arg_errlog_silent(LOG_WARNING,"hdd_io_end: file:%s - fsync (via fcntl) error",c->filename);
+				errno = errmem;
+				return ERROR_IO;
+			}
 #else
-		if (fsync(c->fd)<0) {
-			int errmem = errno;
-			mfs_arg_errlog_silent(LOG_WARNING,"hdd_io_end: file:%s - fsync (direct call) error",c->filename);
-			errno = errmem;
-			return ERROR_IO;
-		}
-#endif
-		te = get_usectime();
-		hdd_stats_datafsync(c->owner,te-ts);
-	}
-	c->crcrefcount--;
-	if (c->crcrefcount==0) {
-		if (OPENSTEPS==0) {
-			if (close(c->fd)<0) {
+			if (fsync(c->fd)<0) {
 				int errmem = errno;
-				c->fd = -1;
-				mfs_arg_errlog_silent(LOG_WARNING,"hdd_io_end: file:%s - close error",c->filename);
+				mfs_arg_errlog_silent(LOG_WARNING,"hdd_io_end: file:%s - fsync (direct call) error",c->filename);
 				errno = errmem;
 				return ERROR_IO;
 			}
-			c->fd = -1;
-		} else {
-			c->opensteps = OPENSTEPS;
-		}
-		c->crcsteps = CRCSTEPS;
-#ifdef PRESERVE_BLOCK
-		c->blocksteps = PRESERVESTEPS;
 #endif
+			te = get_usectime();
+			hdd_stats_datafsync(c->owner,te-ts);
+		}
+	}
+	c->crcrefcount--;
+	if (c->crcrefcount==0) {
+		c->wopen = 0;
+		if (c->wbuff!=NULL) {
+			free(c->wbuff);
+			c->wbuff = NULL;
+			c->wbsize = 0;
+		}
+		hdd_lru_add(c);
+		hdd_lru_trim(LRUTRIMSTEPS);
 	}
 	errno = 0;
-	return STATUS_OK;
+	return wbstatus;
 }
 
 /* I/O operations */
@@ -1884,25 +2316,84 @@ int hdd_close(uint64_t chunkid) {
 	return status;
 }
 
+/* called after reading 'blocks' blocks from 'blocknum' (chunk has to be locked) ; when reader goes through the chunk sequentially and the block cache missed, next ReadAheadBlocks blocks (up to the first block which is already in cache) are scheduled for hdd_readahead */
+static void hdd_readahead_plan(chunk *c,uint16_t blocknum,uint16_t blocks,uint8_t miss) {
+	uint16_t first,rablocks,i;
+	uint8_t seq;
+
+	seq = (blocknum==c->rdnext)?1:0;
+	c->rdnext = blocknum+blocks;
+	c->rablocks = 0;
+	if (seq==0 || miss==0 || ReadAheadBlocks==0 || bcache_enabled()==0) {
+		return;
+	}
+	first = blocknum+blocks;
+	if (first>=c->blocks) {
+		return;
+	}
+	rablocks = c->blocks-first;
+	if (rablocks>ReadAheadBlocks) {
+		rablocks = ReadAheadBlocks;
+	}
+	for (i=0 ; i<rablocks && bcache_contains(c->chunkid,c->version,first+i)==0 ; i++) {}
+	c->rafirst = first;
+	c->rablocks = i;
+}
+
+void hdd_readahead(uint64_t chunkid) {
+	chunk *c;
+	uint8_t *rabuffer;
+	const uint8_t *rcrcptr;
+	uint16_t first,rablocks,i;
+	uint64_t ts,te;
+	ssize_t ret;
+
+	c = hdd_chunk_find(chunkid);
+	if (c==NULL) {
+		return;
+	}
+	first = c->rafirst;
+	rablocks = c->rablocks;
+	c->rablocks = 0;
+	// reader has already closed the chunk or it is being written - blocks wouldn't be used or could be changed
+	if (rablocks==0 || c->crcrefcount==0 || c->fd<0 || c->wopen || first+rablocks>c->blocks) {
+		hdd_chunk_release(c);
+		return;
+	}
+	rabuffer = (uint8_t*)malloc(((uint32_t)rablocks)<<MFSBLOCKBITS);
+	passert(rabuffer);
+	ts = get_usectime();
+#ifdef USE_PIO
+	ret = pread(c->fd,rabuffer,((uint32_t)rablocks)<<MFSBLOCKBITS,CHUNKHDRSIZE+(((uint32_t)first)<<MFSBLOCKBITS));
+#else /* USE_PIO */
+	lseek(c->fd,CHUNKHDRSIZE+(((uint32_t)first)<<MFSBLOCKBITS),SEEK_SET);
+	ret = read(c->fd,rabuffer,((uint32_t)rablocks)<<MFSBLOCKBITS);
+#endif /* USE_PIO */
+	te = get_usectime();
+	hdd_stats_dataread(c->owner,((uint32_t)rablocks)<<MFSBLOCKBITS,te-ts);
+	// errors are not reported here - client will get them when it reads these blocks
+	if (ret==(ssize_t)(((uint32_t)rablocks)<<MFSBLOCKBITS)) {
+		rcrcptr = (c->crc)+(4*first);
+		for (i=0 ; i<rablocks ; i++) {
+			if (get32bit(&rcrcptr)!=mycrc32(0,rabuffer+(((uint32_t)i)<<MFSBLOCKBITS),MFSBLOCKSIZE)) {
+				break;
+			}
+			bcache_put(c->chunkid,c->version,first+i,rabuffer+(((uint32_t)i)<<MFSBLOCKBITS),1);
+		}
+	}
+	hdd_chunk_release(c);
+	free(rabuffer);
+}
+
 int hdd_read(uint64_t chunkid,uint32_t version,uint16_t blocknum,uint8_t *buffer,uint32_t offset,uint32_t size,uint8_t *crcbuff) {
 	chunk *c;
 	int ret;
+	uint8_t hit;
 	const uint8_t *rcrcptr;
 	uint32_t crc,bcrc,precrc,postcrc,combinedcrc;
 	uint64_t ts,te;
-#ifndef PRESERVE_BLOCK
 	uint8_t *blockbuffer;
-	blockbuffer = pthread_getspecific(blockbufferkey);
-	if (blockbuffer==NULL) {
-# ifdef MMAP_ALLOC
-		blockbuffer = mmap(NULL,MFSBLOCKSIZE,PROT_READ | PROT_WRITE, MAP_ANON | MAP_PRIVATE,-1,0);
-# else
-		blockbuffer = malloc(MFSBLOCKSIZE);
-# endif
-		passert(blockbuffer);
-		zassert(pthread_setspecific(blockbufferkey,blockbuffer));
-	}
-#endif /* PRESERVE_BLOCK */
+	blockbuffer = hdd_get_blockbuffer();
 	c = hdd_chunk_find(chunkid);
 	if (c==NULL) {
 		return ERROR_NOCHUNK;
@@ -1911,6 +2402,9 @@ int hdd_read(uint64_t chunkid,uint32_t version,uint16_t blocknum,uint8_t *buffer
 		hdd_chunk_release(c);
 		return ERROR_WRONGVERSION;
 	}
+	if (hdd_chunk_flush_or_release(c)!=STATUS_OK) {	// blocks collected by hdd_write have to be in file
+		return ERROR_IO;
+	}
 	if (blocknum>=MFSBLOCKSINCHUNK) {
 		hdd_chunk_release(c);
 		return ERROR_BNUMTOOBIG;
@@ -1934,13 +2428,15 @@ int hdd_read(uint64_t chunkid,uint32_t version,uint16_t blocknum,uint8_t *buffer
 		hdd_chunk_release(c);
 		return STATUS_OK;
 	}
-	if (offset==0 && size==MFSBLOCKSIZE) {
-#ifdef PRESERVE_BLOCK
-		if (c->blockno==blocknum) {
-			memcpy(buffer,c->block,MFSBLOCKSIZE);
-			ret = MFSBLOCKSIZE;
+	hit = bcache_get(chunkid,c->version,blocknum,buffer,offset,size);
+	if (hit) {
+		if (size==MFSBLOCKSIZE) {
+			rcrcptr = (c->crc)+(4*blocknum);
+			crc = get32bit(&rcrcptr);
 		} else {
-#endif /* PRESERVE_BLOCK */
+			crc = mycrc32(0,buffer,size);
+		}
+	} else if (offset==0 && size==MFSBLOCKSIZE) {
 		ts = get_usectime();
 #ifdef USE_PIO
 		ret = pread(c->fd,buffer,MFSBLOCKSIZE,CHUNKHDRSIZE+(((uint32_t)blocknum)<<MFSBLOCKBITS));
@@ -1950,11 +2446,6 @@ int hdd_read(uint64_t chunkid,uint32_t version,uint16_t blocknum,uint8_t *buffer
 #endif /* USE_PIO */
 		te = get_usectime();
 		hdd_stats_dataread(c->owner,MFSBLOCKSIZE,te-ts);
-#ifdef PRESERVE_BLOCK
-			c->blockno = blocknum;
-			memcpy(c->block,buffer,MFSBLOCKSIZE);
-		}
-#endif /* PRESERVE_BLOCK */
 		crc = mycrc32(0,buffer,MFSBLOCKSIZE);
 		rcrcptr = (c->crc)+(4*blocknum);
 		bcrc = get32bit(&rcrcptr);
@@ -1973,26 +2464,8 @@ int hdd_read(uint64_t chunkid,uint32_t version,uint16_t blocknum,uint8_t *buffer
 			hdd_chunk_release(c);
 			return ERROR_IO;
 		}
+		bcache_put(chunkid,c->version,blocknum,buffer,0);
 	} else {
-#ifdef PRESERVE_BLOCK
-		if (c->blockno != blocknum) {
-			ts = get_usectime();
-#ifdef USE_PIO
-			ret = pread(c->fd,c->block,MFSBLOCKSIZE,CHUNKHDRSIZE+(((uint32_t)blocknum)<<MFSBLOCKBITS));
-#else /* USE_PIO */
-			lseek(c->fd,CHUNKHDRSIZE+(((uint32_t)blocknum)<<MFSBLOCKBITS),SEEK_SET);
-			ret = read(c->fd,c->block,MFSBLOCKSIZE);
-#endif /* USE_PIO */
-			te = get_usectime();
-			hdd_stats_dataread(c->owner,MFSBLOCKSIZE,te-ts);
-			c->blockno = blocknum;
-		} else {
-			ret = MFSBLOCKSIZE;
-		}
-		precrc = mycrc32(0,c->block,offset);
-		crc = mycrc32(0,c->block+offset,size);
-		postcrc = mycrc32(0,c->block+offset+size,MFSBLOCKSIZE-(offset+size));
-#else /* PRESERVE_BLOCK */
 		ts = get_usectime();
 #ifdef USE_PIO
 		ret = pread(c->fd,blockbuffer,MFSBLOCKSIZE,CHUNKHDRSIZE+(((uint32_t)blocknum)<<MFSBLOCKBITS));
@@ -2006,7 +2479,6 @@ int hdd_read(uint64_t chunkid,uint32_t version,uint16_t blocknum,uint8_t *buffer
 		precrc = mycrc32(0,blockbuffer,offset);
 		crc = mycrc32(0,blockbuffer+offset,size);
 		postcrc = mycrc32(0,blockbuffer+offset+size,MFSBLOCKSIZE-(offset+size));
-#endif /* PRESERVE_BLOCK */
 		if (offset==0) {
 			combinedcrc = mycrc32_combine(crc,postcrc,MFSBLOCKSIZE-(offset+size));
 		} else {
@@ -2032,38 +2504,374 @@ int hdd_read(uint64_t chunkid,uint32_t version,uint16_t blocknum,uint8_t *buffer
 			hdd_chunk_release(c);
 			return ERROR_IO;
 		}
-#ifdef PRESERVE_BLOCK
-		memcpy(buffer,c->block+offset,size);
-#else /* PRESERVE_BLOCK */
+		bcache_put(chunkid,c->version,blocknum,blockbuffer,0);
 		memcpy(buffer,blockbuffer+offset,size);
-#endif /* PRESERVE_BLOCK */
 	}
+	hdd_readahead_plan(c,blocknum,1,hit^1);
 	put32bit(&crcbuff,crc);
 	hdd_chunk_release(c);
 	return STATUS_OK;
 }
 
+int hdd_read_blocks(uint64_t chunkid,uint32_t version,uint16_t blocknum,uint16_t blocks,uint8_t **buffers,uint8_t **crcbuffs) {
+	chunk *c;
+	ssize_t ret;
+	const uint8_t *rcrcptr;
+	uint8_t *crcptr;
+	uint32_t crc,bcrc;
+	uint16_t i,rblocks,cblocks;
+	uint64_t ts,te;
+	struct iovec iov[MFSBLOCKSINCHUNK];
+
+	c = hdd_chunk_find(chunkid);
+	if (c==NULL) {
+		return ERROR_NOCHUNK;
+	}
+	if (c->version!=version && version>0) {
+		hdd_chunk_release(c);
+		return ERROR_WRONGVERSION;
+	}
+	if (hdd_chunk_flush_or_release(c)!=STATUS_OK) {	// blocks collected by hdd_write have to be in file
+		return ERROR_IO;
+	}
+	if (blocks==0 || blocknum>=MFSBLOCKSINCHUNK || blocks>MFSBLOCKSINCHUNK-blocknum) {
+		hdd_chunk_release(c);
+		return ERROR_BNUMTOOBIG;
+	}
+	// blocks behind the end of chunk are read as zeros
+	rblocks = (blocknum>=c->blocks)?0:(c->blocks-blocknum);
+	if (rblocks>blocks) {
+		rblocks = blocks;
+	}
+	for (i=rblocks ; i<blocks ; i++) {
+		memset(buffers[i],0,MFSBLOCKSIZE);
+		crcptr = crcbuffs[i];
+		put32bit(&crcptr,emptyblockcrc);
+	}
+	if (rblocks==0) {
+		hdd_chunk_release(c);
+		return STATUS_OK;
+	}
+	// leading blocks found in block cache are not read from disk
+	for (cblocks=0 ; cblocks<rblocks && bcache_get(chunkid,c->version,blocknum+cblocks,buffers[cblocks],0,MFSBLOCKSIZE) ; cblocks++) {}
+	if (cblocks<rblocks) {
+		for (i=cblocks ; i<rblocks ; i++) {
+			iov[i-cblocks].iov_base = buffers[i];
+			iov[i-cblocks].iov_len = MFSBLOCKSIZE;
+		}
+		ts = get_usectime();
+#ifdef USE_PREADV
+		ret = preadv(c->fd,iov,rblocks-cblocks,CHUNKHDRSIZE+(((uint32_t)(blocknum+cblocks))<<MFSBLOCKBITS));
+#else /* USE_PREADV */
+		lseek(c->fd,CHUNKHDRSIZE+(((uint32_t)(blocknum+cblocks))<<MFSBLOCKBITS),SEEK_SET);
+		ret = readv(c->fd,iov,rblocks-cblocks);
+#endif /* USE_PREADV */
+		te = get_usectime();
+		hdd_stats_dataread(c->owner,((uint32_t)(rblocks-cblocks))<<MFSBLOCKBITS,te-ts);
+		if (ret!=(ssize_t)(((uint32_t)(rblocks-cblocks))<<MFSBLOCKBITS)) {
+			hdd_error_occured(c);	// uses and preserves errno !!!
+			mfs_arg_errlog_silent(LOG_WARNING,"read_blocks_from_chunk: file:%s - read error",c->filename);
+			hdd_report_damaged_chunk(chunkid);
+			hdd_chunk_release(c);
+			return ERROR_IO;
+		}
+	}
+	rcrcptr = (c->crc)+(4*blocknum);
+	for (i=0 ; i<rblocks ; i++) {
+		bcrc = get32bit(&rcrcptr);
+		if (i<cblocks) {
+			crc = bcrc;
+		} else {
+			crc = mycrc32(0,buffers[i],MFSBLOCKSIZE);
+		}
+		if (bcrc!=crc) {
+			errno = 0;
+			hdd_error_occured(c);	// uses and preserves errno !!!
+			syslog(LOG_WARNING,"read_blocks_from_chunk: file:%s - crc error",c->filename);
+			hdd_report_damaged_chunk(chunkid);
+			hdd_chunk_release(c);
+			return ERROR_CRC;
+		}
+		if (i>=cblocks) {
+			bcache_put(chunkid,c->version,blocknum+i,buffers[i],0);
+		}
+		crcptr = crcbuffs[i];
+		put32bit(&crcptr,crc);
+	}
+	hdd_readahead_plan(c,blocknum,rblocks,(cblocks<rblocks)?1:0);
+	hdd_chunk_release(c);
+	return STATUS_OK;
+}
+
+#ifdef __linux__
+/* marks blocks which are (whole) in page cache - others would be read from disk by sendfile */
+static void hdd_blocks_incore(int fd,uint16_t blocknum,uint16_t blocks,uint8_t *incore) {
+	static uint32_t pagesize = 0;
+	unsigned char vec[MFSBLOCKSINCHUNK*(MFSBLOCKSIZE/4096)+1];	// pages of at least 4KiB
+	uint64_t start,moff;
+	uint32_t i,p,pfirst,plast,mleng;
+	void *addr;
+
+	memset(incore,0,blocks);
+	if (pagesize==0) {
+		pagesize = sysconf(_SC_PAGESIZE);
+	}
+	if (pagesize<4096) {
+		return;
+	}
+	start = CHUNKHDRSIZE+(((uint32_t)blocknum)<<MFSBLOCKBITS);
+	moff = start-(start%pagesize);
+	mleng = (start-moff)+(((uint32_t)blocks)<<MFSBLOCKBITS);
+	addr = mmap(NULL,mleng,PROT_READ,MAP_SHARED,fd,moff);
+	if (addr==MAP_FAILED) {
+		return;
+	}
+	if (mincore(addr,mleng,vec)==0) {
+		for (i=0 ; i<blocks ; i++) {
+			pfirst = (start-moff+(i<<MFSBLOCKBITS))/pagesize;
+			plast = (start-moff+((i+1)<<MFSBLOCKBITS)-1)/pagesize;
+			incore[i] = 1;
+			for (p=pfirst ; p<=plast ; p++) {
+				if ((vec[p]&1)==0) {
+					incore[i] = 0;
+					break;
+				}
+			}
+		}
+	}
+	munmap(addr,mleng);
+}
+#endif
+
+int hdd_read_fd(uint64_t chunkid,uint32_t version,uint16_t blocknum,uint16_t *blocks,int *fd,uint64_t *fileoffset,uint8_t *crcbuff) {
+	chunk *c;
+	uint16_t i,rblocks;
+	uint8_t incore[MFSBLOCKSINCHUNK];
+	const uint8_t *rcrcptr;
+	uint32_t crc,bcrc;
+	uint64_t ts,te;
+	int ret;
+	uint8_t *blockbuffer;
+
+	c = hdd_chunk_find(chunkid);
+	if (c==NULL) {
+		return ERROR_NOCHUNK;
+	}
+	if (c->version!=version && version>0) {
+		hdd_chunk_release(c);
+		return ERROR_WRONGVERSION;
+	}
+	if (hdd_chunk_flush_or_release(c)!=STATUS_OK) {	// blocks collected by hdd_write have to be in file
+		return ERROR_IO;
+	}
+	if (*blocks==0 || blocknum>=MFSBLOCKSINCHUNK || *blocks>MFSBLOCKSINCHUNK-blocknum) {
+		hdd_chunk_release(c);
+		return ERROR_BNUMTOOBIG;
+	}
+	if (c->crcrefcount==0 || c->fd<0 || c->crc==NULL) {	// not opened
+		hdd_chunk_release(c);
+		return ERROR_NOTOPENED;
+	}
+	rblocks = (blocknum>=c->blocks)?0:(c->blocks-blocknum);
+	if (rblocks>*blocks) {
+		rblocks = *blocks;
+	}
+	if (c->wopen) {	// chunk is being written - its blocks have to be read together with their crc (under chunk lock)
+		rblocks = 0;
+	}
+	*blocks = rblocks;
+	if (rblocks==0) {
+		hdd_chunk_release(c);
+		return STATUS_OK;
+	}
+	if (c->vblocks==NULL) {
+		c->vblocks = (uint8_t*)malloc(MFSBLOCKSINCHUNK/8);
+		passert(c->vblocks);
+		memset(c->vblocks,0,MFSBLOCKSINCHUNK/8);
+	}
+#ifdef __linux__
+	hdd_blocks_incore(c->fd,blocknum,rblocks,incore);
+#else
+	memset(incore,0,rblocks);
+#endif
+	// blocks never checked and blocks not in page cache are read (and checked) here, so sendfile sends only checked data from memory
+	blockbuffer = hdd_get_blockbuffer();
+	for (i=0 ; i<rblocks ; i++) {
+		if (incore[i] && (c->vblocks[(blocknum+i)>>3]&(1<<((blocknum+i)&7)))) {
+			continue;
+		}
+		ts = get_usectime();
+		ret = pread(c->fd,blockbuffer,MFSBLOCKSIZE,CHUNKHDRSIZE+(((uint32_t)(blocknum+i))<<MFSBLOCKBITS));
+		te = get_usectime();
+		hdd_stats_dataread(c->owner,MFSBLOCKSIZE,te-ts);
+		if (ret!=MFSBLOCKSIZE) {
+			hdd_error_occured(c);	// uses and preserves errno !!!
+			mfs_arg_errlog_silent(LOG_WARNING,"hdd_read_fd: file:%s - read error",c->filename);
+			hdd_report_damaged_chunk(chunkid);
+			hdd_chunk_release(c);
+			return ERROR_IO;
+		}
+		crc = mycrc32(0,blockbuffer,MFSBLOCKSIZE);
+		rcrcptr = (c->crc)+(4*(blocknum+i));
+		bcrc = get32bit(&rcrcptr);
+		if (bcrc!=crc) {
+			errno = 0;
+			hdd_error_occured(c);	// uses and preserves errno !!!
+			syslog(LOG_WARNING,"hdd_read_fd: file:%s - crc error",c->filename);
+			hdd_report_damaged_chunk(chunkid);
+			hdd_chunk_release(c);
+			return ERROR_CRC;
+		}
+		c->vblocks[(blocknum+i)>>3] |= 1<<((blocknum+i)&7);
+	}
+	*fd = dup(c->fd);
+	if (*fd<0) {
+		mfs_errlog_silent(LOG_WARNING,"hdd_read_fd: dup error");
+		hdd_chunk_release(c);
+		return ERROR_IO;
+	}
+	*fileoffset = CHUNKHDRSIZE+(((uint32_t)blocknum)<<MFSBLOCKBITS);
+	memcpy(crcbuff,(c->crc)+(4*blocknum),4*rblocks);
+	hdd_chunk_release(c);
+	return STATUS_OK;
+}
+
+int hdd_sendfile(int sock,int fd,uint64_t *fileoffset,uint32_t *bytes) {
+#if defined(HAVE_SENDFILE) && defined(__linux__)
+	off_t foffset;
+	ssize_t i;
+	int status;
+
+	foffset = *fileoffset;
+	status = STATUS_OK;
+	while (*bytes>0) {
+		i = sendfile(sock,fd,&foffset,*bytes);
+		if (i==0) {
+			syslog(LOG_NOTICE,"(sendfile) unexpected end of chunk file");
+			status = ERROR_IO;
+			break;
+		}
+		if (i<0) {
+			if (errno==EINTR) {
+				continue;
+			}
+			if (errno!=EAGAIN) {
+				mfs_errlog_silent(LOG_NOTICE,"(sendfile) write error");
+				status = ERROR_IO;
+			}
+			break;
+		}
+		*bytes -= i;
+	}
+	*fileoffset = foffset;
+	return status;
+#else
+	(void)sock;
+	(void)fd;
+	(void)fileoffset;
+	(void)bytes;
+	return ERROR_ENOTSUP;
+#endif
+}
+
+int hdd_aread_begin(uint64_t chunkid,uint32_t version,uint16_t blocknum,uint16_t blocks,uint8_t **buffers,uint8_t **crcbuffs,uint16_t *rblocks,int *fd,uint64_t *fileoffset,uint64_t *devid,uint32_t *diskid) {
+	chunk *c;
+	uint8_t *crcptr;
+	uint16_t i;
+
+	c = hdd_chunk_tryfind(chunkid);
+	if (c==NULL) {
+		return ERROR_NOCHUNK;
+	}
+	if (c==CHUNKLOCKED) {
+		return ERROR_LOCKED;
+	}
+	if (c->validattr==0 || c->wbblocks>0) {	// not checked yet or not all written blocks are in file
+		hdd_chunk_release(c);
+		return ERROR_LOCKED;
+	}
+	if (c->version!=version && version>0) {
+		hdd_chunk_release(c);
+		return ERROR_WRONGVERSION;
+	}
+	if (blocks==0 || blocknum>=MFSBLOCKSINCHUNK || blocks>MFSBLOCKSINCHUNK-blocknum) {
+		hdd_chunk_release(c);
+		return ERROR_BNUMTOOBIG;
+	}
+	if (c->crcrefcount==0 || c->fd<0 || c->crc==NULL) {	// not opened
+		hdd_chunk_release(c);
+		return ERROR_NOTOPENED;
+	}
+	*rblocks = (blocknum>=c->blocks)?0:(c->blocks-blocknum);
+	if (*rblocks>blocks) {
+		*rblocks = blocks;
+	}
+	for (i=*rblocks ; i<blocks ; i++) {
+		memset(buffers[i],0,MFSBLOCKSIZE);
+		crcptr = crcbuffs[i];
+		put32bit(&crcptr,emptyblockcrc);
+	}
+	if (*rblocks>0) {
+		*fd = dup(c->fd);
+		if (*fd<0) {
+			mfs_errlog_silent(LOG_WARNING,"hdd_aread_begin: dup error");
+			hdd_chunk_release(c);
+			return ERROR_IO;
+		}
+		*fileoffset = CHUNKHDRSIZE+(((uint32_t)blocknum)<<MFSBLOCKBITS);
+		*devid = c->owner->devid;
+		*diskid = c->owner->diskid;
+		// stored crc is kept in crcbuffs until hdd_aread_end compares it with data
+		for (i=0 ; i<*rblocks ; i++) {
+			memcpy(crcbuffs[i],(c->crc)+(4*(blocknum+i)),4);
+		}
+	}
+	hdd_chunk_release(c);
+	return STATUS_OK;
+}
+
+int hdd_aread_end(uint32_t diskid,uint16_t rblocks,uint8_t **buffers,uint8_t **crcbuffs,int32_t result,uint64_t rtime) {
+	folder *f;
+	const uint8_t *rcrcptr;
+	uint8_t *crcptr;
+	uint32_t crc,bcrc;
+	uint16_t i;
+
+	if (rtime>0) {	// chunk isn't locked, so folder is found by id (removed folders are not in disktab)
+		zassert(pthread_mutex_lock(&statslock));
+		if (diskid<disktabsize && (f=disktab[diskid])!=NULL) {
+			hdd_stats_dataread_locked(f,((uint32_t)rblocks)<<MFSBLOCKBITS,rtime);
+		}
+		zassert(pthread_mutex_unlock(&statslock));
+	}
+	if (result!=(int32_t)(((uint32_t)rblocks)<<MFSBLOCKBITS)) {
+		return ERROR_IO;
+	}
+	// stored crc could be changed by write (or truncate) after hdd_aread_begin - caller reads blocks again under chunk lock
+	for (i=0 ; i<rblocks ; i++) {
+		crc = mycrc32(0,buffers[i],MFSBLOCKSIZE);
+		rcrcptr = crcbuffs[i];
+		bcrc = get32bit(&rcrcptr);
+		if (bcrc!=crc) {
+			return ERROR_CRC;
+		}
+		crcptr = crcbuffs[i];
+		put32bit(&crcptr,crc);
+	}
+	return STATUS_OK;
+}
+
 int hdd_write(uint64_t chunkid,uint32_t version,uint16_t blocknum,const uint8_t *buffer,uint32_t offset,uint32_t size,const uint8_t *crcbuff) {
 	chunk *c;
 	int ret;
 	uint8_t *wcrcptr;
 	const uint8_t *rcrcptr;
 	uint32_t crc,bcrc,precrc,postcrc,combinedcrc,chcrc;
-	uint32_t i;
+	uint32_t i,wbmax;
 	uint64_t ts,te;
-#ifndef PRESERVE_BLOCK
+	const uint8_t *wdata;
 	uint8_t *blockbuffer;
-	blockbuffer = pthread_getspecific(blockbufferkey);
-	if (blockbuffer==NULL) {
-# ifdef MMAP_ALLOC
-		blockbuffer = mmap(NULL,MFSBLOCKSIZE,PROT_READ | PROT_WRITE, MAP_ANON | MAP_PRIVATE,-1,0);
-# else
-		blockbuffer = malloc(MFSBLOCKSIZE);
-# endif
-		passert(blockbuffer);
-		zassert(pthread_setspecific(blockbufferkey,blockbuffer));
-	}
-#endif /* PRESERVE_BLOCK */
+	blockbuffer = hdd_get_blockbuffer();
 	c = hdd_chunk_find(chunkid);
 	if (c==NULL) {
 		return ERROR_NOCHUNK;
@@ -2089,6 +2897,23 @@ int hdd_write(uint64_t chunkid,uint32_t version,uint16_t blocknum,const uint8_t
 		hdd_chunk_release(c);
 		return ERROR_CRC;
 	}
+	bcache_invalidate(chunkid,blocknum);
+	if (c->vblocks!=NULL) {	// block has to be checked again by hdd_read_fd
+		c->vblocks[blocknum>>3] &= ~(1<<(blocknum&7));
+	}
+	c->wopen = 1;
+	// adjacent whole blocks are collected and written together ; anything else writes them first
+	wbmax = WriteBatchBlocks;
+	if (c->wbblocks>0 && (offset>0 || size<MFSBLOCKSIZE || blocknum!=c->wbfirst+c->wbblocks || c->wbblocks>=c->wbsize || c->wbblocks>=wbmax)) {
+		hdd_chunk_flush(c);
+	}
+	if (c->wberror) {
+		c->wberror = 0;
+		hdd_error_occured(c);	// uses and preserves errno !!!
+		hdd_report_damaged_chunk(chunkid);
+		hdd_chunk_release(c);
+		return ERROR_IO;
+	}
 	if (offset==0 && size==MFSBLOCKSIZE) {
 		if (blocknum>=c->blocks) {
 			wcrcptr = (c->crc)+(4*(c->blocks));
@@ -2097,16 +2922,31 @@ int hdd_write(uint64_t chunkid,uint32_t version,uint16_t blocknum,const uint8_t
 			}
 			c->blocks = blocknum+1;
 		}
-		ts = get_usectime();
+		if (wbmax>1) {
+			if (c->wbuff==NULL) {
+				c->wbuff = (uint8_t*)malloc(wbmax<<MFSBLOCKBITS);
+				passert(c->wbuff);
+				c->wbsize = wbmax;
+			}
+			if (c->wbblocks==0) {
+				c->wbfirst = blocknum;
+			}
+			memcpy(c->wbuff+(((uint32_t)(c->wbblocks))<<MFSBLOCKBITS),buffer,MFSBLOCKSIZE);
+			wdata = c->wbuff+(((uint32_t)(c->wbblocks))<<MFSBLOCKBITS);
+			ret = MFSBLOCKSIZE;
+		} else {
+			ts = get_usectime();
 #ifdef USE_PIO
-		ret = pwrite(c->fd,buffer,MFSBLOCKSIZE,CHUNKHDRSIZE+(((uint32_t)blocknum)<<MFSBLOCKBITS));
+			ret = pwrite(c->fd,buffer,MFSBLOCKSIZE,CHUNKHDRSIZE+(((uint32_t)blocknum)<<MFSBLOCKBITS));
 #else /* USE_PIO */
-		lseek(c->fd,CHUNKHDRSIZE+(((uint32_t)blocknum)<<MFSBLOCKBITS),SEEK_SET);
-		ret = write(c->fd,buffer,MFSBLOCKSIZE);
+			lseek(c->fd,CHUNKHDRSIZE+(((uint32_t)blocknum)<<MFSBLOCKBITS),SEEK_SET);
+			ret = write(c->fd,buffer,MFSBLOCKSIZE);
 #endif /* USE_PIO */
-		te = get_usectime();
-		hdd_stats_datawrite(c->owner,MFSBLOCKSIZE,te-ts);
-		if (crc!=mycrc32(0,buffer,MFSBLOCKSIZE)) {
+			te = get_usectime();
+			hdd_stats_datawrite(c->owner,MFSBLOCKSIZE,te-ts);
+			wdata = buffer;
+		}
+		if (crc!=mycrc32(0,wdata,MFSBLOCKSIZE)) {
 			errno = 0;
 			hdd_error_occured(c);
 			syslog(LOG_WARNING,"write_block_to_chunk: file:%s - crc error",c->filename);
@@ -2124,28 +2964,22 @@ int hdd_write(uint64_t chunkid,uint32_t version,uint16_t blocknum,const uint8_t
 			hdd_chunk_release(c);
 			return ERROR_IO;
 		}
-#ifdef PRESERVE_BLOCK
-		memcpy(c->block,buffer,MFSBLOCKSIZE);
-		c->blockno = blocknum;
-#endif /* PRESERVE_BLOCK */
+		if (wbmax>1) {
+			c->wbblocks++;
+			if (c->wbblocks<wbmax && c->wbblocks<c->wbsize) {	// block isn't in file yet - caller has to use hdd_flush before acknowledging it
+				hdd_chunk_release(c);
+				return ERROR_DELAYED;
+			}
+			if (hdd_chunk_flush(c)!=STATUS_OK) {	// last block of batch - whole batch is written before returning
+				c->wberror = 0;
+				hdd_error_occured(c);	// uses and preserves errno !!!
+				hdd_report_damaged_chunk(chunkid);
+				hdd_chunk_release(c);
+				return ERROR_IO;
+			}
+		}
 	} else {
 		if (blocknum<c->blocks) {
-#ifdef PRESERVE_BLOCK
-			if (c->blockno != blocknum) {
-				ts = get_usectime();
-#ifdef USE_PIO
-				ret = pread(c->fd,c->block,MFSBLOCKSIZE,CHUNKHDRSIZE+(((uint32_t)blocknum)<<MFSBLOCKBITS));
-#else /* USE_PIO */
-				lseek(c->fd,CHUNKHDRSIZE+(((uint32_t)blocknum)<<MFSBLOCKBITS),SEEK_SET);
-				ret = read(c->fd,c->block,MFSBLOCKSIZE);
-#endif /* USE_PIO */
-				te = get_usectime();
-				hdd_stats_dataread(c->owner,MFSBLOCKSIZE,te-ts);
-				c->blockno = blocknum;
-			} else {
-				ret = MFSBLOCKSIZE;
-			}
-#else /* PRESERVE_BLOCK */
 			ts = get_usectime();
 #ifdef USE_PIO
 			ret = pread(c->fd,blockbuffer,MFSBLOCKSIZE,CHUNKHDRSIZE+(((uint32_t)blocknum)<<MFSBLOCKBITS));
@@ -2155,7 +2989,6 @@ int hdd_write(uint64_t chunkid,uint32_t version,uint16_t blocknum,const uint8_t
 #endif /* USE_PIO */
 			te = get_usectime();
 			hdd_stats_dataread(c->owner,MFSBLOCKSIZE,te-ts);
-#endif /* PRESERVE_BLOCK */
 			if (ret!=MFSBLOCKSIZE) {
 				hdd_error_occured(c);	// uses and preserves errno !!!
 				mfs_arg_errlog_silent(LOG_WARNING,"write_block_to_chunk: file:%s - read error",c->filename);
@@ -2163,15 +2996,9 @@ int hdd_write(uint64_t chunkid,uint32_t version,uint16_t blocknum,const uint8_t
 				hdd_chunk_release(c);
 				return ERROR_IO;
 			}
-#ifdef PRESERVE_BLOCK
-			precrc = mycrc32(0,c->block,offset);
-			chcrc = mycrc32(0,c->block+offset,size);
-			postcrc = mycrc32(0,c->block+offset+size,MFSBLOCKSIZE-(offset+size));
-#else /* PRESERVE_BLOCK */
 			precrc = mycrc32(0,blockbuffer,offset);
 			chcrc = mycrc32(0,blockbuffer+offset,size);
 			postcrc = mycrc32(0,blockbuffer+offset+size,MFSBLOCKSIZE-(offset+size));
-#endif /* PRESERVE_BLOCK */
 			if (offset==0) {
 				combinedcrc = mycrc32_combine(chcrc,postcrc,MFSBLOCKSIZE-(offset+size));
 			} else {
@@ -2203,28 +3030,10 @@ int hdd_write(uint64_t chunkid,uint32_t version,uint16_t blocknum,const uint8_t
 				put32bit(&wcrcptr,emptyblockcrc);
 			}
 			c->blocks = blocknum+1;
-#ifdef PRESERVE_BLOCK
-			memset(c->block,0,MFSBLOCKSIZE);
-			c->blockno = blocknum;
-#else /* PRESERVE_BLOCK */
 			memset(blockbuffer,0,MFSBLOCKSIZE);
-#endif /* PRESERVE_BLOCK */
 			precrc = mycrc32_zeroblock(0,offset);
 			postcrc = mycrc32_zeroblock(0,MFSBLOCKSIZE-(offset+size));
 		}
-#ifdef PRESERVE_BLOCK
-		memcpy(c->block+offset,buffer,size);
-		ts = get_usectime();
-#ifdef USE_PIO
-		ret = pwrite(c->fd,c->block+offset,size,CHUNKHDRSIZE+(((uint32_t)blocknum)<<MFSBLOCKBITS)+offset);
-#else /* USE_PIO */
-		lseek(c->fd,CHUNKHDRSIZE+(((uint32_t)blocknum)<<MFSBLOCKBITS)+offset,SEEK_SET);
-		ret = write(c->fd,c->block+offset,size);
-#endif /* USE_PIO */
-		te = get_usectime();
-		hdd_stats_datawrite(c->owner,size,te-ts);
-		chcrc = mycrc32(0,c->block+offset,size);
-#else /* PRESERVE_BLOCK */
 		memcpy(blockbuffer+offset,buffer,size);
 		ts = get_usectime();
 #ifdef USE_PIO
@@ -2236,7 +3045,6 @@ int hdd_write(uint64_t chunkid,uint32_t version,uint16_t blocknum,const uint8_t
 		te = get_usectime();
 		hdd_stats_datawrite(c->owner,size,te-ts);
 		chcrc = mycrc32(0,blockbuffer+offset,size);
-#endif /* PRESERVE_BLOCK */
 		if (offset==0) {
 			combinedcrc = mycrc32_combine(chcrc,postcrc,MFSBLOCKSIZE-(offset+size));
 		} else {
@@ -2268,6 +3076,24 @@ int hdd_write(uint64_t chunkid,uint32_t version,uint16_t blocknum,const uint8_t
 	return STATUS_OK;
 }
 
+int hdd_flush(uint64_t chunkid) {
+	chunk *c;
+	c = hdd_chunk_find(chunkid);
+	if (c==NULL) {
+		return ERROR_NOCHUNK;
+	}
+	hdd_chunk_flush(c);
+	if (c->wberror) {
+		c->wberror = 0;
+		hdd_error_occured(c);	// uses and preserves errno !!!
+		hdd_report_damaged_chunk(chunkid);
+		hdd_chunk_release(c);
+		return ERROR_IO;
+	}
+	hdd_chunk_release(c);
+	return STATUS_OK;
+}
+
 
 
 /* chunk info */
@@ -2372,11 +3198,7 @@ static int hdd_int_create(uint64_t chunkid,uint32_t version) {
 	chunk *c;
 	int status;
 	uint8_t *ptr;
-#ifdef PRESERVE_BLOCK
-	uint8_t hdrbuffer[CHUNKHDRSIZE];
-#else /* PRESERVE_BLOCK */
 	uint8_t *hdrbuffer;
-#endif /* PRESERVE_BLOCK */
 
 	zassert(pthread_mutex_lock(&folderlock));
 	f = hdd_getfolder();
@@ -2390,14 +3212,7 @@ static int hdd_int_create(uint64_t chunkid,uint32_t version) {
 		return ERROR_CHUNKEXIST;
 	}
 
-#ifndef PRESERVE_BLOCK
-	hdrbuffer = pthread_getspecific(hdrbufferkey);
-	if (hdrbuffer==NULL) {
-		hdrbuffer = malloc(CHUNKHDRSIZE);
-		passert(hdrbuffer);
-		zassert(pthread_setspecific(hdrbufferkey,hdrbuffer));
-	}
-#endif /* PRESERVE_BLOCK */
+	hdrbuffer = hdd_get_hdrbuffer();
 
 	status = hdd_io_begin(c,1);
 	if (status!=STATUS_OK) {
@@ -2437,19 +3252,8 @@ static int hdd_int_test(uint64_t chunkid,uint32_t version) {
 	int32_t retsize;
 	int status;
 	chunk *c;
-#ifndef PRESERVE_BLOCK
 	uint8_t *blockbuffer;
-	blockbuffer = pthread_getspecific(blockbufferkey);
-	if (blockbuffer==NULL) {
-# ifdef MMAP_ALLOC
-		blockbuffer = mmap(NULL,MFSBLOCKSIZE,PROT_READ | PROT_WRITE, MAP_ANON | MAP_PRIVATE,-1,0);
-# else
-		blockbuffer = malloc(MFSBLOCKSIZE);
-# endif
-		passert(blockbuffer);
-		zassert(pthread_setspecific(blockbufferkey,blockbuffer));
-	}
-#endif /* PRESERVE_BLOCK */
+	blockbuffer = hdd_get_blockbuffer();
 	c = hdd_chunk_find(chunkid);
 	if (c==NULL) {
 		return ERROR_NOCHUNK;
@@ -2458,6 +3262,9 @@ static int hdd_int_test(uint64_t chunkid,uint32_t version) {
 		hdd_chunk_release(c);
 		return ERROR_WRONGVERSION;
 	}
+	if (hdd_chunk_flush_or_release(c)!=STATUS_OK) {	// blocks collected by hdd_write have to be in file
+		return ERROR_IO;
+	}
 	status = hdd_io_begin(c,0);
 	if (status!=STATUS_OK) {
 		hdd_error_occured(c);	// uses and preserves errno !!!
@@ -2467,11 +3274,7 @@ static int hdd_int_test(uint64_t chunkid,uint32_t version) {
 	lseek(c->fd,CHUNKHDRSIZE,SEEK_SET);
 	ptr = c->crc;
 	for (block=0 ; block<c->blocks ; block++) {
-#ifdef PRESERVE_BLOCK
-		retsize = read(c->fd,c->block,MFSBLOCKSIZE);
-#else /* PRESERVE_BLOCK */
 		retsize = read(c->fd,blockbuffer,MFSBLOCKSIZE);
-#endif /* PRESERVE_BLOCK */
 		if (retsize!=MFSBLOCKSIZE) {
 			hdd_error_occured(c);	// uses and preserves errno !!!
 			mfs_arg_errlog_silent(LOG_WARNING,"test_chunk: file:%s - data read error",c->filename);
@@ -2480,15 +3283,8 @@ static int hdd_int_test(uint64_t chunkid,uint32_t version) {
 			return ERROR_IO;
 		}
 		hdd_stats_read(MFSBLOCKSIZE);
-#ifdef PRESERVE_BLOCK
-		c->blockno = block;
-#endif
 		bcrc = get32bit(&ptr);
-#ifdef PRESERVE_BLOCK
-		if (bcrc!=mycrc32(0,c->block,MFSBLOCKSIZE)) {
-#else /* PRESERVE_BLOCK */
 		if (bcrc!=mycrc32(0,blockbuffer,MFSBLOCKSIZE)) {
-#endif /* PRESERVE_BLOCK */
 			errno = 0;	// set anything to errno
 			hdd_error_occured(c);	// uses and preserves errno !!!
 			syslog(LOG_WARNING,"test_chunk: file:%s - crc error",c->filename);
@@ -2516,27 +3312,9 @@ static int hdd_int_duplicate(uint64_t chunkid,uint32_t version,uint32_t newversi
 	int32_t retsize;
 	int status;
 	chunk *c,*oc;
-#ifdef PRESERVE_BLOCK
-	uint8_t hdrbuffer[CHUNKHDRSIZE];
-#else /* PRESERVE_BLOCK */
 	uint8_t *blockbuffer,*hdrbuffer;
-	blockbuffer = pthread_getspecific(blockbufferkey);
-	if (blockbuffer==NULL) {
-# ifdef MMAP_ALLOC
-		blockbuffer = mmap(NULL,MFSBLOCKSIZE,PROT_READ | PROT_WRITE, MAP_ANON | MAP_PRIVATE,-1,0);
-# else
-		blockbuffer = malloc(MFSBLOCKSIZE);
-# endif
-		passert(blockbuffer);
-		zassert(pthread_setspecific(blockbufferkey,blockbuffer));
-	}
-	hdrbuffer = pthread_getspecific(hdrbufferkey);
-	if (hdrbuffer==NULL) {
-		hdrbuffer = malloc(CHUNKHDRSIZE);
-		passert(hdrbuffer);
-		zassert(pthread_setspecific(hdrbufferkey,hdrbuffer));
-	}
-#endif /* PRESERVE_BLOCK */
+	blockbuffer = hdd_get_blockbuffer();
+	hdrbuffer = hdd_get_hdrbuffer();
 
 	oc = hdd_chunk_find(chunkid);
 	if (oc==NULL) {
@@ -2546,6 +3324,9 @@ static int hdd_int_duplicate(uint64_t chunkid,uint32_t version,uint32_t newversi
 		hdd_chunk_release(oc);
 		return ERROR_WRONGVERSION;
 	}
+	if (hdd_chunk_flush_or_release(oc)!=STATUS_OK) {	// blocks collected by hdd_write have to be in file
+		return ERROR_IO;
+	}
 	if (copyversion==0) {
 		copyversion = newversion;
 	}
@@ -2641,25 +3422,9 @@ static int hdd_int_duplicate(uint64_t chunkid,uint32_t version,uint32_t newversi
 		return ERROR_IO;
 	}
 	hdd_stats_write(CHUNKHDRSIZE);
-#ifndef PRESERVE_BLOCK
 	lseek(oc->fd,CHUNKHDRSIZE,SEEK_SET);
-#endif /* PRESERVE_BLOCK */
 	for (block=0 ; block<oc->blocks ; block++) {
-#ifdef PRESERVE_BLOCK
-		if (oc->blockno==block) {
-			memcpy(c->block,oc->block,MFSBLOCKSIZE);
-			retsize = MFSBLOCKSIZE;
-		} else {
-#ifdef USE_PIO
-			retsize = pread(oc->fd,c->block,MFSBLOCKSIZE,CHUNKHDRSIZE+(((uint32_t)block)<<MFSBLOCKBITS));
-#else /* USE_PIO */
-			lseek(oc->fd,CHUNKHDRSIZE+(((uint32_t)block)<<MFSBLOCKBITS),SEEK_SET);
-			retsize = read(oc->fd,c->block,MFSBLOCKSIZE);
-#endif /* USE_PIO */
-		}
-#else /* PRESERVE_BLOCK */
 		retsize = read(oc->fd,blockbuffer,MFSBLOCKSIZE);
-#endif /* PRESERVE_BLOCK */
 		if (retsize!=MFSBLOCKSIZE) {
 			hdd_error_occured(oc);	// uses and preserves errno !!!
 			mfs_arg_errlog_silent(LOG_WARNING,"duplicate_chunk: file:%s - data read error",oc->filename);
@@ -2671,15 +3436,8 @@ static int hdd_int_duplicate(uint64_t chunkid,uint32_t version,uint32_t newversi
 			hdd_chunk_release(oc);
 			return ERROR_IO;
 		}
-#ifdef PRESERVE_BLOCK
-		if (oc->blockno!=block) {
-			hdd_stats_read(MFSBLOCKSIZE);
-		}
-		retsize = write(c->fd,c->block,MFSBLOCKSIZE);
-#else /* PRESERVE_BLOCK */
 		hdd_stats_read(MFSBLOCKSIZE);
 		retsize = write(c->fd,blockbuffer,MFSBLOCKSIZE);
-#endif /* PRESERVE_BLOCK */
 		if (retsize!=MFSBLOCKSIZE) {
 			hdd_error_occured(c);	// uses and preserves errno !!!
 			mfs_arg_errlog_silent(LOG_WARNING,"duplicate_chunk: file:%s - data write error",c->filename);
@@ -2691,9 +3449,6 @@ static int hdd_int_duplicate(uint64_t chunkid,uint32_t version,uint32_t newversi
 			return ERROR_IO;	//write error
 		}
 		hdd_stats_write(MFSBLOCKSIZE);
-#ifdef PRESERVE_BLOCK
-		c->blockno = block;
-#endif /* PRESERVE_BLOCK */
 	}
 	status = hdd_io_end(oc);
 	if (status!=STATUS_OK) {
@@ -2736,6 +3491,9 @@ static int hdd_int_version(uint64_t chunkid,uint32_t version,uint32_t newversion
 		hdd_chunk_release(c);
 		return ERROR_WRONGVERSION;
 	}
+	if (hdd_chunk_flush_or_release(c)!=STATUS_OK) {	// blocks collected by hdd_write have to be in file
+		return ERROR_IO;
+	}
 	filenameleng = strlen(c->filename);
 	if (c->filename[filenameleng-13]=='_') {	// new file name format
 		newfilename = (char*) malloc(filenameleng+1);
@@ -2791,19 +3549,8 @@ static int hdd_int_truncate(uint64_t chunkid,uint32_t version,uint32_t newversio
 	chunk *c;
 	uint32_t blocks;
 	uint32_t i;
-#ifndef PRESERVE_BLOCK
 	uint8_t *blockbuffer;
-	blockbuffer = pthread_getspecific(blockbufferkey);
-	if (blockbuffer==NULL) {
-# ifdef MMAP_ALLOC
-		blockbuffer = mmap(NULL,MFSBLOCKSIZE,PROT_READ | PROT_WRITE, MAP_ANON | MAP_PRIVATE,-1,0);
-# else
-		blockbuffer = malloc(MFSBLOCKSIZE);
-# endif
-		passert(blockbuffer);
-		zassert(pthread_setspecific(blockbufferkey,blockbuffer));
-	}
-#endif /* !PRESERVE_BLOCK */
+	blockbuffer = hdd_get_blockbuffer();
 	if (length>MFSCHUNKSIZE) {
 		return ERROR_WRONGSIZE;
 	}
@@ -2816,6 +3563,9 @@ static int hdd_int_truncate(uint64_t chunkid,uint32_t version,uint32_t newversio
 		hdd_chunk_release(c);
 		return ERROR_WRONGVERSION;
 	}
+	if (hdd_chunk_flush_or_release(c)!=STATUS_OK) {	// blocks collected by hdd_write have to be in file
+		return ERROR_IO;
+	}
 	filenameleng = strlen(c->filename);
 	if (c->filename[filenameleng-13]=='_') {	// new file name format
 		newfilename = (char*) malloc(filenameleng+1);
@@ -2888,26 +3638,12 @@ static int hdd_int_truncate(uint64_t chunkid,uint32_t version,uint32_t newversio
 				hdd_chunk_release(c);
 				return ERROR_IO;
 			}
-#ifdef PRESERVE_BLOCK
-			if (c->blockno>=blocks) {
-				c->blockno = 0xFFFF;	// invalidate truncated block
-			}
-			if (c->blockno!=(blockpos>>MFSBLOCKBITS)) {
-
-#ifdef USE_PIO
-				if (pread(c->fd,c->block,blocksize,CHUNKHDRSIZE+blockpos)!=(signed)blocksize) {
-#else /* USE_PIO */
-				lseek(c->fd,CHUNKHDRSIZE+blockpos,SEEK_SET);
-				if (read(c->fd,c->block,blocksize)!=(signed)blocksize) {
-#endif /* USE_PIO */
-#else /* PRESERVE_BLOCK */
 #ifdef USE_PIO
 			if (pread(c->fd,blockbuffer,blocksize,CHUNKHDRSIZE+blockpos)!=(signed)blocksize) {
 #else /* USE_PIO */
 			lseek(c->fd,CHUNKHDRSIZE+blockpos,SEEK_SET);
 			if (read(c->fd,blockbuffer,blocksize)!=(signed)blocksize) {
 #endif /* USE_PIO */
-#endif /* PRESERVE_BLOCK */
 				hdd_error_occured(c);	// uses and preserves errno !!!
 				mfs_arg_errlog_silent(LOG_WARNING,"truncate_chunk: file:%s - read error",c->filename);
 				hdd_io_end(c);
@@ -2915,14 +3651,7 @@ static int hdd_int_truncate(uint64_t chunkid,uint32_t version,uint32_t newversio
 				return ERROR_IO;
 			}
 			hdd_stats_read(blocksize);
-#ifdef PRESERVE_BLOCK
-			}
-			memset(c->block+blocksize,0,MFSBLOCKSIZE-blocksize);
-			c->blockno = blockpos>>MFSBLOCKBITS;
-			i = mycrc32_zeroexpanded(0,c->block,blocksize,MFSBLOCKSIZE-blocksize);
-#else /* PRESERVE_BLOCK */
 			i = mycrc32_zeroexpanded(0,blockbuffer,blocksize,MFSBLOCKSIZE-blocksize);
-#endif /* PRESERVE_BLOCK */
 			ptr = (c->crc)+(4*blocknum);
 			put32bit(&ptr,i);
 			c->crcchanged = 1;
@@ -2953,27 +3682,9 @@ static int hdd_int_duptrunc(uint64_t chunkid,uint32_t version,uint32_t newversio
 	uint32_t crc;
 	int status;
 	chunk *c,*oc;
-#ifdef PRESERVE_BLOCK
-	uint8_t hdrbuffer[CHUNKHDRSIZE];
-#else /* PRESERVE_BLOCK */
 	uint8_t *blockbuffer,*hdrbuffer;
-	blockbuffer = pthread_getspecific(blockbufferkey);
-	if (blockbuffer==NULL) {
-# ifdef MMAP_ALLOC
-		blockbuffer = mmap(NULL,MFSBLOCKSIZE,PROT_READ | PROT_WRITE, MAP_ANON | MAP_PRIVATE,-1,0);
-# else
-		blockbuffer = malloc(MFSBLOCKSIZE);
-# endif
-		passert(blockbuffer);
-		zassert(pthread_setspecific(blockbufferkey,blockbuffer));
-	}
-	hdrbuffer = pthread_getspecific(hdrbufferkey);
-	if (hdrbuffer==NULL) {
-		hdrbuffer = malloc(CHUNKHDRSIZE);
-		passert(hdrbuffer);
-		zassert(pthread_setspecific(hdrbufferkey,hdrbuffer));
-	}
-#endif /* PRESERVE_BLOCK */
+	blockbuffer = hdd_get_blockbuffer();
+	hdrbuffer = hdd_get_hdrbuffer();
 
 	if (length>MFSCHUNKSIZE) {
 		return ERROR_WRONGSIZE;
@@ -2986,6 +3697,9 @@ static int hdd_int_duptrunc(uint64_t chunkid,uint32_t version,uint32_t newversio
 		hdd_chunk_release(oc);
 		return ERROR_WRONGVERSION;
 	}
+	if (hdd_chunk_flush_or_release(oc)!=STATUS_OK) {	// blocks collected by hdd_write have to be in file
+		return ERROR_IO;
+	}
 	if (copyversion==0) {
 		copyversion = newversion;
 	}
@@ -3072,26 +3786,10 @@ static int hdd_int_duptrunc(uint64_t chunkid,uint32_t version,uint32_t newversio
 	memcpy(hdrbuffer+1024,oc->crc,4096);
 // do not write header yet - only seek to apriopriate position
 	lseek(c->fd,CHUNKHDRSIZE,SEEK_SET);
-#ifndef PRESERVE_BLOCK
 	lseek(oc->fd,CHUNKHDRSIZE,SEEK_SET);
-#endif /* PRESERVE_BLOCK */
 	if (blocks>oc->blocks) { // expanding
 		for (block=0 ; block<oc->blocks ; block++) {
-#ifdef PRESERVE_BLOCK
-			if (oc->blockno==block) {
-				memcpy(c->block,oc->block,MFSBLOCKSIZE);
-				retsize = MFSBLOCKSIZE;
-			} else {
-#ifdef USE_PIO
-				retsize = pread(oc->fd,c->block,MFSBLOCKSIZE,CHUNKHDRSIZE+(((uint32_t)block)<<MFSBLOCKBITS));
-#else /* USE_PIO */
-				lseek(oc->fd,CHUNKHDRSIZE+(((uint32_t)block)<<MFSBLOCKBITS),SEEK_SET);
-				retsize = read(oc->fd,c->block,MFSBLOCKSIZE);
-#endif /* USE_PIO */
-			}
-#else /* PRESERVE_BLOCK */
 			retsize = read(oc->fd,blockbuffer,MFSBLOCKSIZE);
-#endif /* PRESERVE_BLOCK */
 			if (retsize!=MFSBLOCKSIZE) {
 				hdd_error_occured(oc);	// uses and preserves errno !!!
 				mfs_arg_errlog_silent(LOG_WARNING,"duptrunc_chunk: file:%s - data read error",oc->filename);
@@ -3103,15 +3801,8 @@ static int hdd_int_duptrunc(uint64_t chunkid,uint32_t version,uint32_t newversio
 				hdd_chunk_release(oc);
 				return ERROR_IO;
 			}
-#ifdef PRESERVE_BLOCK
-			if (oc->blockno!=block) {
-				hdd_stats_read(MFSBLOCKSIZE);
-			}
-			retsize = write(c->fd,c->block,MFSBLOCKSIZE);
-#else /* PRESERVE_BLOCK */
 			hdd_stats_read(MFSBLOCKSIZE);
 			retsize = write(c->fd,blockbuffer,MFSBLOCKSIZE);
-#endif /* PRESERVE_BLOCK */
 			if (retsize!=MFSBLOCKSIZE) {
 				hdd_error_occured(c);	// uses and preserves errno !!!
 				mfs_arg_errlog_silent(LOG_WARNING,"duptrunc_chunk: file:%s - data write error",c->filename);
@@ -3123,9 +3814,6 @@ static int hdd_int_duptrunc(uint64_t chunkid,uint32_t version,uint32_t newversio
 				return ERROR_IO;
 			}
 			hdd_stats_write(MFSBLOCKSIZE);
-#ifdef PRESERVE_BLOCK
-			c->blockno = block;
-#endif /* PRESERVE_BLOCK */
 		}
 		if (ftruncate(c->fd,CHUNKHDRSIZE+(((uint32_t)blocks)<<MFSBLOCKBITS))<0) {
 			hdd_error_occured(c);	// uses and preserves errno !!!
@@ -3145,21 +3833,7 @@ static int hdd_int_duptrunc(uint64_t chunkid,uint32_t version,uint32_t newversio
 		uint32_t blocksize = (length&MFSBLOCKMASK);
 		if (blocksize==0) { // aligned shring
 			for (block=0 ; block<blocks ; block++) {
-#ifdef PRESERVE_BLOCK
-				if (oc->blockno==block) {
-					memcpy(c->block,oc->block,MFSBLOCKSIZE);
-					retsize = MFSBLOCKSIZE;
-				} else {
-#ifdef USE_PIO
-					retsize = pread(oc->fd,c->block,MFSBLOCKSIZE,CHUNKHDRSIZE+(((uint32_t)block)<<MFSBLOCKBITS));
-#else /* USE_PIO */
-					lseek(oc->fd,CHUNKHDRSIZE+(((uint32_t)block)<<MFSBLOCKBITS),SEEK_SET);
-					retsize = read(oc->fd,c->block,MFSBLOCKSIZE);
-#endif /* USE_PIO */
-				}
-#else /* PRESERVE_BLOCK */
 				retsize = read(oc->fd,blockbuffer,MFSBLOCKSIZE);
-#endif /* PRESERVE_BLOCK */
 				if (retsize!=MFSBLOCKSIZE) {
 					hdd_error_occured(oc);	// uses and preserves errno !!!
 					mfs_arg_errlog_silent(LOG_WARNING,"duptrunc_chunk: file:%s - data read error",oc->filename);
@@ -3171,15 +3845,8 @@ static int hdd_int_duptrunc(uint64_t chunkid,uint32_t version,uint32_t newversio
 					hdd_chunk_release(oc);
 					return ERROR_IO;
 				}
-#ifdef PRESERVE_BLOCK
-				if (oc->blockno!=block) {
-					hdd_stats_read(MFSBLOCKSIZE);
-				}
-				retsize = write(c->fd,c->block,MFSBLOCKSIZE);
-#else /* PRESERVE_BLOCK */
 				hdd_stats_read(MFSBLOCKSIZE);
 				retsize = write(c->fd,blockbuffer,MFSBLOCKSIZE);
-#endif /* PRESERVE_BLOCK */
 				if (retsize!=MFSBLOCKSIZE) {
 					hdd_error_occured(c);	// uses and preserves errno !!!
 					mfs_arg_errlog_silent(LOG_WARNING,"duptrunc_chunk: file:%s - data write error",c->filename);
@@ -3191,27 +3858,10 @@ static int hdd_int_duptrunc(uint64_t chunkid,uint32_t version,uint32_t newversio
 					return ERROR_IO;
 				}
 				hdd_stats_write(MFSBLOCKSIZE);
-#ifdef PRESERVE_BLOCK
-				c->blockno = block;
-#endif /* PRESERVE_BLOCK */
 			}
 		} else { // misaligned shrink
 			for (block=0 ; block<blocks-1 ; block++) {
-#ifdef PRESERVE_BLOCK
-				if (oc->blockno==block) {
-					memcpy(c->block,oc->block,MFSBLOCKSIZE);
-					retsize = MFSBLOCKSIZE;
-				} else {
-#ifdef USE_PIO
-					retsize = pread(oc->fd,c->block,MFSBLOCKSIZE,CHUNKHDRSIZE+(((uint32_t)block)<<MFSBLOCKBITS));
-#else /* USE_PIO */
-					lseek(oc->fd,CHUNKHDRSIZE+(((uint32_t)block)<<MFSBLOCKBITS),SEEK_SET);
-					retsize = read(oc->fd,c->block,MFSBLOCKSIZE);
-#endif /* USE_PIO */
-				}
-#else /* PRESERVE_BLOCK */
 				retsize = read(oc->fd,blockbuffer,MFSBLOCKSIZE);
-#endif /* PRESERVE_BLOCK */
 				if (retsize!=MFSBLOCKSIZE) {
 					hdd_error_occured(oc);	// uses and preserves errno !!!
 					mfs_arg_errlog_silent(LOG_WARNING,"duptrunc_chunk: file:%s - data read error",oc->filename);
@@ -3223,15 +3873,8 @@ static int hdd_int_duptrunc(uint64_t chunkid,uint32_t version,uint32_t newversio
 					hdd_chunk_release(oc);
 					return ERROR_IO;
 				}
-#ifdef PRESERVE_BLOCK
-				if (oc->blockno!=block) {
-					hdd_stats_read(MFSBLOCKSIZE);
-				}
-				retsize = write(c->fd,c->block,MFSBLOCKSIZE);
-#else /* PRESERVE_BLOCK */
 				hdd_stats_read(MFSBLOCKSIZE);
 				retsize = write(c->fd,blockbuffer,MFSBLOCKSIZE);
-#endif /* PRESERVE_BLOCK */
 				if (retsize!=MFSBLOCKSIZE) {
 					hdd_error_occured(c);	// uses and preserves errno !!!
 					mfs_arg_errlog_silent(LOG_WARNING,"duptrunc_chunk: file:%s - data write error",c->filename);
@@ -3245,21 +3888,7 @@ static int hdd_int_duptrunc(uint64_t chunkid,uint32_t version,uint32_t newversio
 				hdd_stats_write(MFSBLOCKSIZE);
 			}
 			block = blocks-1;
-#ifdef PRESERVE_BLOCK
-			if (oc->blockno==block) {
-				memcpy(c->block,oc->block,blocksize);
-				retsize = blocksize;
-			} else {
-#ifdef USE_PIO
-				retsize = pread(oc->fd,c->block,blocksize,CHUNKHDRSIZE+(((uint32_t)block)<<MFSBLOCKBITS));
-#else /* USE_PIO */
-				lseek(oc->fd,CHUNKHDRSIZE+(((uint32_t)block)<<MFSBLOCKBITS),SEEK_SET);
-				retsize = read(oc->fd,c->block,blocksize);
-#endif /* USE_PIO */
-			}
-#else /* PRESERVE_BLOCK */
 			retsize = read(oc->fd,blockbuffer,blocksize);
-#endif /* PRESERVE_BLOCK */
 			if (retsize!=(signed)blocksize) {
 				hdd_error_occured(oc);	// uses and preserves errno !!!
 				mfs_arg_errlog_silent(LOG_WARNING,"duptrunc_chunk: file:%s - data read error",oc->filename);
@@ -3271,17 +3900,9 @@ static int hdd_int_duptrunc(uint64_t chunkid,uint32_t version,uint32_t newversio
 				hdd_chunk_release(oc);
 				return ERROR_IO;
 			}
-#ifdef PRESERVE_BLOCK
-			if (oc->blockno!=block) {
-				hdd_stats_read(blocksize);
-			}
-			memset(c->block+blocksize,0,MFSBLOCKSIZE-blocksize);
-			retsize = write(c->fd,c->block,MFSBLOCKSIZE);
-#else /* PRESERVE_BLOCK */
 			hdd_stats_read(blocksize);
 			memset(blockbuffer+blocksize,0,MFSBLOCKSIZE-blocksize);
 			retsize = write(c->fd,blockbuffer,MFSBLOCKSIZE);
-#endif /* PRESERVE_BLOCK */
 			if (retsize!=MFSBLOCKSIZE) {
 				hdd_error_occured(c);	// uses and preserves errno !!!
 				mfs_arg_errlog_silent(LOG_WARNING,"duptrunc_chunk: file:%s - data write error",c->filename);
@@ -3294,15 +3915,8 @@ static int hdd_int_duptrunc(uint64_t chunkid,uint32_t version,uint32_t newversio
 			}
 			hdd_stats_write(MFSBLOCKSIZE);
 			ptr = hdrbuffer+CHUNKHDRCRC+4*(blocks-1);
-#ifdef PRESERVE_BLOCK
-			crc = mycrc32_zeroexpanded(0,c->block,blocksize,MFSBLOCKSIZE-blocksize);
-#else /* PRESERVE_BLOCK */
 			crc = mycrc32_zeroexpanded(0,blockbuffer,blocksize,MFSBLOCKSIZE-blocksize);
-#endif /* PRESERVE_BLOCK */
 			put32bit(&ptr,crc);
-#ifdef PRESERVE_BLOCK
-			c->blockno = block;
-#endif /* PRESERVE_BLOCK */
 		}
 	}
 // and now write header
@@ -3431,6 +4045,7 @@ int hdd_chunkop(uint64_t chunkid,uint32_t version,uint32_t newversion,uint64_t c
 
 void* hdd_tester_thread(void* arg) {
 	folder *f,*of;
+	hashshard *hs;
 	chunk *c;
 	uint64_t chunkid;
 	uint32_t version;
@@ -3448,7 +4063,6 @@ void* hdd_tester_thread(void* arg) {
 		chunkid = 0;
 		version = 0;
 		zassert(pthread_mutex_lock(&folderlock));
-		zassert(pthread_mutex_lock(&hashlock));
 		zassert(pthread_mutex_lock(&testlock));
 		if (testerreset) {
 			testerreset = 0;
@@ -3472,17 +4086,24 @@ void* hdd_tester_thread(void* arg) {
 				path = NULL;
 			} else {
 				c = f->testhead;
-				if (c && c->state==CH_AVAIL) {
+				if (c) {
 					chunkid = c->chunkid;
-					version = c->version;
-					path = strdup(c->filename);
-					passert(path);
 				}
 			}
 		}
 		zassert(pthread_mutex_unlock(&testlock));
-		zassert(pthread_mutex_unlock(&hashlock));
 		zassert(pthread_mutex_unlock(&folderlock));
+		if (chunkid>0) {	// chunk state can be checked only under lock of its shard
+			hs = hdd_hash_shard(chunkid);
+			zassert(pthread_mutex_lock(&(hs->lock)));
+			c = hdd_hash_find(hs,chunkid);
+			if (c && c->state==CH_AVAIL) {
+				version = c->version;
+				path = strdup(c->filename);
+				passert(path);
+			}
+			zassert(pthread_mutex_unlock(&(hs->lock)));
+		}
 		if (path) {
 			syslog(LOG_NOTICE,"testing chunk: %s",path);
 			if (hdd_int_test(chunkid,version)!=STATUS_OK) {
@@ -3658,6 +4279,204 @@ static inline void hdd_add_chunk(folder *f,const char *fullname,uint64_t chunkid
 	zassert(pthread_mutex_unlock(&folderlock));
 }
 
+/* chunk inventory - list of chunks of folder written at clean shutdown, so next start doesn't have to wait for full scan
+ * file: "MFSCHDB1" , count:32 , count * ( chunkid:64 version:32 ) , crc:32 (of entries) ; removed when loaded */
+
+#define CHUNKDB_MAGIC "MFSCHDB1"
+#define CHUNKDB_ENTRYSIZE 12
+
+typedef struct _invchunk {
+	uint64_t chunkid;
+	uint32_t version;
+	uint8_t seen;	// found by verification scan
+} invchunk;
+
+static char* hdd_chunkdb_name(folder *f,const char *suffix) {
+	char *fname;
+	uint32_t plen,slen;
+	plen = strlen(f->path);
+	slen = strlen(suffix);
+	fname = (char*) malloc(plen+slen+1);
+	passert(fname);
+	memcpy(fname,f->path,plen);
+	memcpy(fname+plen,suffix,slen+1);
+	return fname;
+}
+
+// called at termination (no other threads)
+static void hdd_chunkdb_store(folder *f) {
+	chunk *c;
+	uint32_t count;
+	uint8_t *buff,*wptr;
+	char *fname,*tmpname;
+	int fd;
+	ssize_t ret;
+
+	count = 0;
+	for (c=f->testhead ; c ; c=c->testnext) {
+		count++;
+	}
+	buff = (uint8_t*) malloc(8+4+count*CHUNKDB_ENTRYSIZE+4);
+	passert(buff);
+	memcpy(buff,CHUNKDB_MAGIC,8);
+	wptr = buff+8;
+	put32bit(&wptr,count);
+	for (c=f->testhead ; c ; c=c->testnext) {
+		put64bit(&wptr,c->chunkid);
+		put32bit(&wptr,c->version);
+	}
+	put32bit(&wptr,mycrc32(0,buff+12,count*CHUNKDB_ENTRYSIZE));
+	fname = hdd_chunkdb_name(f,".chunkdb");
+	tmpname = hdd_chunkdb_name(f,".chunkdb.tmp");
+	fd = open(tmpname,O_WRONLY|O_CREAT|O_TRUNC,0640);
+	if (fd<0) {
+		mfs_arg_errlog_silent(LOG_WARNING,"hdd_term: can't create chunk inventory '%s'",tmpname);
+	} else {
+		ret = write(fd,buff,wptr-buff);
+		if (ret!=(ssize_t)(wptr-buff) || fsync(fd)<0) {
+			mfs_arg_errlog_silent(LOG_WARNING,"hdd_term: chunk inventory '%s' - write error",tmpname);
+			close(fd);
+			unlink(tmpname);
+		} else {
+			close(fd);
+			if (rename(tmpname,fname)<0) {
+				mfs_arg_errlog_silent(LOG_WARNING,"hdd_term: can't rename chunk inventory '%s'",tmpname);
+				unlink(tmpname);
+			} else {
+				syslog(LOG_NOTICE,"folder %s: chunk inventory stored (%" PRIu32 " chunks)",f->path,count);
+			}
+		}
+	}
+	free(tmpname);
+	free(fname);
+	free(buff);
+}
+
+static int hdd_invchunk_cmp(const void *a,const void *b) {
+	uint64_t aa = ((const invchunk*)a)->chunkid;
+	uint64_t bb = ((const invchunk*)b)->chunkid;
+	return (aa<bb)?-1:(aa>bb)?1:0;
+}
+
+// reads and removes inventory of R/W folder ; returns table sorted by chunkid or NULL when there is no valid inventory
+static invchunk* hdd_chunkdb_load(folder *f,uint32_t *count) {
+	struct stat sb;
+	invchunk *invtab;
+	uint8_t *buff;
+	const uint8_t *rptr,*crcptr;
+	char *fname;
+	uint32_t i,cnt;
+	int fd;
+
+	invtab = NULL;
+	buff = NULL;
+	fname = hdd_chunkdb_name(f,".chunkdb");
+	fd = open(fname,O_RDONLY);
+	if (fd<0) {
+		if (errno!=ENOENT) {
+			mfs_arg_errlog_silent(LOG_WARNING,"scanning folder %s: can't open chunk inventory",f->path);
+		}
+		free(fname);
+		return NULL;
+	}
+	if (fstat(fd,&sb)<0 || sb.st_size<8+4+4) {
+		syslog(LOG_WARNING,"scanning folder %s: chunk inventory is damaged - scanning whole folder",f->path);
+	} else {
+		buff = (uint8_t*) malloc(sb.st_size);
+		passert(buff);
+		if (read(fd,buff,sb.st_size)!=sb.st_size || memcmp(buff,CHUNKDB_MAGIC,8)!=0) {
+			syslog(LOG_WARNING,"scanning folder %s: chunk inventory is damaged - scanning whole folder",f->path);
+		} else {
+			rptr = buff+8;
+			cnt = get32bit(&rptr);
+			crcptr = buff+sb.st_size-4;
+			if ((uint64_t)cnt*CHUNKDB_ENTRYSIZE+8+4+4!=(uint64_t)sb.st_size || mycrc32(0,rptr,cnt*CHUNKDB_ENTRYSIZE)!=get32bit(&crcptr)) {
+				syslog(LOG_WARNING,"scanning folder %s: chunk inventory is damaged - scanning whole folder",f->path);
+			} else {
+				invtab = (invchunk*) malloc(sizeof(invchunk)*(cnt?cnt:1));
+				passert(invtab);
+				for (i=0 ; i<cnt ; i++) {
+					invtab[i].chunkid = get64bit(&rptr);
+					invtab[i].version = get32bit(&rptr);
+					invtab[i].seen = 0;
+				}
+				qsort(invtab,cnt,sizeof(invchunk),hdd_invchunk_cmp);
+				*count = cnt;
+			}
+		}
+	}
+	close(fd);
+	// inventory is valid only until first change of folder
+	if (unlink(fname)<0) {
+		mfs_arg_errlog_silent(LOG_WARNING,"scanning folder %s: can't remove chunk inventory",f->path);
+		if (invtab) {
+			free(invtab);
+			invtab = NULL;
+		}
+	}
+	if (buff) {
+		free(buff);
+	}
+	free(fname);
+	return invtab;
+}
+
+static invchunk* hdd_invchunk_find(invchunk *invtab,uint32_t count,uint64_t chunkid) {
+	uint32_t l,r,m;
+	l = 0;
+	r = count;
+	while (l<r) {
+		m = (l+r)/2;
+		if (invtab[m].chunkid<chunkid) {
+			l = m+1;
+		} else {
+			r = m;
+		}
+	}
+	if (l<count && invtab[l].chunkid==chunkid) {
+		return invtab+l;
+	}
+	return NULL;
+}
+
+// verification scan found file which is not in inventory (or has different version)
+static inline void hdd_verify_chunk(folder *f,const char *fullname,uint64_t chunkid,uint32_t version,uint8_t todel) {
+	chunk *c;
+	uint8_t known;
+	c = hdd_chunk_get(chunkid,CH_NEW_NONE);
+	if (c!=NULL) {
+		known = (c->filename!=NULL && strcmp(c->filename,fullname)==0)?1:0;	// file renamed by version change after loading
+		hdd_chunk_release(c);
+		if (known) {
+			return;
+		}
+	}
+	hdd_add_chunk(f,fullname,chunkid,version,todel);
+}
+
+// chunks from inventory not found by verification scan
+static void hdd_verify_missing(folder *f,invchunk *invtab,uint32_t count) {
+	chunk *c;
+	uint32_t i;
+	for (i=0 ; i<count ; i++) {
+		if (invtab[i].seen) {
+			continue;
+		}
+		c = hdd_chunk_get(invtab[i].chunkid,CH_NEW_NONE);
+		if (c==NULL) {
+			continue;
+		}
+		// chunk could be changed (version) or deleted by master after loading - check file itself
+		if (c->owner==f && c->version==invtab[i].version && c->filename && access(c->filename,F_OK)<0 && errno==ENOENT) {
+			syslog(LOG_WARNING,"scanning folder %s: chunk %016" PRIX64 "_%08" PRIX32 " from inventory not found",f->path,c->chunkid,c->version);
+			hdd_report_lost_chunk(c->chunkid);
+			hdd_chunk_delete(c);
+		} else {
+			hdd_chunk_release(c);
+		}
+	}
+}
+
 void* hdd_folder_scan(void *arg) {
 	folder *f = (folder*)arg;
 	DIR *dd;
@@ -3671,6 +4490,8 @@ void* hdd_folder_scan(void *arg) {
 	uint8_t scanterm,todel;
 	uint8_t lastperc,currentperc;
 	uint32_t lasttime,currenttime,begintime;
+	invchunk *invtab,*ic;
+	uint32_t invcount,i;
 
 	begintime = time(NULL);
 
@@ -3746,6 +4567,33 @@ void* hdd_folder_scan(void *arg) {
 		free(oldfullname);
 
 	}
+
+/* load inventory - chunks are known immediately and folder is scanned in background only to verify it */
+
+	invtab = NULL;
+	invcount = 0;
+	if (todel<2) {
+		invtab = hdd_chunkdb_load(f,&invcount);
+	}
+	if (invtab) {
+		for (i=0 ; i<invcount ; i++) {
+			fullname[plen-3]="0123456789ABCDEF"[(invtab[i].chunkid>>4)&15];
+			fullname[plen-2]="0123456789ABCDEF"[invtab[i].chunkid&15];
+			sprintf(fullname+plen,"chunk_%016" PRIX64 "_%08" PRIX32 ".mfs",invtab[i].chunkid,invtab[i].version);
+			hdd_add_chunk(f,fullname,invtab[i].chunkid,invtab[i].version,todel);
+		}
+		zassert(pthread_mutex_lock(&folderlock));
+		if (f->scanstate==SCST_SCANINPROGRESS) {
+			f->scanstate = SCST_VERIFYING;
+		}
+		f->chunksknown = 1;
+		zassert(pthread_mutex_unlock(&folderlock));
+		zassert(pthread_mutex_lock(&dclock));
+		hddspacechanged = 1;
+		zassert(pthread_mutex_unlock(&dclock));
+		syslog(LOG_NOTICE,"scanning folder %s: %" PRIu32 " chunks loaded from inventory (%" PRIu32 "s) - verifying in background",f->path,invcount,(uint32_t)(time(NULL))-begintime);
+	}
+
 /* scan new file names */
 
 	tcheckcnt = 0;
@@ -3762,7 +4610,16 @@ void* hdd_folder_scan(void *arg) {
 					continue;
 				}
 				memcpy(fullname+plen,de->d_name,36);
-				hdd_add_chunk(f,fullname,namechunkid,nameversion,todel);
+				if (invtab==NULL) {
+					hdd_add_chunk(f,fullname,namechunkid,nameversion,todel);
+				} else {
+					ic = hdd_invchunk_find(invtab,invcount,namechunkid);
+					if (ic && ic->version==nameversion) {
+						ic->seen = 1;
+					} else {
+						hdd_verify_chunk(f,fullname,namechunkid,nameversion,todel);
+					}
+				}
 				tcheckcnt++;
 				if (tcheckcnt>=1000) {
 					zassert(pthread_mutex_lock(&folderlock));
@@ -3794,12 +4651,20 @@ void* hdd_folder_scan(void *arg) {
 	free(destorage);
 //	fprintf(stderr,"hdd space manager: %s: %" PRIu32 " chunks found\n",f->path,f->chunkcount);
 
+	if (invtab) {
+		if (scanterm==0) {
+			hdd_verify_missing(f,invtab,invcount);
+		}
+		free(invtab);
+	}
+
 	hdd_testshuffle(f);
 
 	zassert(pthread_mutex_lock(&folderlock));
 		if (f->scanstate==SCST_SCANTERMINATE) {
 			syslog(LOG_NOTICE,"scanning folder %s: interrupted",f->path);
 		} else {
+			f->chunksknown = 1;
 			syslog(LOG_NOTICE,"scanning folder %s: complete (%" PRIu32 "s)",f->path,(uint32_t)(time(NULL))-begintime);
 		}
 	f->scanstate = SCST_SCANFINISHED;
@@ -3836,19 +4701,17 @@ void* hdd_delayed_thread(void *arg) {
 	return arg;
 }
 
-#ifndef PRESERVE_BLOCK
-# ifdef MMAP_ALLOC
+#ifdef MMAP_ALLOC
 void hdd_blockbuffer_free(void *addr) {
 	munmap(addr,MFSBLOCKSIZE);
 }
-# endif
 #endif
 
 void hdd_term(void) {
-	uint32_t i;
+	uint32_t i,s;
+	hashshard *hs;
 	folder *f,*fn;
 	chunk *c,*cn;
-	dopchunk *dc,*dcn;
 	cntcond *cc,*ccn;
 	lostchunk *lc,*lcn;
 	newchunk *nc,*ncn;
@@ -3867,7 +4730,7 @@ void hdd_term(void) {
 	zassert(pthread_mutex_lock(&folderlock));
 	i = 0;
 	for (f=folderhead ; f ; f=f->next) {
-		if (f->scanstate==SCST_SCANINPROGRESS) {
+		if (f->scanstate==SCST_SCANINPROGRESS || f->scanstate==SCST_VERIFYING) {
 			f->scanstate = SCST_SCANTERMINATE;
 		}
 		if (f->scanstate==SCST_SCANTERMINATE || f->scanstate==SCST_SCANFINISHED) {
@@ -3888,70 +4751,82 @@ void hdd_term(void) {
 		}
 		zassert(pthread_mutex_unlock(&folderlock));
 	}
-	for (i=0 ; i<HASHSIZE ; i++) {
-		for (c=hashtab[i] ; c ; c=cn) {
-			cn = c->next;
-			if (c->state==CH_AVAIL) {
-				if (c->crcchanged) {
-					syslog(LOG_WARNING,"hdd_term: CRC not flushed - writing now");
-					if (chunk_writecrc(c)!=STATUS_OK) {
-						mfs_arg_errlog_silent(LOG_WARNING,"hdd_term: file:%s - write error",c->filename);
+	for (f=folderhead ; f ; f=f->next) {
+		if (f->chunksknown && f->damaged==0 && f->toremove==0 && f->todel<2) {
+			hdd_chunkdb_store(f);
+		}
+	}
+	for (s=0 ; s<HASHSHARDS ; s++) {
+		hs = hashshards+s;
+		for (i=0 ; i<hs->size ; i++) {
+			for (c=hs->tab[i] ; c ; c=cn) {
+				cn = c->next;
+				if (c->state==CH_AVAIL) {
+					if (c->wbblocks>0) {
+						syslog(LOG_WARNING,"hdd_term: blocks not written - writing now");
+						hdd_chunk_flush(c);
 					}
-				}
-				if (c->fd>=0) {
-					close(c->fd);
-				}
-				if (c->crc!=NULL) {
+					if (c->crcchanged) {
+						syslog(LOG_WARNING,"hdd_term: CRC not flushed - writing now");
+						if (chunk_writecrc(c)!=STATUS_OK) {
+							mfs_arg_errlog_silent(LOG_WARNING,"hdd_term: file:%s - write error",c->filename);
+						}
+					}
+					if (c->fd>=0) {
+						close(c->fd);
+					}
+					if (c->crc!=NULL) {
 #ifdef MMAP_ALLOC
-					munmap((void*)(c->crc),4096);
+						munmap((void*)(c->crc),4096);
 #else
-					free(c->crc);
+						free(c->crc);
 #endif
+					}
+					if (c->vblocks!=NULL) {
+						free(c->vblocks);
+					}
+					if (c->wbuff!=NULL) {
+						free(c->wbuff);
+					}
+					if (c->filename) {
+						free(c->filename);
+					}
+					free(c);
+				} else {
+					syslog(LOG_WARNING,"hdd_term: locked chunk !!!");
 				}
-#ifdef PRESERVE_BLOCK
-				if (c->block!=NULL) {
-# ifdef MMAP_ALLOC
-					munmap((void*)(c->block),MFSBLOCKSIZE);
-# else
-					free(c->block);
-# endif
-				}
-#endif /* PRESERVE_BLOCK */
-				if (c->filename) {
-					free(c->filename);
-				}
-				free(c);
-			} else {
-				syslog(LOG_WARNING,"hdd_term: locked chunk !!!");
 			}
 		}
+		free(hs->tab);
+		hs->tab = NULL;
 	}
 	for (f=folderhead ; f ; f=fn) {
 		fn = f->next;
 		if (f->lfd>=0) {
 			close(f->lfd);
 		}
+		hdd_disktab_remove(f);
+		zassert(pthread_cond_destroy(&(f->fsynccond)));
+		zassert(pthread_mutex_destroy(&(f->fsynclock)));
 		free(f->path);
 		free(f);
 	}
-	for (i=0 ; i<DHASHSIZE ; i++) {
-		for (dc=dophashtab[i] ; dc ; dc=dcn) {
-			dcn = dc->next;
-			free(dc);
-		}
-	}
-	for (dc=newdopchunks ; dc ; dc=dcn) {
-		dcn = dc->next;
-		free(dc);
+	if (disktab) {
+		free(disktab);
+		disktab = NULL;
+		disktabsize = 0;
 	}
-	for (cc=cclist ; cc ; cc=ccn) {
-		ccn = cc->next;
-		if (cc->wcnt) {
-			syslog(LOG_WARNING,"hddspacemgr (atexit): used cond !!!");
-		} else {
-			zassert(pthread_cond_destroy(&(cc->cond)));
+	for (s=0 ; s<HASHSHARDS ; s++) {
+		for (cc=hashshards[s].cclist ; cc ; cc=ccn) {
+			ccn = cc->next;
+			if (cc->wcnt) {
+				syslog(LOG_WARNING,"hddspacemgr (atexit): used cond !!!");
+			} else {
+				zassert(pthread_cond_destroy(&(cc->cond)));
+			}
+			free(cc);
 		}
-		free(cc);
+		hashshards[s].cclist = NULL;
 	}
 	for (nc=newchunks ; nc ; nc=ncn) {
 		ncn = nc->next;
@@ -3965,6 +4840,7 @@ void hdd_term(void) {
 		dmcn = dmc->next;
 		free(dmc);
 	}
+	bcache_term();
 }
 
 int hdd_size_parse(const char *str,uint64_t *ret) {
@@ -4215,6 +5091,7 @@ int hdd_parseline(char *hddcfgline) {
 			if (f->damaged) {
 				f->scanstate = SCST_SCANNEEDED;
 				f->scanprogress = 0;
+				f->chunksknown = 0;
 				f->damaged = 0;
 				f->avail = 0ULL;
 				f->total = 0ULL;
@@ -4261,6 +5138,7 @@ int hdd_parseline(char *hddcfgline) {
 	f->damaged = 0;
 	f->scanstate = SCST_SCANNEEDED;
 	f->scanprogress = 0;
+	f->chunksknown = 0;
 	f->path = strdup(pptr);
 	passert(f->path);
 	f->toremove = 0;
@@ -4295,6 +5173,11 @@ int hdd_parseline(char *hddcfgline) {
 	f->testhead = NULL;
 	f->testtail = &(f->testhead);
 	f->carry = (double)(random()&0x7FFFFFFF)/(double)(0x7FFFFFFF);
+	zassert(pthread_mutex_init(&(f->fsynclock),NULL));
+	zassert(pthread_cond_init(&(f->fsynccond),NULL));
+	f->fsynchead = NULL;
+	f->fsyncleader = 0;
+	hdd_disktab_add(f);
 	f->next = folderhead;
 	folderhead = f;
 	testerreset = 1;
@@ -4378,12 +5261,60 @@ int hdd_folders_reinit(void) {
 	return ret;
 }
 
+static void hdd_batch_reload(void) {
+	WriteBatchBlocks = cfg_getuint32("HDD_WRITE_BATCH_BLOCKS",1);
+	if (WriteBatchBlocks<1) {
+		WriteBatchBlocks = 1;
+	}
+	if (WriteBatchBlocks>WRITEBATCH_MAXBLOCKS) {
+		WriteBatchBlocks = WRITEBATCH_MAXBLOCKS;
+	}
+	FsyncWindow = cfg_getuint32("HDD_FSYNC_WINDOW",0);
+	if (FsyncWindow>FSYNCWINDOW_MAX) {
+		FsyncWindow = FSYNCWINDOW_MAX;
+	}
+	FsyncWindow *= 1000;
+}
+
+static void hdd_cache_reload(void) {
+	char *CacheSizeStr;
+	uint64_t size;
+
+	CacheSizeStr = cfg_getstr("HDD_CRC_CACHE_SIZE","256MiB");
+	if (hdd_size_parse(CacheSizeStr,&CrcCacheSize)<0) {
+		syslog(LOG_NOTICE,"hdd space manager: HDD_CRC_CACHE_SIZE parse error - using default (256MiB)");
+		CrcCacheSize = 0x10000000;
+	}
+	free(CacheSizeStr);
+	FdCacheMax = cfg_getuint32("HDD_FD_CACHE",1000);
+	if (FdCacheMax>MFSMAXFILES/2) {
+		FdCacheMax = MFSMAXFILES/2;
+	}
+
+	CacheSizeStr = cfg_getstr("HDD_BLOCK_CACHE_SIZE","64MiB");
+	if (hdd_size_parse(CacheSizeStr,&size)<0) {
+		syslog(LOG_NOTICE,"hdd space manager: HDD_BLOCK_CACHE_SIZE parse error - using default (64MiB)");
+		size = 0x4000000;
+	}
+	free(CacheSizeStr);
+	if (size!=BlockCacheSize) {	// resizing drops cached blocks
+		BlockCacheSize = size;
+		bcache_setsize(BlockCacheSize);
+	}
+	ReadAheadBlocks = cfg_getuint32("HDD_READAHEAD_BLOCKS",8);
+	if (ReadAheadBlocks>READAHEAD_MAXBLOCKS) {
+		ReadAheadBlocks = READAHEAD_MAXBLOCKS;
+	}
+}
+
 void hdd_reload(void) {
 	char *LeaveFreeStr;
 
 	zassert(pthread_mutex_lock(&testlock));
 	HDDTestFreq = cfg_getuint32("HDD_TEST_FREQ",10);
 	zassert(pthread_mutex_unlock(&testlock));
+	hdd_batch_reload();
+	hdd_cache_reload();
 
 	LeaveFreeStr = cfg_getstr("HDD_LEAVE_SPACE_DEFAULT","256MiB");
 	if (hdd_size_parse(LeaveFreeStr,&LeaveFree)<0) {
@@ -4410,26 +5341,18 @@ int hdd_late_init(void) {
 }
 
 int hdd_init(void) {
-	uint32_t hp;
 	folder *f;
 	char *LeaveFreeStr;
 
 	// this routine is called at the beginning from the main thread so no locks are necessary here
-	for (hp=0 ; hp<HASHSIZE ; hp++) {
-		hashtab[hp] = NULL;
-	}
-	for (hp=0 ; hp<DHASHSIZE ; hp++) {
-		dophashtab[hp] = NULL;
-	}
+	hdd_hash_init();
 
-#ifndef PRESERVE_BLOCK
 	zassert(pthread_key_create(&hdrbufferkey,free));
-# ifdef MMAP_ALLOC
+#ifdef MMAP_ALLOC
 	zassert(pthread_key_create(&blockbufferkey,hdd_blockbuffer_free));
-# else
+#else
 	zassert(pthread_key_create(&blockbufferkey,free));
-# endif
-#endif /* PRESERVE_BLOCK */
+#endif
 
 	emptyblockcrc = mycrc32_zeroblock(0,MFSBLOCKSIZE);
 
@@ -4459,6 +5382,8 @@ int hdd_init(void) {
 	fprintf(stderr,"hdd space manager: start background hdd scanning (searching for available chunks)\n");
 
 	HDDTestFreq = cfg_getuint32("HDD_TEST_FREQ",10);
+	hdd_batch_reload();
+	hdd_cache_reload();
 
 	main_reloadregister(hdd_reload);
 	main_timeregister(TIMEMODE_RUN_LATE,60,0,hdd_diskinfo_movestats);
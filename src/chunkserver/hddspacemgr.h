@@ -25,6 +25,8 @@
 
 void hdd_stats(uint64_t *br,uint64_t *bw,uint32_t *opr,uint32_t *opw,uint32_t *dbr,uint32_t *dbw,uint32_t *dopr,uint32_t *dopw,uint64_t *rtime,uint64_t *wtime);
 void hdd_op_stats(uint32_t *op_create,uint32_t *op_delete,uint32_t *op_version,uint32_t *op_duplicate,uint32_t *op_truncate,uint32_t *op_duptrunc,uint32_t *op_test);
+void hdd_batch_stats(uint32_t *wbatches,uint32_t *wbatchblocks,uint32_t *fsyncbatches,uint32_t *fsyncchunks);
+void hdd_cache_stats(uint32_t *hits,uint32_t *misses);
 uint32_t hdd_errorcounter(void);
 
 /* lock/unlock pair */
@@ -50,11 +52,44 @@ void hdd_get_chunks_next_list_data(uint8_t *buff);
 int hdd_spacechanged(void);
 void hdd_get_space(uint64_t *usedspace,uint64_t *totalspace,uint32_t *chunkcount,uint64_t *tdusedspace,uint64_t *tdtotalspace,uint32_t *tdchunkcount);
 
+/* disk queues (bgjobs) - id of the disk (folder) with given chunk (0 - not found) and its device (queues are shared by folders on the same device) and queue stats */
+uint32_t hdd_chunk_diskid(uint64_t chunkid,uint64_t *devid);
+void hdd_stats_queue_add(uint32_t diskid);
+void hdd_stats_queue_start(uint32_t diskid,uint64_t qtime);
+
 /* I/O operations */
 int hdd_open(uint64_t chunkid);
 int hdd_close(uint64_t chunkid);
 int hdd_read(uint64_t chunkid,uint32_t version,uint16_t blocknum,uint8_t *buffer,uint32_t offset,uint32_t size,uint8_t *crcbuff);
+/* reads 'blocks' whole consecutive blocks (block i goes to buffers[i], its crc to crcbuffs[i]) */
+int hdd_read_blocks(uint64_t chunkid,uint32_t version,uint16_t blocknum,uint16_t blocks,uint8_t **buffers,uint8_t **crcbuffs);
+/* reads into block cache blocks following those read by last sequential hdd_read or hdd_read_blocks
+ * of the chunk (if it is still opened) - called by worker after the status of read is sent */
+void hdd_readahead(uint64_t chunkid);
+/* for sending whole blocks directly from chunk file (chunk has to be opened) - returns duplicated
+ * file descriptor, offset of the first block in file and stored crc of each block ; 'blocks' is
+ * decreased to number of blocks present in file (0 - they have to be read by hdd_read_blocks, also
+ * when chunk is being written) ; blocks not checked yet or not in page cache are read and their crc
+ * is checked, so it may wait for disk and should be called by background job */
+int hdd_read_fd(uint64_t chunkid,uint32_t version,uint16_t blocknum,uint16_t *blocks,int *fd,uint64_t *fileoffset,uint8_t *crcbuff);
+/* sends 'bytes' bytes from 'fileoffset' of descriptor returned by hdd_read_fd to non-blocking socket
+ * (stops when socket buffer is full) - offset and number of bytes left are updated ; file pages may
+ * be already evicted from page cache, so it should be called by background job */
+int hdd_sendfile(int sock,int fd,uint64_t *fileoffset,uint32_t *bytes);
+/* asynchronous version of hdd_read_blocks (chunk has to be opened) - begin zeroes blocks behind
+ * the end of chunk and returns number of blocks to read from file ('rblocks'), duplicated file
+ * descriptor, offset of the first block, device and id of the disk ; after reading rblocks blocks
+ * into buffers end checks their crc ('result' - return value of readv, 'rtime' - reading time).
+ * Neither of them waits for locked chunk (begin returns ERROR_LOCKED) and chunk isn't locked while
+ * reading, so end doesn't report errors - blocks could be changed meanwhile - and caller should
+ * read them again with hdd_read_blocks when end doesn't return STATUS_OK */
+int hdd_aread_begin(uint64_t chunkid,uint32_t version,uint16_t blocknum,uint16_t blocks,uint8_t **buffers,uint8_t **crcbuffs,uint16_t *rblocks,int *fd,uint64_t *fileoffset,uint64_t *devid,uint32_t *diskid);
+int hdd_aread_end(uint32_t diskid,uint16_t rblocks,uint8_t **buffers,uint8_t **crcbuffs,int32_t result,uint64_t rtime);
+/* returns ERROR_DELAYED when whole block is only collected with next adjacent blocks (HDD_WRITE_BATCH_BLOCKS>1)
+ * - it is in file after hdd_write returning STATUS_OK (last block of batch) or after hdd_flush */
 int hdd_write(uint64_t chunkid,uint32_t version,uint16_t blocknum,const uint8_t *buffer,uint32_t offset,uint32_t size,const uint8_t *crcbuff);
+/* writes collected blocks - returns ERROR_IO when any of them couldn't be written */
+int hdd_flush(uint64_t chunkid);
 
 /* chunk info */
 int hdd_check_version(uint64_t chunkid,uint32_t version);
@@ -89,4 +124,9 @@ int hdd_init(void);
 /* debug only */
 void hdd_test_show_chunks(void);
 void hdd_test_show_openedchunks(void);
+/* chunk index alone (hddindex_benchmark) - init instead of hdd_init, add chunk without file and
+ * find it the same way as I/O operations do (0 - not found) */
+void hdd_test_index_init(void);
+void hdd_test_chunk_add(uint64_t chunkid,uint32_t version);
+int hdd_test_chunk_find_release(uint64_t chunkid);
 #endif
@@ -1193,7 +1193,7 @@ int masterconn_init(void) {
 	}
 
 #ifdef BGJOBS
-	jpool = job_pool_new(10,BGJOBSCNT,&jobfd);
+	jpool = job_pool_new(10,cfg_getuint8("HDD_WORKERS_PER_DISK",4),BGJOBSCNT,&jobfd);
 	if (jpool==NULL) {
 		return -1;
 	}
@@ -688,7 +688,7 @@ uint8_t replicate(uint64_t chunkid,uint32_t version,uint8_t srccnt,const uint8_t
 				if (r.repsources[i].mode!=IDLE) {
 					rptr = r.repsources[i].packet;
 					status = hdd_write(chunkid,0,b,rptr+20,0,MFSBLOCKSIZE,rptr+16);
-					if (status!=STATUS_OK) {
+					if (status!=STATUS_OK && status!=ERROR_DELAYED) {	// delayed blocks are written by hdd_close at the end
 						syslog(LOG_WARNING,"replicator: write status: %s",mfsstrerr(status));
 						rep_cleanup(&r);
 						return status;
@@ -724,7 +724,7 @@ uint8_t replicate(uint64_t chunkid,uint32_t version,uint8_t srccnt,const uint8_t
 			wptr = r.xorbuff;
 			put32bit(&wptr,xcrc);
 			status = hdd_write(chunkid,0,b,r.xorbuff+4,0,MFSBLOCKSIZE,r.xorbuff);
-			if (status!=STATUS_OK) {
+			if (status!=STATUS_OK && status!=ERROR_DELAYED) {
 				syslog(LOG_WARNING,"replicator: xor write status: %s",mfsstrerr(status));
 				rep_cleanup(&r);
 				return status;
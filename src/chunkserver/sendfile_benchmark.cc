@@ -0,0 +1,223 @@
+// Compares CPU time needed by chunkserver to serve 1 GB of chunk data to a client when blocks
+// are read to memory, checked and written to socket (as csserv does by default) and when they
+// are sent directly from the file with sendfile (CSSERV_SENDFILE = 1).
+// Usage: sendfile_benchmark [file_mb [repeat [directory]]]
+// Data is sent over TCP loopback to a thread which discards it ; only CPU time of the sending
+// thread is counted. The file is read once before measuring, so disk speed doesn't matter.
+
+#include "config.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <netinet/in.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <sys/sendfile.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+#include "crc.h"
+#include "datapack.h"
+#include "MFSCommunication.h"
+
+#define CHUNKHDRSIZE (1024+4*1024)
+#define PACKETHDRSIZE (8+8+2+2+4+4)
+
+enum {MODE_READ_CRC,MODE_READ,MODE_SENDFILE,MODES};
+static const char *modename[MODES] = {"read+crc+write","read+write","sendfile"};
+
+static uint64_t now_usec(void) {
+	struct timeval tv;
+	gettimeofday(&tv,NULL);
+	return tv.tv_sec*UINT64_C(1000000)+tv.tv_usec;
+}
+
+static uint64_t thread_cpu_usec(void) {
+	struct rusage ru;
+	getrusage(RUSAGE_THREAD,&ru);
+	return (ru.ru_utime.tv_sec+ru.ru_stime.tv_sec)*UINT64_C(1000000)+ru.ru_utime.tv_usec+ru.ru_stime.tv_usec;
+}
+
+static int writeall(int sock,const uint8_t *buff,uint32_t leng) {
+	ssize_t i;
+	while (leng>0) {
+		i = write(sock,buff,leng);
+		if (i<=0) {
+			return -1;
+		}
+		buff += i;
+		leng -= i;
+	}
+	return 0;
+}
+
+static void* discard_thread(void *arg) {
+	int sock = *(int*)arg;
+	static uint8_t buff[0x100000];
+	while (read(sock,buff,sizeof(buff))>0) {
+	}
+	return NULL;
+}
+
+static void make_header(uint8_t *ptr,uint16_t blocknum,uint32_t crc) {
+	put32bit(&ptr,CSTOCL_READ_DATA);
+	put32bit(&ptr,8+2+2+4+4+MFSBLOCKSIZE);
+	put64bit(&ptr,1);
+	put16bit(&ptr,blocknum);
+	put16bit(&ptr,0);
+	put32bit(&ptr,MFSBLOCKSIZE);
+	put32bit(&ptr,crc);
+}
+
+// sends all blocks of the file in given mode, returns -1 on error
+static int serve(int fd,int sock,uint32_t blocks,const uint32_t *crcs,uint8_t mode) {
+	static uint8_t packet[PACKETHDRSIZE+MFSBLOCKSIZE];
+	uint32_t b,crc;
+	off_t offset;
+	ssize_t i;
+	uint32_t left;
+
+	for (b=0 ; b<blocks ; b++) {
+		offset = CHUNKHDRSIZE+((uint64_t)b<<MFSBLOCKBITS);
+		if (mode==MODE_SENDFILE) {
+			make_header(packet,b%MFSBLOCKSINCHUNK,crcs[b]);
+			if (writeall(sock,packet,PACKETHDRSIZE)<0) {
+				return -1;
+			}
+			left = MFSBLOCKSIZE;
+			while (left>0) {
+				i = sendfile(sock,fd,&offset,left);
+				if (i<=0) {
+					return -1;
+				}
+				left -= i;
+			}
+		} else {
+			if (pread(fd,packet+PACKETHDRSIZE,MFSBLOCKSIZE,offset)!=MFSBLOCKSIZE) {
+				return -1;
+			}
+			crc = crcs[b];
+			if (mode==MODE_READ_CRC) {
+				crc = mycrc32(0,packet+PACKETHDRSIZE,MFSBLOCKSIZE);
+				if (crc!=crcs[b]) {
+					fprintf(stderr,"crc error\n");
+					return -1;
+				}
+			}
+			make_header(packet,b%MFSBLOCKSINCHUNK,crc);
+			if (writeall(sock,packet,PACKETHDRSIZE+MFSBLOCKSIZE)<0) {
+				return -1;
+			}
+		}
+	}
+	return 0;
+}
+
+int main(int argc,char **argv) {
+	uint32_t filemb,repeat,blocks,b,r,i;
+	uint32_t *crcs;
+	uint8_t *buff;
+	const char *dir;
+	char fname[1024];
+	int fd,lsock,csock,ssock;
+	struct sockaddr_in sa;
+	socklen_t salen;
+	pthread_t th;
+	uint8_t mode;
+	uint64_t start,cpustart,usec,cpuusec;
+	double gb;
+
+	filemb = (argc>1)?strtoul(argv[1],NULL,10):1024;
+	repeat = (argc>2)?strtoul(argv[2],NULL,10):3;
+	dir = (argc>3)?argv[3]:"/tmp";
+	if (filemb==0 || repeat==0) {
+		fprintf(stderr,"file_mb and repeat have to be positive\n");
+		return 1;
+	}
+	mycrc32_init();
+	blocks = filemb*(0x100000/MFSBLOCKSIZE);
+	crcs = (uint32_t*)malloc(sizeof(uint32_t)*blocks);
+	buff = (uint8_t*)malloc(MFSBLOCKSIZE);
+	if (crcs==NULL || buff==NULL) {
+		fprintf(stderr,"out of memory\n");
+		return 1;
+	}
+	snprintf(fname,sizeof(fname),"%s/sendfile_benchmark.XXXXXX",dir);
+	fd = mkstemp(fname);
+	if (fd<0) {
+		fprintf(stderr,"can't create file in %s: %s\n",dir,strerror(errno));
+		return 1;
+	}
+	unlink(fname);
+	memset(buff,0,MFSBLOCKSIZE);
+	if (pwrite(fd,buff,CHUNKHDRSIZE,0)!=CHUNKHDRSIZE) {
+		fprintf(stderr,"write error\n");
+		return 1;
+	}
+	for (b=0 ; b<blocks ; b++) {
+		for (i=0 ; i<MFSBLOCKSIZE ; i++) {
+			buff[i] = (b*7+i*13)&0xFF;
+		}
+		crcs[b] = mycrc32(0,buff,MFSBLOCKSIZE);
+		if (pwrite(fd,buff,MFSBLOCKSIZE,CHUNKHDRSIZE+((uint64_t)b<<MFSBLOCKBITS))!=MFSBLOCKSIZE) {
+			fprintf(stderr,"write error\n");
+			return 1;
+		}
+	}
+
+	lsock = socket(AF_INET,SOCK_STREAM,0);
+	memset(&sa,0,sizeof(sa));
+	sa.sin_family = AF_INET;
+	sa.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	sa.sin_port = 0;
+	salen = sizeof(sa);
+	if (lsock<0 || bind(lsock,(struct sockaddr*)&sa,sizeof(sa))<0 || listen(lsock,1)<0 || getsockname(lsock,(struct sockaddr*)&sa,&salen)<0) {
+		fprintf(stderr,"can't listen on loopback: %s\n",strerror(errno));
+		return 1;
+	}
+	csock = socket(AF_INET,SOCK_STREAM,0);
+	if (csock<0 || connect(csock,(struct sockaddr*)&sa,sizeof(sa))<0) {
+		fprintf(stderr,"can't connect: %s\n",strerror(errno));
+		return 1;
+	}
+	ssock = accept(lsock,NULL,NULL);
+	if (ssock<0) {
+		fprintf(stderr,"can't accept: %s\n",strerror(errno));
+		return 1;
+	}
+	pthread_create(&th,NULL,discard_thread,&csock);
+
+	// warm up page cache
+	if (serve(fd,ssock,blocks,crcs,MODE_READ)<0) {
+		fprintf(stderr,"send error\n");
+		return 1;
+	}
+	gb = (double)blocks*MFSBLOCKSIZE/(1024.0*1024.0*1024.0);
+	for (r=0 ; r<repeat ; r++) {
+		for (mode=0 ; mode<MODES ; mode++) {
+			start = now_usec();
+			cpustart = thread_cpu_usec();
+			if (serve(fd,ssock,blocks,crcs,mode)<0) {
+				fprintf(stderr,"send error\n");
+				return 1;
+			}
+			cpuusec = thread_cpu_usec()-cpustart;
+			usec = now_usec()-start;
+			printf("%-15s: %8.1f MB/s ; cpu: %6.3f s/GB\n",modename[mode],blocks*(double)MFSBLOCKSIZE/usec,cpuusec/1000000.0/gb);
+		}
+	}
+	shutdown(ssock,SHUT_WR);
+	pthread_join(th,NULL);
+	close(ssock);
+	close(csock);
+	close(lsock);
+	close(fd);
+	free(buff);
+	free(crcs);
+	return 0;
+}
@@ -0,0 +1,264 @@
+/*
+   Copyright 2005-2010 Jakub Kruszona-Zawadzki, Gemius SA.
+
+   This file is part of MooseFS.
+
+   MooseFS is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, version 3.
+
+   MooseFS is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with MooseFS.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "config.h"
+
+#if defined(HAVE_LINUX_IO_URING_H) && defined(__linux__)
+#define USE_URING 1
+#endif
+
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include <errno.h>
+#include <sys/uio.h>
+
+#ifdef USE_URING
+#include <unistd.h>
+#include <poll.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+#endif
+
+#include "uring.h"
+
+#ifdef USE_URING
+
+typedef struct _uring {
+	int fd;
+	uint32_t tosubmit;
+	uint32_t sqentries;
+	unsigned *sqhead,*sqtail,*sqmask,*sqarray;
+	unsigned *cqhead,*cqtail,*cqmask;
+	struct io_uring_sqe *sqes;
+	struct io_uring_cqe *cqes;
+	void *sqptr,*cqptr;
+	size_t sqsize,cqsize,sqessize;
+} uring;
+
+static inline int uring_setup(uint32_t entries,struct io_uring_params *p) {
+	return syscall(__NR_io_uring_setup,entries,p);
+}
+
+static inline int uring_enter(int fd,uint32_t tosubmit,uint32_t waitnr,uint32_t flags) {
+	return syscall(__NR_io_uring_enter,fd,tosubmit,waitnr,flags,NULL,0);
+}
+
+void* uring_new(uint32_t entries) {
+	struct io_uring_params p;
+	uring *ur;
+	uint32_t i;
+
+	ur = (uring*) malloc(sizeof(uring));
+	if (ur==NULL) {
+		return NULL;
+	}
+	memset(&p,0,sizeof(p));
+	ur->fd = uring_setup(entries,&p);
+	if (ur->fd<0) {
+		free(ur);
+		return NULL;
+	}
+	ur->sqsize = p.sq_off.array + p.sq_entries*sizeof(unsigned);
+	ur->cqsize = p.cq_off.cqes + p.cq_entries*sizeof(struct io_uring_cqe);
+	if (p.features & IORING_FEAT_SINGLE_MMAP) {
+		if (ur->cqsize>ur->sqsize) {
+			ur->sqsize = ur->cqsize;
+		}
+		ur->cqsize = 0;
+	}
+	ur->sqptr = mmap(NULL,ur->sqsize,PROT_READ|PROT_WRITE,MAP_SHARED|MAP_POPULATE,ur->fd,IORING_OFF_SQ_RING);
+	if (ur->sqptr==MAP_FAILED) {
+		close(ur->fd);
+		free(ur);
+		return NULL;
+	}
+	if (ur->cqsize>0) {
+		ur->cqptr = mmap(NULL,ur->cqsize,PROT_READ|PROT_WRITE,MAP_SHARED|MAP_POPULATE,ur->fd,IORING_OFF_CQ_RING);
+		if (ur->cqptr==MAP_FAILED) {
+			munmap(ur->sqptr,ur->sqsize);
+			close(ur->fd);
+			free(ur);
+			return NULL;
+		}
+	} else {
+		ur->cqptr = ur->sqptr;
+	}
+	ur->sqessize = p.sq_entries*sizeof(struct io_uring_sqe);
+	ur->sqes = (struct io_uring_sqe*) mmap(NULL,ur->sqessize,PROT_READ|PROT_WRITE,MAP_SHARED|MAP_POPULATE,ur->fd,IORING_OFF_SQES);
+	if (ur->sqes==MAP_FAILED) {
+		if (ur->cqsize>0) {
+			munmap(ur->cqptr,ur->cqsize);
+		}
+		munmap(ur->sqptr,ur->sqsize);
+		close(ur->fd);
+		free(ur);
+		return NULL;
+	}
+	ur->sqhead = (unsigned*)((uint8_t*)(ur->sqptr)+p.sq_off.head);
+	ur->sqtail = (unsigned*)((uint8_t*)(ur->sqptr)+p.sq_off.tail);
+	ur->sqmask = (unsigned*)((uint8_t*)(ur->sqptr)+p.sq_off.ring_mask);
+	ur->sqarray = (unsigned*)((uint8_t*)(ur->sqptr)+p.sq_off.array);
+	ur->cqhead = (unsigned*)((uint8_t*)(ur->cqptr)+p.cq_off.head);
+	ur->cqtail = (unsigned*)((uint8_t*)(ur->cqptr)+p.cq_off.tail);
+	ur->cqmask = (unsigned*)((uint8_t*)(ur->cqptr)+p.cq_off.ring_mask);
+	ur->cqes = (struct io_uring_cqe*)((uint8_t*)(ur->cqptr)+p.cq_off.cqes);
+	ur->sqentries = p.sq_entries;
+	ur->tosubmit = 0;
+	// sqe number i is always in slot i of submission ring
+	for (i=0 ; i<p.sq_entries ; i++) {
+		ur->sqarray[i] = i;
+	}
+	return ur;
+}
+
+void uring_delete(void *urp) {
+	uring *ur = (uring*)urp;
+	munmap(ur->sqes,ur->sqessize);
+	if (ur->cqsize>0) {
+		munmap(ur->cqptr,ur->cqsize);
+	}
+	munmap(ur->sqptr,ur->sqsize);
+	close(ur->fd);
+	free(ur);
+}
+
+static inline struct io_uring_sqe* uring_get_sqe(uring *ur) {
+	unsigned head,tail;
+	struct io_uring_sqe *sqe;
+	head = __atomic_load_n(ur->sqhead,__ATOMIC_ACQUIRE);
+	tail = *(ur->sqtail);
+	if (tail-head>=ur->sqentries) {
+		return NULL;
+	}
+	sqe = ur->sqes+(tail & *(ur->sqmask));
+	memset(sqe,0,sizeof(struct io_uring_sqe));
+	return sqe;
+}
+
+static inline void uring_put_sqe(uring *ur) {
+	__atomic_store_n(ur->sqtail,*(ur->sqtail)+1,__ATOMIC_RELEASE);
+	ur->tosubmit++;
+}
+
+int uring_readv(void *urp,int fd,const struct iovec *iov,uint32_t iovcnt,uint64_t offset,uint64_t userdata) {
+	uring *ur = (uring*)urp;
+	struct io_uring_sqe *sqe;
+	sqe = uring_get_sqe(ur);
+	if (sqe==NULL) {
+		return -1;
+	}
+	sqe->opcode = IORING_OP_READV;
+	sqe->fd = fd;
+	sqe->off = offset;
+	sqe->addr = (uint64_t)(uintptr_t)iov;
+	sqe->len = iovcnt;
+	sqe->user_data = userdata;
+	uring_put_sqe(ur);
+	return 0;
+}
+
+int uring_poll(void *urp,int fd,uint64_t userdata) {
+	uring *ur = (uring*)urp;
+	struct io_uring_sqe *sqe;
+	sqe = uring_get_sqe(ur);
+	if (sqe==NULL) {
+		return -1;
+	}
+	sqe->opcode = IORING_OP_POLL_ADD;
+	sqe->fd = fd;
+	sqe->poll_events = POLLIN;
+	sqe->user_data = userdata;
+	uring_put_sqe(ur);
+	return 0;
+}
+
+int uring_submit(void *urp,uint32_t waitnr) {
+	uring *ur = (uring*)urp;
+	int ret;
+	if (ur->tosubmit==0 && waitnr==0) {
+		return 0;
+	}
+	ret = uring_enter(ur->fd,ur->tosubmit,waitnr,(waitnr>0)?IORING_ENTER_GETEVENTS:0);
+	if (ret<0) {
+		return -1;
+	}
+	ur->tosubmit -= ((uint32_t)ret<ur->tosubmit)?ret:ur->tosubmit;
+	return 0;
+}
+
+int uring_complete(void *urp,uint64_t *userdata,int32_t *result) {
+	uring *ur = (uring*)urp;
+	unsigned head;
+	struct io_uring_cqe *cqe;
+	head = *(ur->cqhead);
+	if (head==__atomic_load_n(ur->cqtail,__ATOMIC_ACQUIRE)) {
+		return 0;
+	}
+	cqe = ur->cqes+(head & *(ur->cqmask));
+	*userdata = cqe->user_data;
+	*result = cqe->res;
+	__atomic_store_n(ur->cqhead,head+1,__ATOMIC_RELEASE);
+	return 1;
+}
+
+#else /* USE_URING */
+
+void* uring_new(uint32_t entries) {
+	(void)entries;
+	errno = ENOSYS;
+	return NULL;
+}
+
+void uring_delete(void *urp) {
+	(void)urp;
+}
+
+int uring_readv(void *urp,int fd,const struct iovec *iov,uint32_t iovcnt,uint64_t offset,uint64_t userdata) {
+	(void)urp;
+	(void)fd;
+	(void)iov;
+	(void)iovcnt;
+	(void)offset;
+	(void)userdata;
+	return -1;
+}
+
+int uring_poll(void *urp,int fd,uint64_t userdata) {
+	(void)urp;
+	(void)fd;
+	(void)userdata;
+	return -1;
+}
+
+int uring_submit(void *urp,uint32_t waitnr) {
+	(void)urp;
+	(void)waitnr;
+	errno = ENOSYS;
+	return -1;
+}
+
+int uring_complete(void *urp,uint64_t *userdata,int32_t *result) {
+	(void)urp;
+	(void)userdata;
+	(void)result;
+	return 0;
+}
+
+#endif /* USE_URING */
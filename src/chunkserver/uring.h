@@ -0,0 +1,38 @@
+/*
+   Copyright 2005-2010 Jakub Kruszona-Zawadzki, Gemius SA.
+
+   This file is part of MooseFS.
+
+   MooseFS is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, version 3.
+
+   MooseFS is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with MooseFS.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _URING_H_
+#define _URING_H_
+
+#include <inttypes.h>
+#include <sys/uio.h>
+
+/* minimal io_uring wrapper (raw system calls, no liburing) - one thread submits and reaps */
+
+/* returns NULL when io_uring is not supported by system (or by this build) */
+void* uring_new(uint32_t entries);
+void uring_delete(void *ur);
+/* queue readv / poll request (iovecs have to stay valid until completion) ; returns -1 when submission queue is full */
+int uring_readv(void *ur,int fd,const struct iovec *iov,uint32_t iovcnt,uint64_t offset,uint64_t userdata);
+int uring_poll(void *ur,int fd,uint64_t userdata);
+/* submits queued requests and waits for at least 'waitnr' completions ; returns -1 on error (errno is set) */
+int uring_submit(void *ur,uint32_t waitnr);
+/* returns 1 and userdata with result (bytes or -errno) of one completed request, 0 if there is nothing */
+int uring_complete(void *ur,uint64_t *userdata,int32_t *result);
+
+#endif
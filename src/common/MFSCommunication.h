@@ -1066,6 +1066,40 @@
 #define MATOCL_FUSE_SETXATTR (PROTO_BASE+481)
 // msgid:32 status:8 
 
+// since 1.6.29
+// 0x01E2
+#define CLTOMA_FUSE_GETDIR_PAGE (PROTO_BASE+482)
+// msgid:32 inode:32 uid:32 gid:32 flags:8 cursor:64 maxsize:32
+//   cursor: 0 - from the beginning, otherwise one of the cursors returned by the master
+//   maxsize: requested size of answer (at least one entry is always sent)
+
+// 0x01E3
+#define MATOCL_FUSE_GETDIR_PAGE (PROTO_BASE+483)
+// msgid:32 status:8
+// msgid:32 nextcursor:64 N:32 N*[ cursor:64 ] N*[ name:NAME inode:32 type:8 ]	- when GETDIR_FLAG_WITHATTR in flags is not set
+// msgid:32 nextcursor:64 N:32 N*[ cursor:64 ] N*[ name:NAME inode:32 attr:35B ]	- when GETDIR_FLAG_WITHATTR in flags is set
+//   cursor - where to continue after given entry ; nextcursor - where to continue after this page (0 - end of directory)
+
+// since 1.6.29
+// 0x01E4
+#define CLTOMA_FUSE_LOOKUP_MULTI (PROTO_BASE+484)
+// msgid:32 N*[ inode:32 name:NAME uid:32 gid:32 ]
+
+// 0x01E5
+#define MATOCL_FUSE_LOOKUP_MULTI (PROTO_BASE+485)
+// msgid:32 status:8	- for broken packets
+// msgid:32 N*[ status:8 inode:32 attr:35B ]	- inode and attr are zeros when status is not STATUS_OK
+
+// since 1.6.29
+// 0x01E6
+#define CLTOMA_FUSE_GETATTR_MULTI (PROTO_BASE+486)
+// msgid:32 N*[ inode:32 uid:32 gid:32 ]
+
+// 0x01E7
+#define MATOCL_FUSE_GETATTR_MULTI (PROTO_BASE+487)
+// msgid:32 status:8	- for broken packets
+// msgid:32 N*[ status:8 attr:35B ]	- attr is zeros when status is not STATUS_OK
+
 
 
 /* Abandoned sub-project - directory entries cached on client side
@@ -1249,5 +1283,6 @@
 // 0x00259
 #define CSTOCL_HDD_LIST_V2 (PROTO_BASE+601)
 // N*[ entrysize:16 path:NAME flags:8 errchunkid:64 errtime:32 used:64 total:64 chunkscount:32 bytesread:64 usecread:64 usecreadmax:64 byteswriten:64 usecwrite:64 usecwritemax:64]
+// since 1.6.29 entry is followed by disk queue stats: queuedjobs:32 3*[usecqueue:64 queueops:32 usecqueuemax:32] (last min, hour, day)
 
 #endif
@@ -22,7 +22,95 @@
 #include <stdlib.h>
 #include <generic_crc.h>
 
+#ifndef WORDS_BIGENDIAN
+# if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#  define CRC_PCLMUL 1
+#  include <cpuid.h>
+#  include <wmmintrin.h>
+#  include <smmintrin.h>
+# endif
+# if defined(__aarch64__) && defined(__ARM_FEATURE_CRYPTO) && defined(__linux__)
+#  define CRC_PMULL 1
+#  include <arm_neon.h>
+#  include <sys/auxv.h>
+# endif
+#endif
+
 #include "MFSCommunication.h"
+#include "crc.h"
+
+/* crc_combine */
+
+static uint32_t crc_combine_table[32][4][256];
+
+static void crc_matrix_square(uint32_t sqr[32], uint32_t m[32]) {
+	uint32_t i,j,s,v;
+	for (i=0; i<32; i++) {
+		for (j=0,s=0,v=m[i] ; v && j<32 ; j++, v>>=1) {
+			if (v&1) {
+				s^=m[j];
+			}
+		}
+		sqr[i] = s;
+	}
+}
+
+static void crc_generate_combine_tables(void) {
+	uint32_t i,j,k,l,sum;
+	uint32_t m1[32],m2[32],*mc,*m;
+	m1[0]=CRC_POLY;
+	j=1;
+	for (i=1 ; i<32 ; i++) {
+		m1[i]=j;
+		j<<=1;
+	}
+	crc_matrix_square(m2,m1); // 1 bit -> 2 bits
+	crc_matrix_square(m1,m2); // 2 bits -> 4 bits
+
+	for (i=0 ; i<32 ; i++) {
+		if (i&1) {
+			crc_matrix_square(m1,m2);
+			mc = m1;
+		} else {
+			crc_matrix_square(m2,m1);
+			mc = m2;
+		}
+		for (j=0 ; j<4 ; j++) {
+			for (k=0 ; k<256 ; k++) {
+				sum = 0;
+				l=k;
+				m=mc+(j*8);
+				while (l) {
+					if (l&1) {
+						sum ^= *m;
+					}
+					l>>=1;
+					m++;
+				}
+				crc_combine_table[i][j][k]=sum;
+			}
+		}
+	}
+}
+
+static uint32_t crc_combine(uint32_t crc1, uint32_t crc2, uint32_t leng2) {
+	uint8_t i;
+
+	/* add leng2 zeros to crc1 */
+	i=0;
+	while (leng2) {
+		if (leng2&1) {
+			crc1 = crc_combine_table[i][3][(crc1>>24)] \
+			     ^ crc_combine_table[i][2][(crc1>>16)&0xFF] \
+			     ^ crc_combine_table[i][1][(crc1>>8)&0xFF] \
+			     ^ crc_combine_table[i][0][crc1&0xFF];
+		}
+		i++;
+		leng2>>=1;
+	};
+	/* then combine crc1 and crc2 as output */
+	return crc1^crc2;
+}
 
 /*
  * CRC implementation from crcutil supports only little endian machines.
@@ -32,16 +120,239 @@
 
 static crcutil::GenericCrc<uint64_t, uint64_t, uint64_t, 4> gCrc(CRC_POLY, 32, true);
 
-uint32_t mycrc32(uint32_t crc, const uint8_t *block, uint32_t leng) {
+static uint32_t crc_generic(uint32_t crc, const uint8_t *block, uint32_t leng) {
 	return gCrc.CrcDefault(block, leng, crc);
 }
 
+/*
+ * Folding with carry-less multiplication, as described in Intel's paper "Fast CRC Computation
+ * for Generic Polynomials Using PCLMULQDQ Instruction". Constants are for CRC_POLY (bit reflected):
+ * x^(4*128+32), x^(4*128-32), x^(128+32), x^(128-32), x^64 mod P, P and floor(x^64/P).
+ * Four 128-bit lanes are folded 64 bytes ahead, then into one lane, which is reduced to 32 bits.
+ * Buffers shorter than 64 bytes and the last few bytes are done by crcutil.
+ */
+#define CRC_K1 UINT64_C(0x154442bd4)
+#define CRC_K2 UINT64_C(0x1c6e41596)
+#define CRC_K3 UINT64_C(0x1751997d0)
+#define CRC_K4 UINT64_C(0x0ccaa009e)
+#define CRC_K5 UINT64_C(0x163cd6124)
+#define CRC_P  UINT64_C(0x1db710641)
+#define CRC_U  UINT64_C(0x1f7011641)
+
+#ifdef CRC_PCLMUL
+
+#define CRC_PCLMUL_FOLD(x,k,data) { \
+	__m128i t = _mm_clmulepi64_si128(x, k, 0x00); \
+	x = _mm_clmulepi64_si128(x, k, 0x11); \
+	x = _mm_xor_si128(_mm_xor_si128(x, t), data); \
+}
+
+__attribute__((target("pclmul,sse4.1")))
+static uint32_t crc_pclmul(uint32_t crc, const uint8_t *block, uint32_t leng) {
+	__m128i x1, x2, x3, x4, k, t, mask;
+
+	if (leng < 64) {
+		return crc_generic(crc, block, leng);
+	}
+	x1 = _mm_loadu_si128((const __m128i*)block);
+	x2 = _mm_loadu_si128((const __m128i*)(block + 16));
+	x3 = _mm_loadu_si128((const __m128i*)(block + 32));
+	x4 = _mm_loadu_si128((const __m128i*)(block + 48));
+	x1 = _mm_xor_si128(x1, _mm_cvtsi32_si128(crc ^ 0xFFFFFFFF));
+	block += 64;
+	leng -= 64;
+
+	k = _mm_set_epi64x(CRC_K2, CRC_K1);
+	while (leng >= 64) {
+		CRC_PCLMUL_FOLD(x1, k, _mm_loadu_si128((const __m128i*)block));
+		CRC_PCLMUL_FOLD(x2, k, _mm_loadu_si128((const __m128i*)(block + 16)));
+		CRC_PCLMUL_FOLD(x3, k, _mm_loadu_si128((const __m128i*)(block + 32)));
+		CRC_PCLMUL_FOLD(x4, k, _mm_loadu_si128((const __m128i*)(block + 48)));
+		block += 64;
+		leng -= 64;
+	}
+
+	k = _mm_set_epi64x(CRC_K4, CRC_K3);
+	CRC_PCLMUL_FOLD(x1, k, x2);
+	CRC_PCLMUL_FOLD(x1, k, x3);
+	CRC_PCLMUL_FOLD(x1, k, x4);
+	while (leng >= 16) {
+		CRC_PCLMUL_FOLD(x1, k, _mm_loadu_si128((const __m128i*)block));
+		block += 16;
+		leng -= 16;
+	}
+
+	// 128 bits -> 64 bits
+	t = _mm_clmulepi64_si128(k, x1, 0x01);
+	x1 = _mm_xor_si128(_mm_srli_si128(x1, 8), t);
+	mask = _mm_set_epi32(0, 0, 0, -1);
+	t = _mm_srli_si128(x1, 4);
+	x1 = _mm_clmulepi64_si128(_mm_and_si128(x1, mask), _mm_set_epi64x(0, CRC_K5), 0x00);
+	x1 = _mm_xor_si128(x1, t);
+	// Barrett reduction 64 bits -> 32 bits
+	k = _mm_set_epi64x(CRC_U, CRC_P);
+	t = x1;
+	x1 = _mm_clmulepi64_si128(_mm_and_si128(x1, mask), k, 0x10);
+	x1 = _mm_clmulepi64_si128(_mm_and_si128(x1, mask), k, 0x00);
+	x1 = _mm_xor_si128(x1, t);
+	crc = _mm_extract_epi32(x1, 1) ^ 0xFFFFFFFF;
+
+	if (leng > 0) {
+		crc = crc_generic(crc, block, leng);
+	}
+	return crc;
+}
+
+static int crc_pclmul_supported(void) {
+	unsigned int eax, ebx, ecx, edx;
+	if (__get_cpuid(1, &eax, &ebx, &ecx, &edx) == 0) {
+		return 0;
+	}
+	return ((ecx & bit_PCLMUL) && (ecx & bit_SSE4_1)) ? 1 : 0;
+}
+
+#endif // CRC_PCLMUL
+
+#ifdef CRC_PMULL
+
+static inline uint64x2_t crc_pmull_lo(uint64x2_t a, uint64x2_t b) {
+	return vreinterpretq_u64_p128(vmull_p64((poly64_t)vgetq_lane_u64(a, 0), (poly64_t)vgetq_lane_u64(b, 0)));
+}
+
+static inline uint64x2_t crc_pmull_hi(uint64x2_t a, uint64x2_t b) {
+	return vreinterpretq_u64_p128(vmull_high_p64(vreinterpretq_p64_u64(a), vreinterpretq_p64_u64(b)));
+}
+
+#define CRC_PMULL_FOLD(x,k,data) { \
+	uint64x2_t t = crc_pmull_lo(x, k); \
+	x = crc_pmull_hi(x, k); \
+	x = veorq_u64(veorq_u64(x, t), data); \
+}
+
+#define CRC_PMULL_LOAD(ptr) vreinterpretq_u64_u8(vld1q_u8(ptr))
+
+// the same algorithm as crc_pclmul
+static uint32_t crc_pmull(uint32_t crc, const uint8_t *block, uint32_t leng) {
+	uint64x2_t x1, x2, x3, x4, k, t, mask, zero;
+
+	if (leng < 64) {
+		return crc_generic(crc, block, leng);
+	}
+	x1 = CRC_PMULL_LOAD(block);
+	x2 = CRC_PMULL_LOAD(block + 16);
+	x3 = CRC_PMULL_LOAD(block + 32);
+	x4 = CRC_PMULL_LOAD(block + 48);
+	x1 = veorq_u64(x1, vcombine_u64(vcreate_u64(crc ^ 0xFFFFFFFF), vcreate_u64(0)));
+	block += 64;
+	leng -= 64;
+
+	k = vcombine_u64(vcreate_u64(CRC_K1), vcreate_u64(CRC_K2));
+	while (leng >= 64) {
+		CRC_PMULL_FOLD(x1, k, CRC_PMULL_LOAD(block));
+		CRC_PMULL_FOLD(x2, k, CRC_PMULL_LOAD(block + 16));
+		CRC_PMULL_FOLD(x3, k, CRC_PMULL_LOAD(block + 32));
+		CRC_PMULL_FOLD(x4, k, CRC_PMULL_LOAD(block + 48));
+		block += 64;
+		leng -= 64;
+	}
+
+	k = vcombine_u64(vcreate_u64(CRC_K3), vcreate_u64(CRC_K4));
+	CRC_PMULL_FOLD(x1, k, x2);
+	CRC_PMULL_FOLD(x1, k, x3);
+	CRC_PMULL_FOLD(x1, k, x4);
+	while (leng >= 16) {
+		CRC_PMULL_FOLD(x1, k, CRC_PMULL_LOAD(block));
+		block += 16;
+		leng -= 16;
+	}
+
+	// 128 bits -> 64 bits
+	zero = vdupq_n_u64(0);
+	t = crc_pmull_lo(x1, vcombine_u64(vcreate_u64(CRC_K4), vcreate_u64(0)));
+	x1 = veorq_u64(vreinterpretq_u64_u8(vextq_u8(vreinterpretq_u8_u64(x1), vreinterpretq_u8_u64(zero), 8)), t);
+	mask = vcombine_u64(vcreate_u64(0xFFFFFFFF), vcreate_u64(0));
+	t = vreinterpretq_u64_u8(vextq_u8(vreinterpretq_u8_u64(x1), vreinterpretq_u8_u64(zero), 4));
+	x1 = crc_pmull_lo(vandq_u64(x1, mask), vcombine_u64(vcreate_u64(CRC_K5), vcreate_u64(0)));
+	x1 = veorq_u64(x1, t);
+	// Barrett reduction 64 bits -> 32 bits
+	t = x1;
+	x1 = crc_pmull_lo(vandq_u64(x1, mask), vcombine_u64(vcreate_u64(CRC_U), vcreate_u64(0)));
+	x1 = crc_pmull_lo(vandq_u64(x1, mask), vcombine_u64(vcreate_u64(CRC_P), vcreate_u64(0)));
+	x1 = veorq_u64(x1, t);
+	crc = vgetq_lane_u32(vreinterpretq_u32_u64(x1), 1) ^ 0xFFFFFFFF;
+
+	if (leng > 0) {
+		crc = crc_generic(crc, block, leng);
+	}
+	return crc;
+}
+
+static int crc_pmull_supported(void) {
+	return (getauxval(AT_HWCAP) & HWCAP_PMULL) ? 1 : 0;
+}
+
+#endif // CRC_PMULL
+
+typedef struct _crckernel {
+	const char *name;
+	mycrc32_fn fn;
+	int (*supported)(void);
+} crckernel;
+
+// from the slowest to the fastest
+static const crckernel crckernels[] = {
+	{"crcutil", crc_generic, NULL},
+#ifdef CRC_PCLMUL
+	{"pclmul", crc_pclmul, crc_pclmul_supported},
+#endif
+#ifdef CRC_PMULL
+	{"pmull", crc_pmull, crc_pmull_supported},
+#endif
+};
+
+#define CRCKERNELS (sizeof(crckernels)/sizeof(crckernel))
+
+// crcutil is used until mycrc32_init is called
+static mycrc32_fn crc_kernel = crc_generic;
+static uint8_t crc_combine_ready = 0;
+
+uint32_t mycrc32(uint32_t crc, const uint8_t *block, uint32_t leng) {
+	return crc_kernel(crc, block, leng);
+}
+
 uint32_t mycrc32_combine(uint32_t crc1, uint32_t crc2, uint32_t leng2) {
+	if (crc_combine_ready) {
+		return crc_combine(crc1, crc2, leng2);
+	}
 	return gCrc.Base().Concatenate(crc1, crc2, leng2);
 }
 
 void mycrc32_init(void) {
-	// This implementation does not need any initialization
+	uint32_t i;
+	if (crc_combine_ready == 0) {
+		crc_generate_combine_tables();
+		crc_combine_ready = 1;
+	}
+	for (i = 0; i < CRCKERNELS; i++) {
+		if (crckernels[i].supported == NULL || crckernels[i].supported()) {
+			crc_kernel = crckernels[i].fn;
+		}
+	}
+}
+
+uint32_t mycrc32_kernels(const char **names, mycrc32_fn *kernels, uint32_t max) {
+	uint32_t i, n;
+	n = 0;
+	for (i = 0; i < CRCKERNELS; i++) {
+		if (crckernels[i].supported == NULL || crckernels[i].supported()) {
+			if (n < max) {
+				names[n] = crckernels[i].name;
+				kernels[n] = crckernels[i].fn;
+			}
+			n++;
+		}
+	}
+	return n;
 }
 
 #else // WORDS_BIGENDIAN; Use old code, which supports both big endian and little endian
@@ -131,77 +442,8 @@ uint32_t mycrc32(uint32_t crc,const uint8_t *block,uint32_t leng) {
 	return crc;
 }
 
-/* crc_combine */
-
-static uint32_t crc_combine_table[32][4][256];
-
-static void crc_matrix_square(uint32_t sqr[32], uint32_t m[32]) {
-	uint32_t i,j,s,v;
-	for (i=0; i<32; i++) {
-		for (j=0,s=0,v=m[i] ; v && j<32 ; j++, v>>=1) {
-			if (v&1) {
-				s^=m[j];
-			}
-		}
-		sqr[i] = s;
-	}
-}
-
-static void crc_generate_combine_tables(void) {
-	uint32_t i,j,k,l,sum;
-	uint32_t m1[32],m2[32],*mc,*m;
-	m1[0]=CRC_POLY;
-	j=1;
-	for (i=1 ; i<32 ; i++) {
-		m1[i]=j;
-		j<<=1;
-	}
-	crc_matrix_square(m2,m1); // 1 bit -> 2 bits
-	crc_matrix_square(m1,m2); // 2 bits -> 4 bits
-
-	for (i=0 ; i<32 ; i++) {
-		if (i&1) {
-			crc_matrix_square(m1,m2);
-			mc = m1;
-		} else {
-			crc_matrix_square(m2,m1);
-			mc = m2;
-		}
-		for (j=0 ; j<4 ; j++) {
-			for (k=0 ; k<256 ; k++) {
-				sum = 0;
-				l=k;
-				m=mc+(j*8);
-				while (l) {
-					if (l&1) {
-						sum ^= *m;
-					}
-					l>>=1;
-					m++;
-				}
-				crc_combine_table[i][j][k]=sum;
-			}
-		}
-	}
-}
-
 uint32_t mycrc32_combine(uint32_t crc1, uint32_t crc2, uint32_t leng2) {
-	uint8_t i;
-
-	/* add leng2 zeros to crc1 */
-	i=0;
-	while (leng2) {
-		if (leng2&1) {
-			crc1 = crc_combine_table[i][3][(crc1>>24)] \
-			     ^ crc_combine_table[i][2][(crc1>>16)&0xFF] \
-			     ^ crc_combine_table[i][1][(crc1>>8)&0xFF] \
-			     ^ crc_combine_table[i][0][crc1&0xFF];
-		}
-		i++;
-		leng2>>=1;
-	};
-	/* then combine crc1 and crc2 as output */
-	return crc1^crc2;
+	return crc_combine(crc1,crc2,leng2);
 }
 
 void mycrc32_init(void) {
@@ -209,4 +451,12 @@ void mycrc32_init(void) {
 	crc_generate_combine_tables();
 }
 
+uint32_t mycrc32_kernels(const char **names,mycrc32_fn *kernels,uint32_t max) {
+	if (max>0) {
+		names[0] = "table";
+		kernels[0] = mycrc32;
+	}
+	return 1;
+}
+
 #endif // WORDS_BIGENDIAN
@@ -28,4 +28,8 @@ uint32_t mycrc32_combine(uint32_t crc1, uint32_t crc2, uint32_t leng2);
 
 void mycrc32_init(void);
 
+/* implementations of mycrc32 usable on this cpu (after mycrc32_init the last one is used by mycrc32) ; for tests and benchmarks */
+typedef uint32_t (*mycrc32_fn)(uint32_t crc,const uint8_t *block,uint32_t leng);
+uint32_t mycrc32_kernels(const char **names,mycrc32_fn *kernels,uint32_t max);
+
 #endif
@@ -0,0 +1,93 @@
+// Measures speed of every crc32 implementation usable on this cpu (crcutil tables and
+// carry-less multiplication - pclmul on x86, pmull on ARM) on 64 KiB blocks, like chunkserver
+// and clients do, and speed of mycrc32_combine with crcutil and with the combine tables.
+// Usage: crc_benchmark [buffer_mb [repeat]]
+// The buffer is small enough (default 4 MB) to stay in cache, so memory speed doesn't matter.
+
+#include "config.h"
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/time.h>
+
+#include "crc.h"
+#include "MFSCommunication.h"
+
+#define MAXKERNELS 8
+#define COMBINES 10000000
+
+static volatile uint32_t combined;
+
+static uint64_t now_usec(void) {
+	struct timeval tv;
+	gettimeofday(&tv,NULL);
+	return tv.tv_sec*UINT64_C(1000000)+tv.tv_usec;
+}
+
+static uint64_t combine_usec(void) {
+	uint64_t start;
+	uint32_t i,crc;
+	crc = 0;
+	start = now_usec();
+	for (i=0 ; i<COMBINES ; i++) {
+		crc = mycrc32_combine(crc,i,(i*2654435761U)%MFSBLOCKSIZE);
+	}
+	combined = crc;
+	return now_usec()-start;
+}
+
+int main(int argc,char **argv) {
+	uint32_t buffmb,repeat,blocks,b,r,k,kernelscnt,crc;
+	const char *names[MAXKERNELS];
+	mycrc32_fn kernels[MAXKERNELS];
+	uint32_t crcs[MAXKERNELS];
+	uint8_t *buff;
+	uint64_t start,usec,i;
+
+	buffmb = (argc>1)?strtoul(argv[1],NULL,10):4;
+	repeat = (argc>2)?strtoul(argv[2],NULL,10):100;
+	if (buffmb==0 || repeat==0) {
+		fprintf(stderr,"buffer_mb and repeat have to be positive\n");
+		return 1;
+	}
+	blocks = buffmb*(0x100000/MFSBLOCKSIZE);
+	buff = (uint8_t*)malloc((uint64_t)blocks*MFSBLOCKSIZE);
+	if (buff==NULL) {
+		fprintf(stderr,"out of memory\n");
+		return 1;
+	}
+	for (i=0 ; i<(uint64_t)blocks*MFSBLOCKSIZE ; i++) {
+		buff[i] = (i*13+i/MFSBLOCKSIZE)&0xFF;
+	}
+
+	// combine tables are built by mycrc32_init, before that crcutil is used
+	usec = combine_usec();
+	printf("%-10s: combine %12.0f/s\n","crcutil",COMBINES*1000000.0/(usec?usec:1));
+	mycrc32_init();
+	usec = combine_usec();
+	printf("%-10s: combine %12.0f/s\n","tables",COMBINES*1000000.0/(usec?usec:1));
+
+	kernelscnt = mycrc32_kernels(names,kernels,MAXKERNELS);
+	if (kernelscnt>MAXKERNELS) {
+		kernelscnt = MAXKERNELS;
+	}
+	for (k=0 ; k<kernelscnt ; k++) {
+		crc = 0;
+		start = now_usec();
+		for (r=0 ; r<repeat ; r++) {
+			for (b=0 ; b<blocks ; b++) {
+				crc ^= kernels[k](0,buff+(uint64_t)b*MFSBLOCKSIZE,MFSBLOCKSIZE);
+			}
+		}
+		usec = now_usec()-start;
+		crcs[k] = crc;
+		printf("%-10s: %8.2f GB/s%s\n",names[k],(double)blocks*repeat*MFSBLOCKSIZE/(usec?usec:1)/1000.0,(k+1==kernelscnt)?" (used by mycrc32)":"");
+		if (crcs[k]!=crcs[0]) {
+			fprintf(stderr,"%s: wrong crc\n",names[k]);
+			return 1;
+		}
+	}
+	free(buff);
+	return 0;
+}
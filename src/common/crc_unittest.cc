@@ -44,3 +44,23 @@ TEST(CrcTests, MyCrc32Combine) {
 		EXPECT_EQ(crc, combined);
 	}
 }
+
+TEST(CrcTests, MyCrc32Kernels) {
+	std::vector<uint8_t> data(MFSBLOCKSIZE + 16);
+	for (size_t i = 0; i < data.size(); ++i) {
+		data[i] = i * 7 + 3;
+	}
+	const char *names[8];
+	mycrc32_fn kernels[8];
+	uint32_t count = mycrc32_kernels(names, kernels, 8);
+	ASSERT_GE(count, 1U);
+	for (uint32_t k = 1; k < count; ++k) {
+		SCOPED_TRACE(std::string("Testing kernel ") + names[k]);
+		for (size_t offset : {0, 1, 7}) {
+			for (size_t length : {0, 1, 15, 63, 64, 65, 127, 128, 1000, 4096, MFSBLOCKSIZE}) {
+				EXPECT_EQ(kernels[0](0x12345678, data.data() + offset, length),
+						kernels[k](0x12345678, data.data() + offset, length));
+			}
+		}
+	}
+}
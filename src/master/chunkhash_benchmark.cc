@@ -0,0 +1,225 @@
+// Compares the old fixed chunk hash (2^20 buckets) with the growing chunk hash used by chunks.cc.
+// Usage: chunkhash_benchmark [maxchunks [lookups]]
+// Chunk counts are doubled from 1M up to maxchunks (default 32M). For each count it prints
+// chunk_find throughput and the time of a full sweep over all buckets (what the jobs loop
+// and chunk_store do).
+
+#include "config.h"
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+
+#define FIXEDHASHSIZE 0x100000
+#define FIXEDHASHPOS(chunkid) (((uint32_t)chunkid)&0xFFFFF)
+
+#define HASHINITSIZE 0x100000
+#define HASHMAXLOAD 2
+#define HASHSPLITSTEPS 2
+
+// roughly the size of chunk
+typedef struct _chunk {
+	uint64_t chunkid;
+	uint8_t data[32];
+	struct _chunk *next;
+} chunk;
+
+typedef struct _growhash {
+	chunk **hash;
+	uint32_t size;
+	uint32_t splitpos;
+	uint32_t elements;
+} growhash;
+
+static uint64_t now_usec(void) {
+	struct timeval tv;
+	gettimeofday(&tv,NULL);
+	return tv.tv_sec*UINT64_C(1000000)+tv.tv_usec;
+}
+
+static inline uint32_t next_random(uint64_t *state) {
+	*state = *state * UINT64_C(6364136223846793005) + UINT64_C(1442695040888963407);
+	return *state >> 32;
+}
+
+// same algorithm as chunk_hash_split, chunk_hash_grow and chunk_hashpos in chunks.cc
+static inline void grow_split(growhash *g,uint32_t steps) {
+	uint32_t half;
+	chunk *c,**lo,**hi;
+	half = g->size/2;
+	while (steps>0 && g->splitpos<half) {
+		c = g->hash[g->splitpos];
+		lo = g->hash+g->splitpos;
+		hi = g->hash+g->splitpos+half;
+		while (c) {
+			if (c->chunkid&half) {
+				*hi = c;
+				hi = &(c->next);
+			} else {
+				*lo = c;
+				lo = &(c->next);
+			}
+			c = c->next;
+		}
+		*lo = NULL;
+		*hi = NULL;
+		g->splitpos++;
+		steps--;
+	}
+}
+
+static inline int grow_grow(growhash *g) {
+	chunk **newhash;
+	if (g->elements<=(uint64_t)g->size*HASHMAXLOAD || g->splitpos<g->size/2) {
+		return 0;
+	}
+	newhash = (chunk**)realloc(g->hash,sizeof(chunk*)*g->size*2);
+	if (newhash==NULL) {
+		return -1;
+	}
+	memset(newhash+g->size,0,sizeof(chunk*)*g->size);
+	g->hash = newhash;
+	g->splitpos = 0;
+	g->size *= 2;
+	return 0;
+}
+
+static inline uint32_t grow_pos(const growhash *g,uint64_t chunkid) {
+	uint32_t pos,half;
+	pos = ((uint32_t)chunkid)&(g->size-1);
+	half = g->size/2;
+	if (pos>=half && pos-half>=g->splitpos) {
+		pos -= half;
+	}
+	return pos;
+}
+
+static inline chunk* fixed_find(chunk **hash,uint64_t chunkid) {
+	chunk *c;
+	for (c=hash[FIXEDHASHPOS(chunkid)] ; c ; c=c->next) {
+		if (c->chunkid==chunkid) {
+			return c;
+		}
+	}
+	return NULL;
+}
+
+static inline chunk* grow_find(const growhash *g,uint64_t chunkid) {
+	chunk *c;
+	for (c=g->hash[grow_pos(g,chunkid)] ; c ; c=c->next) {
+		if (c->chunkid==chunkid) {
+			return c;
+		}
+	}
+	return NULL;
+}
+
+static uint64_t sweep(chunk **hash,uint32_t size) {
+	uint64_t sum;
+	uint32_t i;
+	chunk *c;
+	sum = 0;
+	for (i=0 ; i<size ; i++) {
+		for (c=hash[i] ; c ; c=c->next) {
+			sum += c->data[0];
+		}
+	}
+	return sum;
+}
+
+int main(int argc,char **argv) {
+	uint32_t maxchunks,nchunks,lookups,i,pos;
+	uint64_t rnd,start,found,fixedusec,growusec,fixedsweep,growsweep;
+	chunk *chunks,*c,**fixed;
+	growhash g;
+
+	maxchunks = (argc>1)?strtoul(argv[1],NULL,10):32*1024*1024;
+	lookups = (argc>2)?strtoul(argv[2],NULL,10):10000000;
+	if (lookups==0) {
+		fprintf(stderr,"lookups has to be positive\n");
+		return 1;
+	}
+	fixed = (chunk**)malloc(sizeof(chunk*)*FIXEDHASHSIZE);
+	if (fixed==NULL) {
+		fprintf(stderr,"out of memory\n");
+		return 1;
+	}
+	for (nchunks=1024*1024 ; nchunks<=maxchunks ; nchunks*=2) {
+		chunks = (chunk*)malloc(sizeof(chunk)*nchunks);
+		g.size = HASHINITSIZE;
+		g.splitpos = g.size/2;
+		g.elements = 0;
+		g.hash = (chunk**)calloc(g.size,sizeof(chunk*));
+		if (chunks==NULL || g.hash==NULL) {
+			fprintf(stderr,"out of memory\n");
+			return 1;
+		}
+		memset(fixed,0,sizeof(chunk*)*FIXEDHASHSIZE);
+		// chunks get consecutive ids, so both hashes are filled like in chunk_new
+		for (i=0 ; i<nchunks ; i++) {
+			chunks[i].chunkid = i+1;
+			chunks[i].data[0] = i&1;
+			pos = FIXEDHASHPOS(chunks[i].chunkid);
+			chunks[i].next = fixed[pos];
+			fixed[pos] = chunks+i;
+		}
+		// the same chunk objects are rehashed into the growing hash
+		for (i=0 ; i<nchunks ; i++) {
+			c = chunks+i;
+			g.elements++;
+			if (grow_grow(&g)<0) {
+				fprintf(stderr,"out of memory\n");
+				return 1;
+			}
+			grow_split(&g,HASHSPLITSTEPS);
+			pos = grow_pos(&g,c->chunkid);
+			c->next = g.hash[pos];
+			g.hash[pos] = c;
+		}
+		// the jobs loop finishes splitting in the background
+		grow_split(&g,g.size);
+
+		found = 0;
+		rnd = 2;
+		start = now_usec();
+		for (i=0 ; i<lookups ; i++) {
+			found += (grow_find(&g,next_random(&rnd)%nchunks+1)!=NULL);
+		}
+		growusec = now_usec()-start;
+		start = now_usec();
+		found += sweep(g.hash,g.size);
+		growsweep = now_usec()-start;
+
+		// rebuild the fixed chains (the growing hash reused 'next' pointers)
+		memset(fixed,0,sizeof(chunk*)*FIXEDHASHSIZE);
+		for (i=0 ; i<nchunks ; i++) {
+			pos = FIXEDHASHPOS(chunks[i].chunkid);
+			chunks[i].next = fixed[pos];
+			fixed[pos] = chunks+i;
+		}
+		rnd = 2;
+		start = now_usec();
+		for (i=0 ; i<lookups ; i++) {
+			found += (fixed_find(fixed,next_random(&rnd)%nchunks+1)!=NULL);
+		}
+		fixedusec = now_usec()-start;
+		start = now_usec();
+		found += sweep(fixed,FIXEDHASHSIZE);
+		fixedsweep = now_usec()-start;
+
+		if (found!=2*(uint64_t)lookups+nchunks) {
+			fprintf(stderr,"lookup error\n");
+			return 1;
+		}
+		printf("chunks: %10" PRIu32 " ; fixed: %12.0f lookups/s, sweep %7.1f ms ; growing (%10" PRIu32 " buckets): %12.0f lookups/s, sweep %7.1f ms\n",nchunks,lookups*1000000.0/(fixedusec?fixedusec:1),fixedsweep/1000.0,g.size,lookups*1000000.0/(growusec?growusec:1),growsweep/1000.0);
+		free(g.hash);
+		free(chunks);
+		if (nchunks>UINT32_MAX/2) {
+			break;
+		}
+	}
+	free(fixed);
+	return 0;
+}
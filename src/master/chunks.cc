@@ -25,10 +25,13 @@
 #include <syslog.h>
 #include <stdio.h>
 #include <string.h>
+#include <errno.h>
 #include <sys/types.h>
 #include <sys/stat.h>
 #ifdef METARESTORE
 #include <time.h>
+#else
+#include <pthread.h>
 #endif
 
 #include "MFSCommunication.h"
@@ -56,8 +59,14 @@
 #define MAXCPS 10000000
 #define MINCPS 10000
 
-#define HASHSIZE 0x100000
-#define HASHPOS(chunkid) (((uint32_t)chunkid)&0xFFFFF)
+#define HASHINITSIZE 0x100000
+#define HASHMAXSIZE 0x80000000U
+#define HASHMAXLOAD 2
+#define HASHSPLITSTEPS 2
+#define HASHPOS(chunkid) chunk_hashpos(chunkid)
+
+#define CHUNKFSIZE 16
+#define CHUNKCNT 1000
 
 #ifndef METARESTORE
 
@@ -130,7 +139,18 @@ static chunk_bucket *cbhead = NULL;
 static chunk *chfreehead = NULL;
 #endif /* USE_CHUNK_BUCKETS */
 
-static chunk *chunkhash[HASHSIZE];
+/* chunkhash grows with number of chunks (linear hashing)
+ * When there are more than HASHMAXLOAD chunks per bucket on average the table is
+ * doubled and then buckets are split one by one (a few with every new chunk and
+ * some every second) - chunks from bucket 'i' which have the new bit set in
+ * their ids are moved to bucket 'i+hashsize/2'. Lower buckets keep the order of
+ * chunks and their positions never change, so the jobs loop isn't disturbed.
+ * Chunks from buckets that haven't been split yet are looked up in the lower half.
+ */
+static chunk **chunkhash;
+static uint32_t hashsize;
+static uint32_t hashsplitpos;	// buckets below this position are split (hashsize/2 means no split in progress)
+static uint32_t hashelements;
 static uint64_t nextchunkid=1;
 #define LOCKTIMEOUT 120
 
@@ -147,7 +167,7 @@ static uint32_t MaxDelSoftLimit;
 static uint32_t MaxDelHardLimit;
 static double TmpMaxDelFrac;
 static uint32_t TmpMaxDel;
-static uint32_t HashSteps;
+static uint32_t HashLoopTime;
 static uint32_t HashCPS;
 static double AcceptableDifference;
 
@@ -282,8 +302,115 @@ static inline void chunk_free(chunk* p) {
 
 #endif /* USE_CHUNK_BUCKETS */
 
+#ifndef METARESTORE
+/* background metadata store (see fs_storeall)
+ * Chunk hash buckets are written by the store thread one after another. Before the main thread
+ * changes a bucket that hasn't been written yet (new chunk, version, lock time, deletion) the whole
+ * bucket is copied as it was when the store started and then it's skipped by the store thread. */
+static pthread_mutex_t bgstore_lock = PTHREAD_MUTEX_INITIALIZER;
+static uint8_t bgstore_running = 0;
+static uint8_t *bgstore_bucketmap = NULL;
+static FILE *bgstore_copy = NULL;
+static char *bgstore_copybuff = NULL;
+static size_t bgstore_copyleng = 0;
+static uint64_t bgstore_nextchunkid;
+static uint32_t bgstore_now;
+static uint32_t bgstore_copies;
+
+static void chunk_bgstore_writebucket(uint32_t pos,FILE *fd) {
+	uint8_t storebuff[CHUNKFSIZE];
+	uint8_t *ptr;
+	uint32_t lockedto;
+	chunk *c;
+	for (c=chunkhash[pos] ; c ; c=c->next) {
+		ptr = storebuff;
+		put64bit(&ptr,c->chunkid);
+		put32bit(&ptr,c->version);
+		lockedto = c->lockedto;
+		if (lockedto<bgstore_now) {
+			lockedto = 0;
+		}
+		put32bit(&ptr,lockedto);
+		fwrite(storebuff,1,CHUNKFSIZE,fd);
+	}
+}
+
+static void chunk_bgstore_copybucket(uint32_t pos) {
+	zassert(pthread_mutex_lock(&bgstore_lock));
+	if ((bgstore_bucketmap[pos>>3]&(1<<(pos&7)))==0) {
+		chunk_bgstore_writebucket(pos,bgstore_copy);
+		bgstore_bucketmap[pos>>3] |= (1<<(pos&7));
+		bgstore_copies++;
+	}
+	zassert(pthread_mutex_unlock(&bgstore_lock));
+}
+
+static inline void chunk_bgstore_bucket(uint32_t pos) {
+	if (bgstore_running && (bgstore_bucketmap[pos>>3]&(1<<(pos&7)))==0) {
+		chunk_bgstore_copybucket(pos);
+	}
+}
+
+#define chunk_bgstore_chunk(c) chunk_bgstore_bucket(HASHPOS((c)->chunkid))
+#define chunk_hash_frozen() (bgstore_running)	// background store relies on bucket positions
+#else
+#define chunk_bgstore_bucket(pos)
+#define chunk_bgstore_chunk(c)
+#define chunk_hash_frozen() 0
+#endif
+
+static inline void chunk_hash_split(uint32_t steps) {
+	uint32_t half;
+	chunk *c,**lo,**hi;
+	half = hashsize/2;
+	while (steps>0 && hashsplitpos<half && !chunk_hash_frozen()) {
+		c = chunkhash[hashsplitpos];
+		lo = chunkhash+hashsplitpos;
+		hi = chunkhash+hashsplitpos+half;
+		while (c) {
+			if (c->chunkid&half) {
+				*hi = c;
+				hi = &(c->next);
+			} else {
+				*lo = c;
+				lo = &(c->next);
+			}
+			c = c->next;
+		}
+		*lo = NULL;
+		*hi = NULL;
+		hashsplitpos++;
+		steps--;
+	}
+}
+
+static inline void chunk_hash_grow(void) {
+	chunk **newhash;
+	if (hashelements<=(uint64_t)hashsize*HASHMAXLOAD || hashsize>=HASHMAXSIZE || hashsplitpos<hashsize/2 || chunk_hash_frozen()) {
+		return;
+	}
+	newhash = (chunk**)realloc(chunkhash,sizeof(chunk*)*hashsize*2);
+	if (newhash==NULL) {	// not fatal - just longer chains
+		return;
+	}
+	memset(newhash+hashsize,0,sizeof(chunk*)*hashsize);
+	chunkhash = newhash;
+	hashsplitpos = 0;
+	hashsize *= 2;
+}
+
+static inline uint32_t chunk_hashpos(uint64_t chunkid) {
+	uint32_t pos,half;
+	pos = ((uint32_t)chunkid)&(hashsize-1);
+	half = hashsize/2;
+	if (pos>=half && pos-half>=hashsplitpos) {	// not split yet
+		pos -= half;
+	}
+	return pos;
+}
+
 chunk* chunk_new(uint64_t chunkid) {
-	uint32_t chunkpos = HASHPOS(chunkid);
+	uint32_t chunkpos;
 	chunk *newchunk;
 	newchunk = chunk_malloc();
 #ifdef METARESTORE
@@ -294,6 +421,11 @@ chunk* chunk_new(uint64_t chunkid) {
 	allchunkcounts[0][0]++;
 	regularchunkcounts[0][0]++;
 #endif
+	hashelements++;
+	chunk_hash_grow();
+	chunk_hash_split(HASHSPLITSTEPS);
+	chunkpos = HASHPOS(chunkid);
+	chunk_bgstore_bucket(chunkpos);
 	newchunk->next = chunkhash[chunkpos];
 	chunkhash[chunkpos] = newchunk;
 	newchunk->chunkid = chunkid;
@@ -341,6 +473,7 @@ void chunk_delete(chunk* c) {
 		lastchunkptr=NULL;
 	}
 	chunks--;
+	hashelements--;
 	allchunkcounts[c->goal][0]--;
 	regularchunkcounts[c->goal][0]--;
 	chunk_free(c);
@@ -584,6 +717,7 @@ int chunk_unlock(uint64_t chunkid) {
 	if (c==NULL) {
 		return ERROR_NOCHUNK;
 	}
+	chunk_bgstore_chunk(c);
 	c->lockedto=0;
 	return STATUS_OK;
 }
@@ -667,6 +801,7 @@ int chunk_multi_modify(uint32_t ts,uint64_t *nchunkid,uint64_t ochunkid,uint8_t
 			return ERROR_LOCKED;
 		}
 #endif
+		chunk_bgstore_chunk(oc);
 		if (oc->fcount==1) {	// refcount==1
 			*nchunkid = ochunkid;
 			c = oc;
@@ -784,6 +919,7 @@ int chunk_multi_truncate(uint32_t ts,uint64_t *nchunkid,uint64_t ochunkid,uint8_
 		return ERROR_LOCKED;
 	}
 #endif
+	chunk_bgstore_chunk(oc);
 	if (oc->fcount==1) {	// refcount==1
 		*nchunkid = ochunkid;
 		c = oc;
@@ -916,6 +1052,7 @@ int chunk_repair(uint8_t goal,uint64_t ochunkid,uint32_t *nversion) {
 		c->allvalidcopies = 0;
 		c->regularvalidcopies = 0;
 	}
+	chunk_bgstore_chunk(c);
 	c->version = bestversion;
 	for (s=c->slisthead ; s ; s=s->next) {
 		if (s->valid == INVALID && s->version==bestversion) {
@@ -959,6 +1096,7 @@ void chunk_emergency_increase_version(chunk *c) {
 		}
 	}
 	if (i>0) {	// should always be true !!!
+		chunk_bgstore_chunk(c);
 		c->interrupted = 0;
 		c->operation = SET_VERSION;
 		c->version++;
@@ -1148,7 +1286,7 @@ void chunk_server_disconnected(void *ptr) {
 	slist *s,**st;
 	uint32_t i;
 	uint8_t valid,vs;
-	for (i=0 ; i<HASHSIZE ; i++) {
+	for (i=0 ; i<hashsize ; i++) {
 		for (c=chunkhash[i] ; c ; c=c->next ) {
 			st = &(c->slisthead);
 			while (*st) {
@@ -1819,7 +1957,7 @@ void chunk_do_jobs(chunk *c,uint16_t scount,double minusage,double maxusage) {
 }
 
 void chunk_jobs_main(void) {
-	uint32_t i,l,lc,r;
+	uint32_t i,l,lc,r,hashsteps;
 	uint16_t uscount,tscount;
 	static uint16_t lasttscount=0;
 	static uint16_t maxtscount=0;
@@ -1849,8 +1987,10 @@ void chunk_jobs_main(void) {
 	}
 
 	chunk_do_jobs(NULL,JOBS_EVERYSECOND,0.0,0.0);	// every second tasks
+	hashsteps = 1+hashsize/HashLoopTime;
+	chunk_hash_split(hashsteps);
 	lc = 0;
-	for (i=0 ; i<HashSteps && lc<HashCPS ; i++) {
+	for (i=0 ; i<hashsteps && lc<HashCPS ; i++) {
 		if (jobshpos==0) {
 			chunk_do_jobs(NULL,JOBS_EVERYLOOP,0.0,0.0);	// every loop tasks
 		}
@@ -1859,6 +1999,7 @@ void chunk_jobs_main(void) {
 		cp = &(chunkhash[jobshpos]);
 		while ((c=*cp)!=NULL) {
 			if (c->fcount==0 && c->slisthead==NULL) {
+				chunk_bgstore_bucket(jobshpos);
 				*cp = (c->next);
 				chunk_delete(c);
 			} else {
@@ -1883,16 +2024,13 @@ void chunk_jobs_main(void) {
 				l++;
 			}
 		}
-		jobshpos+=123;	// if HASHSIZE is any power of 2 then any odd number is good here
-		jobshpos%=HASHSIZE;
+		jobshpos+=123;	// hashsize is always a power of 2, so any odd number is good here
+		jobshpos%=hashsize;
 	}
 }
 
 #endif
 
-#define CHUNKFSIZE 16
-#define CHUNKCNT 1000
-
 #ifdef METARESTORE
 
 void chunk_dump(void) {
@@ -1900,7 +2038,7 @@ void chunk_dump(void) {
 	uint32_t i,lockedto,now;
 	now = time(NULL);
 
-	for (i=0 ; i<HASHSIZE ; i++) {
+	for (i=0 ; i<hashsize ; i++) {
 		for (c=chunkhash[i] ; c ; c=c->next) {
 			lockedto = c->lockedto;
 			if (lockedto<now) {
@@ -1979,7 +2117,7 @@ void chunk_store(FILE *fd) {
 	}
 	j=0;
 	ptr = storebuff;
-	for (i=0 ; i<HASHSIZE ; i++) {
+	for (i=0 ; i<hashsize ; i++) {
 		for (c=chunkhash[i] ; c ; c=c->next) {
 			chunkid = c->chunkid;
 			put64bit(&ptr,chunkid);
@@ -2007,6 +2145,95 @@ void chunk_store(FILE *fd) {
 	}
 }
 
+#ifndef METARESTORE
+#define BGSTORE_BUCKETS 256
+
+/* called by main thread */
+int chunk_bgstore_start(void) {
+	bgstore_bucketmap = (uint8_t*)calloc(hashsize/8,1);
+	if (bgstore_bucketmap==NULL) {
+		return -1;
+	}
+	bgstore_copy = open_memstream(&bgstore_copybuff,&bgstore_copyleng);
+	if (bgstore_copy==NULL) {
+		free(bgstore_bucketmap);
+		bgstore_bucketmap = NULL;
+		return -1;
+	}
+	bgstore_nextchunkid = nextchunkid;
+	bgstore_now = main_time();
+	bgstore_copies = 0;
+	bgstore_running = 1;
+	return 0;
+}
+
+/* called by store thread - same format as chunk_store */
+int chunk_bgstore(FILE *fd) {
+	uint8_t hdr[8];
+	uint8_t *ptr;
+	uint32_t i,pos;
+	FILE *batch;
+	char *batchbuff;
+	size_t batchleng;
+
+	ptr = hdr;
+	put64bit(&ptr,bgstore_nextchunkid);
+	if (fwrite(hdr,1,8,fd)!=(size_t)8) {
+		return -1;
+	}
+	batchbuff = NULL;
+	batchleng = 0;
+	for (i=0 ; i<hashsize ; i+=BGSTORE_BUCKETS) {
+		batch = open_memstream(&batchbuff,&batchleng);
+		if (batch==NULL) {
+			return -1;
+		}
+		zassert(pthread_mutex_lock(&bgstore_lock));
+		for (pos=i ; pos<i+BGSTORE_BUCKETS ; pos++) {
+			if ((bgstore_bucketmap[pos>>3]&(1<<(pos&7)))==0) {
+				chunk_bgstore_writebucket(pos,batch);
+				bgstore_bucketmap[pos>>3] |= (1<<(pos&7));
+			}
+		}
+		zassert(pthread_mutex_unlock(&bgstore_lock));
+		fclose(batch);
+		if (batchleng>0 && fwrite(batchbuff,1,batchleng,fd)!=batchleng) {
+			free(batchbuff);
+			return -1;
+		}
+		free(batchbuff);
+	}
+	// all buckets are marked now, so the copy buffer won't change any more
+	zassert(pthread_mutex_lock(&bgstore_lock));
+	fclose(bgstore_copy);
+	bgstore_copy = NULL;
+	zassert(pthread_mutex_unlock(&bgstore_lock));
+	if (bgstore_copyleng>0 && fwrite(bgstore_copybuff,1,bgstore_copyleng,fd)!=bgstore_copyleng) {
+		return -1;
+	}
+	memset(hdr,0,8);
+	if (fwrite(hdr,1,8,fd)!=(size_t)8 || fwrite(hdr,1,8,fd)!=(size_t)8) {
+		return -1;
+	}
+	return 0;
+}
+
+/* called by main thread after store thread has finished */
+uint32_t chunk_bgstore_end(void) {
+	bgstore_running = 0;
+	if (bgstore_copy) {
+		fclose(bgstore_copy);
+		bgstore_copy = NULL;
+	}
+	free(bgstore_copybuff);
+	bgstore_copybuff = NULL;
+	bgstore_copyleng = 0;
+	free(bgstore_bucketmap);
+	bgstore_bucketmap = NULL;
+	return bgstore_copies;
+}
+#endif
+
 void chunk_term(void) {
 #ifndef METARESTORE
 # ifdef USE_SLIST_BUCKETS
@@ -2044,7 +2271,7 @@ void chunk_term(void) {
 		free(sb);
 	}
 # else
-	for (i=0 ; i<HASHSIZE ; i++) {
+	for (i=0 ; i<hashsize ; i++) {
 		for (ch = chunkhash[i] ; ch ; ch = ch->next) {
 			for (sl = ch->slisthead ; sl ; sl = sln) {
 				sln = sl->next;
@@ -2060,13 +2287,15 @@ void chunk_term(void) {
 		free(cb);
 	}
 #else
-	for (i=0 ; i<HASHSIZE ; i++) {
+	for (i=0 ; i<hashsize ; i++) {
 		for (ch = chunkhash[i] ; ch ; ch = chn) {
 			chn = ch->next;
 			free(ch);
 		}
 	}
 #endif
+	free(chunkhash);
+	chunkhash = NULL;
 }
 
 void chunk_newfs(void) {
@@ -2138,7 +2367,7 @@ void chunk_reload(void) {
 			syslog(LOG_NOTICE,"CHUNKS_LOOP_TIME value too high (%" PRIu32 ") decreased to %u",looptime,MAXLOOPTIME);
 			looptime = MAXLOOPTIME;
 		}
-		HashSteps = 1+((HASHSIZE)/looptime);
+		HashLoopTime = looptime;
 		HashCPS = 0xFFFFFFFF;
 	} else {
 		looptime = cfg_getuint32("CHUNKS_LOOP_MIN_TIME",300);
@@ -2150,7 +2379,7 @@ void chunk_reload(void) {
 			syslog(LOG_NOTICE,"CHUNKS_LOOP_MIN_TIME value too high (%" PRIu32 ") decreased to %u",looptime,MAXLOOPTIME);
 			looptime = MAXLOOPTIME;
 		}
-		HashSteps = 1+((HASHSIZE)/looptime);
+		HashLoopTime = looptime;
 		HashCPS = cfg_getuint32("CHUNKS_LOOP_MAX_CPS",100000);
 		if (HashCPS < MINCPS) {
 			syslog(LOG_NOTICE,"CHUNKS_LOOP_MAX_CPS value too low (%" PRIu32 ") increased to %u",HashCPS,MINCPS);
@@ -2217,7 +2446,7 @@ int chunk_strinit(void) {
 			fprintf(stderr,"CHUNKS_LOOP_TIME value too high (%" PRIu32 ") decreased to %u\n",looptime,MAXLOOPTIME);
 			looptime = MAXLOOPTIME;
 		}
-		HashSteps = 1+((HASHSIZE)/looptime);
+		HashLoopTime = looptime;
 		HashCPS = 0xFFFFFFFF;
 	} else {
 		looptime = cfg_getuint32("CHUNKS_LOOP_MIN_TIME",300);
@@ -2229,7 +2458,7 @@ int chunk_strinit(void) {
 			fprintf(stderr,"CHUNKS_LOOP_MIN_TIME value too high (%" PRIu32 ") decreased to %u\n",looptime,MAXLOOPTIME);
 			looptime = MAXLOOPTIME;
 		}
-		HashSteps = 1+((HASHSIZE)/looptime);
+		HashLoopTime = looptime;
 		HashCPS = cfg_getuint32("CHUNKS_LOOP_MAX_CPS",100000);
 		if (HashCPS < MINCPS) {
 			fprintf(stderr,"CHUNKS_LOOP_MAX_CPS value too low (%" PRIu32 ") increased to %u\n",HashCPS,MINCPS);
@@ -2248,7 +2477,12 @@ int chunk_strinit(void) {
 		AcceptableDifference = 10.0;
 	}
 #endif
-	for (i=0 ; i<HASHSIZE ; i++) {
+	hashsize = HASHINITSIZE;
+	hashsplitpos = hashsize/2;
+	hashelements = 0;
+	chunkhash = (chunk**)malloc(sizeof(chunk*)*hashsize);
+	passert(chunkhash);
+	for (i=0 ; i<hashsize ; i++) {
 		chunkhash[i]=NULL;
 	}
 #ifndef METARESTORE
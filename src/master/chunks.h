@@ -69,6 +69,10 @@ void chunk_got_setversion_status(void *ptr,uint64_t chunkid,uint8_t status);
 void chunk_got_truncate_status(void *ptr,uint64_t chunkid,uint8_t status);
 void chunk_got_duptrunc_status(void *ptr,uint64_t chunkid,uint8_t status);
 
+int chunk_bgstore_start(void);
+int chunk_bgstore(FILE *fd);
+uint32_t chunk_bgstore_end(void);
+
 #endif
 
 int chunk_load(FILE *fd);
@@ -0,0 +1,248 @@
+// Compares creates and lookups in a huge directory when its entries live in the global
+// edgehash (2^22 buckets shared with all other directories) and in a per-directory index
+// that grows with the directory, like filesystem.cc does above DIRINDEX_HIGHLIMIT entries.
+// Usage: dirindex_benchmark [entries [otheredges [lookups]]]
+// Defaults: directories with 1M and 10M entries, 4M edges in other directories.
+
+#include "config.h"
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+
+#define EDGEHASHBITS (22)
+#define EDGEHASHSIZE (1<<EDGEHASHBITS)
+#define EDGEHASHPOS(hash) ((hash)&(EDGEHASHSIZE-1))
+
+#define DIRINDEX_HIGHLIMIT 4096
+#define DIRINDEX_MAXLOAD 2
+
+#define NAMELENG 12
+
+// roughly the size of fsedge
+typedef struct _edge {
+	uint32_t parentid;
+	uint8_t data[40];
+	uint16_t nleng;
+	uint8_t name[NAMELENG];
+	struct _edge *next;
+} edge;
+
+typedef struct _dirindex {
+	edge **hash;
+	uint32_t hashsize;
+	uint32_t elements;
+} dirindex;
+
+static uint64_t now_usec(void) {
+	struct timeval tv;
+	gettimeofday(&tv,NULL);
+	return tv.tv_sec*UINT64_C(1000000)+tv.tv_usec;
+}
+
+static inline uint32_t next_random(uint64_t *state) {
+	*state = *state * UINT64_C(6364136223846793005) + UINT64_C(1442695040888963407);
+	return *state >> 32;
+}
+
+// same as fsnodes_hash
+static inline uint32_t name_hash(uint32_t parentid,uint16_t nleng,const uint8_t *name) {
+	uint32_t hash,i;
+	hash = ((parentid * 0x5F2318BD) + nleng);
+	for (i=0 ; i<nleng ; i++) {
+		hash = hash*33+name[i];
+	}
+	return hash;
+}
+
+static inline void make_name(uint32_t n,uint8_t *name) {
+	uint32_t i;
+	memcpy(name,"file",4);
+	for (i=NAMELENG ; i>4 ; i--) {
+		name[i-1] = '0'+(n%10);
+		n/=10;
+	}
+}
+
+static inline edge* chain_find(edge *e,uint32_t parentid,const uint8_t *name) {
+	while (e) {
+		if (e->parentid==parentid && e->nleng==NAMELENG && memcmp(e->name,name,NAMELENG)==0) {
+			return e;
+		}
+		e = e->next;
+	}
+	return NULL;
+}
+
+static inline edge** global_bucket(edge **edgehash,uint32_t parentid,const uint8_t *name) {
+	return edgehash+EDGEHASHPOS(name_hash(parentid,NAMELENG,name));
+}
+
+static inline edge** index_bucket(dirindex *di,uint32_t parentid,const uint8_t *name) {
+	return di->hash+(name_hash(parentid,NAMELENG,name)&(di->hashsize-1));
+}
+
+static void index_grow(dirindex *di,uint32_t parentid) {
+	edge **oldhash,*e,*en,**b;
+	uint32_t i,oldsize;
+	oldhash = di->hash;
+	oldsize = di->hashsize;
+	di->hashsize *= 2;
+	di->hash = (edge**)calloc(di->hashsize,sizeof(edge*));
+	if (di->hash==NULL) {
+		fprintf(stderr,"out of memory\n");
+		exit(1);
+	}
+	for (i=0 ; i<oldsize ; i++) {
+		for (e=oldhash[i] ; e ; e=en) {
+			en = e->next;
+			b = index_bucket(di,parentid,e->name);
+			e->next = *b;
+			*b = e;
+		}
+	}
+	free(oldhash);
+}
+
+// creates (with name check, like fs_mknod) all entries of the huge directory, then looks up random names
+static void run(edge **edgehash,edge *edges,uint32_t entries,uint32_t lookups,uint8_t useindex,uint64_t *createusec,uint64_t *lookupusec) {
+	dirindex di;
+	edge **b;
+	uint64_t rnd,start,found;
+	uint32_t i;
+	uint8_t name[NAMELENG];
+
+	di.hashsize = DIRINDEX_HIGHLIMIT;
+	di.hash = (edge**)calloc(di.hashsize,sizeof(edge*));
+	di.elements = 0;
+	if (di.hash==NULL) {
+		fprintf(stderr,"out of memory\n");
+		exit(1);
+	}
+	start = now_usec();
+	for (i=0 ; i<entries ; i++) {
+		b = (useindex)?index_bucket(&di,1,edges[i].name):global_bucket(edgehash,1,edges[i].name);
+		if (chain_find(*b,1,edges[i].name)) {
+			fprintf(stderr,"name is used\n");
+			exit(1);
+		}
+		edges[i].next = *b;
+		*b = edges+i;
+		if (useindex) {
+			di.elements++;
+			if (di.elements>di.hashsize*DIRINDEX_MAXLOAD) {
+				index_grow(&di,1);
+			}
+		}
+	}
+	*createusec = now_usec()-start;
+
+	found = 0;
+	rnd = 2;
+	start = now_usec();
+	for (i=0 ; i<lookups ; i++) {
+		make_name(next_random(&rnd)%entries,name);
+		b = (useindex)?index_bucket(&di,1,name):global_bucket(edgehash,1,name);
+		found += (chain_find(*b,1,name)!=NULL);
+	}
+	*lookupusec = now_usec()-start;
+	if (found!=lookups) {
+		fprintf(stderr,"lookup error\n");
+		exit(1);
+	}
+
+	free(di.hash);
+}
+
+// looks up random names in small directories (what everybody else sees)
+static uint64_t others(edge **edgehash,edge *other,uint32_t otheredges,uint32_t lookups) {
+	uint64_t rnd,start,found;
+	uint32_t i,n;
+	start = now_usec();
+	found = 0;
+	rnd = 3;
+	for (i=0 ; i<lookups ; i++) {
+		n = next_random(&rnd)%otheredges;
+		found += (chain_find(*global_bucket(edgehash,other[n].parentid,other[n].name),other[n].parentid,other[n].name)!=NULL);
+	}
+	if (found!=lookups) {
+		fprintf(stderr,"lookup error\n");
+		exit(1);
+	}
+	return now_usec()-start;
+}
+
+static void test(edge **edgehash,edge *other,uint32_t otheredges,uint32_t entries,uint32_t lookups) {
+	edge *edges,**b;
+	uint64_t gcreate,glookup,gother,icreate,ilookup,iother;
+	uint32_t i;
+
+	edges = (edge*)malloc(sizeof(edge)*entries);
+	if (edges==NULL) {
+		fprintf(stderr,"out of memory\n");
+		exit(1);
+	}
+	for (i=0 ; i<entries ; i++) {
+		edges[i].parentid = 1;
+		edges[i].nleng = NAMELENG;
+		make_name(i,edges[i].name);
+	}
+
+	run(edgehash,edges,entries,lookups,0,&gcreate,&glookup);
+	gother = others(edgehash,other,otheredges,lookups);
+	// take the huge directory out of edgehash
+	for (i=0 ; i<entries ; i++) {
+		b = global_bucket(edgehash,1,edges[i].name);
+		while (*b!=edges+i) {
+			b = &((*b)->next);
+		}
+		*b = edges[i].next;
+	}
+
+	run(edgehash,edges,entries,lookups,1,&icreate,&ilookup);
+	iother = others(edgehash,other,otheredges,lookups);
+
+	printf("entries: %9" PRIu32 "\n",entries);
+	printf("  edgehash:  create %10.0f/s ; lookup %10.0f/s ; other dirs lookup %10.0f/s\n",entries*1000000.0/(gcreate?gcreate:1),lookups*1000000.0/(glookup?glookup:1),lookups*1000000.0/(gother?gother:1));
+	printf("  dir index: create %10.0f/s ; lookup %10.0f/s ; other dirs lookup %10.0f/s\n",entries*1000000.0/(icreate?icreate:1),lookups*1000000.0/(ilookup?ilookup:1),lookups*1000000.0/(iother?iother:1));
+	free(edges);
+}
+
+int main(int argc,char **argv) {
+	uint32_t entries,otheredges,lookups,i;
+	edge **edgehash,*other,**b;
+
+	entries = (argc>1)?strtoul(argv[1],NULL,10):0;
+	otheredges = (argc>2)?strtoul(argv[2],NULL,10):4*1024*1024;
+	lookups = (argc>3)?strtoul(argv[3],NULL,10):5000000;
+	if (otheredges==0 || lookups==0) {
+		fprintf(stderr,"otheredges and lookups have to be positive\n");
+		return 1;
+	}
+	edgehash = (edge**)calloc(EDGEHASHSIZE,sizeof(edge*));
+	other = (edge*)malloc(sizeof(edge)*otheredges);
+	if (edgehash==NULL || other==NULL) {
+		fprintf(stderr,"out of memory\n");
+		return 1;
+	}
+	// other directories have 20 entries each
+	for (i=0 ; i<otheredges ; i++) {
+		other[i].parentid = 2+i/20;
+		other[i].nleng = NAMELENG;
+		make_name(i%20,other[i].name);
+		b = global_bucket(edgehash,other[i].parentid,other[i].name);
+		other[i].next = *b;
+		*b = other+i;
+	}
+	if (entries>0) {
+		test(edgehash,other,otheredges,entries,lookups);
+	} else {
+		test(edgehash,other,otheredges,1000000,lookups);
+		test(edgehash,other,otheredges,10000000,lookups);
+	}
+	free(other);
+	free(edgehash);
+	return 0;
+}
@@ -28,8 +28,13 @@
 #include <pwd.h>
 #endif
 #include <sys/stat.h>
+#include <sys/mman.h>
 #include <inttypes.h>
 #include <errno.h>
+#include <pthread.h>
+#ifndef METARESTORE
+#include <sys/time.h>
+#endif
 
 #include "MFSCommunication.h"
 
@@ -56,17 +61,24 @@
 
 #define USE_FREENODE_BUCKETS 1
 #define USE_CUIDREC_BUCKETS 1
+#define USE_FSNODE_BUCKETS 1
+#define USE_FSEDGE_BUCKETS 1
 #define EDGEHASH 1
 
-#define NODEHASHBITS (22)
-#define NODEHASHSIZE (1<<NODEHASHBITS)
-#define NODEHASHPOS(nodeid) ((nodeid)&(NODEHASHSIZE-1))
+#define NODETABLE_INITSIZE 0x100000
 
 #ifdef EDGEHASH
 #define EDGEHASHBITS (22)
 #define EDGEHASHSIZE (1<<EDGEHASHBITS)
 #define EDGEHASHPOS(hash) ((hash)&(EDGEHASHSIZE-1))
 #define LOOKUPNOHASHLIMIT 10
+// directories with more children get their own name index (and leave edgehash)
+#define DIRINDEX_HIGHLIMIT 4096
+// and lose it when they shrink below this
+#define DIRINDEX_LOWLIMIT 2048
+#define DIRINDEX_MAXLOAD 2
+#define DIRINDEXHASHSIZE 4096
+#define DIRINDEXHASHPOS(nodeid) ((nodeid)&(DIRINDEXHASHSIZE-1))
 #endif
 
 #define XATTR_INODE_HASH_SIZE 65536
@@ -108,6 +120,9 @@ typedef struct _sessionidrec {
 
 struct _fsnode;
 
+// names fit in the space of a pointer and the padding before it - fsedge still has 80 bytes on 64-bit machines
+#define EDGE_INLINE_NAME ((int)(2*sizeof(uint8_t*)-sizeof(uint16_t)))
+
 typedef struct _fsedge {
 	struct _fsnode *child,*parent;
 	struct _fsedge *nextchild,*nextparent;
@@ -117,9 +132,27 @@ typedef struct _fsedge {
 #endif
 	uint16_t nleng;
 //	uint16_t nhash;
-	uint8_t *name;
+	uint8_t name[EDGE_INLINE_NAME];	// short names are kept here, for longer ones it holds pointer to malloc'ed name
 } fsedge;
 
+static inline uint8_t* fsedge_name(fsedge *e) {
+	uint8_t *lname;
+	if (e->nleng<=EDGE_INLINE_NAME) {
+		return e->name;
+	}
+	memcpy(&lname,e->name,sizeof(uint8_t*));
+	return lname;
+}
+
+#ifdef EDGEHASH
+typedef struct _dirindex {
+	uint32_t nodeid;
+	uint32_t hashsize;
+	fsedge **hash;
+	struct _dirindex *next;
+} dirindex;
+#endif
+
 #ifndef METARESTORE
 typedef struct _statsrecord {
 	uint32_t inodes;
@@ -228,7 +261,6 @@ typedef struct _fsnode {
 */
 	} data;
 	fsedge *parents;
-	struct _fsnode *next;
 } fsnode;
 
 typedef struct _freenode {
@@ -245,9 +277,11 @@ static freenode *freelist,**freetail;
 static fsedge *trash;
 static fsedge *reserved;
 static fsnode *root;
-static fsnode* nodehash[NODEHASHSIZE];
+static fsnode **nodetable;	// indexed directly by inode number
+static uint32_t nodetablesize;
 #ifdef EDGEHASH
 static fsedge* edgehash[EDGEHASHSIZE];
+static dirindex* dirindexhash[DIRINDEXHASHSIZE];
 #endif
 
 static uint32_t maxnodeid;
@@ -265,6 +299,40 @@ static uint32_t dirnodes;
 #ifndef METARESTORE
 
 static uint32_t BackMetaCopies;
+static uint32_t BackMetaFork;
+
+/* background metadata store (without fork)
+ *
+ * fs_storeall remembers the header, serializes small sections (free inodes,
+ * quota, xattrs) into memory and starts a writer thread, which walks through
+ * nodetable and writes nodes and edges as they are at that moment. Before the
+ * main thread modifies a node (or a list of edges) which hasn't been written
+ * yet, it writes its current version to 'copy' buffer (copy on write), so the
+ * image is consistent with 'bgstore_metaversion'. Bitmaps indexed by inode
+ * number tell which nodes and lists of edges are already stored. For
+ * directories the list of edges is the list of children, for other objects
+ * it is the list of parentless edges (trash and reserved files).
+ * All changes of bitmaps and nodetable are made under 'bgstore_lock'.
+ */
+static pthread_mutex_t bgstore_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_t bgstore_thread;
+static uint8_t bgstore_running;			// changed only by the main thread
+static volatile uint8_t bgstore_finished;	// set by the writer thread
+static uint8_t bgstore_status;
+static uint8_t bgstore_fver;
+static uint32_t bgstore_maxnodeid;
+static uint64_t bgstore_metaversion;
+static uint32_t bgstore_nextsessionid;
+static uint8_t *bgstore_nodemap;
+static uint8_t *bgstore_edgemap;
+static FILE *bgstore_nodecopy,*bgstore_edgecopy;
+static char *bgstore_nodecopybuff,*bgstore_edgecopybuff;
+static size_t bgstore_nodecopyleng,bgstore_edgecopyleng;
+static char *bgstore_freebuff,*bgstore_quotabuff,*bgstore_xattrbuff;
+static size_t bgstore_freeleng,bgstore_quotaleng,bgstore_xattrleng;
+static uint32_t bgstore_nodecopies,bgstore_edgecopies;
+static uint64_t bgstore_starttime,bgstore_pausetime,bgstore_endtime;
+static uint64_t bgstore_bytes;
 
 #define MSGBUFFSIZE 1000000
 #define ERRORS_LOG_MAX 500
@@ -299,6 +367,9 @@ static uint32_t stats_open=0;
 static uint32_t stats_read=0;
 static uint32_t stats_write=0;
 
+// counters incremented by operations that may run on matoclserv read workers
+#define STATS_INC(x) __sync_fetch_and_add(&(x),1)
+
 void fs_stats(uint32_t stats[16]) {
 	stats[0] = stats_statfs;
 	stats[1] = stats_getattr;
@@ -336,6 +407,12 @@ void fs_stats(uint32_t stats[16]) {
 
 #endif
 
+// memory used by metadata structures (reported by fs_info)
+static uint64_t memusage_nodes = 0;
+static uint64_t memusage_edges = 0;
+static uint64_t memusage_names = 0;
+static uint64_t memusage_other = 0;
+
 #ifdef USE_FREENODE_BUCKETS
 #define FREENODE_BUCKET_SIZE 5000
 
@@ -362,6 +439,7 @@ static inline freenode* freenode_malloc() {
 		fnb->next = fnbhead;
 		fnb->firstfree = 0;
 		fnbhead = fnb;
+		memusage_other += sizeof(freenode_bucket);
 	}
 	ret = (fnbhead->bucket)+(fnbhead->firstfree);
 	fnbhead->firstfree++;
@@ -413,6 +491,7 @@ static inline sessionidrec* sessionidrec_malloc() {
 		crb->next = crbhead;
 		crb->firstfree = 0;
 		crbhead = crb;
+		memusage_other += sizeof(sessionidrec_bucket);
 	}
 	ret = (crbhead->bucket)+(crbhead->firstfree);
 	crbhead->firstfree++;
@@ -438,6 +517,146 @@ static inline void sessionidrec_free(sessionidrec* p) {
 
 #endif /* USE_CUIDREC_BUCKETS */
 
+#ifdef USE_FSNODE_BUCKETS
+#define FSNODE_BUCKET_SIZE 5000
+
+typedef struct _fsnode_bucket {
+	fsnode bucket[FSNODE_BUCKET_SIZE];
+	uint32_t firstfree;
+	struct _fsnode_bucket *next;
+} fsnode_bucket;
+
+static fsnode_bucket *nbhead = NULL;
+static fsnode *nfreehead = NULL;
+
+static inline fsnode* fsnode_malloc() {
+	fsnode_bucket *nb;
+	fsnode *ret;
+	if (nfreehead) {
+		ret = nfreehead;
+		nfreehead = *((fsnode**)ret);
+		return ret;
+	}
+	if (nbhead==NULL || nbhead->firstfree==FSNODE_BUCKET_SIZE) {
+		nb = (fsnode_bucket*)malloc(sizeof(fsnode_bucket));
+		passert(nb);
+		nb->next = nbhead;
+		nb->firstfree = 0;
+		nbhead = nb;
+		memusage_nodes += sizeof(fsnode_bucket);
+	}
+	ret = (nbhead->bucket)+(nbhead->firstfree);
+	nbhead->firstfree++;
+	return ret;
+}
+
+static inline void fsnode_free(fsnode *p) {
+	*((fsnode**)p) = nfreehead;	// free nodes are linked through their first bytes
+	nfreehead = p;
+}
+#else /* USE_FSNODE_BUCKETS */
+
+static inline fsnode* fsnode_malloc() {
+	fsnode *p;
+	p = (fsnode*)malloc(sizeof(fsnode));
+	passert(p);
+	memusage_nodes += sizeof(fsnode);
+	return p;
+}
+
+static inline void fsnode_free(fsnode* p) {
+	memusage_nodes -= sizeof(fsnode);
+	free(p);
+}
+
+#endif /* USE_FSNODE_BUCKETS */
+
+#ifdef USE_FSEDGE_BUCKETS
+#define FSEDGE_BUCKET_SIZE 5000
+
+typedef struct _fsedge_bucket {
+	fsedge bucket[FSEDGE_BUCKET_SIZE];
+	uint32_t firstfree;
+	struct _fsedge_bucket *next;
+} fsedge_bucket;
+
+static fsedge_bucket *ebhead = NULL;
+static fsedge *efreehead = NULL;
+
+static inline fsedge* fsedge_malloc() {
+	fsedge_bucket *eb;
+	fsedge *ret;
+	if (efreehead) {
+		ret = efreehead;
+		efreehead = ret->nextchild;
+	} else {
+		if (ebhead==NULL || ebhead->firstfree==FSEDGE_BUCKET_SIZE) {
+			eb = (fsedge_bucket*)malloc(sizeof(fsedge_bucket));
+			passert(eb);
+			eb->next = ebhead;
+			eb->firstfree = 0;
+			ebhead = eb;
+			memusage_edges += sizeof(fsedge_bucket);
+		}
+		ret = (ebhead->bucket)+(ebhead->firstfree);
+		ebhead->firstfree++;
+	}
+	ret->nleng = 0;
+	return ret;
+}
+
+static inline void fsedge_freeedge(fsedge *e) {
+	e->nextchild = efreehead;
+	efreehead = e;
+}
+#else /* USE_FSEDGE_BUCKETS */
+
+static inline fsedge* fsedge_malloc() {
+	fsedge *e;
+	e = (fsedge*)malloc(sizeof(fsedge));
+	passert(e);
+	memusage_edges += sizeof(fsedge);
+	e->nleng = 0;
+	return e;
+}
+
+static inline void fsedge_freeedge(fsedge* e) {
+	memusage_edges -= sizeof(fsedge);
+	free(e);
+}
+
+#endif /* USE_FSEDGE_BUCKETS */
+
+// prepares place for name of given length (name itself has to be copied by caller)
+static inline void fsedge_allocname(fsedge *e,uint16_t nleng) {
+	uint8_t *lname;
+	e->nleng = nleng;
+	if (nleng>EDGE_INLINE_NAME) {
+		lname = (uint8_t*) malloc(nleng);
+		passert(lname);
+		memcpy(e->name,&lname,sizeof(uint8_t*));
+		memusage_names += nleng;
+	}
+}
+
+static inline void fsedge_setname(fsedge *e,uint16_t nleng,const uint8_t *name) {
+	fsedge_allocname(e,nleng);
+	memcpy(fsedge_name(e),name,nleng);
+}
+
+static inline void fsedge_freename(fsedge *e) {
+	if (e->nleng>EDGE_INLINE_NAME) {
+		memusage_names -= e->nleng;
+		free(fsedge_name(e));
+	}
+	e->nleng = 0;
+}
+
+static inline void fsedge_free(fsedge *e) {
+	fsedge_freename(e);
+	fsedge_freeedge(e);
+}
+
 uint32_t fsnodes_get_next_id() {
 	uint32_t i,mask;
 	while (searchpos<bitmasksize && freebitmask[searchpos]==0xFFFFFFFF) {
@@ -798,7 +1017,6 @@ static char* fsnodes_escape_name(uint32_t nleng,const uint8_t *name) {
 	return currescname;
 }
 
-#ifdef EDGEHASH
 static inline uint32_t fsnodes_hash(uint32_t parentid,uint16_t nleng,const uint8_t *name) {
 	uint32_t hash,i;
 	hash = ((parentid * 0x5F2318BD) + nleng);
@@ -807,15 +1025,123 @@ static inline uint32_t fsnodes_hash(uint32_t parentid,uint16_t nleng,const uint8
 	}
 	return hash;
 }
+
+#ifdef EDGEHASH
+
+static inline dirindex* fsnodes_dirindex_get(uint32_t nodeid) {
+	dirindex *di;
+	for (di=dirindexhash[DIRINDEXHASHPOS(nodeid)] ; di ; di=di->next) {
+		if (di->nodeid==nodeid) {
+			return di;
+		}
+	}
+	return NULL;
+}
+
+/* returns hash chain where edge with given name belongs - the directory's own index or edgehash */
+static inline fsedge** fsnodes_edgebucket(fsnode *parent,uint16_t nleng,const uint8_t *name) {
+	dirindex *di;
+	uint32_t hash;
+	hash = fsnodes_hash(parent->id,nleng,name);
+	if (parent->data.ddata.elements>=DIRINDEX_LOWLIMIT && (di=fsnodes_dirindex_get(parent->id))!=NULL) {
+		return di->hash+(hash&(di->hashsize-1));
+	}
+	return edgehash+EDGEHASHPOS(hash);
+}
+
+static inline void fsnodes_edgebucket_insert(fsedge **bucket,fsedge *e) {
+	e->next = *bucket;
+	if (e->next) {
+		e->next->prev = &(e->next);
+	}
+	*bucket = e;
+	e->prev = bucket;
+}
+
+/* moves all children of the directory to new hash table (di==NULL means edgehash) */
+static void fsnodes_dirindex_rehash(fsnode *node,dirindex *di) {
+	fsedge *e;
+	uint32_t hash;
+	for (e=node->data.ddata.children ; e ; e=e->nextchild) {
+		hash = fsnodes_hash(node->id,e->nleng,fsedge_name(e));
+		fsnodes_edgebucket_insert((di)?di->hash+(hash&(di->hashsize-1)):edgehash+EDGEHASHPOS(hash),e);
+	}
+}
+
+/* called after number of children has changed (by one) */
+static void fsnodes_dirindex_check(fsnode *node) {
+	dirindex *di,**dip;
+	fsedge **oldhash;
+	fsedge *e;
+	uint32_t elements,newsize;
+
+	elements = node->data.ddata.elements;
+	if (elements<DIRINDEX_LOWLIMIT-1) {
+		return;
+	}
+	dip = dirindexhash+DIRINDEXHASHPOS(node->id);
+	while ((di=*dip) && di->nodeid!=node->id) {
+		dip = &(di->next);
+	}
+	if (di==NULL) {
+		if (elements<=DIRINDEX_HIGHLIMIT) {
+			return;
+		}
+		di = (dirindex*)malloc(sizeof(dirindex));
+		passert(di);
+		di->nodeid = node->id;
+		di->hashsize = DIRINDEX_HIGHLIMIT;
+		di->hash = (fsedge**)calloc(di->hashsize,sizeof(fsedge*));
+		passert(di->hash);
+		di->next = dirindexhash[DIRINDEXHASHPOS(node->id)];
+		dirindexhash[DIRINDEXHASHPOS(node->id)] = di;
+		memusage_other += sizeof(dirindex)+sizeof(fsedge*)*di->hashsize;
+		// leave edgehash
+		for (e=node->data.ddata.children ; e ; e=e->nextchild) {
+			*(e->prev) = e->next;
+			if (e->next) {
+				e->next->prev = e->prev;
+			}
+		}
+		fsnodes_dirindex_rehash(node,di);
+		return;
+	}
+	if (elements<DIRINDEX_LOWLIMIT) {
+		*dip = di->next;
+		fsnodes_dirindex_rehash(node,NULL);
+		memusage_other -= sizeof(dirindex)+sizeof(fsedge*)*di->hashsize;
+		free(di->hash);
+		free(di);
+		return;
+	}
+	if (elements>di->hashsize*DIRINDEX_MAXLOAD && di->hashsize<0x80000000U) {
+		newsize = di->hashsize*2;
+	} else if (elements<di->hashsize/8 && di->hashsize>DIRINDEX_HIGHLIMIT) {
+		newsize = di->hashsize/2;
+	} else {
+		return;
+	}
+	oldhash = di->hash;
+	di->hash = (fsedge**)calloc(newsize,sizeof(fsedge*));
+	if (di->hash==NULL) {	// not fatal - just longer chains
+		di->hash = oldhash;
+		return;
+	}
+	memusage_other += sizeof(fsedge*)*newsize;
+	memusage_other -= sizeof(fsedge*)*di->hashsize;
+	di->hashsize = newsize;
+	fsnodes_dirindex_rehash(node,di);
+	free(oldhash);
+}
 #endif
 
 static inline int fsnodes_nameisused(fsnode *node,uint16_t nleng,const uint8_t *name) {
 	fsedge *ei;
 #ifdef EDGEHASH
 	if (node->data.ddata.elements>LOOKUPNOHASHLIMIT) {
-		ei = edgehash[EDGEHASHPOS(fsnodes_hash(node->id,nleng,name))];
+		ei = *fsnodes_edgebucket(node,nleng,name);
 		while (ei) {
-			if (ei->parent==node && nleng==ei->nleng && memcmp((char*)(ei->name),(char*)name,nleng)==0) {
+			if (ei->parent==node && nleng==ei->nleng && memcmp((char*)(fsedge_name(ei)),(char*)name,nleng)==0) {
 				return 1;
 			}
 			ei = ei->next;
@@ -823,7 +1149,7 @@ static inline int fsnodes_nameisused(fsnode *node,uint16_t nleng,const uint8_t *
 	} else {
 		ei = node->data.ddata.children;
 		while (ei) {
-			if (nleng==ei->nleng && memcmp((char*)(ei->name),(char*)name,nleng)==0) {
+			if (nleng==ei->nleng && memcmp((char*)(fsedge_name(ei)),(char*)name,nleng)==0) {
 				return 1;
 			}
 			ei = ei->nextchild;
@@ -832,7 +1158,7 @@ static inline int fsnodes_nameisused(fsnode *node,uint16_t nleng,const uint8_t *
 #else
 	ei = node->data.ddata.children;
 	while (ei) {
-		if (nleng==ei->nleng && memcmp((char*)(ei->name),(char*)name,nleng)==0) {
+		if (nleng==ei->nleng && memcmp((char*)(fsedge_name(ei)),(char*)name,nleng)==0) {
 			return 1;
 		}
 		ei = ei->nextchild;
@@ -849,9 +1175,9 @@ static inline fsedge* fsnodes_lookup(fsnode *node,uint16_t nleng,const uint8_t *
 	}
 #ifdef EDGEHASH
 	if (node->data.ddata.elements>LOOKUPNOHASHLIMIT) {
-		ei = edgehash[EDGEHASHPOS(fsnodes_hash(node->id,nleng,name))];
+		ei = *fsnodes_edgebucket(node,nleng,name);
 		while (ei) {
-			if (ei->parent==node && nleng==ei->nleng && memcmp((char*)(ei->name),(char*)name,nleng)==0) {
+			if (ei->parent==node && nleng==ei->nleng && memcmp((char*)(fsedge_name(ei)),(char*)name,nleng)==0) {
 				return ei;
 			}
 			ei = ei->next;
@@ -859,7 +1185,7 @@ static inline fsedge* fsnodes_lookup(fsnode *node,uint16_t nleng,const uint8_t *
 	} else {
 		ei = node->data.ddata.children;
 		while (ei) {
-			if (nleng==ei->nleng && memcmp((char*)(ei->name),(char*)name,nleng)==0) {
+			if (nleng==ei->nleng && memcmp((char*)(fsedge_name(ei)),(char*)name,nleng)==0) {
 				return ei;
 			}
 			ei = ei->nextchild;
@@ -868,7 +1194,7 @@ static inline fsedge* fsnodes_lookup(fsnode *node,uint16_t nleng,const uint8_t *
 #else
 	ei = node->data.ddata.children;
 	while (ei) {
-		if (nleng==ei->nleng && memcmp((char*)(ei->name),(char*)name,nleng)==0) {
+		if (nleng==ei->nleng && memcmp((char*)(fsedge_name(ei)),(char*)name,nleng)==0) {
 			return ei;
 		}
 		ei = ei->nextchild;
@@ -878,16 +1204,132 @@ static inline fsedge* fsnodes_lookup(fsnode *node,uint16_t nleng,const uint8_t *
 }
 
 static inline fsnode* fsnodes_id_to_node(uint32_t id) {
-	fsnode *p;
-	uint32_t nodepos = NODEHASHPOS(id);
-	for (p=nodehash[nodepos]; p ; p=p->next ) {
-		if (p->id == id) {
-			return p;
-		}
+	if (id<nodetablesize) {
+		return nodetable[id];
 	}
 	return NULL;
 }
 
+static void fsnodes_nodetable_resize(uint32_t size) {
+	fsnode **nt;
+	nt = (fsnode**) realloc(nodetable,sizeof(fsnode*)*size);
+	passert(nt);
+	if (size>nodetablesize) {
+		memset(nt+nodetablesize,0,sizeof(fsnode*)*(size-nodetablesize));
+	}
+	memusage_other += sizeof(fsnode*)*size;
+	memusage_other -= sizeof(fsnode*)*nodetablesize;
+	nodetable = nt;
+	nodetablesize = size;
+}
+
+static inline void fsnodes_nodetable_insert(fsnode *p) {
+	uint64_t size;
+	if (p->id>=nodetablesize) {
+		size = nodetablesize;
+		while (size<=p->id) {
+			size *= 2;
+		}
+		if (size>UINT32_MAX) {
+			size = UINT32_MAX;
+		}
+		fsnodes_nodetable_resize(size);
+	}
+	nodetable[p->id] = p;
+}
+
+#ifndef METARESTORE
+void fs_storenode(fsnode *f,FILE *fd);
+void fs_storeedge(fsedge *e,FILE *fd);
+
+static inline int fsnodes_bgstore_needed(const uint8_t *map,uint32_t id) {
+	return (bgstore_running && id<=bgstore_maxnodeid && (map[id>>3]&(1<<(id&7)))==0);
+}
+
+static inline void fsnodes_bgstore_mark(uint8_t *map,uint32_t id) {
+	if (id<=bgstore_maxnodeid) {
+		map[id>>3] |= (1<<(id&7));
+	}
+}
+
+// stores list of edges "owned" by given node (has to be called with bgstore_lock)
+static void fsnodes_bgstore_edgelist(fsnode *p,FILE *fd) {
+	fsedge *e;
+	if (p->type==TYPE_DIRECTORY) {
+		for (e=p->data.ddata.children ; e ; e=e->nextchild) {
+			fs_storeedge(e,fd);
+		}
+	} else {
+		for (e=p->parents ; e ; e=e->nextparent) {
+			if (e->parent==NULL) {
+				fs_storeedge(e,fd);
+			}
+		}
+	}
+}
+
+static void fsnodes_bgstore_copynode(fsnode *p) {
+	zassert(pthread_mutex_lock(&bgstore_lock));
+	if (fsnodes_bgstore_needed(bgstore_nodemap,p->id)) {
+		fs_storenode(p,bgstore_nodecopy);
+		fsnodes_bgstore_mark(bgstore_nodemap,p->id);
+		bgstore_nodecopies++;
+	}
+	zassert(pthread_mutex_unlock(&bgstore_lock));
+}
+
+static void fsnodes_bgstore_copyedges(fsnode *p) {
+	zassert(pthread_mutex_lock(&bgstore_lock));
+	if (fsnodes_bgstore_needed(bgstore_edgemap,p->id)) {
+		fsnodes_bgstore_edgelist(p,bgstore_edgecopy);
+		fsnodes_bgstore_mark(bgstore_edgemap,p->id);
+		bgstore_edgecopies++;
+	}
+	zassert(pthread_mutex_unlock(&bgstore_lock));
+}
+
+// has to be called before any change of stored node attributes
+static inline void fsnodes_bgstore_node(fsnode *p) {
+	if (fsnodes_bgstore_needed(bgstore_nodemap,p->id)) {
+		fsnodes_bgstore_copynode(p);
+	}
+}
+
+// has to be called before adding or removing edges owned by node (see above)
+static inline void fsnodes_bgstore_edges(fsnode *p) {
+	if (fsnodes_bgstore_needed(bgstore_edgemap,p->id)) {
+		fsnodes_bgstore_copyedges(p);
+	}
+}
+
+// nodehash can be modified only between these calls
+static inline void fsnodes_bgstore_lock(void) {
+	if (bgstore_running) {
+		zassert(pthread_mutex_lock(&bgstore_lock));
+	}
+}
+
+static inline void fsnodes_bgstore_unlock(void) {
+	if (bgstore_running) {
+		zassert(pthread_mutex_unlock(&bgstore_lock));
+	}
+}
+
+// new node (or node with reused id) is not a part of the image
+static inline void fsnodes_bgstore_newnode(fsnode *p) {
+	if (bgstore_running) {
+		fsnodes_bgstore_mark(bgstore_nodemap,p->id);
+		fsnodes_bgstore_mark(bgstore_edgemap,p->id);
+	}
+}
+#else
+#define fsnodes_bgstore_node(p)
+#define fsnodes_bgstore_edges(p)
+#define fsnodes_bgstore_lock()
+#define fsnodes_bgstore_unlock()
+#define fsnodes_bgstore_newnode(p)
+#endif
+
 // returns 1 only if f is ancestor of p
 static inline int fsnodes_isancestor(fsnode *f,fsnode *p) {
 	fsedge *e;
@@ -1277,6 +1719,16 @@ static inline void fsnodes_remove_edge(uint32_t ts,fsedge *e) {
 #ifndef METARESTORE
 	statsrecord sr;
 #endif
+	if (e->parent) {
+		fsnodes_bgstore_node(e->parent);
+		fsnodes_bgstore_edges(e->parent);
+	}
+	if (e->child) {
+		fsnodes_bgstore_node(e->child);
+		if (e->child->type!=TYPE_DIRECTORY) {
+			fsnodes_bgstore_edges(e->child);
+		}
+	}
 	if (e->parent) {
 #ifndef METARESTORE
 		fsnodes_get_stats(e->child,&sr);
@@ -1306,12 +1758,15 @@ static inline void fsnodes_remove_edge(uint32_t ts,fsedge *e) {
 			e->next->prev = e->prev;
 		}
 	}
+	if (e->parent) {
+		fsnodes_dirindex_check(e->parent);
+	}
 #endif
 #ifndef METARESTORE
 /*
 #ifdef CACHENOTIFY
 	if (e->parent) {
-		matoclserv_notify_unlink(e->parent->id,e->nleng,e->name,ts);
+		matoclserv_notify_unlink(e->parent->id,e->nleng,fsedge_name(e),ts);
 		if (e->child->type==TYPE_DIRECTORY) {
 			fsnodes_attr_changed(e->parent,ts);		// nlink attr in the parent directory has changed
 		} else {
@@ -1321,8 +1776,7 @@ static inline void fsnodes_remove_edge(uint32_t ts,fsedge *e) {
 #endif
 */
 #endif
-	free(e->name);
-	free(e);
+	fsedge_free(e);
 }
 
 static inline void fsnodes_link(uint32_t ts,fsnode *parent,fsnode *child,uint16_t nleng,const uint8_t *name) {
@@ -1334,17 +1788,16 @@ static inline void fsnodes_link(uint32_t ts,fsnode *parent,fsnode *child,uint16_
 	uint8_t attr[35];
 #endif
 */
-#endif
-#ifdef EDGEHASH
-	uint32_t hpos;
 #endif
 
-	e = (fsedge*) malloc(sizeof(fsedge));
-	passert(e);
-	e->nleng = nleng;
-	e->name = (uint8_t*) malloc(nleng);
-	passert(e->name);
-	memcpy(e->name,name,nleng);
+	fsnodes_bgstore_node(parent);
+	fsnodes_bgstore_edges(parent);
+	fsnodes_bgstore_node(child);
+	if (child->type!=TYPE_DIRECTORY) {
+		fsnodes_bgstore_edges(child);
+	}
+	e = fsedge_malloc();
+	fsedge_setname(e,nleng,name);
 	e->child = child;
 	e->parent = parent;
 	e->nextchild = parent->data.ddata.children;
@@ -1360,19 +1813,16 @@ static inline void fsnodes_link(uint32_t ts,fsnode *parent,fsnode *child,uint16_
 	child->parents = e;
 	e->prevparent = &(child->parents);
 #ifdef EDGEHASH
-	hpos = EDGEHASHPOS(fsnodes_hash(parent->id,nleng,name));
-	e->next = edgehash[hpos];
-	if (e->next) {
-		e->next->prev = &(e->next);
-	}
-	edgehash[hpos] = e;
-	e->prev = &(edgehash[hpos]);
+	fsnodes_edgebucket_insert(fsnodes_edgebucket(parent,nleng,name),e);
 #endif
 
 	parent->data.ddata.elements++;
 	if (child->type==TYPE_DIRECTORY) {
 		parent->data.ddata.nlink++;
 	}
+#ifdef EDGEHASH
+	fsnodes_dirindex_check(parent);
+#endif
 #ifndef METARESTORE
 	fsnodes_get_stats(child,&sr);
 	fsnodes_add_stats(parent,&sr);
@@ -1403,9 +1853,7 @@ static inline fsnode* fsnodes_create_node(uint32_t ts,fsnode* node,uint16_t nlen
 #ifndef METARESTORE
 	statsrecord *sr;
 #endif
-	uint32_t nodepos;
-	p = (fsnode*) malloc(sizeof(fsnode));
-	passert(p);
+	p = fsnode_malloc();
 	nodes++;
 	if (type==TYPE_DIRECTORY) {
 		dirnodes++;
@@ -1486,9 +1934,10 @@ static inline fsnode* fsnodes_create_node(uint32_t ts,fsnode* node,uint16_t nlen
 */
 	}
 	p->parents = NULL;
-	nodepos = NODEHASHPOS(p->id);
-	p->next = nodehash[nodepos];
-	nodehash[nodepos] = p;
+	fsnodes_bgstore_lock();
+	fsnodes_bgstore_newnode(p);
+	fsnodes_nodetable_insert(p);
+	fsnodes_bgstore_unlock();
 	fsnodes_link(ts,node,p,nleng,name);
 	return p;
 }
@@ -1515,9 +1964,9 @@ static inline void fsnodes_getpath_data(fsedge *e,uint8_t *path,uint32_t size) {
 	}
 	if (size>=e->nleng) {
 		size-=e->nleng;
-		memcpy(path+size,e->name,e->nleng);
+		memcpy(path+size,fsedge_name(e),e->nleng);
 	} else if (size>0) {
-		memcpy(path,e->name+(e->nleng-size),size);
+		memcpy(path,fsedge_name(e)+(e->nleng-size),size);
 		size=0;
 	}
 	if (size>0) {
@@ -1527,9 +1976,9 @@ static inline void fsnodes_getpath_data(fsedge *e,uint8_t *path,uint32_t size) {
 	while (p!=root && p->parents) {
 		if (size>=p->parents->nleng) {
 			size-=p->parents->nleng;
-			memcpy(path+size,p->parents->name,p->parents->nleng);
+			memcpy(path+size,fsedge_name(p->parents),p->parents->nleng);
 		} else if (size>0) {
-			memcpy(path,p->parents->name+(p->parents->nleng-size),size);
+			memcpy(path,fsedge_name(p->parents)+(p->parents->nleng-size),size);
 			size=0;
 		}
 		if (size>0) {
@@ -1558,7 +2007,7 @@ static inline void fsnodes_getpath(fsedge *e,uint16_t *pleng,uint8_t **path) {
 	ret = (uint8_t*) malloc(size);
 	passert(ret);
 	size -= e->nleng;
-	memcpy(ret+size,e->name,e->nleng);
+	memcpy(ret+size,fsedge_name(e),e->nleng);
 	if (size>0) {
 		ret[--size]='/';
 	}
@@ -1566,10 +2015,10 @@ static inline void fsnodes_getpath(fsedge *e,uint16_t *pleng,uint8_t **path) {
 	while (p!=root && p->parents) {
 		if (size>=p->parents->nleng) {
 			size-=p->parents->nleng;
-			memcpy(ret+size,p->parents->name,p->parents->nleng);
+			memcpy(ret+size,fsedge_name(p->parents),p->parents->nleng);
 		} else {
 			if (size>0) {
-				memcpy(ret,p->parents->name+(p->parents->nleng-size),size);
+				memcpy(ret,fsedge_name(p->parents)+(p->parents->nleng-size),size);
 				size=0;
 			}
 		}
@@ -1607,7 +2056,7 @@ static inline void fsnodes_getdetacheddata(fsedge *start,uint8_t *dbuff) {
 			dbuff++;
 			memcpy(dbuff,"(...)",5);
 			dbuff+=5;
-			sptr = e->name+(e->nleng-235);
+			sptr = fsedge_name(e)+(e->nleng-235);
 			for (c=0 ; c<235 ; c++) {
 				if (*sptr=='/') {
 					*dbuff='|';
@@ -1620,7 +2069,7 @@ static inline void fsnodes_getdetacheddata(fsedge *start,uint8_t *dbuff) {
 		} else {
 			*dbuff=e->nleng;
 			dbuff++;
-			sptr = e->name;
+			sptr = fsedge_name(e);
 			for (c=0 ; c<e->nleng ; c++) {
 				if (*sptr=='/') {
 					*dbuff='|';
@@ -1645,8 +2094,7 @@ static inline uint32_t fsnodes_getdirsize(fsnode *p,uint8_t withattr) {
 	return result;
 }
 
-static inline void fsnodes_getdirdata(uint32_t rootinode,uint32_t uid,uint32_t gid,uint32_t auid,uint32_t agid,uint8_t sesflags,fsnode *p,uint8_t *dbuff,uint8_t withattr) {
-	fsedge *e;
+static inline uint8_t* fsnodes_getdirdot(uint32_t rootinode,uint32_t uid,uint32_t gid,uint32_t auid,uint32_t agid,uint8_t sesflags,fsnode *p,uint8_t *dbuff,uint8_t withattr) {
 // '.' - self
 	dbuff[0]=1;
 	dbuff[1]='.';
@@ -1662,6 +2110,10 @@ static inline void fsnodes_getdirdata(uint32_t rootinode,uint32_t uid,uint32_t g
 	} else {
 		put8bit(&dbuff,TYPE_DIRECTORY);
 	}
+	return dbuff;
+}
+
+static inline uint8_t* fsnodes_getdirdotdot(uint32_t rootinode,uint32_t uid,uint32_t gid,uint32_t auid,uint32_t agid,uint8_t sesflags,fsnode *p,uint8_t *dbuff,uint8_t withattr) {
 // '..' - parent
 	dbuff[0]=2;
 	dbuff[1]='.';
@@ -1701,20 +2153,194 @@ static inline void fsnodes_getdirdata(uint32_t rootinode,uint32_t uid,uint32_t g
 			put8bit(&dbuff,TYPE_DIRECTORY);
 		}
 	}
+	return dbuff;
+}
+
+static inline uint8_t* fsnodes_getdirentry(uint32_t uid,uint32_t gid,uint32_t auid,uint32_t agid,uint8_t sesflags,fsnode *p,fsedge *e,uint8_t *dbuff,uint8_t withattr) {
+	dbuff[0]=e->nleng;
+	dbuff++;
+	memcpy(dbuff,fsedge_name(e),e->nleng);
+	dbuff+=e->nleng;
+	put32bit(&dbuff,e->child->id);
+	if (withattr) {
+		fsnodes_fill_attr(e->child,p,uid,gid,auid,agid,sesflags,dbuff);
+		dbuff+=35;
+	} else {
+		put8bit(&dbuff,e->child->type);
+	}
+	return dbuff;
+}
+
+static inline void fsnodes_getdirdata(uint32_t rootinode,uint32_t uid,uint32_t gid,uint32_t auid,uint32_t agid,uint8_t sesflags,fsnode *p,uint8_t *dbuff,uint8_t withattr) {
+	fsedge *e;
+	dbuff = fsnodes_getdirdot(rootinode,uid,gid,auid,agid,sesflags,p,dbuff,withattr);
+	dbuff = fsnodes_getdirdotdot(rootinode,uid,gid,auid,agid,sesflags,p,dbuff,withattr);
 // entries
 	for (e = p->data.ddata.children ; e ; e=e->nextchild) {
-		dbuff[0]=e->nleng;
-		dbuff++;
-		memcpy(dbuff,e->name,e->nleng);
-		dbuff+=e->nleng;
-		put32bit(&dbuff,e->child->id);
-		if (withattr) {
-			fsnodes_fill_attr(e->child,p,uid,gid,auid,agid,sesflags,dbuff);
-			dbuff+=35;
-		} else {
-			put8bit(&dbuff,e->child->type);
+		dbuff = fsnodes_getdirentry(uid,gid,auid,agid,sesflags,p,e,dbuff,withattr);
+	}
+}
+
+/* paginated readdir
+ * Entries are sent in order of their bit-reversed name hashes ('keys'). For directories with
+ * own index it is just the order of buckets, so a page is collected without looking at the
+ * rest of the directory. Cursors (opaque for clients):
+ *   0 - '.', '..' and entries ; 1 - '..' and entries ; 2+key - entries with key>=key
+ * Entries with the same key always go to the same page, so cursors stay valid when the
+ * directory is modified or its index is resized in the meantime.
+ */
+#define DIRPAGE_CURSOR_DOTDOT 1
+#define DIRPAGE_CURSOR_ENTRIES 2
+#define DIRPAGE_MAXSIZE 0x400000
+
+typedef struct _dirpageentry {
+	uint32_t key;
+	fsedge *e;
+} dirpageentry;
+
+typedef struct _dirpage {
+	uint8_t dot,dotdot;
+	uint32_t count;
+	uint32_t size;			// answer size (cursors and entries)
+	uint64_t nextcursor;
+	dirpageentry *entries;
+	uint32_t entriessize;
+} dirpage;
+
+static inline uint32_t fsnodes_bitrev(uint32_t v) {
+	v = ((v>>1)&0x55555555)|((v&0x55555555)<<1);
+	v = ((v>>2)&0x33333333)|((v&0x33333333)<<2);
+	v = ((v>>4)&0x0F0F0F0F)|((v&0x0F0F0F0F)<<4);
+	v = ((v>>8)&0x00FF00FF)|((v&0x00FF00FF)<<8);
+	return (v>>16)|(v<<16);
+}
+
+static int fsnodes_dirpage_cmp(const void *a,const void *b) {
+	uint32_t ka = ((const dirpageentry*)a)->key;
+	uint32_t kb = ((const dirpageentry*)b)->key;
+	return (ka<kb)?-1:(ka>kb)?1:0;
+}
+
+static inline void fsnodes_dirpage_candidate(dirpageentry **cand,uint32_t *n,uint32_t *candsize,uint32_t key,fsedge *e) {
+	if (*n>=*candsize) {
+		*candsize = (*candsize)?(*candsize)*2:256;
+		*cand = (dirpageentry*)realloc(*cand,sizeof(dirpageentry)*(*candsize));
+		passert(*cand);
+	}
+	(*cand)[*n].key = key;
+	(*cand)[*n].e = e;
+	(*n)++;
+}
+
+/* sorts candidates and adds them to page - returns 1 when page is full (nextcursor is set then) */
+static int fsnodes_dirpage_add(dirpage *dp,dirpageentry *cand,uint32_t n,uint8_t withattr,uint32_t maxsize) {
+	uint32_t i,j,gsize;
+
+	qsort(cand,n,sizeof(dirpageentry),fsnodes_dirpage_cmp);
+	for (i=0 ; i<n ; i=j) {
+		gsize = 0;
+		for (j=i ; j<n && cand[j].key==cand[i].key ; j++) {
+			gsize += 8+((withattr)?40:6)+cand[j].e->nleng;
+		}
+		if (dp->size>0 && dp->size+gsize>maxsize) {
+			dp->nextcursor = DIRPAGE_CURSOR_ENTRIES+(uint64_t)(cand[i].key);
+			return 1;
+		}
+		if (dp->count+(j-i)>dp->entriessize) {
+			while (dp->count+(j-i)>dp->entriessize) {
+				dp->entriessize = (dp->entriessize)?dp->entriessize*2:256;
+			}
+			dp->entries = (dirpageentry*)realloc(dp->entries,sizeof(dirpageentry)*dp->entriessize);
+			passert(dp->entries);
+		}
+		memcpy(dp->entries+dp->count,cand+i,sizeof(dirpageentry)*(j-i));
+		dp->count += j-i;
+		dp->size += gsize;
+	}
+	return 0;
+}
+
+static dirpage* fsnodes_dirpage_collect(fsnode *p,uint64_t cursor,uint8_t withattr,uint32_t maxsize) {
+	dirpage *dp;
+	dirpageentry *cand;
+	uint32_t n,candsize,startkey,key;
+	fsedge *e;
+#ifdef EDGEHASH
+	dirindex *di;
+	uint32_t bits,j;
+#endif
+
+	dp = (dirpage*)malloc(sizeof(dirpage));
+	passert(dp);
+	dp->dot = (cursor==0)?1:0;
+	dp->dotdot = (cursor<=DIRPAGE_CURSOR_DOTDOT)?1:0;
+	dp->count = 0;
+	dp->size = dp->dot*(8+((withattr)?40:6)+1) + dp->dotdot*(8+((withattr)?40:6)+2);
+	dp->nextcursor = 0;
+	dp->entries = NULL;
+	dp->entriessize = 0;
+	if (cursor>DIRPAGE_CURSOR_ENTRIES+UINT64_C(0xFFFFFFFF)) {	// after the last possible key
+		return dp;
+	}
+	startkey = (cursor<DIRPAGE_CURSOR_ENTRIES)?0:(cursor-DIRPAGE_CURSOR_ENTRIES);
+	cand = NULL;
+	candsize = 0;
+	n = 0;
+#ifdef EDGEHASH
+	if (p->data.ddata.elements>=DIRINDEX_LOWLIMIT && (di=fsnodes_dirindex_get(p->id))!=NULL) {
+		for (bits=0 ; (1U<<bits)<di->hashsize ; bits++) {}
+		// bucket 'pos' has entries with keys from bitrev(pos)<<(32-bits) to the next bucket
+		for (j=startkey>>(32-bits) ; j<di->hashsize ; j++) {
+			n = 0;
+			for (e=di->hash[fsnodes_bitrev(j)>>(32-bits)] ; e ; e=e->next) {
+				key = fsnodes_bitrev(fsnodes_hash(p->id,e->nleng,fsedge_name(e)));
+				if (key>=startkey) {
+					fsnodes_dirpage_candidate(&cand,&n,&candsize,key,e);
+				}
+			}
+			if (n>0 && fsnodes_dirpage_add(dp,cand,n,withattr,maxsize)) {
+				break;
+			}
+		}
+		free(cand);
+		return dp;
+	}
+#endif
+	for (e=p->data.ddata.children ; e ; e=e->nextchild) {
+		key = fsnodes_bitrev(fsnodes_hash(p->id,e->nleng,fsedge_name(e)));
+		if (key>=startkey) {
+			fsnodes_dirpage_candidate(&cand,&n,&candsize,key,e);
 		}
 	}
+	if (n>0) {
+		fsnodes_dirpage_add(dp,cand,n,withattr,maxsize);
+	}
+	free(cand);
+	return dp;
+}
+
+static void fsnodes_getdirpage(uint32_t rootinode,uint32_t uid,uint32_t gid,uint32_t auid,uint32_t agid,uint8_t sesflags,fsnode *p,dirpage *dp,uint8_t *dbuff,uint8_t withattr) {
+	uint32_t i;
+	put64bit(&dbuff,dp->nextcursor);
+	put32bit(&dbuff,dp->dot+dp->dotdot+dp->count);
+	if (dp->dot) {
+		put64bit(&dbuff,DIRPAGE_CURSOR_DOTDOT);
+	}
+	if (dp->dotdot) {
+		put64bit(&dbuff,DIRPAGE_CURSOR_ENTRIES);
+	}
+	for (i=0 ; i<dp->count ; i++) {
+		put64bit(&dbuff,DIRPAGE_CURSOR_ENTRIES+1+(uint64_t)(dp->entries[i].key));
+	}
+	if (dp->dot) {
+		dbuff = fsnodes_getdirdot(rootinode,uid,gid,auid,agid,sesflags,p,dbuff,withattr);
+	}
+	if (dp->dotdot) {
+		dbuff = fsnodes_getdirdotdot(rootinode,uid,gid,auid,agid,sesflags,p,dbuff,withattr);
+	}
+	for (i=0 ; i<dp->count ; i++) {
+		dbuff = fsnodes_getdirentry(uid,gid,auid,agid,sesflags,p,dp->entries[i].e,dbuff,withattr);
+	}
 }
 
 static inline void fsnodes_checkfile(fsnode *p,uint32_t chunkcount[11]) {
@@ -1766,6 +2392,8 @@ static inline uint8_t fsnodes_appendchunks(uint32_t ts,fsnode *dstobj,fsnode *sr
 		return ERROR_INDEXTOOBIG;
 	}
 #ifndef METARESTORE
+	fsnodes_bgstore_node(dstobj);
+	fsnodes_bgstore_node(srcobj);
 	fsnodes_get_stats(dstobj,&psr);
 #endif
 	if (i>=dstobj->data.fdata.chunks) {
@@ -1844,6 +2472,7 @@ static inline void fsnodes_changefilegoal(fsnode *obj,uint8_t goal) {
 	statsrecord psr,nsr;
 	fsedge *e;
 
+	fsnodes_bgstore_node(obj);
 	fsnodes_get_stats(obj,&psr);
 	nsr = psr;
 	nsr.realsize = goal * nsr.size;
@@ -1865,6 +2494,7 @@ static inline void fsnodes_setlength(fsnode *obj,uint64_t length) {
 #ifndef METARESTORE
 	fsedge *e;
 	statsrecord psr,nsr;
+	fsnodes_bgstore_node(obj);
 	fsnodes_get_stats(obj,&psr);
 #endif
 	if (obj->type==TYPE_TRASH) {
@@ -1912,21 +2542,15 @@ static inline void fsnodes_setlength(fsnode *obj,uint64_t length) {
 
 
 static inline void fsnodes_remove_node(uint32_t ts,fsnode *toremove) {
-	uint32_t nodepos;
-	fsnode **ptr;
 	if (toremove->parents!=NULL) {
 		return;
 	}
-// remove from idhash
-	nodepos = NODEHASHPOS(toremove->id);
-	ptr = &(nodehash[nodepos]);
-	while (*ptr) {
-		if (*ptr==toremove) {
-			*ptr=toremove->next;
-			break;
-		}
-		ptr = &((*ptr)->next);
-	}
+	fsnodes_bgstore_node(toremove);
+	fsnodes_bgstore_edges(toremove);
+// remove from nodetable
+	fsnodes_bgstore_lock();
+	nodetable[toremove->id] = NULL;
+	fsnodes_bgstore_unlock();
 // and free
 	nodes--;
 	if (toremove->type==TYPE_DIRECTORY) {
@@ -1965,7 +2589,7 @@ static inline void fsnodes_remove_node(uint32_t ts,fsnode *toremove) {
 #ifndef METARESTORE
 	dcm_modify(toremove->id,0);
 #endif
-	free(toremove);
+	fsnode_free(toremove);
 }
 
 
@@ -1986,10 +2610,9 @@ static inline void fsnodes_unlink(uint32_t ts,fsedge *e) {
 			if (child->trashtime>0) {
 				child->type = TYPE_TRASH;
 				child->ctime = ts;
-				e = (fsedge*) malloc(sizeof(fsedge));
-				passert(e);
-				e->nleng = pleng;
-				e->name = path;
+				e = fsedge_malloc();
+				fsedge_setname(e,pleng,path);
+				free(path);
 				e->child = child;
 				e->parent = NULL;
 				e->nextchild = trash;
@@ -2009,10 +2632,9 @@ static inline void fsnodes_unlink(uint32_t ts,fsedge *e) {
 				trashnodes++;
 			} else if (child->data.fdata.sessionids!=NULL) {
 				child->type = TYPE_RESERVED;
-				e = (fsedge*) malloc(sizeof(fsedge));
-				passert(e);
-				e->nleng = pleng;
-				e->name = path;
+				e = fsedge_malloc();
+				fsedge_setname(e,pleng,path);
+				free(path);
 				e->child = child;
 				e->parent = NULL;
 				e->nextchild = reserved;
@@ -2050,6 +2672,7 @@ static inline void fsnodes_unlink(uint32_t ts,fsedge *e) {
 static inline int fsnodes_purge(uint32_t ts,fsnode *p) {
 	fsedge *e;
 	e = p->parents;
+	fsnodes_bgstore_node(p);
 
 	if (p->type==TYPE_TRASH) {
 		trashspace -= p->data.fdata.length;
@@ -2095,7 +2718,7 @@ static inline uint8_t fsnodes_undel(uint32_t ts,fsnode *node) {
 /* check path */
 	e = node->parents;
 	pleng = e->nleng;
-	path = e->name;
+	path = fsedge_name(e);
 
 	if (path==NULL) {
 		return ERROR_CANTCREATEPATH;
@@ -2157,6 +2780,7 @@ static inline uint8_t fsnodes_undel(uint32_t ts,fsnode *node) {
 				return ERROR_EEXIST;
 			}
 			// remove from trash and link to new parent
+			fsnodes_bgstore_node(node);
 			node->type = TYPE_FILE;
 			node->ctime = ts;
 			fsnodes_link(ts,p,node,partleng,path);
@@ -2204,9 +2828,11 @@ static inline void fsnodes_getgoal_recursive(fsnode *node,uint8_t gmode,uint32_t
 	} else if (node->type==TYPE_DIRECTORY) {
 		if (node->goal>9) {
 			syslog(LOG_WARNING,"inode %" PRIu32 ": goal>9 !!! - fixing",node->id);
+			fsnodes_bgstore_node(node);
 			node->goal=9;
 		} else if (node->goal<1) {
 			syslog(LOG_WARNING,"inode %" PRIu32 ": goal<1 !!! - fixing",node->id);
+			fsnodes_bgstore_node(node);
 			node->goal=1;
 		}
 		dgtab[node->goal]++;
@@ -2325,6 +2951,7 @@ static inline void fsnodes_setgoal_recursive(fsnode *node,uint32_t ts,uint32_t u
 				break;
 			}
 			if (set) {
+				fsnodes_bgstore_node(node);
 				if (node->type!=TYPE_DIRECTORY) {
 #if VERSHEX>=0x010700
 					if (quota && goal>node->goal) {
@@ -2381,18 +3008,21 @@ static inline void fsnodes_settrashtime_recursive(fsnode *node,uint32_t ts,uint3
 			switch (smode&SMODE_TMASK) {
 			case SMODE_SET:
 				if (node->trashtime!=trashtime) {
+					fsnodes_bgstore_node(node);
 					node->trashtime=trashtime;
 					set=1;
 				}
 				break;
 			case SMODE_INCREASE:
 				if (node->trashtime<trashtime) {
+					fsnodes_bgstore_node(node);
 					node->trashtime=trashtime;
 					set=1;
 				}
 				break;
 			case SMODE_DECREASE:
 				if (node->trashtime>trashtime) {
+					fsnodes_bgstore_node(node);
 					node->trashtime=trashtime;
 					set=1;
 				}
@@ -2428,6 +3058,9 @@ static inline void fsnodes_seteattr_recursive(fsnode *node,uint32_t ts,uint32_t
 		(*nsinodes)++;
 	} else {
 		seattr = eattr;
+		if (node->type!=TYPE_DIRECTORY && (node->mode&(EATTR_NOECACHE<<12))) {
+			fsnodes_bgstore_node(node);
+		}
 		if (node->type!=TYPE_DIRECTORY) {
 			node->mode &= ~(EATTR_NOECACHE<<12);
 			seattr &= ~(EATTR_NOECACHE);
@@ -2445,6 +3078,7 @@ static inline void fsnodes_seteattr_recursive(fsnode *node,uint32_t ts,uint32_t
 				break;
 		}
 		if (neweattr!=(node->mode>>12)) {
+			fsnodes_bgstore_node(node);
 			node->mode = (node->mode&0xFFF) | (((uint16_t)neweattr)<<12);
 			(*sinodes)++;
 			node->ctime = ts;
@@ -2473,9 +3107,10 @@ static inline void fsnodes_snapshot(uint32_t ts,fsnode *srcnode,fsnode *parentno
 	uint64_t chunkid;
 	if ((e=fsnodes_lookup(parentnode,nleng,name))) {
 		dstnode = e->child;
+		fsnodes_bgstore_node(dstnode);
 		if (srcnode->type==TYPE_DIRECTORY) {
 			for (e = srcnode->data.ddata.children ; e ; e=e->nextchild) {
-				fsnodes_snapshot(ts,e->child,dstnode,e->nleng,e->name);
+				fsnodes_snapshot(ts,e->child,dstnode,e->nleng,fsedge_name(e));
 			}
 		} else if (srcnode->type==TYPE_FILE) {
 			uint8_t same;
@@ -2583,7 +3218,7 @@ static inline void fsnodes_snapshot(uint32_t ts,fsnode *srcnode,fsnode *parentno
 			dstnode->mtime = srcnode->mtime;
 			if (srcnode->type==TYPE_DIRECTORY) {
 				for (e = srcnode->data.ddata.children ; e ; e=e->nextchild) {
-					fsnodes_snapshot(ts,e->child,dstnode,e->nleng,e->name);
+					fsnodes_snapshot(ts,e->child,dstnode,e->nleng,fsedge_name(e));
 				}
 			} else if (srcnode->type==TYPE_FILE) {
 				if (srcnode->data.fdata.chunks>0) {
@@ -2650,7 +3285,7 @@ static inline uint8_t fsnodes_snapshot_test(fsnode *origsrcnode,fsnode *srcnode,
 		}
 		if (srcnode->type==TYPE_DIRECTORY) {
 			for (e = srcnode->data.ddata.children ; e ; e=e->nextchild) {
-				status = fsnodes_snapshot_test(origsrcnode,e->child,dstnode,e->nleng,e->name,canoverwrite);
+				status = fsnodes_snapshot_test(origsrcnode,e->child,dstnode,e->nleng,fsedge_name(e),canoverwrite);
 				if (status!=STATUS_OK) {
 					return status;
 				}
@@ -2806,7 +3441,7 @@ uint8_t fs_gettrashpath(uint32_t rootinode,uint8_t sesflags,uint32_t inode,uint3
 		return ERROR_ENOENT;
 	}
 	*pleng = p->parents->nleng;
-	*path = p->parents->name;
+	*path = fsedge_name(p->parents);
 	return STATUS_OK;
 }
 #endif
@@ -2818,7 +3453,6 @@ uint8_t fs_setpath(uint32_t inode,const uint8_t *path) {
 	uint32_t pleng;
 #endif
 	fsnode *p;
-	uint8_t *newpath;
 #ifdef METARESTORE
 	pleng = strlen((char*)path);
 #else
@@ -2845,14 +3479,11 @@ uint8_t fs_setpath(uint32_t inode,const uint8_t *path) {
 	if (p->type!=TYPE_TRASH) {
 		return ERROR_ENOENT;
 	}
-	newpath = (uint8_t*) malloc(pleng);
-	passert(newpath);
-	free(p->parents->name);
-	memcpy(newpath,path,pleng);
-	p->parents->name = newpath;
-	p->parents->nleng = pleng;
+	fsnodes_bgstore_edges(p);
+	fsedge_freename(p->parents);
+	fsedge_setname(p->parents,pleng,path);
 #ifndef METARESTORE
-	changelog(metaversion++,"%" PRIu32 "|SETPATH(%" PRIu32 ",%s)",(uint32_t)main_time(),inode,fsnodes_escape_name(pleng,newpath));
+	changelog(metaversion++,"%" PRIu32 "|SETPATH(%" PRIu32 ",%s)",(uint32_t)main_time(),inode,fsnodes_escape_name(pleng,path));
 #else
 	metaversion++;
 #endif
@@ -2927,8 +3558,9 @@ uint8_t fs_purge(uint32_t ts,uint32_t inode) {
 }
 
 #ifndef METARESTORE
-void fs_info(uint64_t *totalspace,uint64_t *availspace,uint64_t *trspace,uint32_t *trnodes,uint64_t *respace,uint32_t *renodes,uint32_t *inodes,uint32_t *dnodes,uint32_t *fnodes) {
+void fs_info(uint64_t *totalspace,uint64_t *availspace,uint64_t *trspace,uint32_t *trnodes,uint64_t *respace,uint32_t *renodes,uint32_t *inodes,uint32_t *dnodes,uint32_t *fnodes,uint64_t *memusage) {
 	matocsserv_getspace(totalspace,availspace);
+	*memusage = memusage_nodes+memusage_edges+memusage_names+memusage_other;
 	*trspace = trashspace;
 	*trnodes = trashnodes;
 	*respace = reservedspace;
@@ -3092,7 +3724,7 @@ uint8_t fs_lookup(uint32_t rootinode,uint8_t sesflags,uint32_t parent,uint16_t n
 				*inode = wd->id;
 			}
 			fsnodes_fill_attr(wd,wd,uid,gid,auid,agid,sesflags,attr);
-			stats_lookup++;
+			STATS_INC(stats_lookup);
 			return STATUS_OK;
 		}
 		if (nleng==2 && name[1]=='.') {	// parent
@@ -3112,7 +3744,7 @@ uint8_t fs_lookup(uint32_t rootinode,uint8_t sesflags,uint32_t parent,uint16_t n
 					fsnodes_fill_attr(rn,wd,uid,gid,auid,agid,sesflags,attr);
 				}
 			}
-			stats_lookup++;
+			STATS_INC(stats_lookup);
 			return STATUS_OK;
 		}
 	}
@@ -3130,7 +3762,7 @@ uint8_t fs_lookup(uint32_t rootinode,uint8_t sesflags,uint32_t parent,uint16_t n
 */
 	*inode = e->child->id;
 	fsnodes_fill_attr(e->child,wd,uid,gid,auid,agid,sesflags,attr);
-	stats_lookup++;
+	STATS_INC(stats_lookup);
 	return STATUS_OK;
 }
 
@@ -3172,7 +3804,7 @@ uint8_t fs_getattr(uint32_t rootinode,uint8_t sesflags,uint32_t inode,uint32_t u
 #endif
 */
 	fsnodes_fill_attr(p,NULL,uid,gid,auid,agid,sesflags,attr);
-	stats_getattr++;
+	STATS_INC(stats_getattr);
 	return STATUS_OK;
 }
 
@@ -3229,6 +3861,7 @@ uint8_t fs_try_setlength(uint32_t rootinode,uint8_t sesflags,uint32_t inode,uint
 				if (status!=STATUS_OK) {
 					return status;
 				}
+				fsnodes_bgstore_node(p);
 				p->data.fdata.chunktab[indx] = nchunkid;
 				*chunkid = nchunkid;
 				changelog(metaversion++,"%" PRIu32 "|TRUNC(%" PRIu32 ",%" PRIu32 "):%" PRIu64,(uint32_t)main_time(),inode,indx,nchunkid);
@@ -3383,6 +4016,7 @@ uint8_t fs_setattr(uint32_t rootinode,uint8_t sesflags,uint32_t inode,uint32_t u
 	if ((setmask&(SET_UID_FLAG|SET_GID_FLAG)) && (setmask&SET_MODE_FLAG)) {	// chown+chmod = chown with sugid clears
 		attrmode |= (p->mode & 06000);
 	}
+	fsnodes_bgstore_node(p);
 	// then do it yourself
 	if ((p->mode & 06000) && (setmask&(SET_UID_FLAG|SET_GID_FLAG))) { // this is "chown" operation and suid or sgid bit is set
 		switch (sugidclearmode) {
@@ -3533,6 +4167,7 @@ uint8_t fs_readlink(uint32_t rootinode,uint8_t sesflags,uint32_t inode,uint32_t
 	*pleng = p->data.sdata.pleng;
 	*path = p->data.sdata.path;
 	if (p->atime!=ts) {
+		fsnodes_bgstore_node(p);
 		p->atime = ts;
 /*
 #ifdef CACHENOTIFY
@@ -4369,10 +5004,8 @@ uint8_t fs_append(uint32_t ts,uint32_t inode,uint32_t inode_src) {
 }
 
 #ifndef METARESTORE
-uint8_t fs_readdir_size(uint32_t rootinode,uint8_t sesflags,uint32_t inode,uint32_t uid,uint32_t gid,uint8_t flags,void **dnode,uint32_t *dbuffsize) {
+static uint8_t fs_readdir_getnode(uint32_t rootinode,uint8_t sesflags,uint32_t inode,uint32_t uid,uint32_t gid,fsnode **dnode) {
 	fsnode *p,*rn;
-	*dnode = NULL;
-	*dbuffsize = 0;
 	if (rootinode==MFS_ROOT_ID) {
 		p = fsnodes_id_to_node(inode);
 		if (!p) {
@@ -4402,31 +5035,83 @@ uint8_t fs_readdir_size(uint32_t rootinode,uint8_t sesflags,uint32_t inode,uint3
 		return ERROR_EACCES;
 	}
 	*dnode = p;
+	return STATUS_OK;
+}
+
+uint8_t fs_readdir_size(uint32_t rootinode,uint8_t sesflags,uint32_t inode,uint32_t uid,uint32_t gid,uint8_t flags,void **dnode,uint32_t *dbuffsize) {
+	fsnode *p;
+	uint8_t status;
+	*dnode = NULL;
+	*dbuffsize = 0;
+	status = fs_readdir_getnode(rootinode,sesflags,inode,uid,gid,&p);
+	if (status!=STATUS_OK) {
+		return status;
+	}
+	*dnode = p;
 	*dbuffsize = fsnodes_getdirsize(p,flags&GETDIR_FLAG_WITHATTR);
 	return STATUS_OK;
 }
 
 void fs_readdir_data(uint32_t rootinode,uint8_t sesflags,uint32_t uid,uint32_t gid,uint32_t auid,uint32_t agid,uint8_t flags,void *dnode,uint8_t *dbuff) {
+	fs_readdir_atime(dnode);
+	fs_readdir_data_ro(rootinode,sesflags,uid,gid,auid,agid,flags,dnode,dbuff);
+}
+
+void fs_readdir_data_ro(uint32_t rootinode,uint8_t sesflags,uint32_t uid,uint32_t gid,uint32_t auid,uint32_t agid,uint8_t flags,void *dnode,uint8_t *dbuff) {
 	fsnode *p = (fsnode*)dnode;
-	uint32_t ts = main_time();
 
-	if (p->atime!=ts) {
-		p->atime = ts;
-		changelog(metaversion++,"%" PRIu32 "|ACCESS(%" PRIu32 ")",ts,p->id);
-		fsnodes_getdirdata(rootinode,uid,gid,auid,agid,sesflags,p,dbuff,flags&GETDIR_FLAG_WITHATTR);
-/*
-#ifdef CACHENOTIFY
-		fsnodes_attr_changed(p,ts);
-#endif
-*/
-	} else {
-		fsnodes_getdirdata(rootinode,uid,gid,auid,agid,sesflags,p,dbuff,flags&GETDIR_FLAG_WITHATTR);
-	}
-	stats_readdir++;
+	fsnodes_getdirdata(rootinode,uid,gid,auid,agid,sesflags,p,dbuff,flags&GETDIR_FLAG_WITHATTR);
+	STATS_INC(stats_readdir);
 }
 
-
-uint8_t fs_checkfile(uint32_t rootinode,uint8_t sesflags,uint32_t inode,uint32_t chunkcount[11]) {
+uint8_t fs_readdir_page_size(uint32_t rootinode,uint8_t sesflags,uint32_t inode,uint32_t uid,uint32_t gid,uint8_t flags,uint64_t cursor,uint32_t maxsize,void **dnode,void **dpage,uint32_t *dbuffsize) {
+	fsnode *p;
+	dirpage *dp;
+	uint8_t status;
+	*dnode = NULL;
+	*dpage = NULL;
+	*dbuffsize = 0;
+	status = fs_readdir_getnode(rootinode,sesflags,inode,uid,gid,&p);
+	if (status!=STATUS_OK) {
+		return status;
+	}
+	if (maxsize>DIRPAGE_MAXSIZE) {
+		maxsize = DIRPAGE_MAXSIZE;
+	}
+	dp = fsnodes_dirpage_collect(p,cursor,flags&GETDIR_FLAG_WITHATTR,maxsize);
+	*dnode = p;
+	*dpage = dp;
+	*dbuffsize = 8+4+dp->size;
+	return STATUS_OK;
+}
+
+void fs_readdir_page_data_ro(uint32_t rootinode,uint8_t sesflags,uint32_t uid,uint32_t gid,uint32_t auid,uint32_t agid,uint8_t flags,void *dnode,void *dpage,uint8_t *dbuff) {
+	dirpage *dp = (dirpage*)dpage;
+
+	fsnodes_getdirpage(rootinode,uid,gid,auid,agid,sesflags,(fsnode*)dnode,dp,dbuff,flags&GETDIR_FLAG_WITHATTR);
+	free(dp->entries);
+	free(dp);
+	STATS_INC(stats_readdir);
+}
+
+void fs_readdir_atime(void *dnode) {
+	fsnode *p = (fsnode*)dnode;
+	uint32_t ts = main_time();
+
+	if (p->atime!=ts) {
+		fsnodes_bgstore_node(p);
+		p->atime = ts;
+		changelog(metaversion++,"%" PRIu32 "|ACCESS(%" PRIu32 ")",ts,p->id);
+/*
+#ifdef CACHENOTIFY
+		fsnodes_attr_changed(p,ts);
+#endif
+*/
+	}
+}
+
+
+uint8_t fs_checkfile(uint32_t rootinode,uint8_t sesflags,uint32_t inode,uint32_t chunkcount[11]) {
 	fsnode *p,*rn;
 	(void)sesflags;
 	if (rootinode==MFS_ROOT_ID || rootinode==0) {
@@ -4525,6 +5210,7 @@ uint8_t fs_acquire(uint32_t inode,uint32_t sessionid) {
 			return ERROR_EINVAL;
 		}
 	}
+	fsnodes_bgstore_node(p);
 	cr = sessionidrec_malloc();
 	cr->sessionid = sessionid;
 	cr->next = p->data.fdata.sessionids;
@@ -4550,6 +5236,7 @@ uint8_t fs_release(uint32_t inode,uint32_t sessionid) {
 	crp = &(p->data.fdata.sessionids);
 	while ((cr=*crp)) {
 		if (cr->sessionid==sessionid) {
+			fsnodes_bgstore_node(p);
 			*crp = cr->next;
 			sessionidrec_free(cr);
 #ifndef METARESTORE
@@ -4586,8 +5273,17 @@ uint8_t fs_session(uint32_t sessionid) {
 
 #ifndef METARESTORE
 uint8_t fs_readchunk(uint32_t inode,uint32_t indx,uint64_t *chunkid,uint64_t *length) {
+	uint8_t status;
+
+	status = fs_readchunk_ro(inode,indx,chunkid,length);
+	if (status==STATUS_OK) {
+		fs_readchunk_atime(inode);
+	}
+	return status;
+}
+
+uint8_t fs_readchunk_ro(uint32_t inode,uint32_t indx,uint64_t *chunkid,uint64_t *length) {
 	fsnode *p;
-	uint32_t ts = main_time();
 
 	*chunkid = 0;
 	*length = 0;
@@ -4605,7 +5301,17 @@ uint8_t fs_readchunk(uint32_t inode,uint32_t indx,uint64_t *chunkid,uint64_t *le
 		*chunkid = p->data.fdata.chunktab[indx];
 	}
 	*length = p->data.fdata.length;
-	if (p->atime!=ts) {
+	STATS_INC(stats_read);
+	return STATUS_OK;
+}
+
+void fs_readchunk_atime(uint32_t inode) {
+	fsnode *p;
+	uint32_t ts = main_time();
+
+	p = fsnodes_id_to_node(inode);
+	if (p && p->atime!=ts) {
+		fsnodes_bgstore_node(p);
 		p->atime = ts;
 		changelog(metaversion++,"%" PRIu32 "|ACCESS(%" PRIu32 ")",ts,inode);
 /*
@@ -4614,8 +5320,6 @@ uint8_t fs_readchunk(uint32_t inode,uint32_t indx,uint64_t *chunkid,uint64_t *le
 #endif
 */
 	}
-	stats_read++;
-	return STATUS_OK;
 }
 #endif
 
@@ -4644,6 +5348,7 @@ uint8_t fs_writechunk(uint32_t inode,uint32_t indx,uint64_t *chunkid,uint64_t *l
 	if (indx>MAX_INDEX) {
 		return ERROR_INDEXTOOBIG;
 	}
+	fsnodes_bgstore_node(p);
 	fsnodes_get_stats(p,&psr);
 	/* resize chunks structure */
 	if (indx>=p->data.fdata.chunks) {
@@ -4832,6 +5537,7 @@ uint8_t fs_repair(uint32_t rootinode,uint8_t sesflags,uint32_t inode,uint32_t ui
 	if (!fsnodes_access(p,uid,gid,MODE_MASK_W,sesflags)) {
 		return ERROR_EACCES;
 	}
+	fsnodes_bgstore_node(p);
 	fsnodes_get_stats(p,&psr);
 	for (indx=0 ; indx<p->data.fdata.chunks ; indx++) {
 		if (chunk_repair(p->goal,p->data.fdata.chunktab[indx],&nversion)) {
@@ -5408,6 +6114,7 @@ uint8_t fs_setxattr(uint32_t rootinode,uint8_t sesflags,uint32_t inode,uint8_t o
 	if (status!=STATUS_OK) {
 		return status;
 	}
+	fsnodes_bgstore_node(p);
 	p->ctime = ts;
 	changelog(metaversion++,"%" PRIu32 "|SETXATTR(%" PRIu32 ",%s,%s,%" PRIu8 ")",ts,inode,fsnodes_escape_name(anleng,attrname),fsnodes_escape_name(avleng,attrvalue),mode);
 	return STATUS_OK;
@@ -5847,8 +6554,8 @@ void fs_add_files_to_chunks() {
 	uint32_t i,j;
 	uint64_t chunkid;
 	fsnode *f;
-	for (i=0 ; i<NODEHASHSIZE ; i++) {
-		for (f=nodehash[i] ; f ; f=f->next) {
+	for (i=0 ; i<nodetablesize ; i++) {
+		if ((f=nodetable[i])!=NULL) {
 			if (f->type==TYPE_FILE || f->type==TYPE_TRASH || f->type==TYPE_RESERVED) {
 				for (j=0 ; j<f->data.fdata.chunks ; j++) {
 					chunkid = f->data.fdata.chunktab[j];
@@ -5880,25 +6587,25 @@ uint32_t fs_test_log_inconsistency(fsedge *e,const char *iname,char *buff,uint32
 	uint32_t leng;
 	leng=0;
 	if (e->parent) {
-		syslog(LOG_ERR,"structure error - %s inconsistency (edge: %" PRIu32 ",%s -> %" PRIu32 ")",iname,e->parent->id,fsnodes_escape_name(e->nleng,e->name),e->child->id);
+		syslog(LOG_ERR,"structure error - %s inconsistency (edge: %" PRIu32 ",%s -> %" PRIu32 ")",iname,e->parent->id,fsnodes_escape_name(e->nleng,fsedge_name(e)),e->child->id);
 		if (leng<size) {
-			leng += snprintf(buff+leng,size-leng,"structure error - %s inconsistency (edge: %" PRIu32 ",%s -> %" PRIu32 ")\n",iname,e->parent->id,fsnodes_escape_name(e->nleng,e->name),e->child->id);
+			leng += snprintf(buff+leng,size-leng,"structure error - %s inconsistency (edge: %" PRIu32 ",%s -> %" PRIu32 ")\n",iname,e->parent->id,fsnodes_escape_name(e->nleng,fsedge_name(e)),e->child->id);
 		}
 	} else {
 		if (e->child->type==TYPE_TRASH) {
-			syslog(LOG_ERR,"structure error - %s inconsistency (edge: TRASH,%s -> %" PRIu32 ")",iname,fsnodes_escape_name(e->nleng,e->name),e->child->id);
+			syslog(LOG_ERR,"structure error - %s inconsistency (edge: TRASH,%s -> %" PRIu32 ")",iname,fsnodes_escape_name(e->nleng,fsedge_name(e)),e->child->id);
 			if (leng<size) {
-				leng += snprintf(buff+leng,size-leng,"structure error - %s inconsistency (edge: TRASH,%s -> %" PRIu32 ")\n",iname,fsnodes_escape_name(e->nleng,e->name),e->child->id);
+				leng += snprintf(buff+leng,size-leng,"structure error - %s inconsistency (edge: TRASH,%s -> %" PRIu32 ")\n",iname,fsnodes_escape_name(e->nleng,fsedge_name(e)),e->child->id);
 			}
 		} else if (e->child->type==TYPE_RESERVED) {
-			syslog(LOG_ERR,"structure error - %s inconsistency (edge: RESERVED,%s -> %" PRIu32 ")",iname,fsnodes_escape_name(e->nleng,e->name),e->child->id);
+			syslog(LOG_ERR,"structure error - %s inconsistency (edge: RESERVED,%s -> %" PRIu32 ")",iname,fsnodes_escape_name(e->nleng,fsedge_name(e)),e->child->id);
 			if (leng<size) {
-				leng += snprintf(buff+leng,size-leng,"structure error - %s inconsistency (edge: RESERVED,%s -> %" PRIu32 ")\n",iname,fsnodes_escape_name(e->nleng,e->name),e->child->id);
+				leng += snprintf(buff+leng,size-leng,"structure error - %s inconsistency (edge: RESERVED,%s -> %" PRIu32 ")\n",iname,fsnodes_escape_name(e->nleng,fsedge_name(e)),e->child->id);
 			}
 		} else {
-			syslog(LOG_ERR,"structure error - %s inconsistency (edge: NULL,%s -> %" PRIu32 ")",iname,fsnodes_escape_name(e->nleng,e->name),e->child->id);
+			syslog(LOG_ERR,"structure error - %s inconsistency (edge: NULL,%s -> %" PRIu32 ")",iname,fsnodes_escape_name(e->nleng,fsedge_name(e)),e->child->id);
 			if (leng<size) {
-				leng += snprintf(buff+leng,size-leng,"structure error - %s inconsistency (edge: NULL,%s -> %" PRIu32 ")\n",iname,fsnodes_escape_name(e->nleng,e->name),e->child->id);
+				leng += snprintf(buff+leng,size-leng,"structure error - %s inconsistency (edge: NULL,%s -> %" PRIu32 ")\n",iname,fsnodes_escape_name(e->nleng,fsedge_name(e)),e->child->id);
 			}
 		}
 	}
@@ -5931,7 +6638,7 @@ void fs_test_files() {
 	if ((uint32_t)(main_time())<=test_start_time) {
 		return;
 	}
-	if (i>=NODEHASHSIZE) {
+	if (i>=nodetablesize) {
 		syslog(LOG_NOTICE,"structure check loop");
 		i=0;
 		errors=0;
@@ -6008,8 +6715,8 @@ void fs_test_files() {
 		fsinfo_loopstart = fsinfo_loopend;
 		fsinfo_loopend = main_time();
 	}
-	for (k=0 ; k<(NODEHASHSIZE/14400) && i<NODEHASHSIZE ; k++,i++) {
-		for (f=nodehash[i] ; f ; f=f->next) {
+	for (k=0 ; k<=(nodetablesize/14400) && i<nodetablesize ; k++,i++) {
+		if ((f=nodetable[i])!=NULL) {
 			if (f->type==TYPE_FILE || f->type==TYPE_TRASH || f->type==TYPE_RESERVED) {
 				valid = 1;
 				ugflag = 0;
@@ -6055,9 +6762,9 @@ void fs_test_files() {
 					mfiles++;
 					if (f->type==TYPE_TRASH) {
 						if (errors<ERRORS_LOG_MAX) {
-							syslog(LOG_ERR,"- currently unavailable file in trash %" PRIu32 ": %s",f->id,fsnodes_escape_name(f->parents->nleng,f->parents->name));
+							syslog(LOG_ERR,"- currently unavailable file in trash %" PRIu32 ": %s",f->id,fsnodes_escape_name(f->parents->nleng,fsedge_name(f->parents)));
 							if (leng<MSGBUFFSIZE) {
-								leng += snprintf(msgbuff+leng,MSGBUFFSIZE-leng,"- currently unavailable file in trash %" PRIu32 ": %s\n",f->id,fsnodes_escape_name(f->parents->nleng,f->parents->name));
+								leng += snprintf(msgbuff+leng,MSGBUFFSIZE-leng,"- currently unavailable file in trash %" PRIu32 ": %s\n",f->id,fsnodes_escape_name(f->parents->nleng,fsedge_name(f->parents)));
 							}
 							errors++;
 							unavailtrashfiles++;
@@ -6067,9 +6774,9 @@ void fs_test_files() {
 						}
 					} else if (f->type==TYPE_RESERVED) {
 						if (errors<ERRORS_LOG_MAX) {
-							syslog(LOG_ERR,"+ currently unavailable reserved file %" PRIu32 ": %s",f->id,fsnodes_escape_name(f->parents->nleng,f->parents->name));
+							syslog(LOG_ERR,"+ currently unavailable reserved file %" PRIu32 ": %s",f->id,fsnodes_escape_name(f->parents->nleng,fsedge_name(f->parents)));
 							if (leng<MSGBUFFSIZE) {
-								leng += snprintf(msgbuff+leng,MSGBUFFSIZE-leng,"+ currently unavailable reserved file %" PRIu32 ": %s\n",f->id,fsnodes_escape_name(f->parents->nleng,f->parents->name));
+								leng += snprintf(msgbuff+leng,MSGBUFFSIZE-leng,"+ currently unavailable reserved file %" PRIu32 ": %s\n",f->id,fsnodes_escape_name(f->parents->nleng,fsedge_name(f->parents)));
 							}
 							errors++;
 							unavailreservedfiles++;
@@ -6104,14 +6811,14 @@ void fs_test_files() {
 			for (e=f->parents ; e ; e=e->nextparent) {
 				if (e->child != f) {
 					if (e->parent) {
-						syslog(LOG_ERR,"structure error - edge->child/child->edges (node: %" PRIu32 " ; edge: %" PRIu32 ",%s -> %" PRIu32 ")",f->id,e->parent->id,fsnodes_escape_name(e->nleng,e->name),e->child->id);
+						syslog(LOG_ERR,"structure error - edge->child/child->edges (node: %" PRIu32 " ; edge: %" PRIu32 ",%s -> %" PRIu32 ")",f->id,e->parent->id,fsnodes_escape_name(e->nleng,fsedge_name(e)),e->child->id);
 						if (leng<MSGBUFFSIZE) {
-							leng += snprintf(msgbuff+leng,MSGBUFFSIZE-leng,"structure error - edge->child/child->edges (node: %" PRIu32 " ; edge: %" PRIu32 ",%s -> %" PRIu32 ")\n",f->id,e->parent->id,fsnodes_escape_name(e->nleng,e->name),e->child->id);
+							leng += snprintf(msgbuff+leng,MSGBUFFSIZE-leng,"structure error - edge->child/child->edges (node: %" PRIu32 " ; edge: %" PRIu32 ",%s -> %" PRIu32 ")\n",f->id,e->parent->id,fsnodes_escape_name(e->nleng,fsedge_name(e)),e->child->id);
 						}
 					} else {
-						syslog(LOG_ERR,"structure error - edge->child/child->edges (node: %" PRIu32 " ; edge: NULL,%s -> %" PRIu32 ")",f->id,fsnodes_escape_name(e->nleng,e->name),e->child->id);
+						syslog(LOG_ERR,"structure error - edge->child/child->edges (node: %" PRIu32 " ; edge: NULL,%s -> %" PRIu32 ")",f->id,fsnodes_escape_name(e->nleng,fsedge_name(e)),e->child->id);
 						if (leng<MSGBUFFSIZE) {
-							leng += snprintf(msgbuff+leng,MSGBUFFSIZE-leng,"structure error - edge->child/child->edges (node: %" PRIu32 " ; edge: NULL,%s -> %" PRIu32 ")\n",f->id,fsnodes_escape_name(e->nleng,e->name),e->child->id);
+							leng += snprintf(msgbuff+leng,MSGBUFFSIZE-leng,"structure error - edge->child/child->edges (node: %" PRIu32 " ; edge: NULL,%s -> %" PRIu32 ")\n",f->id,fsnodes_escape_name(e->nleng,fsedge_name(e)),e->child->id);
 						}
 					}
 				} else if (e->nextchild) {
@@ -6146,14 +6853,14 @@ void fs_test_files() {
 				for (e=f->data.ddata.children ; e ; e=e->nextchild) {
 					if (e->parent != f) {
 						if (e->parent) {
-							syslog(LOG_ERR,"structure error - edge->parent/parent->edges (node: %" PRIu32 " ; edge: %" PRIu32 ",%s -> %" PRIu32 ")",f->id,e->parent->id,fsnodes_escape_name(e->nleng,e->name),e->child->id);
+							syslog(LOG_ERR,"structure error - edge->parent/parent->edges (node: %" PRIu32 " ; edge: %" PRIu32 ",%s -> %" PRIu32 ")",f->id,e->parent->id,fsnodes_escape_name(e->nleng,fsedge_name(e)),e->child->id);
 							if (leng<MSGBUFFSIZE) {
-								leng += snprintf(msgbuff+leng,MSGBUFFSIZE-leng,"structure error - edge->parent/parent->edges (node: %" PRIu32 " ; edge: %" PRIu32 ",%s -> %" PRIu32 ")\n",f->id,e->parent->id,fsnodes_escape_name(e->nleng,e->name),e->child->id);
+								leng += snprintf(msgbuff+leng,MSGBUFFSIZE-leng,"structure error - edge->parent/parent->edges (node: %" PRIu32 " ; edge: %" PRIu32 ",%s -> %" PRIu32 ")\n",f->id,e->parent->id,fsnodes_escape_name(e->nleng,fsedge_name(e)),e->child->id);
 							}
 						} else {
-							syslog(LOG_ERR,"structure error - edge->parent/parent->edges (node: %" PRIu32 " ; edge: NULL,%s -> %" PRIu32 ")",f->id,fsnodes_escape_name(e->nleng,e->name),e->child->id);
+							syslog(LOG_ERR,"structure error - edge->parent/parent->edges (node: %" PRIu32 " ; edge: NULL,%s -> %" PRIu32 ")",f->id,fsnodes_escape_name(e->nleng,fsedge_name(e)),e->child->id);
 							if (leng<MSGBUFFSIZE) {
-								leng += snprintf(msgbuff+leng,MSGBUFFSIZE-leng,"structure error - edge->parent/parent->edges (node: %" PRIu32 " ; edge: NULL,%s -> %" PRIu32 ")\n",f->id,fsnodes_escape_name(e->nleng,e->name),e->child->id);
+								leng += snprintf(msgbuff+leng,MSGBUFFSIZE-leng,"structure error - edge->parent/parent->edges (node: %" PRIu32 " ; edge: NULL,%s -> %" PRIu32 ")\n",f->id,fsnodes_escape_name(e->nleng,fsedge_name(e)),e->child->id);
 							}
 						}
 					} else if (e->nextchild) {
@@ -6282,14 +6989,14 @@ enum {FLAG_TREE,FLAG_TRASH,FLAG_RESERVED};
 void fs_dumpedge(fsedge *e) {
 	if (e->parent==NULL) {
 		if (e->child->type==TYPE_TRASH) {
-			printf("E|p:     TRASH|c:%10" PRIu32 "|n:%s\n",e->child->id,fsnodes_escape_name(e->nleng,e->name));
+			printf("E|p:     TRASH|c:%10" PRIu32 "|n:%s\n",e->child->id,fsnodes_escape_name(e->nleng,fsedge_name(e)));
 		} else if (e->child->type==TYPE_RESERVED) {
-			printf("E|p:  RESERVED|c:%10" PRIu32 "|n:%s\n",e->child->id,fsnodes_escape_name(e->nleng,e->name));
+			printf("E|p:  RESERVED|c:%10" PRIu32 "|n:%s\n",e->child->id,fsnodes_escape_name(e->nleng,fsedge_name(e)));
 		} else {
-			printf("E|p:      NULL|c:%10" PRIu32 "|n:%s\n",e->child->id,fsnodes_escape_name(e->nleng,e->name));
+			printf("E|p:      NULL|c:%10" PRIu32 "|n:%s\n",e->child->id,fsnodes_escape_name(e->nleng,fsedge_name(e)));
 		}
 	} else {
-		printf("E|p:%10" PRIu32 "|c:%10" PRIu32 "|n:%s\n",e->parent->id,e->child->id,fsnodes_escape_name(e->nleng,e->name));
+		printf("E|p:%10" PRIu32 "|c:%10" PRIu32 "|n:%s\n",e->parent->id,e->child->id,fsnodes_escape_name(e->nleng,fsedge_name(e)));
 	}
 }
 
@@ -6369,8 +7076,8 @@ void fs_dumpnode(fsnode *f) {
 void fs_dumpnodes() {
 	uint32_t i;
 	fsnode *p;
-	for (i=0 ; i<NODEHASHSIZE ; i++) {
-		for (p=nodehash[i] ; p ; p=p->next) {
+	for (i=0 ; i<nodetablesize ; i++) {
+		if ((p=nodetable[i])!=NULL) {
 			fs_dumpnode(p);
 		}
 	}
@@ -6633,7 +7340,7 @@ void fs_storeedge(fsedge *e,FILE *fd) {
 	}
 	put32bit(&ptr,e->child->id);
 	put16bit(&ptr,e->nleng);
-	memcpy(ptr,e->name,e->nleng);
+	memcpy(ptr,fsedge_name(e),e->nleng);
 	if (fwrite(uedgebuff,1,4+4+2+e->nleng,fd)!=(size_t)(4+4+2+e->nleng)) {
 		syslog(LOG_NOTICE,"fwrite error");
 		return;
@@ -6645,9 +7352,6 @@ int fs_loadedge(FILE *fd,int ignoreflag) {
 	const uint8_t *ptr;
 	uint32_t parent_id;
 	uint32_t child_id;
-#ifdef EDGEHASH
-	uint32_t hpos;
-#endif
 	fsedge *e;
 #ifndef METARESTORE
 	statsrecord sr;
@@ -6681,8 +7385,7 @@ int fs_loadedge(FILE *fd,int ignoreflag) {
 	if (parent_id==0 && child_id==0) {	// last edge
 		return 1;
 	}
-	e = (fsedge*) malloc(sizeof(fsedge));
-	passert(e);
+	e = fsedge_malloc();
 	e->nleng = get16bit(&ptr);
 	if (e->nleng==0) {
 		if (nl) {
@@ -6690,12 +7393,11 @@ int fs_loadedge(FILE *fd,int ignoreflag) {
 			nl=0;
 		}
 		mfs_arg_syslog(LOG_ERR,"loading edge: %" PRIu32 "->%" PRIu32 " error: empty name",parent_id,child_id);
-		free(e);
+		fsedge_free(e);
 		return -1;
 	}
-	e->name = (uint8_t*) malloc(e->nleng);
-	passert(e->name);
-	if (fread(e->name,1,e->nleng,fd)!=e->nleng) {
+	fsedge_allocname(e,e->nleng);
+	if (fread(fsedge_name(e),1,e->nleng,fd)!=e->nleng) {
 		int err = errno;
 		if (nl) {
 			fputc('\n',stderr);
@@ -6703,8 +7405,7 @@ int fs_loadedge(FILE *fd,int ignoreflag) {
 		}
 		errno = err;
 		mfs_errlog(LOG_ERR,"loading edge: read error");
-		free(e->name);
-		free(e);
+		fsedge_free(e);
 		return -1;
 	}
 	e->child = fsnodes_id_to_node(child_id);
@@ -6713,9 +7414,8 @@ int fs_loadedge(FILE *fd,int ignoreflag) {
 			fputc('\n',stderr);
 			nl=0;
 		}
-		mfs_arg_syslog(LOG_ERR,"loading edge: %" PRIu32 ",%s->%" PRIu32 " error: child not found",parent_id,fsnodes_escape_name(e->nleng,e->name),child_id);
-		free(e->name);
-		free(e);
+		mfs_arg_syslog(LOG_ERR,"loading edge: %" PRIu32 ",%s->%" PRIu32 " error: child not found",parent_id,fsnodes_escape_name(e->nleng,fsedge_name(e)),child_id);
+		fsedge_free(e);
 		if (ignoreflag) {
 			return 0;
 		}
@@ -6755,12 +7455,11 @@ int fs_loadedge(FILE *fd,int ignoreflag) {
 				fputc('\n',stderr);
 				nl=0;
 			}
-			fprintf(stderr,"loading edge: %" PRIu32 ",%s->%" PRIu32 " error: bad child type (%c)\n",parent_id,fsnodes_escape_name(e->nleng,e->name),child_id,e->child->type);
+			fprintf(stderr,"loading edge: %" PRIu32 ",%s->%" PRIu32 " error: bad child type (%c)\n",parent_id,fsnodes_escape_name(e->nleng,fsedge_name(e)),child_id,e->child->type);
 #ifndef METARESTORE
-			syslog(LOG_ERR,"loading edge: %" PRIu32 ",%s->%" PRIu32 " error: bad child type (%c)",parent_id,fsnodes_escape_name(e->nleng,e->name),child_id,e->child->type);
+			syslog(LOG_ERR,"loading edge: %" PRIu32 ",%s->%" PRIu32 " error: bad child type (%c)",parent_id,fsnodes_escape_name(e->nleng,fsedge_name(e)),child_id,e->child->type);
 #endif
-			free(e->name);
-			free(e);
+			fsedge_free(e);
 			return -1;
 		}
 	} else {
@@ -6770,30 +7469,28 @@ int fs_loadedge(FILE *fd,int ignoreflag) {
 				fputc('\n',stderr);
 				nl=0;
 			}
-			fprintf(stderr,"loading edge: %" PRIu32 ",%s->%" PRIu32 " error: parent not found\n",parent_id,fsnodes_escape_name(e->nleng,e->name),child_id);
+			fprintf(stderr,"loading edge: %" PRIu32 ",%s->%" PRIu32 " error: parent not found\n",parent_id,fsnodes_escape_name(e->nleng,fsedge_name(e)),child_id);
 #ifndef METARESTORE
-			syslog(LOG_ERR,"loading edge: %" PRIu32 ",%s->%" PRIu32 " error: parent not found",parent_id,fsnodes_escape_name(e->nleng,e->name),child_id);
+			syslog(LOG_ERR,"loading edge: %" PRIu32 ",%s->%" PRIu32 " error: parent not found",parent_id,fsnodes_escape_name(e->nleng,fsedge_name(e)),child_id);
 #endif
 			if (ignoreflag) {
 				e->parent = fsnodes_id_to_node(MFS_ROOT_ID);
 				if (e->parent==NULL || e->parent->type!=TYPE_DIRECTORY) {
-					fprintf(stderr,"loading edge: %" PRIu32 ",%s->%" PRIu32 " root dir not found !!!\n",parent_id,fsnodes_escape_name(e->nleng,e->name),child_id);
+					fprintf(stderr,"loading edge: %" PRIu32 ",%s->%" PRIu32 " root dir not found !!!\n",parent_id,fsnodes_escape_name(e->nleng,fsedge_name(e)),child_id);
 #ifndef METARESTORE
-					syslog(LOG_ERR,"loading edge: %" PRIu32 ",%s->%" PRIu32 " root dir not found !!!",parent_id,fsnodes_escape_name(e->nleng,e->name),child_id);
+					syslog(LOG_ERR,"loading edge: %" PRIu32 ",%s->%" PRIu32 " root dir not found !!!",parent_id,fsnodes_escape_name(e->nleng,fsedge_name(e)),child_id);
 #endif
-					free(e->name);
-					free(e);
+					fsedge_free(e);
 					return -1;
 				}
-				fprintf(stderr,"loading edge: %" PRIu32 ",%s->%" PRIu32 " attaching node to root dir\n",parent_id,fsnodes_escape_name(e->nleng,e->name),child_id);
+				fprintf(stderr,"loading edge: %" PRIu32 ",%s->%" PRIu32 " attaching node to root dir\n",parent_id,fsnodes_escape_name(e->nleng,fsedge_name(e)),child_id);
 #ifndef METARESTORE
-				syslog(LOG_ERR,"loading edge: %" PRIu32 ",%s->%" PRIu32 " attaching node to root dir",parent_id,fsnodes_escape_name(e->nleng,e->name),child_id);
+				syslog(LOG_ERR,"loading edge: %" PRIu32 ",%s->%" PRIu32 " attaching node to root dir",parent_id,fsnodes_escape_name(e->nleng,fsedge_name(e)),child_id);
 #endif
 				parent_id = MFS_ROOT_ID;
 			} else {
 				fprintf(stderr,"use mfsmetarestore (option -i) to attach this node to root dir\n");
-				free(e->name);
-				free(e);
+				fsedge_free(e);
 				return -1;
 			}
 		}
@@ -6802,30 +7499,28 @@ int fs_loadedge(FILE *fd,int ignoreflag) {
 				fputc('\n',stderr);
 				nl=0;
 			}
-			fprintf(stderr,"loading edge: %" PRIu32 ",%s->%" PRIu32 " error: bad parent type (%c)\n",parent_id,fsnodes_escape_name(e->nleng,e->name),child_id,e->parent->type);
+			fprintf(stderr,"loading edge: %" PRIu32 ",%s->%" PRIu32 " error: bad parent type (%c)\n",parent_id,fsnodes_escape_name(e->nleng,fsedge_name(e)),child_id,e->parent->type);
 #ifndef METARESTORE
-			syslog(LOG_ERR,"loading edge: %" PRIu32 ",%s->%" PRIu32 " error: bad parent type (%c)",parent_id,fsnodes_escape_name(e->nleng,e->name),child_id,e->parent->type);
+			syslog(LOG_ERR,"loading edge: %" PRIu32 ",%s->%" PRIu32 " error: bad parent type (%c)",parent_id,fsnodes_escape_name(e->nleng,fsedge_name(e)),child_id,e->parent->type);
 #endif
 			if (ignoreflag) {
 				e->parent = fsnodes_id_to_node(MFS_ROOT_ID);
 				if (e->parent==NULL || e->parent->type!=TYPE_DIRECTORY) {
-					fprintf(stderr,"loading edge: %" PRIu32 ",%s->%" PRIu32 " root dir not found !!!\n",parent_id,fsnodes_escape_name(e->nleng,e->name),child_id);
+					fprintf(stderr,"loading edge: %" PRIu32 ",%s->%" PRIu32 " root dir not found !!!\n",parent_id,fsnodes_escape_name(e->nleng,fsedge_name(e)),child_id);
 #ifndef METARESTORE
-					syslog(LOG_ERR,"loading edge: %" PRIu32 ",%s->%" PRIu32 " root dir not found !!!",parent_id,fsnodes_escape_name(e->nleng,e->name),child_id);
+					syslog(LOG_ERR,"loading edge: %" PRIu32 ",%s->%" PRIu32 " root dir not found !!!",parent_id,fsnodes_escape_name(e->nleng,fsedge_name(e)),child_id);
 #endif
-					free(e->name);
-					free(e);
+					fsedge_free(e);
 					return -1;
 				}
-				fprintf(stderr,"loading edge: %" PRIu32 ",%s->%" PRIu32 " attaching node to root dir\n",parent_id,fsnodes_escape_name(e->nleng,e->name),child_id);
+				fprintf(stderr,"loading edge: %" PRIu32 ",%s->%" PRIu32 " attaching node to root dir\n",parent_id,fsnodes_escape_name(e->nleng,fsedge_name(e)),child_id);
 #ifndef METARESTORE
-				syslog(LOG_ERR,"loading edge: %" PRIu32 ",%s->%" PRIu32 " attaching node to root dir",parent_id,fsnodes_escape_name(e->nleng,e->name),child_id);
+				syslog(LOG_ERR,"loading edge: %" PRIu32 ",%s->%" PRIu32 " attaching node to root dir",parent_id,fsnodes_escape_name(e->nleng,fsedge_name(e)),child_id);
 #endif
 				parent_id = MFS_ROOT_ID;
 			} else {
 				fprintf(stderr,"use mfsmetarestore (option -i) to attach this node to root dir\n");
-				free(e->name);
-				free(e);
+				fsedge_free(e);
 				return -1;
 			}
 		}
@@ -6839,9 +7534,9 @@ int fs_loadedge(FILE *fd,int ignoreflag) {
 					fputc('\n',stderr);
 					nl=0;
 				}
-				fprintf(stderr,"loading edge: %" PRIu32 ",%s->%" PRIu32 " error: parent node sequence error\n",parent_id,fsnodes_escape_name(e->nleng,e->name),child_id);
+				fprintf(stderr,"loading edge: %" PRIu32 ",%s->%" PRIu32 " error: parent node sequence error\n",parent_id,fsnodes_escape_name(e->nleng,fsedge_name(e)),child_id);
 #ifndef METARESTORE
-				syslog(LOG_ERR,"loading edge: %" PRIu32 ",%s->%" PRIu32 " error: parent node sequence error",parent_id,fsnodes_escape_name(e->nleng,e->name),child_id);
+				syslog(LOG_ERR,"loading edge: %" PRIu32 ",%s->%" PRIu32 " error: parent node sequence error",parent_id,fsnodes_escape_name(e->nleng,fsedge_name(e)),child_id);
 #endif
 				if (ignoreflag) {
 					current_tail = &(e->parent->data.ddata.children);
@@ -6849,8 +7544,7 @@ int fs_loadedge(FILE *fd,int ignoreflag) {
 						current_tail = &((*current_tail)->nextchild);
 					}
 				} else {
-					free(e->name);
-					free(e);
+					fsedge_free(e);
 					return -1;
 				}
 			} else {
@@ -6868,18 +7562,15 @@ int fs_loadedge(FILE *fd,int ignoreflag) {
 			e->prevchild = current_tail;
 			current_tail = &(e->nextchild);
 		}
+#ifdef EDGEHASH
+		fsnodes_edgebucket_insert(fsnodes_edgebucket(e->parent,e->nleng,fsedge_name(e)),e);
+#endif
 		e->parent->data.ddata.elements++;
 		if (e->child->type==TYPE_DIRECTORY) {
 			e->parent->data.ddata.nlink++;
 		}
 #ifdef EDGEHASH
-		hpos = EDGEHASHPOS(fsnodes_hash(e->parent->id,e->nleng,e->name));
-		e->next = edgehash[hpos];
-		if (e->next) {
-			e->next->prev = &(e->next);
-		}
-		edgehash[hpos] = e;
-		e->prev = &(edgehash[hpos]);
+		fsnodes_dirindex_check(e->parent);
 #endif
 	}
 	e->nextparent = e->child->parents;
@@ -7001,30 +7692,67 @@ void fs_storenode(fsnode *f,FILE *fd) {
 	}
 }
 
-int fs_loadnode(FILE *fd) {
+// state of one node loader - when NODE section is decoded in parallel there is one per thread
+typedef struct _nodeloader {
+	uint8_t nl;
+	uint8_t parallel;	// nodes are counted and marked as used by fs_loadnodes_scan, shared allocators have to be locked
+} nodeloader;
+
+static pthread_mutex_t nodeload_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static inline void fs_loadnode_lock(nodeloader *ld) {
+	if (ld->parallel) {
+		zassert(pthread_mutex_lock(&nodeload_lock));
+	}
+}
+
+static inline void fs_loadnode_unlock(nodeloader *ld) {
+	if (ld->parallel) {
+		zassert(pthread_mutex_unlock(&nodeload_lock));
+	}
+}
+
+static inline void fs_loadnode_free(nodeloader *ld,fsnode *p) {
+	fs_loadnode_lock(ld);
+	fsnode_free(p);
+	fs_loadnode_unlock(ld);
+}
+
+// frees node rejected after all its data has been read (chunk table and session list included)
+static void fs_loadnode_reject(nodeloader *ld,fsnode *p) {
+	sessionidrec *sessionidptr;
+	if (p->type==TYPE_FILE || p->type==TYPE_TRASH || p->type==TYPE_RESERVED) {
+		if (p->data.fdata.chunktab) {
+			free(p->data.fdata.chunktab);
+		}
+		fs_loadnode_lock(ld);
+		while ((sessionidptr=p->data.fdata.sessionids)) {
+			p->data.fdata.sessionids = sessionidptr->next;
+			sessionidrec_free(sessionidptr);
+		}
+		fs_loadnode_unlock(ld);
+	}
+	fs_loadnode_free(ld,p);
+}
+
+static int fs_loadnode_int(FILE *fd,nodeloader *ld) {
 	uint8_t unodebuff[4+1+2+4+4+4+4+4+4+8+4+2+8*65536+4*65536+4];
 	const uint8_t *ptr,*chptr;
 	uint8_t type;
 	uint32_t i,indx,pleng,ch,sessionids,sessionid;
 	fsnode *p;
 	sessionidrec *sessionidptr;
-	uint32_t nodepos;
 #ifndef METARESTORE
 	statsrecord *sr;
 #endif
-	static uint8_t nl;
-
-	if (fd==NULL) {
-		nl=1;
-		return 0;
-	}
 
 	type = fgetc(fd);
 	if (type==0) {	// last node
 		return 1;
 	}
-	p = (fsnode*) malloc(sizeof(fsnode));
-	passert(p);
+	fs_loadnode_lock(ld);
+	p = fsnode_malloc();
+	fs_loadnode_unlock(ld);
 	p->type = type;
 	switch (type) {
 	case TYPE_DIRECTORY:
@@ -7032,13 +7760,13 @@ int fs_loadnode(FILE *fd) {
 	case TYPE_SOCKET:
 		if (fread(unodebuff,1,4+1+2+4+4+4+4+4+4,fd)!=4+1+2+4+4+4+4+4+4) {
 			int err = errno;
-			if (nl) {
+			if (ld->nl) {
 				fputc('\n',stderr);
-				nl=0;
+				ld->nl=0;
 			}
 			errno = err;
 			mfs_errlog(LOG_ERR,"loading node: read error");
-			free(p);
+			fs_loadnode_free(ld,p);
 			return -1;
 		}
 		break;
@@ -7047,13 +7775,13 @@ int fs_loadnode(FILE *fd) {
 	case TYPE_SYMLINK:
 		if (fread(unodebuff,1,4+1+2+4+4+4+4+4+4+4,fd)!=4+1+2+4+4+4+4+4+4+4) {
 			int err = errno;
-			if (nl) {
+			if (ld->nl) {
 				fputc('\n',stderr);
-				nl=0;
+				ld->nl=0;
 			}
 			errno = err;
 			mfs_errlog(LOG_ERR,"loading node: read error");
-			free(p);
+			fs_loadnode_free(ld,p);
 			return -1;
 		}
 		break;
@@ -7062,23 +7790,23 @@ int fs_loadnode(FILE *fd) {
 	case TYPE_RESERVED:
 		if (fread(unodebuff,1,4+1+2+4+4+4+4+4+4+8+4+2,fd)!=4+1+2+4+4+4+4+4+4+8+4+2) {
 			int err = errno;
-			if (nl) {
+			if (ld->nl) {
 				fputc('\n',stderr);
-				nl=0;
+				ld->nl=0;
 			}
 			errno = err;
 			mfs_errlog(LOG_ERR,"loading node: read error");
-			free(p);
+			fs_loadnode_free(ld,p);
 			return -1;
 		}
 		break;
 	default:
-		if (nl) {
+		if (ld->nl) {
 			fputc('\n',stderr);
-			nl=0;
+			ld->nl=0;
 		}
 		mfs_arg_syslog(LOG_ERR,"loading node: unrecognized node type: %c",type);
-		free(p);
+		fs_loadnode_free(ld,p);
 		return -1;
 	}
 	ptr = unodebuff;
@@ -7128,14 +7856,14 @@ int fs_loadnode(FILE *fd) {
 			passert(p->data.sdata.path);
 			if (fread(p->data.sdata.path,1,pleng,fd)!=pleng) {
 				int err = errno;
-				if (nl) {
+				if (ld->nl) {
 					fputc('\n',stderr);
-					nl=0;
+					ld->nl=0;
 				}
 				errno = err;
 				mfs_errlog(LOG_ERR,"loading node: read error");
 				free(p->data.sdata.path);
-				free(p);
+				fs_loadnode_free(ld,p);
 				return -1;
 			}
 		} else {
@@ -7165,16 +7893,16 @@ int fs_loadnode(FILE *fd) {
 			chptr = ptr;
 			if (fread((uint8_t*)ptr,1,8*65536,fd)!=8*65536) {
 				int err = errno;
-				if (nl) {
+				if (ld->nl) {
 					fputc('\n',stderr);
-					nl=0;
+					ld->nl=0;
 				}
 				errno = err;
 				mfs_errlog(LOG_ERR,"loading node: read error");
 				if (p->data.fdata.chunktab) {
 					free(p->data.fdata.chunktab);
 				}
-				free(p);
+				fs_loadnode_free(ld,p);
 				return -1;
 			}
 			for (i=0 ; i<65536 ; i++) {
@@ -7185,16 +7913,16 @@ int fs_loadnode(FILE *fd) {
 		}
 		if (fread((uint8_t*)ptr,1,8*ch+4*sessionids,fd)!=8*ch+4*sessionids) {
 			int err = errno;
-			if (nl) {
+			if (ld->nl) {
 				fputc('\n',stderr);
-				nl=0;
+				ld->nl=0;
 			}
 			errno = err;
 			mfs_errlog(LOG_ERR,"loading node: read error");
 			if (p->data.fdata.chunktab) {
 				free(p->data.fdata.chunktab);
 			}
-			free(p);
+			fs_loadnode_free(ld,p);
 			return -1;
 		}
 		for (i=0 ; i<ch ; i++) {
@@ -7204,13 +7932,15 @@ int fs_loadnode(FILE *fd) {
 		p->data.fdata.sessionids=NULL;
 		while (sessionids) {
 			sessionid = get32bit(&ptr);
+			fs_loadnode_lock(ld);
 			sessionidptr = sessionidrec_malloc();
-			sessionidptr->sessionid = sessionid;
-			sessionidptr->next = p->data.fdata.sessionids;
-			p->data.fdata.sessionids = sessionidptr;
 #ifndef METARESTORE
 			matoclserv_init_sessions(sessionid,p->id);
 #endif
+			fs_loadnode_unlock(ld);
+			sessionidptr->sessionid = sessionid;
+			sessionidptr->next = p->data.fdata.sessionids;
+			p->data.fdata.sessionids = sessionidptr;
 			sessionids--;
 		}
 /*
@@ -7220,9 +7950,24 @@ int fs_loadnode(FILE *fd) {
 */
 	}
 	p->parents = NULL;
-	nodepos = NODEHASHPOS(p->id);
-	p->next = nodehash[nodepos];
-	nodehash[nodepos] = p;
+	fs_loadnode_lock(ld);
+	if (p->id<nodetablesize && nodetable[p->id]!=NULL) {
+		fs_loadnode_unlock(ld);
+		if (ld->nl) {
+			fputc('\n',stderr);
+			ld->nl=0;
+		}
+		mfs_arg_syslog(LOG_ERR,"loading node: %" PRIu32 " error: duplicated inode",p->id);
+		fs_loadnode_reject(ld,p);
+		return -1;
+	}
+	if (ld->parallel) {
+		nodetable[p->id] = p;	// table is big enough - see fs_loadnodes_scan
+		fs_loadnode_unlock(ld);
+		return 0;
+	}
+	fs_loadnode_unlock(ld);
+	fsnodes_nodetable_insert(p);
 	fsnodes_used_inode(p->id);
 	nodes++;
 	if (type==TYPE_DIRECTORY) {
@@ -7234,11 +7979,21 @@ int fs_loadnode(FILE *fd) {
 	return 0;
 }
 
+int fs_loadnode(FILE *fd) {
+	static nodeloader ld;
+	if (fd==NULL) {
+		ld.nl = 1;
+		ld.parallel = 0;
+		return 0;
+	}
+	return fs_loadnode_int(fd,&ld);
+}
+
 void fs_storenodes(FILE *fd) {
 	uint32_t i;
 	fsnode *p;
-	for (i=0 ; i<NODEHASHSIZE ; i++) {
-		for (p=nodehash[i] ; p ; p=p->next) {
+	for (i=0 ; i<nodetablesize ; i++) {
+		if ((p=nodetable[i])!=NULL) {
 			fs_storenode(p,fd);
 		}
 	}
@@ -7293,8 +8048,8 @@ int fs_checknodes(int ignoreflag) {
 	uint8_t nl;
 	fsnode *p;
 	nl=1;
-	for (i=0 ; i<NODEHASHSIZE ; i++) {
-		for (p=nodehash[i] ; p ; p=p->next) {
+	for (i=0 ; i<nodetablesize ; i++) {
+		if ((p=nodetable[i])!=NULL) {
 			if (p->parents==NULL && p!=root) {
 				if (nl) {
 					fputc('\n',stderr);
@@ -7577,15 +8332,127 @@ int fs_loadquota(FILE *fd,int ignoreflag) {
 	return 0;
 }
 
-void fs_store(FILE *fd,uint8_t fver) {
+#ifndef METARESTORE
+#define BGSTORE_NODES 4096
+
+static int fs_bgstore_flush(FILE *fd,FILE *mfd,char **buff,size_t *leng) {
+	int ret;
+	fclose(mfd);
+	ret = 0;
+	if (*leng>0 && fwrite(*buff,1,*leng,fd)!=*leng) {
+		ret = -1;
+	}
+	free(*buff);
+	*buff = NULL;
+	*leng = 0;
+	return ret;
+}
+
+/* called by store thread - same output as fs_storenodes */
+static void fs_bgstore_nodes(FILE *fd) {
+	uint32_t i,j;
+	fsnode *p;
+	FILE *mfd;
+	char *buff;
+	size_t leng;
+
+	buff = NULL;
+	leng = 0;
+	for (i=0 ; i<=bgstore_maxnodeid ; i+=BGSTORE_NODES) {
+		mfd = open_memstream(&buff,&leng);
+		if (mfd==NULL) {
+			bgstore_status = 1;
+			return;
+		}
+		zassert(pthread_mutex_lock(&bgstore_lock));
+		for (j=i ; j<i+BGSTORE_NODES && j<=bgstore_maxnodeid && j<nodetablesize ; j++) {
+			if ((p=nodetable[j])!=NULL) {
+				if (fsnodes_bgstore_needed(bgstore_nodemap,p->id)) {
+					fs_storenode(p,mfd);
+					fsnodes_bgstore_mark(bgstore_nodemap,p->id);
+				}
+			}
+		}
+		zassert(pthread_mutex_unlock(&bgstore_lock));
+		if (fs_bgstore_flush(fd,mfd,&buff,&leng)<0) {
+			return;
+		}
+	}
+	// every node is marked now - nothing more will be added to the copy buffer
+	zassert(pthread_mutex_lock(&bgstore_lock));
+	mfd = bgstore_nodecopy;
+	bgstore_nodecopy = NULL;
+	zassert(pthread_mutex_unlock(&bgstore_lock));
+	if (fs_bgstore_flush(fd,mfd,&bgstore_nodecopybuff,&bgstore_nodecopyleng)<0) {
+		return;
+	}
+	fs_storenode(NULL,fd);	// end marker
+}
+
+/* called by store thread - edges of each parent are stored together, so the output is compatible with fs_storeedges */
+static void fs_bgstore_edges(FILE *fd) {
+	uint32_t i,j;
+	fsnode *p;
+	FILE *mfd;
+	char *buff;
+	size_t leng;
+
+	buff = NULL;
+	leng = 0;
+	for (i=0 ; i<=bgstore_maxnodeid ; i+=BGSTORE_NODES) {
+		mfd = open_memstream(&buff,&leng);
+		if (mfd==NULL) {
+			bgstore_status = 1;
+			return;
+		}
+		zassert(pthread_mutex_lock(&bgstore_lock));
+		for (j=i ; j<i+BGSTORE_NODES && j<=bgstore_maxnodeid && j<nodetablesize ; j++) {
+			if ((p=nodetable[j])!=NULL) {
+				if (fsnodes_bgstore_needed(bgstore_edgemap,p->id)) {
+					fsnodes_bgstore_edgelist(p,mfd);
+					fsnodes_bgstore_mark(bgstore_edgemap,p->id);
+				}
+			}
+		}
+		zassert(pthread_mutex_unlock(&bgstore_lock));
+		if (fs_bgstore_flush(fd,mfd,&buff,&leng)<0) {
+			return;
+		}
+	}
+	zassert(pthread_mutex_lock(&bgstore_lock));
+	mfd = bgstore_edgecopy;
+	bgstore_edgecopy = NULL;
+	zassert(pthread_mutex_unlock(&bgstore_lock));
+	if (fs_bgstore_flush(fd,mfd,&bgstore_edgecopybuff,&bgstore_edgecopyleng)<0) {
+		return;
+	}
+	fs_storeedge(NULL,fd);	// end marker
+}
+#endif
+
+static void fs_store_int(FILE *fd,uint8_t fver,uint8_t bg) {
 	uint8_t hdr[16];
 	uint8_t *ptr;
 	off_t offbegin,offend;
+	uint32_t mnid,nsid;
+	uint64_t mver;
 
+	mnid = maxnodeid;
+	mver = metaversion;
+	nsid = nextsessionid;
+#ifndef METARESTORE
+	if (bg) {
+		mnid = bgstore_maxnodeid;
+		mver = bgstore_metaversion;
+		nsid = bgstore_nextsessionid;
+	}
+#else
+	(void)bg;
+#endif
 	ptr = hdr;
-	put32bit(&ptr,maxnodeid);
-	put64bit(&ptr,metaversion);
-	put32bit(&ptr,nextsessionid);
+	put32bit(&ptr,mnid);
+	put64bit(&ptr,mver);
+	put32bit(&ptr,nsid);
 	if (fwrite(hdr,1,16,fd)!=(size_t)16) {
 		syslog(LOG_NOTICE,"fwrite error");
 		return;
@@ -7596,6 +8463,11 @@ void fs_store(FILE *fd,uint8_t fver) {
 	} else {
 		offbegin = 0;	// makes some old compilers happy
 	}
+#ifndef METARESTORE
+	if (bg) {
+		fs_bgstore_nodes(fd);
+	} else
+#endif
 	fs_storenodes(fd);
 	if (fver>=0x16) {
 		offend = ftello(fd);
@@ -7610,6 +8482,11 @@ void fs_store(FILE *fd,uint8_t fver) {
 		offbegin = offend;
 		fseeko(fd,offbegin+16,SEEK_SET);
 	}
+#ifndef METARESTORE
+	if (bg) {
+		fs_bgstore_edges(fd);
+	} else
+#endif
 	fs_storeedges(fd);
 	if (fver>=0x16) {
 		offend = ftello(fd);
@@ -7624,6 +8501,11 @@ void fs_store(FILE *fd,uint8_t fver) {
 		offbegin = offend;
 		fseeko(fd,offbegin+16,SEEK_SET);
 	}
+#ifndef METARESTORE
+	if (bg) {
+		fwrite(bgstore_freebuff,1,bgstore_freeleng,fd);
+	} else
+#endif
 	fs_storefree(fd);
 	if (fver>=0x16) {
 		offend = ftello(fd);
@@ -7638,6 +8520,11 @@ void fs_store(FILE *fd,uint8_t fver) {
 		offbegin = offend;
 		fseeko(fd,offbegin+16,SEEK_SET);
 
+#ifndef METARESTORE
+		if (bg) {
+			fwrite(bgstore_quotabuff,1,bgstore_quotaleng,fd);
+		} else
+#endif
 		fs_storequota(fd);
 
 		offend = ftello(fd);
@@ -7652,6 +8539,11 @@ void fs_store(FILE *fd,uint8_t fver) {
 		offbegin = offend;
 		fseeko(fd,offbegin+16,SEEK_SET);
 
+#ifndef METARESTORE
+		if (bg) {
+			fwrite(bgstore_xattrbuff,1,bgstore_xattrleng,fd);
+		} else
+#endif
 		xattr_store(fd);
 
 		offend = ftello(fd);
@@ -7666,6 +8558,13 @@ void fs_store(FILE *fd,uint8_t fver) {
 		offbegin = offend;
 		fseeko(fd,offbegin+16,SEEK_SET);
 	}
+#ifndef METARESTORE
+	if (bg) {
+		if (chunk_bgstore(fd)<0) {
+			bgstore_status = 1;
+		}
+	} else
+#endif
 	chunk_store(fd);
 	if (fver>=0x16) {
 		offend = ftello(fd);
@@ -7687,6 +8586,10 @@ void fs_store(FILE *fd,uint8_t fver) {
 	}
 }
 
+void fs_store(FILE *fd,uint8_t fver) {
+	fs_store_int(fd,fver,0);
+}
+
 uint64_t fs_loadversion(FILE *fd) {
 	uint8_t hdr[12];
 	const uint8_t *ptr;
@@ -7700,11 +8603,394 @@ uint64_t fs_loadversion(FILE *fd) {
 	return fversion;
 }
 
-int fs_load(FILE *fd,int ignoreflag,uint8_t fver) {
+/* sections of metadata file (fver>=0x16)
+ *
+ * Every section starts with a 16-byte header (name and length), so the whole
+ * file is indexed first by jumping from one header to another. Chunks and
+ * xattrs don't depend on anything else, so they are decoded by separate
+ * threads (each one with its own stream) while nodes, edges, free nodes and
+ * quota (which depend on nodes) are decoded by the calling thread.
+ *
+ * NODE section (the biggest one) is mapped into memory and split at record
+ * boundaries into parts decoded by separate threads. Boundaries are found by
+ * one quick pass, which also marks inodes as used and resizes node table, so
+ * decoders only store nodes in their own slots. Edges are loaded after that.
+ */
+#define LOADMAXSECTIONS 16
+#define LOADBUFFSIZE 0x100000
+#define LOADNODEPARTS 16
+
+static uint8_t ParallelLoad = 1;
+
+#ifdef METARESTORE
+void fs_setparallelload(uint8_t enable) {
+	ParallelLoad = enable;
+}
+#endif
+
+typedef struct _loadsection {
+	uint8_t name[8];
+	off_t offset;
+	uint64_t length;
+	int (*loadfn)(FILE *fd,int ignoreflag);
+	const char *desc;
+	// used when section is loaded in background
+	const char *fname;
+	int ignoreflag;
+	int status;
+	uint8_t background;
+	pthread_t thread;
+} loadsection;
+
+static int fs_loadnodes_int(FILE *fd,int ignoreflag) {
+	(void)ignoreflag;
+	return fs_loadnodes(fd);
+}
+
+typedef struct _nodepart {
+	const uint8_t *data;
+	uint64_t leng;
+	int status;
+	pthread_t thread;
+} nodepart;
+
+// finds where parts begin (part[i].data) ; returns -1 when section is corrupted
+static int fs_loadnodes_scan(const uint8_t *buff,uint64_t leng,nodepart *parts,uint32_t pcnt) {
+	const uint8_t *ptr,*rptr;
+	uint64_t pos,rleng;
+	uint32_t id,maxid,pleng,ch,sessionids,p;
+	uint8_t type;
+
+	maxid = 0;
+	pos = 0;
+	p = 0;
+	for (;;) {
+		if (pos>=leng) {
+			return -1;
+		}
+		if (p<pcnt && pos>=leng/pcnt*p) {
+			parts[p].data = buff+pos;
+			p++;
+		}
+		ptr = buff+pos;
+		type = ptr[0];
+		if (type==0) {	// last node
+			break;
+		}
+		switch (type) {
+		case TYPE_DIRECTORY:
+		case TYPE_FIFO:
+		case TYPE_SOCKET:
+			rleng = 1+4+1+2+4+4+4+4+4+4;
+			break;
+		case TYPE_BLOCKDEV:
+		case TYPE_CHARDEV:
+			rleng = 1+4+1+2+4+4+4+4+4+4+4;
+			break;
+		case TYPE_SYMLINK:
+			rleng = 1+4+1+2+4+4+4+4+4+4+4;
+			if (pos+rleng<=leng) {
+				rptr = ptr+rleng-4;
+				pleng = get32bit(&rptr);
+				rleng += pleng;
+			}
+			break;
+		case TYPE_FILE:
+		case TYPE_TRASH:
+		case TYPE_RESERVED:
+			rleng = 1+4+1+2+4+4+4+4+4+4+8+4+2;
+			if (pos+rleng<=leng) {
+				rptr = ptr+rleng-6;
+				ch = get32bit(&rptr);
+				sessionids = get16bit(&rptr);
+				rleng += 8*(uint64_t)ch+4*sessionids;
+			}
+			break;
+		default:
+			fprintf(stderr,"loading node: unrecognized node type: %c\n",type);
+			return -1;
+		}
+		if (pos+rleng>leng) {
+			return -1;
+		}
+		rptr = ptr+1;
+		id = get32bit(&rptr);
+		if (id>maxid) {
+			maxid = id;
+		}
+		fsnodes_used_inode(id);
+		nodes++;
+		if (type==TYPE_DIRECTORY) {
+			dirnodes++;
+		}
+		if (type==TYPE_FILE || type==TYPE_TRASH || type==TYPE_RESERVED) {
+			filenodes++;
+		}
+		pos += rleng;
+	}
+	if (pos+1!=leng) {
+		fprintf(stderr,"not all section has been read - file corrupted\n");
+		return -1;
+	}
+	while (p<pcnt) {	// less nodes than parts
+		parts[p].data = buff+pos;
+		p++;
+	}
+	for (p=0 ; p<pcnt ; p++) {
+		parts[p].leng = ((p+1<pcnt)?parts[p+1].data:buff+leng)-parts[p].data;
+	}
+	if (maxid>=nodetablesize) {
+		fsnodes_nodetable_resize(maxid+1);
+	}
+	return 0;
+}
+
+static void* fs_loadnodes_thread(void *arg) {
+	nodepart *np = (nodepart*)arg;
+	nodeloader ld;
+	FILE *fd;
+	int s;
+
+	if (np->leng==0) {
+		np->status = 0;
+		return NULL;
+	}
+	np->status = -1;
+	fd = fmemopen((void*)(np->data),np->leng,"r");	// discard const (safe - stream is read only)
+	if (fd==NULL) {
+		return NULL;
+	}
+	ld.nl = 1;
+	ld.parallel = 1;
+	s = 0;
+	while (s==0 && (uint64_t)ftello(fd)<np->leng) {
+		s = fs_loadnode_int(fd,&ld);
+	}
+	if (s>=0 && (uint64_t)ftello(fd)==np->leng) {
+		np->status = 0;
+	}
+	fclose(fd);
+	return NULL;
+}
+
+// returns 1 when section can't be mapped (it should be loaded sequentially then)
+static int fs_loadnodes_parallel(FILE *fd,loadsection *ls) {
+	nodepart parts[LOADNODEPARTS];
+	uint8_t *map;
+	uint64_t pgoff,mapleng;
+	long cpus;
+	uint32_t pcnt,p;
+	int status;
+
+	pgoff = ls->offset % sysconf(_SC_PAGESIZE);
+	mapleng = ls->length+pgoff;
+	map = (uint8_t*)mmap(NULL,mapleng,PROT_READ,MAP_PRIVATE,fileno(fd),ls->offset-pgoff);
+	if (map==MAP_FAILED) {
+		return 1;
+	}
+	madvise(map,mapleng,MADV_SEQUENTIAL);
+	cpus = sysconf(_SC_NPROCESSORS_ONLN);
+	pcnt = (cpus<1)?1:(cpus>LOADNODEPARTS)?LOADNODEPARTS:cpus;
+	if (fs_loadnodes_scan(map+pgoff,ls->length,parts,pcnt)<0) {
+		munmap(map,mapleng);
+		return -1;
+	}
+	for (p=1 ; p<pcnt ; p++) {
+		if (pthread_create(&(parts[p].thread),NULL,fs_loadnodes_thread,parts+p)!=0) {
+			parts[p].thread = pthread_self();	// decoded below by calling thread
+		}
+	}
+	fs_loadnodes_thread(parts);
+	status = parts[0].status;
+	for (p=1 ; p<pcnt ; p++) {
+		if (pthread_equal(parts[p].thread,pthread_self())) {
+			fs_loadnodes_thread(parts+p);
+		} else {
+			zassert(pthread_join(parts[p].thread,NULL));
+		}
+		if (parts[p].status<0) {
+			status = -1;
+		}
+	}
+	munmap(map,mapleng);
+	if (fseeko(fd,ls->offset+ls->length,SEEK_SET)<0) {
+		return -1;
+	}
+	return status;
+}
+
+static int fs_loadfree_int(FILE *fd,int ignoreflag) {
+	(void)ignoreflag;
+	return fs_loadfree(fd);
+}
+
+static int chunk_load_int(FILE *fd,int ignoreflag) {
+	(void)ignoreflag;
+	return chunk_load(fd);
+}
+
+static int fs_loadsection_check(FILE *fd,loadsection *ls,int ignoreflag) {
+	if ((off_t)(ls->offset+ls->length)!=ftello(fd)) {
+		fprintf(stderr,"not all section has been read - file corrupted\n");
+		if (ignoreflag==0) {
+			return -1;
+		}
+	}
+	return 0;
+}
+
+static void* fs_loadsection_thread(void *arg) {
+	loadsection *ls = (loadsection*)arg;
+	FILE *fd;
+
+	ls->status = -1;
+	fd = fopen(ls->fname,"r");
+	if (fd==NULL) {
+		fprintf(stderr,"can't open metadata file\n");
+		return NULL;
+	}
+	setvbuf(fd,NULL,_IOFBF,LOADBUFFSIZE);
+	if (fseeko(fd,ls->offset,SEEK_SET)<0) {
+		fclose(fd);
+		return NULL;
+	}
+	if (ls->loadfn(fd,ls->ignoreflag)>=0 && fs_loadsection_check(fd,ls,ls->ignoreflag)>=0) {
+		ls->status = 0;
+	}
+	fclose(fd);
+	return NULL;
+}
+
+int fs_loadsections(FILE *fd,const char *fname,int ignoreflag) {
+	uint8_t hdr[16];
+	const uint8_t *ptr;
+	loadsection sections[LOADMAXSECTIONS];
+	loadsection *ls;
+	uint32_t i,scnt;
+	int status,res;
+
+	// build section index
+	scnt = 0;
+	while (1) {
+		if (fread(hdr,1,16,fd)!=16) {
+			fprintf(stderr,"error section header\n");
+			return -1;
+		}
+		if (memcmp(hdr,"[MFS EOF MARKER]",16)==0) {
+			break;
+		}
+		if (scnt>=LOADMAXSECTIONS) {
+			fprintf(stderr,"error: too many sections\n");
+			return -1;
+		}
+		ls = sections+scnt;
+		memcpy(ls->name,hdr,8);
+		ptr = hdr+8;
+		ls->length = get64bit(&ptr);
+		ls->offset = ftello(fd);
+		ls->fname = fname;
+		ls->ignoreflag = ignoreflag;
+		ls->status = 0;
+		ls->background = 0;
+		if (memcmp(hdr,"NODE 1.0",8)==0) {
+			ls->loadfn = fs_loadnodes_int;
+			ls->desc = "objects (files,directories,etc.)";
+		} else if (memcmp(hdr,"EDGE 1.0",8)==0) {
+			ls->loadfn = fs_loadedges;
+			ls->desc = "names";
+		} else if (memcmp(hdr,"FREE 1.0",8)==0) {
+			ls->loadfn = fs_loadfree_int;
+			ls->desc = "deletion timestamps";
+		} else if (memcmp(hdr,"QUOT 1.0",8)==0) {
+			ls->loadfn = fs_loadquota;
+			ls->desc = "quota definitions";
+		} else if (memcmp(hdr,"XATR 1.0",8)==0) {
+			ls->loadfn = xattr_load;
+			ls->desc = "extra attributes (xattr)";
+		} else if (memcmp(hdr,"LOCK 1.0",8)==0) {
+			fprintf(stderr,"ignoring locks\n");
+			ls->loadfn = NULL;
+		} else if (memcmp(hdr,"CHNK 1.0",8)==0) {
+			ls->loadfn = chunk_load_int;
+			ls->desc = "chunks data";
+		} else {
+			hdr[8]=0;
+			if (ignoreflag) {
+				fprintf(stderr,"unknown section found (leng:%" PRIu64 ",name:%s) - all data from this section will be lost !!!\n",ls->length,hdr);
+				ls->loadfn = NULL;
+			} else {
+				fprintf(stderr,"error: unknown section found (leng:%" PRIu64 ",name:%s)\n",ls->length,hdr);
+				return -1;
+			}
+		}
+		if (ls->loadfn) {
+			scnt++;
+		}
+		if (fseeko(fd,ls->length,SEEK_CUR)<0) {
+			fprintf(stderr,"error section header\n");
+			return -1;
+		}
+	}
+
+	// start independent sections in background
+	for (i=0 ; i<scnt ; i++) {
+		ls = sections+i;
+		if (ParallelLoad && (ls->loadfn==chunk_load_int || ls->loadfn==xattr_load)) {
+			if (pthread_create(&(ls->thread),NULL,fs_loadsection_thread,ls)==0) {
+				ls->background = 1;
+			}
+		}
+	}
+
+	status = 0;
+	for (i=0 ; i<scnt && status==0 ; i++) {
+		ls = sections+i;
+		if (ls->background) {
+			continue;
+		}
+		fprintf(stderr,"loading %s ... ",ls->desc);
+		fflush(stderr);
+		res = 1;
+		if (ParallelLoad && ls->loadfn==fs_loadnodes_int) {
+			res = fs_loadnodes_parallel(fd,ls);
+		}
+		if (res<0 || (res>0 && (fseeko(fd,ls->offset,SEEK_SET)<0 || ls->loadfn(fd,ignoreflag)<0))) {
+			fprintf(stderr,"error\n");
+#ifndef METARESTORE
+			syslog(LOG_ERR,"error reading metadata (%s)",ls->desc);
+#endif
+			status = -1;
+		} else if (fs_loadsection_check(fd,ls,ignoreflag)<0) {
+			status = -1;
+		} else {
+			fprintf(stderr,"ok\n");
+		}
+	}
+
+	// wait for background sections even after error - they use global structures
+	for (i=0 ; i<scnt ; i++) {
+		ls = sections+i;
+		if (ls->background==0) {
+			continue;
+		}
+		zassert(pthread_join(ls->thread,NULL));
+		fprintf(stderr,"loading %s (in background) ... ",ls->desc);
+		if (ls->status<0) {
+			fprintf(stderr,"error\n");
+#ifndef METARESTORE
+			syslog(LOG_ERR,"error reading metadata (%s)",ls->desc);
+#endif
+			status = -1;
+		} else {
+			fprintf(stderr,"ok\n");
+		}
+	}
+	return status;
+}
+
+int fs_load(FILE *fd,const char *fname,int ignoreflag,uint8_t fver) {
 	uint8_t hdr[16];
 	const uint8_t *ptr;
-	off_t offbegin;
-	uint64_t sleng;
 
 	if (fread(hdr,1,16,fd)!=16) {
 		fprintf(stderr,"error loading header\n");
@@ -7715,6 +9001,9 @@ int fs_load(FILE *fd,int ignoreflag,uint8_t fver) {
 	metaversion = get64bit(&ptr);
 	nextsessionid = get32bit(&ptr);
 	fsnodes_init_freebitmask();
+	if (maxnodeid>=nodetablesize) {
+		fsnodes_nodetable_resize(maxnodeid+1);
+	}
 
 	if (fver<0x16) {
 		fprintf(stderr,"loading objects (files,directories,etc.) ... ");
@@ -7756,93 +9045,8 @@ int fs_load(FILE *fd,int ignoreflag,uint8_t fver) {
 		}
 		fprintf(stderr,"ok\n");
 	} else { // fver>=0x16
-		while (1) {
-			if (fread(hdr,1,16,fd)!=16) {
-				fprintf(stderr,"error section header\n");
-				return -1;
-			}
-			if (memcmp(hdr,"[MFS EOF MARKER]",16)==0) {
-				break;
-			}
-			ptr = hdr+8;
-			sleng = get64bit(&ptr);
-			offbegin = ftello(fd);
-			if (memcmp(hdr,"NODE 1.0",8)==0) {
-				fprintf(stderr,"loading objects (files,directories,etc.) ... ");
-				fflush(stderr);
-				if (fs_loadnodes(fd)<0) {
-#ifndef METARESTORE
-					syslog(LOG_ERR,"error reading metadata (node)");
-#endif
-					return -1;
-				}
-			} else if (memcmp(hdr,"EDGE 1.0",8)==0) {
-				fprintf(stderr,"loading names ... ");
-				fflush(stderr);
-				if (fs_loadedges(fd,ignoreflag)<0) {
-#ifndef METARESTORE
-					syslog(LOG_ERR,"error reading metadata (edge)");
-#endif
-					return -1;
-				}
-			} else if (memcmp(hdr,"FREE 1.0",8)==0) {
-				fprintf(stderr,"loading deletion timestamps ... ");
-				fflush(stderr);
-				if (fs_loadfree(fd)<0) {
-#ifndef METARESTORE
-					syslog(LOG_ERR,"error reading metadata (free)");
-#endif
-					return -1;
-				}
-			} else if (memcmp(hdr,"QUOT 1.0",8)==0) {
-				fprintf(stderr,"loading quota definitions ... ");
-				fflush(stderr);
-				if (fs_loadquota(fd,ignoreflag)<0) {
-#ifndef METARESTORE
-					syslog(LOG_ERR,"error reading metadata (quota)");
-#endif
-					return -1;
-				}
-			} else if (memcmp(hdr,"XATR 1.0",8)==0) {
-				fprintf(stderr,"loading extra attributes (xattr) ... ");
-				fflush(stderr);
-				if (xattr_load(fd,ignoreflag)<0) {
-#ifndef METARESTORE
-					syslog(LOG_ERR,"error reading metadata (xattr)");
-#endif
-					return -1;
-				}
-			} else if (memcmp(hdr,"LOCK 1.0",8)==0) {
-				fprintf(stderr,"ignoring locks\n");
-				fseeko(fd,sleng,SEEK_CUR);
-			} else if (memcmp(hdr,"CHNK 1.0",8)==0) {
-				fprintf(stderr,"loading chunks data ... ");
-				fflush(stderr);
-				if (chunk_load(fd)<0) {
-					fprintf(stderr,"error\n");
-#ifndef METARESTORE
-					syslog(LOG_ERR,"error reading metadata (chunks)");
-#endif
-					fclose(fd);
-					return -1;
-				}
-			} else {
-				hdr[8]=0;
-				if (ignoreflag) {
-					fprintf(stderr,"unknown section found (leng:%" PRIu64 ",name:%s) - all data from this section will be lost !!!\n",sleng,hdr);
-					fseeko(fd,sleng,SEEK_CUR);
-				} else {
-					fprintf(stderr,"error: unknown section found (leng:%" PRIu64 ",name:%s)\n",sleng,hdr);
-					return -1;
-				}
-			}
-			if ((off_t)(offbegin+sleng)!=ftello(fd)) {
-				fprintf(stderr,"not all section has been read - file corrupted\n");
-				if (ignoreflag==0) {
-					return -1;
-				}
-			}
-			fprintf(stderr,"ok\n");
+		if (fs_loadsections(fd,fname,ignoreflag)<0) {
+			return -1;
 		}
 	}
 
@@ -7865,14 +9069,12 @@ int fs_load(FILE *fd,int ignoreflag,uint8_t fver) {
 
 #ifndef METARESTORE
 void fs_new(void) {
-	uint32_t nodepos;
 	statsrecord *sr;
 	maxnodeid = MFS_ROOT_ID;
 	metaversion = 0;
 	nextsessionid = 1;
 	fsnodes_init_freebitmask();
-	root = (fsnode*) malloc(sizeof(fsnode));
-	passert(root);
+	root = fsnode_malloc();
 	root->id = MFS_ROOT_ID;
 	root->type = TYPE_DIRECTORY;
 	root->ctime = root->mtime = root->atime = main_time();
@@ -7890,9 +9092,7 @@ void fs_new(void) {
 	root->data.ddata.elements = 0;
 	root->data.ddata.nlink = 2;
 	root->parents = NULL;
-	nodepos = NODEHASHPOS(root->id);
-	root->next = nodehash[nodepos];
-	nodehash[nodepos] = root;
+	fsnodes_nodetable_insert(root);
 	fsnodes_used_inode(root->id);
 	chunk_newfs();
 	nodes=1;
@@ -7984,15 +9184,197 @@ int fs_emergency_saves() {
 }
 
 #ifndef METARESTORE
+static void fs_storeall_rotate(void) {
+	if (BackMetaCopies>0) {
+		char metaname1[100],metaname2[100];
+		int n;
+		for (n=BackMetaCopies-1 ; n>0 ; n--) {
+			snprintf(metaname1,100,"metadata.mfs.back.%" PRIu32,n+1);
+			snprintf(metaname2,100,"metadata.mfs.back.%" PRIu32,n);
+			rename(metaname2,metaname1);
+		}
+		rename("metadata.mfs.back","metadata.mfs.back.1");
+	}
+	rename("metadata.mfs.back.tmp","metadata.mfs.back");
+	unlink("metadata.mfs");
+}
+
+static uint64_t fs_bgstore_usec(void) {
+	struct timeval tv;
+	gettimeofday(&tv,NULL);
+	return tv.tv_sec*UINT64_C(1000000)+tv.tv_usec;
+}
+
+static void* fs_bgstore_thread(void *arg) {
+	FILE *fd;
+	(void)arg;
+	fd = fopen("metadata.mfs.back.tmp","w");
+	if (fd==NULL) {
+		syslog(LOG_ERR,"can't open metadata file");
+		bgstore_status = 1;
+	} else {
+		if (fwrite((bgstore_fver>=0x17)?MFSSIGNATURE "M 1.7":MFSSIGNATURE "M 1.5",1,8,fd)!=(size_t)8) {
+			syslog(LOG_NOTICE,"fwrite error");
+		} else {
+			fs_store_int(fd,bgstore_fver,1);
+		}
+		if (ferror(fd)!=0 || bgstore_status) {
+			syslog(LOG_ERR,"can't write metadata");
+			fclose(fd);
+			unlink("metadata.mfs.back.tmp");
+			bgstore_status = 1;
+		} else {
+			bgstore_bytes = ftello(fd);
+			fclose(fd);
+			fs_storeall_rotate();
+		}
+	}
+	bgstore_endtime = fs_bgstore_usec();
+	bgstore_finished = 1;
+	return NULL;
+}
+
+static void fs_bgstore_free(void) {
+	if (bgstore_nodecopy) {
+		fclose(bgstore_nodecopy);
+		bgstore_nodecopy = NULL;
+	}
+	if (bgstore_edgecopy) {
+		fclose(bgstore_edgecopy);
+		bgstore_edgecopy = NULL;
+	}
+	free(bgstore_nodecopybuff);
+	free(bgstore_edgecopybuff);
+	free(bgstore_freebuff);
+	free(bgstore_quotabuff);
+	free(bgstore_xattrbuff);
+	free(bgstore_nodemap);
+	free(bgstore_edgemap);
+	bgstore_nodecopybuff = bgstore_edgecopybuff = NULL;
+	bgstore_freebuff = bgstore_quotabuff = bgstore_xattrbuff = NULL;
+	bgstore_nodecopyleng = bgstore_edgecopyleng = 0;
+	bgstore_freeleng = bgstore_quotaleng = bgstore_xattrleng = 0;
+	bgstore_nodemap = bgstore_edgemap = NULL;
+}
+
+static int fs_bgstore_section(void (*storefn)(FILE *),char **buff,size_t *leng) {
+	FILE *mfd;
+	mfd = open_memstream(buff,leng);
+	if (mfd==NULL) {
+		return -1;
+	}
+	storefn(mfd);
+	if (ferror(mfd)!=0) {
+		fclose(mfd);
+		return -1;
+	}
+	fclose(mfd);
+	return 0;
+}
+
+static int fs_bgstore_start(uint8_t fver) {
+	pthread_attr_t thattr;
+	uint32_t mapsize;
+	int res;
+
+	bgstore_starttime = fs_bgstore_usec();
+	bgstore_fver = fver;
+	bgstore_maxnodeid = maxnodeid;
+	bgstore_metaversion = metaversion;
+	bgstore_nextsessionid = nextsessionid;
+	mapsize = (maxnodeid>>3)+1;
+	bgstore_nodemap = (uint8_t*)calloc(mapsize,1);
+	bgstore_edgemap = (uint8_t*)calloc(mapsize,1);
+	bgstore_nodecopy = open_memstream(&bgstore_nodecopybuff,&bgstore_nodecopyleng);
+	bgstore_edgecopy = open_memstream(&bgstore_edgecopybuff,&bgstore_edgecopyleng);
+	if (bgstore_nodemap==NULL || bgstore_edgemap==NULL || bgstore_nodecopy==NULL || bgstore_edgecopy==NULL
+			|| fs_bgstore_section(fs_storefree,&bgstore_freebuff,&bgstore_freeleng)<0
+			|| fs_bgstore_section(fs_storequota,&bgstore_quotabuff,&bgstore_quotaleng)<0
+			|| fs_bgstore_section(xattr_store,&bgstore_xattrbuff,&bgstore_xattrleng)<0) {
+		fs_bgstore_free();
+		return -1;
+	}
+	if (chunk_bgstore_start()<0) {
+		fs_bgstore_free();
+		return -1;
+	}
+	bgstore_status = 0;
+	bgstore_finished = 0;
+	bgstore_nodecopies = 0;
+	bgstore_edgecopies = 0;
+	bgstore_bytes = 0;
+	bgstore_running = 1;
+	zassert(pthread_attr_init(&thattr));
+	zassert(pthread_attr_setstacksize(&thattr,0x400000));	// fs_storenode uses big buffer on stack
+	res = pthread_create(&bgstore_thread,&thattr,fs_bgstore_thread,NULL);
+	zassert(pthread_attr_destroy(&thattr));
+	if (res!=0) {
+		bgstore_running = 0;
+		chunk_bgstore_end();
+		fs_bgstore_free();
+		return -1;
+	}
+	bgstore_pausetime = fs_bgstore_usec()-bgstore_starttime;
+	return 0;
+}
+
+// waits for store thread and releases all copies
+static void fs_bgstore_wait(void) {
+	uint32_t chunkcopies;
+	uint64_t storetime;
+	if (bgstore_running==0) {
+		return;
+	}
+	zassert(pthread_join(bgstore_thread,NULL));
+	bgstore_running = 0;
+	chunkcopies = chunk_bgstore_end();
+	if (bgstore_status==0) {
+		storetime = bgstore_endtime-bgstore_starttime;
+		if (storetime==0) {
+			storetime = 1;
+		}
+		syslog(LOG_NOTICE,"metadata stored in background (pause: %" PRIu64 "us, size: %" PRIu64 "B, time: %.3fs, speed: %.2fMB/s, copied: %" PRIu32 " nodes, %" PRIu32 " edge lists, %" PRIu32 " chunk buckets)",bgstore_pausetime,bgstore_bytes,storetime/1000000.0,(double)bgstore_bytes/storetime,bgstore_nodecopies,bgstore_edgecopies,chunkcopies);
+	}
+	fs_bgstore_free();
+	if (bgstore_status) {
+		// try to save in alternative location - just in case (the same as forked store does)
+		fs_emergency_saves();
+	}
+}
+
+static void fs_bgstore_check(void) {
+	if (bgstore_running && bgstore_finished) {
+		fs_bgstore_wait();
+	}
+}
+
 int fs_storeall(int bg) {
 	FILE *fd;
 	int i;
 	struct stat sb;
+	if (bgstore_running) {
+		if (bg && bgstore_finished==0) {
+			syslog(LOG_ERR,"previous metadata save process hasn't finished yet - do not start another one");
+			return -1;
+		}
+		fs_bgstore_wait();
+	}
 	if (stat("metadata.mfs.back.tmp",&sb)==0) {
 		syslog(LOG_ERR,"previous metadata save process hasn't finished yet - do not start another one");
 		return -1;
 	}
 	changelog_rotate();
+	if (bg && BackMetaFork==0) {
+#if VERSHEX>=0x010700
+		i = fs_bgstore_start(0x17);
+#else
+		i = fs_bgstore_start(0x15);
+#endif
+		if (i==0) {
+			return 1;
+		}
+		syslog(LOG_WARNING,"can't start metadata store thread - using fork");
+	}
 	if (bg) {
 		i = fork();
 	} else {
@@ -8035,18 +9417,7 @@ int fs_storeall(int bg) {
 			return 0;
 		} else {
 			fclose(fd);
-			if (BackMetaCopies>0) {
-				char metaname1[100],metaname2[100];
-				int n;
-				for (n=BackMetaCopies-1 ; n>0 ; n--) {
-					snprintf(metaname1,100,"metadata.mfs.back.%" PRIu32,n+1);
-					snprintf(metaname2,100,"metadata.mfs.back.%" PRIu32,n);
-					rename(metaname2,metaname1);
-				}
-				rename("metadata.mfs.back","metadata.mfs.back.1");
-			}
-			rename("metadata.mfs.back.tmp","metadata.mfs.back");
-			unlink("metadata.mfs");
+			fs_storeall_rotate();
 		}
 		if (i==0) {
 			exit(0);
@@ -8170,6 +9541,7 @@ int fs_loadall(const char *fname,int ignoreflag) {
 #endif
 		return -1;
 	}
+	setvbuf(fd,NULL,_IOFBF,LOADBUFFSIZE);
 	if (fread(hdr,1,8,fd)!=8) {
 		fclose(fd);
 		fprintf(stderr,"can't read metadata header\n");
@@ -8200,9 +9572,9 @@ int fs_loadall(const char *fname,int ignoreflag) {
 #endif
 	if (memcmp(hdr,MFSSIGNATURE "M 1.5",8)==0) {
 #ifndef METARESTORE
-		if (fs_load(fd,0,0x15)<0) {
+		if (fs_load(fd,"metadata.mfs",0,0x15)<0) {
 #else
-		if (fs_load(fd,ignoreflag,0x15)<0) {
+		if (fs_load(fd,fname,ignoreflag,0x15)<0) {
 #endif
 #ifndef METARESTORE
 			syslog(LOG_ERR,"error reading metadata (structure)");
@@ -8212,9 +9584,9 @@ int fs_loadall(const char *fname,int ignoreflag) {
 		}
 	} else if (memcmp(hdr,MFSSIGNATURE "M 1.7",8)==0) {
 #ifndef METARESTORE
-		if (fs_load(fd,0,0x17)<0) {
+		if (fs_load(fd,"metadata.mfs",0,0x17)<0) {
 #else
-		if (fs_load(fd,ignoreflag,0x17)<0) {
+		if (fs_load(fd,fname,ignoreflag,0x17)<0) {
 #endif
 #ifndef METARESTORE
 			syslog(LOG_ERR,"error reading metadata (structure)");
@@ -8290,13 +9662,14 @@ void fs_strinit(void) {
 	quotahead = NULL;
 #endif
 	xattr_init();
-	for (i=0 ; i<NODEHASHSIZE ; i++) {
-		nodehash[i]=NULL;
-	}
+	fsnodes_nodetable_resize(NODETABLE_INITSIZE);
 #ifdef EDGEHASH
 	for (i=0 ; i<EDGEHASHSIZE ; i++) {
 		edgehash[i]=NULL;
 	}
+	for (i=0 ; i<DIRINDEXHASHSIZE ; i++) {
+		dirindexhash[i]=NULL;
+	}
 #endif
 }
 
@@ -8314,6 +9687,7 @@ void fs_reload(void) {
 	if (BackMetaCopies>99) {
 		BackMetaCopies=99;
 	}
+	BackMetaFork = cfg_getuint32("BACK_META_FORK",0);
 }
 
 int fs_init(void) {
@@ -8325,6 +9699,7 @@ int fs_init(void) {
 		return -1;
 	}
 	fprintf(stderr,"metadata file has been loaded\n");
+	fprintf(stderr,"metadata memory usage: nodes: %" PRIu64 "B, edges: %" PRIu64 "B, long names: %" PRIu64 "B, other: %" PRIu64 "B\n",memusage_nodes,memusage_edges,memusage_names,memusage_other);
 #if VERSHEX>=0x010700
 	QuotaTimeLimit = cfg_getuint32("QUOTA_TIME_LIMIT",7*86400);
 #else
@@ -8334,11 +9709,13 @@ int fs_init(void) {
 	if (BackMetaCopies>99) {
 		BackMetaCopies=99;
 	}
+	BackMetaFork = cfg_getuint32("BACK_META_FORK",0);
 
 	main_reloadregister(fs_reload);
 	main_timeregister(TIMEMODE_RUN_LATE,1,0,fs_test_files);
 	main_timeregister(TIMEMODE_RUN_LATE,1,0,fsnodes_check_all_quotas);
 	main_timeregister(TIMEMODE_RUN_LATE,3600,0,fs_dostoreall);
+	main_timeregister(TIMEMODE_RUN_LATE,1,0,fs_bgstore_check);
 	main_timeregister(TIMEMODE_RUN_LATE,300,0,fs_emptytrash);
 	main_timeregister(TIMEMODE_RUN_LATE,60,0,fs_emptyreserved);
 	main_timeregister(TIMEMODE_RUN_LATE,60,0,fsnodes_freeinodes);
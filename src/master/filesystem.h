@@ -63,12 +63,13 @@ uint8_t fs_quota(uint32_t ts,uint32_t inode,uint8_t exceeded,uint8_t flags,uint3
 void fs_dump(void);
 void fs_term(const char *fname);
 int fs_init(const char *fname,int ignoreflag);
+void fs_setparallelload(uint8_t enable);
 
 #else
 
 // attr blob: [ type:8 goal:8 mode:16 uid:32 gid:32 atime:32 mtime:32 ctime:32 length:64 ]
 void fs_stats(uint32_t stats[16]);
-void fs_info(uint64_t *totalspace,uint64_t *availspace,uint64_t *trspace,uint32_t *trnodes,uint64_t *respace,uint32_t *renodes,uint32_t *inodes,uint32_t *dnodes,uint32_t *fnodes);
+void fs_info(uint64_t *totalspace,uint64_t *availspace,uint64_t *trspace,uint32_t *trnodes,uint64_t *respace,uint32_t *renodes,uint32_t *inodes,uint32_t *dnodes,uint32_t *fnodes,uint64_t *memusage);
 void fs_test_getdata(uint32_t *loopstart,uint32_t *loopend,uint32_t *files,uint32_t *ugfiles,uint32_t *mfiles,uint32_t *chunks,uint32_t *ugchunks,uint32_t *mchunks,char **msgbuff,uint32_t *msgbuffleng);
 
 // void fs_attrtoblob(uint8_t attr[32],uint8_t attrblob[32]);
@@ -100,12 +101,21 @@ uint8_t fs_append(uint32_t rootinode,uint8_t sesflags,uint32_t inode,uint32_t in
 
 uint8_t fs_readdir_size(uint32_t rootinode,uint8_t sesflags,uint32_t inode,uint32_t uid,uint32_t gid,uint8_t flags,void **dnode,uint32_t *dbuffsize);
 void fs_readdir_data(uint32_t rootinode,uint8_t sesflags,uint32_t uid,uint32_t gid,uint32_t auid,uint32_t agid,uint8_t flags,void *dnode,uint8_t *dbuff);
+// '_ro' versions do not modify metadata and are safe to call from many threads at once (as long as nothing else modifies metadata)
+// access time has to be updated afterwards from the main thread with '_atime' functions
+void fs_readdir_data_ro(uint32_t rootinode,uint8_t sesflags,uint32_t uid,uint32_t gid,uint32_t auid,uint32_t agid,uint8_t flags,void *dnode,uint8_t *dbuff);
+void fs_readdir_atime(void *dnode);
+// one page of directory starting at 'cursor' - dpage is freed by fs_readdir_page_data_ro
+uint8_t fs_readdir_page_size(uint32_t rootinode,uint8_t sesflags,uint32_t inode,uint32_t uid,uint32_t gid,uint8_t flags,uint64_t cursor,uint32_t maxsize,void **dnode,void **dpage,uint32_t *dbuffsize);
+void fs_readdir_page_data_ro(uint32_t rootinode,uint8_t sesflags,uint32_t uid,uint32_t gid,uint32_t auid,uint32_t agid,uint8_t flags,void *dnode,void *dpage,uint8_t *dbuff);
 
 uint8_t fs_checkfile(uint32_t rootinode,uint8_t sesflags,uint32_t inode,uint32_t chunkcount[11]);
 
 uint8_t fs_opencheck(uint32_t rootinode,uint8_t sesflags,uint32_t inode,uint32_t uid,uint32_t gid,uint32_t auid,uint32_t agid,uint8_t flags,uint8_t attr[35]);
 
 uint8_t fs_readchunk(uint32_t inode,uint32_t indx,uint64_t *chunkid,uint64_t *length);
+uint8_t fs_readchunk_ro(uint32_t inode,uint32_t indx,uint64_t *chunkid,uint64_t *length);
+void fs_readchunk_atime(uint32_t inode);
 uint8_t fs_writechunk(uint32_t inode,uint32_t indx,uint64_t *chunkid,uint64_t *length,uint8_t *opflag);
 uint8_t fs_writeend(uint32_t inode,uint64_t length,uint64_t chunkid);
 
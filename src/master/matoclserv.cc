@@ -31,6 +31,7 @@
 #include <inttypes.h>
 #include <netinet/in.h>
 #include <sys/resource.h>
+#include <pthread.h>
 
 #include "MFSCommunication.h"
 
@@ -50,8 +51,10 @@
 #include "sockets.h"
 #include "slogger.h"
 #include "massert.h"
+#include "pcqueue.h"
 
 #define MaxPacketSize 1000000
+#define MAXREADWORKERS 64
 
 // matoclserventry.mode
 enum {KILL,HEADER,DATA};
@@ -167,6 +170,34 @@ typedef struct matoclserventry {
 	struct matoclserventry *next;
 } matoclserventry;
 
+// read-only request, which can be executed by one of read workers
+typedef struct readreq {
+	matoclserventry *eptr;
+	uint32_t type;
+	uint32_t msgid;
+	uint32_t rootinode;
+	uint8_t sesflags;
+	uint32_t inode;
+	uint32_t uid,gid,auid,agid;
+	uint8_t flags;		// modemask (ACCESS) or flags (GETDIR)
+	uint32_t indx;		// READ_CHUNK
+	uint64_t cursor;	// GETDIR_PAGE
+	uint32_t maxsize;	// GETDIR_PAGE
+	uint8_t nleng;		// LOOKUP
+	const uint8_t *name;	// LOOKUP - points into 'packet'
+	uint32_t count;		// LOOKUP_MULTI, GETATTR_MULTI
+	const uint8_t *items;	// LOOKUP_MULTI, GETATTR_MULTI - points into 'packet'
+	uint8_t *packet;	// input packet (freed after request is finished)
+// results
+	uint8_t status;
+	uint64_t chunkid;
+	uint64_t fleng;
+	void *dnode;
+	void *dpage;
+	packetstruct *answer;
+	struct readreq *next;
+} readreq;
+
 static session *sessionshead=NULL;
 static matoclserventry *matoclservhead=NULL;
 static int lsock;
@@ -178,6 +209,15 @@ static char *ListenHost;
 static char *ListenPort;
 static uint32_t RejectOld;
 static uint32_t SessionSustainTime;
+static uint32_t ReadWorkers;
+
+// read workers
+static readreq *rrhead,**rrtail;
+static uint32_t rrcount;
+static void *rrjobqueue;
+static void *rrdonequeue;
+static pthread_t rrworkerthreads[MAXREADWORKERS];
+static uint32_t rrworkers;
 
 static uint32_t stats_prcvd = 0;
 static uint32_t stats_psent = 0;
@@ -636,9 +676,8 @@ void matoclserv_init_sessions(uint32_t sessionid,uint32_t inode) {
 	*ofpptr = ofptr;
 }
 
-uint8_t* matoclserv_createpacket(matoclserventry *eptr,uint32_t type,uint32_t size) {
+static inline packetstruct* matoclserv_allocpacket(uint32_t type,uint32_t size,uint8_t **ptr) {
 	packetstruct *outpacket;
-	uint8_t *ptr;
 	uint32_t psize;
 
 	outpacket=(packetstruct*)malloc(sizeof(packetstruct));
@@ -647,13 +686,25 @@ uint8_t* matoclserv_createpacket(matoclserventry *eptr,uint32_t type,uint32_t si
 	outpacket->packet= (uint8_t*) malloc(psize);
 	passert(outpacket->packet);
 	outpacket->bytesleft = psize;
-	ptr = outpacket->packet;
-	put32bit(&ptr,type);
-	put32bit(&ptr,size);
+	*ptr = outpacket->packet;
+	put32bit(ptr,type);
+	put32bit(ptr,size);
 	outpacket->startptr = (uint8_t*)(outpacket->packet);
 	outpacket->next = NULL;
+	return outpacket;
+}
+
+static inline void matoclserv_attachpacket(matoclserventry *eptr,packetstruct *outpacket) {
 	*(eptr->outputtail) = outpacket;
 	eptr->outputtail = &(outpacket->next);
+}
+
+uint8_t* matoclserv_createpacket(matoclserventry *eptr,uint32_t type,uint32_t size) {
+	packetstruct *outpacket;
+	uint8_t *ptr;
+
+	outpacket = matoclserv_allocpacket(type,size,&ptr);
+	matoclserv_attachpacket(eptr,outpacket);
 	return ptr;
 }
 
@@ -913,15 +964,10 @@ void matoclserv_info(matoclserventry *eptr,const uint8_t *data,uint32_t length)
 		eptr->mode = KILL;
 		return;
 	}
-	fs_info(&totalspace,&availspace,&trspace,&trnodes,&respace,&renodes,&inodes,&dnodes,&fnodes);
+	fs_info(&totalspace,&availspace,&trspace,&trnodes,&respace,&renodes,&inodes,&dnodes,&fnodes,&memusage);
 	chunk_info(&chunks,&chunkcopies,&tdcopies);
 #ifdef MEMORY_USAGE
 	memusage = chartsdata_memusage();
-#else
-	/* XXX(lamvak): what exactly should be inserted here when there's no MEMORY_USAGE
-	 * probably needs a fix
-	 */
-	memusage = 0;
 #endif
 	ptr = matoclserv_createpacket(eptr,MATOCL_INFO,76);
 	put16bit(&ptr,PACKAGE_VERSION_MAJOR);
@@ -1653,102 +1699,456 @@ void matoclserv_fuse_statfs(matoclserventry *eptr,const uint8_t *data,uint32_t l
 	}
 }
 
-void matoclserv_fuse_access(matoclserventry *eptr,const uint8_t *data,uint32_t length) {
-	uint32_t inode,uid,gid;
-	uint8_t modemask;
-	uint32_t msgid;
+/* read-only requests
+ *
+ * ACCESS, LOOKUP, GETATTR, GETDIR, READ_CHUNK and their paged/batched
+ * variants are split into three steps:
+ * parsing (main thread), execution (main thread or one of read workers) and
+ * finishing (main thread). When MATOCL_READ_WORKERS is greater than zero,
+ * requests received in one poll loop are collected and executed in parallel.
+ * Nothing modifies metadata while they are executed, because any other packet
+ * flushes the collected requests before it is processed.
+ */
+
+static inline readreq* matoclserv_readreq_new(matoclserventry *eptr,uint32_t type,const uint8_t *data) {
+	readreq *rr;
+	rr = (readreq*)malloc(sizeof(readreq));
+	passert(rr);
+	rr->eptr = eptr;
+	rr->type = type;
+	rr->rootinode = eptr->sesdata->rootinode;
+	rr->sesflags = eptr->sesdata->sesflags;
+	rr->packet = NULL;
+	if (data && data==eptr->inputpacket.packet) {	// take ownership of input packet - 'name' points into it
+		rr->packet = eptr->inputpacket.packet;
+		eptr->inputpacket.packet = NULL;
+	}
+	rr->status = STATUS_OK;
+	rr->dnode = NULL;
+	rr->dpage = NULL;
+	rr->answer = NULL;
+	rr->next = NULL;
+	return rr;
+}
+
+// can be called from read workers - must not modify anything outside 'rr'
+static void matoclserv_readreq_execute(readreq *rr) {
 	uint8_t *ptr;
-	uint8_t status;
+	const uint8_t *rptr,*name;
+	uint8_t attr[35];
+	uint32_t newinode;
+	uint32_t dleng;
+	uint32_t i,inode,uid,gid,auid,agid;
+	uint8_t nleng,status;
+
+	switch (rr->type) {
+		case CLTOMA_FUSE_ACCESS:
+			rr->status = fs_access(rr->rootinode,rr->sesflags,rr->inode,rr->uid,rr->gid,rr->flags);
+			rr->answer = matoclserv_allocpacket(MATOCL_FUSE_ACCESS,5,&ptr);
+			put32bit(&ptr,rr->msgid);
+			put8bit(&ptr,rr->status);
+			break;
+		case CLTOMA_FUSE_LOOKUP:
+			rr->status = fs_lookup(rr->rootinode,rr->sesflags,rr->inode,rr->nleng,rr->name,rr->uid,rr->gid,rr->auid,rr->agid,&newinode,attr);
+			rr->answer = matoclserv_allocpacket(MATOCL_FUSE_LOOKUP,(rr->status!=STATUS_OK)?5:43,&ptr);
+			put32bit(&ptr,rr->msgid);
+			if (rr->status!=STATUS_OK) {
+				put8bit(&ptr,rr->status);
+			} else {
+				put32bit(&ptr,newinode);
+				memcpy(ptr,attr,35);
+			}
+			break;
+		case CLTOMA_FUSE_GETATTR:
+			rr->status = fs_getattr(rr->rootinode,rr->sesflags,rr->inode,rr->uid,rr->gid,rr->auid,rr->agid,attr);
+			rr->answer = matoclserv_allocpacket(MATOCL_FUSE_GETATTR,(rr->status!=STATUS_OK)?5:39,&ptr);
+			put32bit(&ptr,rr->msgid);
+			if (rr->status!=STATUS_OK) {
+				put8bit(&ptr,rr->status);
+			} else {
+				memcpy(ptr,attr,35);
+			}
+			break;
+		case CLTOMA_FUSE_GETDIR:
+			rr->status = fs_readdir_size(rr->rootinode,rr->sesflags,rr->inode,rr->uid,rr->gid,rr->flags,&(rr->dnode),&dleng);
+			rr->answer = matoclserv_allocpacket(MATOCL_FUSE_GETDIR,(rr->status!=STATUS_OK)?5:4+dleng,&ptr);
+			put32bit(&ptr,rr->msgid);
+			if (rr->status!=STATUS_OK) {
+				put8bit(&ptr,rr->status);
+			} else {
+				fs_readdir_data_ro(rr->rootinode,rr->sesflags,rr->uid,rr->gid,rr->auid,rr->agid,rr->flags,rr->dnode,ptr);
+			}
+			break;
+		case CLTOMA_FUSE_GETDIR_PAGE:
+			rr->status = fs_readdir_page_size(rr->rootinode,rr->sesflags,rr->inode,rr->uid,rr->gid,rr->flags,rr->cursor,rr->maxsize,&(rr->dnode),&(rr->dpage),&dleng);
+			rr->answer = matoclserv_allocpacket(MATOCL_FUSE_GETDIR_PAGE,(rr->status!=STATUS_OK)?5:4+dleng,&ptr);
+			put32bit(&ptr,rr->msgid);
+			if (rr->status!=STATUS_OK) {
+				put8bit(&ptr,rr->status);
+			} else {
+				fs_readdir_page_data_ro(rr->rootinode,rr->sesflags,rr->uid,rr->gid,rr->auid,rr->agid,rr->flags,rr->dnode,rr->dpage,ptr);
+			}
+			break;
+		case CLTOMA_FUSE_LOOKUP_MULTI:
+			rr->answer = matoclserv_allocpacket(MATOCL_FUSE_LOOKUP_MULTI,4+rr->count*40,&ptr);
+			put32bit(&ptr,rr->msgid);
+			rptr = rr->items;
+			for (i=0 ; i<rr->count ; i++) {
+				inode = get32bit(&rptr);
+				nleng = get8bit(&rptr);
+				name = rptr;
+				rptr += nleng;
+				auid = uid = get32bit(&rptr);
+				agid = gid = get32bit(&rptr);
+				matoclserv_ugid_remap(rr->eptr,&uid,&gid);
+				status = fs_lookup(rr->rootinode,rr->sesflags,inode,nleng,name,uid,gid,auid,agid,&newinode,attr);
+				put8bit(&ptr,status);
+				if (status!=STATUS_OK) {
+					memset(ptr,0,39);
+					ptr+=39;
+				} else {
+					put32bit(&ptr,newinode);
+					memcpy(ptr,attr,35);
+					ptr+=35;
+				}
+			}
+			break;
+		case CLTOMA_FUSE_GETATTR_MULTI:
+			rr->answer = matoclserv_allocpacket(MATOCL_FUSE_GETATTR_MULTI,4+rr->count*36,&ptr);
+			put32bit(&ptr,rr->msgid);
+			rptr = rr->items;
+			for (i=0 ; i<rr->count ; i++) {
+				inode = get32bit(&rptr);
+				auid = uid = get32bit(&rptr);
+				agid = gid = get32bit(&rptr);
+				matoclserv_ugid_remap(rr->eptr,&uid,&gid);
+				status = fs_getattr(rr->rootinode,rr->sesflags,inode,uid,gid,auid,agid,attr);
+				put8bit(&ptr,status);
+				if (status!=STATUS_OK) {
+					memset(ptr,0,35);
+				} else {
+					memcpy(ptr,attr,35);
+				}
+				ptr+=35;
+			}
+			break;
+		case CLTOMA_FUSE_READ_CHUNK:
+			// chunk locations are taken in matoclserv_readreq_finish - chunk module is not thread safe
+			rr->status = fs_readchunk_ro(rr->inode,rr->indx,&(rr->chunkid),&(rr->fleng));
+			break;
+	}
+}
+
+static void matoclserv_readreq_finish(readreq *rr) {
+	matoclserventry *eptr = rr->eptr;
+	uint8_t *ptr;
+	uint32_t version;
+	uint8_t count;
+	uint8_t loc[100*6];
+
+	switch (rr->type) {
+		case CLTOMA_FUSE_LOOKUP:
+			if (eptr->sesdata) {
+				eptr->sesdata->currentopstats[3]++;
+			}
+			break;
+		case CLTOMA_FUSE_GETATTR:
+			if (eptr->sesdata) {
+				eptr->sesdata->currentopstats[1]++;
+			}
+			break;
+		case CLTOMA_FUSE_LOOKUP_MULTI:
+			if (eptr->sesdata) {
+				eptr->sesdata->currentopstats[3]+=rr->count;
+			}
+			break;
+		case CLTOMA_FUSE_GETATTR_MULTI:
+			if (eptr->sesdata) {
+				eptr->sesdata->currentopstats[1]+=rr->count;
+			}
+			break;
+		case CLTOMA_FUSE_GETDIR:
+		case CLTOMA_FUSE_GETDIR_PAGE:
+			if (rr->status==STATUS_OK) {
+				fs_readdir_atime(rr->dnode);
+/* CACHENOTIFY
+				if (rr->flags&GETDIR_FLAG_ADDTOCACHE) {
+					if (rr->inode==MFS_ROOT_ID) {
+						matoclserv_notify_add_dir(eptr,eptr->sesdata->rootinode);
+					} else {
+						matoclserv_notify_add_dir(eptr,rr->inode);
+					}
+				}
+*/
+			}
+			if (eptr->sesdata) {
+				eptr->sesdata->currentopstats[12]++;
+			}
+			break;
+		case CLTOMA_FUSE_READ_CHUNK:
+			if (rr->status==STATUS_OK) {
+				fs_readchunk_atime(rr->inode);
+				if (rr->chunkid>0) {
+					rr->status = chunk_getversionandlocations(rr->chunkid,eptr->peerip,&version,&count,loc);
+				} else {
+					version = 0;
+					count = 0;
+				}
+			}
+			if (rr->status!=STATUS_OK) {
+				ptr = matoclserv_createpacket(eptr,MATOCL_FUSE_READ_CHUNK,5);
+				put32bit(&ptr,rr->msgid);
+				put8bit(&ptr,rr->status);
+				break;
+			}
+			dcm_access(rr->inode,eptr->sesdata->sessionid);
+			ptr = matoclserv_createpacket(eptr,MATOCL_FUSE_READ_CHUNK,24+count*6);
+			put32bit(&ptr,rr->msgid);
+			put64bit(&ptr,rr->fleng);
+			put64bit(&ptr,rr->chunkid);
+			put32bit(&ptr,version);
+			memcpy(ptr,loc,count*6);
+			if (eptr->sesdata) {
+				eptr->sesdata->currentopstats[14]++;
+			}
+			break;
+	}
+	if (rr->answer) {
+		matoclserv_attachpacket(eptr,rr->answer);
+		rr->answer = NULL;
+	}
+}
+
+static inline void matoclserv_readreq_free(readreq *rr) {
+	if (rr->packet) {
+		free(rr->packet);
+	}
+	free(rr);
+}
+
+static inline void matoclserv_readreq_process(readreq *rr) {
+	if (rrworkers==0) {
+		matoclserv_readreq_execute(rr);
+		matoclserv_readreq_finish(rr);
+		matoclserv_readreq_free(rr);
+	} else {
+		*rrtail = rr;
+		rrtail = &(rr->next);
+		rrcount++;
+	}
+}
+
+void* matoclserv_readreq_worker(void *arg) {
+	uint8_t *data;
+	(void)arg;
+	for (;;) {
+		queue_get(rrjobqueue,NULL,NULL,&data,NULL);
+		if (data==NULL) {	// exit
+			return NULL;
+		}
+		matoclserv_readreq_execute((readreq*)data);
+		queue_put(rrdonequeue,0,0,NULL,0);
+	}
+}
+
+// executes all collected read-only requests and sends answers (in the order of arrival)
+void matoclserv_readreq_flush(void) {
+	readreq *rr,*rrn;
+	uint8_t *data;
+	uint32_t done;
+
+	if (rrhead==NULL) {
+		return;
+	}
+	if (rrcount==1) {
+		matoclserv_readreq_execute(rrhead);
+	} else {
+		for (rr=rrhead ; rr ; rr=rr->next) {
+			queue_put(rrjobqueue,0,0,(uint8_t*)rr,0);
+		}
+		done = 0;
+		// help workers instead of waiting idle
+		while (queue_tryget(rrjobqueue,NULL,NULL,&data,NULL)==0) {
+			matoclserv_readreq_execute((readreq*)data);
+			done++;
+		}
+		while (done<rrcount) {
+			queue_get(rrdonequeue,NULL,NULL,NULL,NULL);
+			done++;
+		}
+	}
+	for (rr=rrhead ; rr ; rr=rrn) {
+		rrn = rr->next;
+		matoclserv_readreq_finish(rr);
+		matoclserv_readreq_free(rr);
+	}
+	rrhead = NULL;
+	rrtail = &rrhead;
+	rrcount = 0;
+}
+
+static void matoclserv_readworkers_stop(void) {
+	uint32_t i;
+	matoclserv_readreq_flush();
+	for (i=0 ; i<rrworkers ; i++) {
+		queue_put(rrjobqueue,0,0,NULL,0);
+	}
+	for (i=0 ; i<rrworkers ; i++) {
+		zassert(pthread_join(rrworkerthreads[i],NULL));
+	}
+	if (rrworkers>0) {
+		queue_delete(rrjobqueue);
+		queue_delete(rrdonequeue);
+	}
+	rrworkers = 0;
+}
+
+static void matoclserv_readworkers_start(uint32_t workers) {
+	pthread_attr_t thattr;
+	uint32_t i;
+
+	rrhead = NULL;
+	rrtail = &rrhead;
+	rrcount = 0;
+	rrworkers = 0;
+	if (workers==0) {
+		return;
+	}
+	rrjobqueue = queue_new(0);
+	rrdonequeue = queue_new(0);
+	zassert(pthread_attr_init(&thattr));
+	zassert(pthread_attr_setstacksize(&thattr,0x100000));
+	zassert(pthread_attr_setdetachstate(&thattr,PTHREAD_CREATE_JOINABLE));
+	for (i=0 ; i<workers ; i++) {
+		zassert(pthread_create(rrworkerthreads+i,&thattr,matoclserv_readreq_worker,NULL));
+	}
+	zassert(pthread_attr_destroy(&thattr));
+	rrworkers = workers;
+}
+
+static inline int matoclserv_readreq_type(uint32_t type) {
+	switch (type) {
+		case CLTOMA_FUSE_ACCESS:
+		case CLTOMA_FUSE_LOOKUP:
+		case CLTOMA_FUSE_GETATTR:
+		case CLTOMA_FUSE_GETDIR:
+		case CLTOMA_FUSE_GETDIR_PAGE:
+		case CLTOMA_FUSE_LOOKUP_MULTI:
+		case CLTOMA_FUSE_GETATTR_MULTI:
+		case CLTOMA_FUSE_READ_CHUNK:
+			return 1;
+	}
+	return 0;
+}
+
+void matoclserv_fuse_access(matoclserventry *eptr,const uint8_t *data,uint32_t length) {
+	readreq *rr;
 	if (length!=17) {
 		syslog(LOG_NOTICE,"CLTOMA_FUSE_ACCESS - wrong size (%" PRIu32 "/17)",length);
 		eptr->mode = KILL;
 		return;
 	}
-	msgid = get32bit(&data);
-	inode = get32bit(&data);
-	uid = get32bit(&data);
-	gid = get32bit(&data);
-	matoclserv_ugid_remap(eptr,&uid,&gid);
-	modemask = get8bit(&data);
-	status = fs_access(eptr->sesdata->rootinode,eptr->sesdata->sesflags,inode,uid,gid,modemask);
-	ptr = matoclserv_createpacket(eptr,MATOCL_FUSE_ACCESS,5);
-	put32bit(&ptr,msgid);
-	put8bit(&ptr,status);
+	rr = matoclserv_readreq_new(eptr,CLTOMA_FUSE_ACCESS,data);
+	rr->msgid = get32bit(&data);
+	rr->inode = get32bit(&data);
+	rr->uid = get32bit(&data);
+	rr->gid = get32bit(&data);
+	matoclserv_ugid_remap(eptr,&(rr->uid),&(rr->gid));
+	rr->flags = get8bit(&data);
+	matoclserv_readreq_process(rr);
 }
 
 void matoclserv_fuse_lookup(matoclserventry *eptr,const uint8_t *data,uint32_t length) {
-	uint32_t inode,uid,gid,auid,agid;
+	readreq *rr;
+	uint32_t msgid,inode;
 	uint8_t nleng;
-	const uint8_t *name;
-	uint32_t newinode;
-	uint8_t attr[35];
-	uint32_t msgid;
-	uint8_t *ptr;
-	uint8_t status;
 	if (length<17) {
 		syslog(LOG_NOTICE,"CLTOMA_FUSE_LOOKUP - wrong size (%" PRIu32 ")",length);
 		eptr->mode = KILL;
 		return;
 	}
+	rr = matoclserv_readreq_new(eptr,CLTOMA_FUSE_LOOKUP,data);
 	msgid = get32bit(&data);
 	inode = get32bit(&data);
 	nleng = get8bit(&data);
 	if (length!=17U+nleng) {
 		syslog(LOG_NOTICE,"CLTOMA_FUSE_LOOKUP - wrong size (%" PRIu32 ":nleng=%" PRIu8 ")",length,nleng);
 		eptr->mode = KILL;
+		matoclserv_readreq_free(rr);
 		return;
 	}
-	name = data;
+	rr->msgid = msgid;
+	rr->inode = inode;
+	rr->nleng = nleng;
+	rr->name = data;
 	data += nleng;
-	auid = uid = get32bit(&data);
-	agid = gid = get32bit(&data);
-	matoclserv_ugid_remap(eptr,&uid,&gid);
-	status = fs_lookup(eptr->sesdata->rootinode,eptr->sesdata->sesflags,inode,nleng,name,uid,gid,auid,agid,&newinode,attr);
-	ptr = matoclserv_createpacket(eptr,MATOCL_FUSE_LOOKUP,(status!=STATUS_OK)?5:43);
-	put32bit(&ptr,msgid);
-	if (status!=STATUS_OK) {
-		put8bit(&ptr,status);
-	} else {
-		put32bit(&ptr,newinode);
-		memcpy(ptr,attr,35);
+	rr->auid = rr->uid = get32bit(&data);
+	rr->agid = rr->gid = get32bit(&data);
+	matoclserv_ugid_remap(eptr,&(rr->uid),&(rr->gid));
+	matoclserv_readreq_process(rr);
+}
+
+void matoclserv_fuse_lookup_multi(matoclserventry *eptr,const uint8_t *data,uint32_t length) {
+	readreq *rr;
+	const uint8_t *rptr;
+	uint32_t count;
+	if (length<4) {
+		syslog(LOG_NOTICE,"CLTOMA_FUSE_LOOKUP_MULTI - wrong size (%" PRIu32 ")",length);
+		eptr->mode = KILL;
+		return;
 	}
-	if (eptr->sesdata) {
-		eptr->sesdata->currentopstats[3]++;
+	// check item sizes here, so execution can't read past the packet
+	rptr = data+4;
+	count = 0;
+	while (rptr+13<=data+length) {
+		rptr += 13+rptr[4];
+		count++;
+	}
+	if (rptr!=data+length) {
+		syslog(LOG_NOTICE,"CLTOMA_FUSE_LOOKUP_MULTI - wrong size (%" PRIu32 ")",length);
+		eptr->mode = KILL;
+		return;
+	}
+	rr = matoclserv_readreq_new(eptr,CLTOMA_FUSE_LOOKUP_MULTI,data);
+	rr->msgid = get32bit(&data);
+	rr->count = count;
+	rr->items = data;
+	matoclserv_readreq_process(rr);
+}
+
+void matoclserv_fuse_getattr_multi(matoclserventry *eptr,const uint8_t *data,uint32_t length) {
+	readreq *rr;
+	if (length<4 || (length-4)%12!=0) {
+		syslog(LOG_NOTICE,"CLTOMA_FUSE_GETATTR_MULTI - wrong size (%" PRIu32 ")",length);
+		eptr->mode = KILL;
+		return;
 	}
+	rr = matoclserv_readreq_new(eptr,CLTOMA_FUSE_GETATTR_MULTI,data);
+	rr->msgid = get32bit(&data);
+	rr->count = (length-4)/12;
+	rr->items = data;
+	matoclserv_readreq_process(rr);
 }
 
 void matoclserv_fuse_getattr(matoclserventry *eptr,const uint8_t *data,uint32_t length) {
-	uint32_t inode,uid,gid,auid,agid;
-	uint8_t attr[35];
-	uint32_t msgid;
-	uint8_t *ptr;
-	uint8_t status;
+	readreq *rr;
 	if (length!=8 && length!=16) {
 		syslog(LOG_NOTICE,"CLTOMA_FUSE_GETATTR - wrong size (%" PRIu32 "/8,16)",length);
 		eptr->mode = KILL;
 		return;
 	}
-	msgid = get32bit(&data);
-	inode = get32bit(&data);
+	rr = matoclserv_readreq_new(eptr,CLTOMA_FUSE_GETATTR,data);
+	rr->msgid = get32bit(&data);
+	rr->inode = get32bit(&data);
 	if (length==16) {
-		auid = uid = get32bit(&data);
-		agid = gid = get32bit(&data);
-		matoclserv_ugid_remap(eptr,&uid,&gid);
+		rr->auid = rr->uid = get32bit(&data);
+		rr->agid = rr->gid = get32bit(&data);
+		matoclserv_ugid_remap(eptr,&(rr->uid),&(rr->gid));
 	} else {
-		auid = uid = 12345;
-		agid = gid = 12345;
-	}
-	status = fs_getattr(eptr->sesdata->rootinode,eptr->sesdata->sesflags,inode,uid,gid,auid,agid,attr);
-	ptr = matoclserv_createpacket(eptr,MATOCL_FUSE_GETATTR,(status!=STATUS_OK)?5:39);
-	put32bit(&ptr,msgid);
-	if (status!=STATUS_OK) {
-		put8bit(&ptr,status);
-	} else {
-		memcpy(ptr,attr,35);
-	}
-	if (eptr->sesdata) {
-		eptr->sesdata->currentopstats[1]++;
+		rr->auid = rr->uid = 12345;
+		rr->agid = rr->gid = 12345;
 	}
+	matoclserv_readreq_process(rr);
 }
 
 void matoclserv_fuse_setattr(matoclserventry *eptr,const uint8_t *data,uint32_t length) {
@@ -2213,48 +2613,43 @@ void matoclserv_fuse_link(matoclserventry *eptr,const uint8_t *data,uint32_t len
 }
 
 void matoclserv_fuse_getdir(matoclserventry *eptr,const uint8_t *data,uint32_t length) {
-	uint32_t inode,uid,gid,auid,agid;
-	uint8_t flags;
-	uint32_t msgid;
-	uint8_t *ptr;
-	uint8_t status;
-	uint32_t dleng;
-	void *custom;
+	readreq *rr;
 	if (length!=16 && length!=17) {
 		syslog(LOG_NOTICE,"CLTOMA_FUSE_GETDIR - wrong size (%" PRIu32 "/16|17)",length);
 		eptr->mode = KILL;
 		return;
 	}
-	msgid = get32bit(&data);
-	inode = get32bit(&data);
-	auid = uid = get32bit(&data);
-	agid = gid = get32bit(&data);
-	matoclserv_ugid_remap(eptr,&uid,&gid);
+	rr = matoclserv_readreq_new(eptr,CLTOMA_FUSE_GETDIR,data);
+	rr->msgid = get32bit(&data);
+	rr->inode = get32bit(&data);
+	rr->auid = rr->uid = get32bit(&data);
+	rr->agid = rr->gid = get32bit(&data);
+	matoclserv_ugid_remap(eptr,&(rr->uid),&(rr->gid));
 	if (length==17) {
-		flags = get8bit(&data);
-	} else {
-		flags = 0;
-	}
-	status = fs_readdir_size(eptr->sesdata->rootinode,eptr->sesdata->sesflags,inode,uid,gid,flags,&custom,&dleng);
-	ptr = matoclserv_createpacket(eptr,MATOCL_FUSE_GETDIR,(status!=STATUS_OK)?5:4+dleng);
-	put32bit(&ptr,msgid);
-	if (status!=STATUS_OK) {
-		put8bit(&ptr,status);
+		rr->flags = get8bit(&data);
 	} else {
-		fs_readdir_data(eptr->sesdata->rootinode,eptr->sesdata->sesflags,uid,gid,auid,agid,flags,custom,ptr);
-/* CACHENOTIFY
-		if (flags&GETDIR_FLAG_ADDTOCACHE) {
-			if (inode==MFS_ROOT_ID) {
-				matoclserv_notify_add_dir(eptr,eptr->sesdata->rootinode);
-			} else {
-				matoclserv_notify_add_dir(eptr,inode);
-			}
-		}
-*/
+		rr->flags = 0;
 	}
-	if (eptr->sesdata) {
-		eptr->sesdata->currentopstats[12]++;
+	matoclserv_readreq_process(rr);
+}
+
+void matoclserv_fuse_getdir_page(matoclserventry *eptr,const uint8_t *data,uint32_t length) {
+	readreq *rr;
+	if (length!=29) {
+		syslog(LOG_NOTICE,"CLTOMA_FUSE_GETDIR_PAGE - wrong size (%" PRIu32 "/29)",length);
+		eptr->mode = KILL;
+		return;
 	}
+	rr = matoclserv_readreq_new(eptr,CLTOMA_FUSE_GETDIR_PAGE,data);
+	rr->msgid = get32bit(&data);
+	rr->inode = get32bit(&data);
+	rr->auid = rr->uid = get32bit(&data);
+	rr->agid = rr->gid = get32bit(&data);
+	matoclserv_ugid_remap(eptr,&(rr->uid),&(rr->gid));
+	rr->flags = get8bit(&data);
+	rr->cursor = get64bit(&data);
+	rr->maxsize = get32bit(&data);
+	matoclserv_readreq_process(rr);
 }
 
 /* CACHENOTIFY
@@ -2327,49 +2722,17 @@ void matoclserv_fuse_open(matoclserventry *eptr,const uint8_t *data,uint32_t len
 }
 
 void matoclserv_fuse_read_chunk(matoclserventry *eptr,const uint8_t *data,uint32_t length) {
-	uint8_t *ptr;
-	uint8_t status;
-	uint32_t inode;
-	uint32_t indx;
-	uint64_t chunkid;
-	uint64_t fleng;
-	uint32_t version;
-	uint8_t count;
-	uint8_t loc[100*6];
-	uint32_t msgid;
+	readreq *rr;
 	if (length!=12) {
 		syslog(LOG_NOTICE,"CLTOMA_FUSE_READ_CHUNK - wrong size (%" PRIu32 "/12)",length);
 		eptr->mode = KILL;
 		return;
 	}
-	msgid = get32bit(&data);
-	inode = get32bit(&data);
-	indx = get32bit(&data);
-	status = fs_readchunk(inode,indx,&chunkid,&fleng);
-	if (status==STATUS_OK) {
-		if (chunkid>0) {
-			status = chunk_getversionandlocations(chunkid,eptr->peerip,&version,&count,loc);
-		} else {
-			version = 0;
-			count = 0;
-		}
-	}
-	if (status!=STATUS_OK) {
-		ptr = matoclserv_createpacket(eptr,MATOCL_FUSE_READ_CHUNK,5);
-		put32bit(&ptr,msgid);
-		put8bit(&ptr,status);
-		return;
-	}
-	dcm_access(inode,eptr->sesdata->sessionid);
-	ptr = matoclserv_createpacket(eptr,MATOCL_FUSE_READ_CHUNK,24+count*6);
-	put32bit(&ptr,msgid);
-	put64bit(&ptr,fleng);
-	put64bit(&ptr,chunkid);
-	put32bit(&ptr,version);
-	memcpy(ptr,loc,count*6);
-	if (eptr->sesdata) {
-		eptr->sesdata->currentopstats[14]++;
-	}
+	rr = matoclserv_readreq_new(eptr,CLTOMA_FUSE_READ_CHUNK,data);
+	rr->msgid = get32bit(&data);
+	rr->inode = get32bit(&data);
+	rr->indx = get32bit(&data);
+	matoclserv_readreq_process(rr);
 }
 
 void matoclserv_fuse_write_chunk(matoclserventry *eptr,const uint8_t *data,uint32_t length) {
@@ -3354,6 +3717,10 @@ void matoclserv_gotpacket(matoclserventry *eptr,uint32_t type,const uint8_t *dat
 	if (type==ANTOAN_BAD_COMMAND_SIZE) { // for future use
 		return;
 	}
+	if (rrhead && (eptr->registered==0 || eptr->registered>=100 || matoclserv_readreq_type(type)==0)) {
+		// this packet may modify metadata - finish all pending read-only requests first
+		matoclserv_readreq_flush();
+	}
 	if (eptr->registered==0) {	// unregistered clients - beware that in this context sesdata is NULL
 		switch (type) {
 			case CLTOMA_FUSE_REGISTER:
@@ -3454,6 +3821,15 @@ void matoclserv_gotpacket(matoclserventry *eptr,uint32_t type,const uint8_t *dat
 			case CLTOMA_FUSE_GETDIR:
 				matoclserv_fuse_getdir(eptr,data,length);
 				break;
+			case CLTOMA_FUSE_GETDIR_PAGE:
+				matoclserv_fuse_getdir_page(eptr,data,length);
+				break;
+			case CLTOMA_FUSE_LOOKUP_MULTI:
+				matoclserv_fuse_lookup_multi(eptr,data,length);
+				break;
+			case CLTOMA_FUSE_GETATTR_MULTI:
+				matoclserv_fuse_getattr_multi(eptr,data,length);
+				break;
 /* CACHENOTIFY
 			case CLTOMA_FUSE_DIR_REMOVED:
 				matoclserv_fuse_dir_removed(eptr,data,length);
@@ -3650,6 +4026,7 @@ void matoclserv_term(void) {
 
 	syslog(LOG_NOTICE,"main master server module: closing %s:%s",ListenHost,ListenPort);
 	tcpclose(lsock);
+	matoclserv_readworkers_stop();
 
 	for (eptr = matoclservhead ; eptr ; eptr = eptrn) {
 		eptrn = eptr->next;
@@ -3892,6 +4269,7 @@ void matoclserv_serve(struct pollfd *pdesc) {
 			}
 		}
 	}
+	matoclserv_readreq_flush();
 
 // write
 	for (eptr=matoclservhead ; eptr ; eptr=eptr->next) {
@@ -3993,6 +4371,15 @@ void matoclserv_reload(void) {
 	int newlsock;
 
 	RejectOld = cfg_getuint32("REJECT_OLD_CLIENTS",0);
+	ReadWorkers = cfg_getuint32("MATOCL_READ_WORKERS",0);
+	if (ReadWorkers>MAXREADWORKERS) {
+		ReadWorkers = MAXREADWORKERS;
+		mfs_arg_syslog(LOG_WARNING,"MATOCL_READ_WORKERS too big - setting this value to %u",MAXREADWORKERS);
+	}
+	if (ReadWorkers!=rrworkers) {
+		matoclserv_readworkers_stop();
+		matoclserv_readworkers_start(ReadWorkers);
+	}
 	SessionSustainTime = cfg_getuint32("SESSION_SUSTAIN_TIME",86400);
 	if (SessionSustainTime>7*86400) {
 		SessionSustainTime=7*86400;
@@ -4060,6 +4447,12 @@ int matoclserv_networkinit(void) {
 		ListenPort = cfg_getstr("MATOCU_LISTEN_PORT","9421");
 	}
 	RejectOld = cfg_getuint32("REJECT_OLD_CLIENTS",0);
+	ReadWorkers = cfg_getuint32("MATOCL_READ_WORKERS",0);
+	if (ReadWorkers>MAXREADWORKERS) {
+		ReadWorkers = MAXREADWORKERS;
+		mfs_arg_syslog(LOG_WARNING,"MATOCL_READ_WORKERS too big - setting this value to %u",MAXREADWORKERS);
+	}
+	matoclserv_readworkers_start(ReadWorkers);
 
 	exiting = 0;
 	starting = 12;
@@ -0,0 +1,121 @@
+// Compares id->node lookup throughput of the old chained nodehash (2^22 buckets)
+// with the directly indexed node table used by filesystem.cc.
+// Usage: nodetable_benchmark [maxinodes [lookups]]
+// Inode counts are doubled from 1M up to maxinodes (default 64M).
+
+#include "config.h"
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+
+#define NODEHASHBITS (22)
+#define NODEHASHSIZE (1<<NODEHASHBITS)
+#define NODEHASHPOS(nodeid) ((nodeid)&(NODEHASHSIZE-1))
+
+// roughly the size of fsnode
+typedef struct _node {
+	uint32_t id;
+	uint8_t data[76];
+	struct _node *next;
+} node;
+
+static uint64_t now_usec(void) {
+	struct timeval tv;
+	gettimeofday(&tv,NULL);
+	return tv.tv_sec*UINT64_C(1000000)+tv.tv_usec;
+}
+
+static inline uint32_t next_random(uint64_t *state) {
+	*state = *state * UINT64_C(6364136223846793005) + UINT64_C(1442695040888963407);
+	return *state >> 32;
+}
+
+static inline node* hash_find(node **hash,uint32_t id) {
+	node *p;
+	for (p=hash[NODEHASHPOS(id)] ; p ; p=p->next) {
+		if (p->id==id) {
+			return p;
+		}
+	}
+	return NULL;
+}
+
+static inline node* table_find(node **table,uint32_t size,uint32_t id) {
+	return (id<size)?table[id]:NULL;
+}
+
+int main(int argc,char **argv) {
+	uint32_t maxinodes,inodes,lookups,i,id,pos;
+	uint64_t rnd,start,found,hashusec,tableusec;
+	node *nodes,**hash,**table;
+
+	maxinodes = (argc>1)?strtoul(argv[1],NULL,10):64*1024*1024;
+	lookups = (argc>2)?strtoul(argv[2],NULL,10):10000000;
+	if (lookups==0) {
+		fprintf(stderr,"lookups has to be positive\n");
+		return 1;
+	}
+	hash = (node**)malloc(sizeof(node*)*NODEHASHSIZE);
+	if (hash==NULL) {
+		fprintf(stderr,"out of memory\n");
+		return 1;
+	}
+	for (inodes=1024*1024 ; inodes<=maxinodes ; inodes*=2) {
+		nodes = (node*)malloc(sizeof(node)*inodes);
+		table = (node**)malloc(sizeof(node*)*(inodes+1));
+		if (nodes==NULL || table==NULL) {
+			fprintf(stderr,"out of memory\n");
+			return 1;
+		}
+		memset(hash,0,sizeof(node*)*NODEHASHSIZE);
+		table[0] = NULL;
+		// insert nodes in random order, like long living file systems have them in memory
+		rnd = 1;
+		for (i=0 ; i<inodes ; i++) {
+			nodes[i].id = i+1;
+		}
+		for (i=inodes-1 ; i>0 ; i--) {
+			pos = next_random(&rnd)%(i+1);
+			id = nodes[i].id;
+			nodes[i].id = nodes[pos].id;
+			nodes[pos].id = id;
+		}
+		for (i=0 ; i<inodes ; i++) {
+			pos = NODEHASHPOS(nodes[i].id);
+			nodes[i].next = hash[pos];
+			hash[pos] = nodes+i;
+			table[nodes[i].id] = nodes+i;
+		}
+
+		found = 0;
+		rnd = 2;
+		start = now_usec();
+		for (i=0 ; i<lookups ; i++) {
+			found += (hash_find(hash,next_random(&rnd)%inodes+1)!=NULL);
+		}
+		hashusec = now_usec()-start;
+
+		rnd = 2;
+		start = now_usec();
+		for (i=0 ; i<lookups ; i++) {
+			found += (table_find(table,inodes+1,next_random(&rnd)%inodes+1)!=NULL);
+		}
+		tableusec = now_usec()-start;
+
+		if (found!=2*(uint64_t)lookups) {
+			fprintf(stderr,"lookup error\n");
+			return 1;
+		}
+		printf("inodes: %10" PRIu32 " ; hash: %12.0f lookups/s ; table: %12.0f lookups/s\n",inodes,lookups*1000000.0/(hashusec?hashusec:1),lookups*1000000.0/(tableusec?tableusec:1));
+		free(table);
+		free(nodes);
+		if (inodes>UINT32_MAX/2) {
+			break;
+		}
+	}
+	free(hash);
+	return 0;
+}
@@ -0,0 +1,98 @@
+// Measures how long it takes to load a metadata file.
+// Usage: metaload_benchmark metadata.mfs [repeat]
+// The file is loaded in separate processes, sequentially and in parallel (independent sections -
+// chunks, xattrs - in their own threads and nodes split between one thread per CPU), so both
+// times can be compared.
+
+#include "config.h"
+
+#include <fcntl.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "filesystem.h"
+
+static uint64_t now_usec(void) {
+	struct timeval tv;
+	gettimeofday(&tv,NULL);
+	return tv.tv_sec*UINT64_C(1000000)+tv.tv_usec;
+}
+
+// loads metadata in a child process (loaded structures can't be freed) and returns load time
+static int64_t load_time(const char *fname,uint8_t parallel) {
+	int pipefd[2];
+	int64_t usec;
+	pid_t pid;
+	int status;
+
+	if (pipe(pipefd)<0) {
+		return -1;
+	}
+	pid = fork();
+	if (pid<0) {
+		return -1;
+	}
+	if (pid==0) {
+		uint64_t start;
+		int nullfd;
+		close(pipefd[0]);
+		// metarestore structures print every chunk on stdout
+		nullfd = open("/dev/null",O_WRONLY);
+		if (nullfd>=0) {
+			dup2(nullfd,1);
+			dup2(nullfd,2);
+			close(nullfd);
+		}
+		fs_setparallelload(parallel);
+		start = now_usec();
+		if (fs_init(fname,0)<0) {
+			usec = -1;
+		} else {
+			usec = now_usec()-start;
+		}
+		if (write(pipefd[1],&usec,sizeof(usec))!=(ssize_t)sizeof(usec)) {
+			_exit(1);
+		}
+		_exit(0);
+	}
+	close(pipefd[1]);
+	if (read(pipefd[0],&usec,sizeof(usec))!=(ssize_t)sizeof(usec)) {
+		usec = -1;
+	}
+	close(pipefd[0]);
+	waitpid(pid,&status,0);
+	return usec;
+}
+
+int main(int argc,char **argv) {
+	struct stat st;
+	uint32_t repeat,i;
+	uint8_t parallel;
+	int64_t usec;
+
+	if (argc<2) {
+		fprintf(stderr,"usage: %s metadata.mfs [repeat]\n",argv[0]);
+		return 1;
+	}
+	if (stat(argv[1],&st)<0) {
+		fprintf(stderr,"can't stat %s\n",argv[1]);
+		return 1;
+	}
+	repeat = (argc>2)?strtoul(argv[2],NULL,10):1;
+	for (i=0 ; i<repeat ; i++) {
+		for (parallel=0 ; parallel<2 ; parallel++) {
+			usec = load_time(argv[1],parallel);
+			if (usec<0) {
+				fprintf(stderr,"can't load %s\n",argv[1]);
+				return 1;
+			}
+			printf("%s load: %.3f s ; %.2f MB/s\n",parallel?"parallel":"sequential",usec/1000000.0,(double)st.st_size/usec);
+		}
+	}
+	return 0;
+}
@@ -25,6 +25,8 @@
 #include <time.h>
 #include <errno.h>
 #include <syslog.h>
+#include <poll.h>
+#include <sys/time.h>
 
 #include "MFSCommunication.h"
 #include "sockets.h"
@@ -32,12 +34,16 @@
 #include "strerr.h"
 #include "mfsstrerr.h"
 #include "crc.h"
+#include "cscomm.h"
 
 #define CSMSECTIMEOUT 5000
+// how often (in ms) striped read checks whether some part should be hedged
+#define CSHEDGECHECKMSEC 10
+// part is hedged when it takes more than CSHEDGEFACTOR times longer than the idle replica would need for it
+#define CSHEDGEFACTOR 2
 
-int cs_readblock(int fd,uint64_t chunkid,uint32_t version,uint32_t offset,uint32_t size,uint8_t *buff) {
+int cs_readsend(int fd,uint64_t chunkid,uint32_t version,uint32_t offset,uint32_t size) {
 	uint8_t *wptr,ibuff[28];
-	const uint8_t *rptr;
 
 	wptr = ibuff;
 	put32bit(&wptr,CLTOCS_READ);
@@ -50,6 +56,16 @@ int cs_readblock(int fd,uint64_t chunkid,uint32_t version,uint32_t offset,uint32
 		syslog(LOG_NOTICE,"readblock; tcpwrite error: %s",strerr(errno));
 		return -1;
 	}
+	return 0;
+}
+
+int cs_readrecv(int fd,uint64_t chunkid,uint32_t *offsetp,uint32_t *sizep,uint8_t **buffp) {
+	uint8_t ibuff[28];
+	const uint8_t *rptr;
+	uint32_t offset = *offsetp;
+	uint32_t size = *sizep;
+	uint8_t *buff = *buffp;
+
 	for (;;) {
 		uint32_t cmd,l;
 		uint64_t t64;
@@ -85,7 +101,7 @@ int cs_readblock(int fd,uint64_t chunkid,uint32_t version,uint32_t offset,uint32
 				syslog(LOG_NOTICE,"readblock; READ_STATUS incorrect data size (left: %" PRIu32 ")",size);
 				return -1;
 			}
-			return 0;
+			return 1;
 		} else if (cmd==CSTOCL_READ_DATA) {
 			if (l<20) {
 				syslog(LOG_NOTICE,"readblock; READ_DATA incorrect message size (%" PRIu32 "/>=20)",l);
@@ -137,9 +153,10 @@ int cs_readblock(int fd,uint64_t chunkid,uint32_t version,uint32_t offset,uint32
 				syslog(LOG_NOTICE,"readblock; READ_DATA crc checksum error");
 				return -1;
 			}
-			offset+=blocksize;
-			size-=blocksize;
-			buff+=blocksize;
+			*offsetp = offset+blocksize;
+			*sizep = size-blocksize;
+			*buffp = buff+blocksize;
+			return 0;
 		} else if (cmd==ANTOAN_NOP) {
 			if (l!=0) {
 				syslog(LOG_NOTICE,"readblock; NOP incorrect message size (%" PRIu32 "/0)",l);
@@ -153,5 +170,363 @@ int cs_readblock(int fd,uint64_t chunkid,uint32_t version,uint32_t offset,uint32
 			return -1;
 		}
 	}
+	return -1;
+}
+
+int cs_readblock(int fd,uint64_t chunkid,uint32_t version,uint32_t offset,uint32_t size,uint8_t *buff) {
+	int r;
+	if (cs_readsend(fd,chunkid,version,offset,size)<0) {
+		return -1;
+	}
+	while ((r=cs_readrecv(fd,chunkid,&offset,&size,&buff))==0) {}
+	return (r>0)?0:-1;
+}
+
+typedef struct _cspart {
+	uint32_t offset,size;
+	uint8_t *buff;
+	uint64_t start;
+	uint8_t done;
+	uint8_t hedged;
+} cspart;
+
+typedef struct _csreq {
+	int32_t part;		// -1 - replica is idle
+	uint32_t offset,size;	// left to receive
+	uint8_t *buff;
+	uint8_t *tmp;		// hedge gets its own buffer - copied to part when hedge finishes first
+	uint32_t dstoffset;	// where tmp starts in part
+	uint32_t reqsize;
+	uint64_t start;
+} csreq;
+
+static uint64_t cs_usec(void) {
+	struct timeval tv;
+	gettimeofday(&tv,NULL);
+	return tv.tv_sec*UINT64_C(1000000)+tv.tv_usec;
+}
+
+static int cs_stripe_send(csreplica *rep,csreq *rq,cspart *pt,int32_t p,uint64_t chunkid,uint32_t version,uint32_t offset,uint32_t size,uint8_t hedge,uint64_t now) {
+	if (hedge) {
+		rq->tmp = (uint8_t*) malloc(size);
+		if (rq->tmp==NULL) {
+			return -1;
+		}
+		rq->buff = rq->tmp;
+		rq->dstoffset = offset-pt->offset;
+	} else {
+		rq->tmp = NULL;
+		rq->buff = pt->buff+(offset-pt->offset);
+	}
+	if (cs_readsend(rep->fd,chunkid,version,offset,size)<0) {
+		if (rq->tmp) {
+			free(rq->tmp);
+			rq->tmp = NULL;
+		}
+		rep->broken = CS_BROKEN_ERROR;
+		return -1;
+	}
+	rq->part = p;
+	rq->offset = offset;
+	rq->size = size;
+	rq->reqsize = size;
+	rq->start = now;
 	return 0;
 }
+
+// connection of replica with unfinished request can't be used for anything else
+static void cs_stripe_drop(csreplica *rep,csreq *rq,uint8_t reason) {
+	if (rq->tmp) {
+		free(rq->tmp);
+		rq->tmp = NULL;
+	}
+	rq->part = -1;
+	rep->broken = reason;
+}
+
+int cs_readstriped(csreplica *rep,uint32_t cnt,uint64_t chunkid,uint32_t version,uint32_t offset,uint32_t size,uint8_t *buff) {
+	cspart pt[CS_MAXSTRIPES];
+	csreq rq[CS_MAXSTRIPES];
+	struct pollfd pfd[CS_MAXSTRIPES];
+	uint32_t pidx[CS_MAXSTRIPES];
+	uint64_t wsum,now,lastprogress,expected;
+	uint32_t i,j,k,n,pos,pend,w,active,best;
+	int32_t p;
+	int status;
+
+	if (cnt==0 || cnt>CS_MAXSTRIPES || size==0) {
+		return -1;
+	}
+	wsum = 0;
+	for (i=0 ; i<cnt ; i++) {
+		rep[i].bytes = 0;
+		rep[i].usec = 0;
+		rep[i].latency = 0;
+		rep[i].broken = 0;
+		rq[i].part = -1;
+		rq[i].tmp = NULL;
+		wsum += (rep[i].weight>0)?rep[i].weight:1;
+	}
+	// part boundaries are block aligned, so every chunkserver reads (and checks crc of) whole blocks
+	now = cs_usec();
+	pos = offset;
+	for (i=0 ; i<cnt ; i++) {
+		if (i==cnt-1) {
+			pend = offset+size;
+		} else {
+			w = (rep[i].weight>0)?rep[i].weight:1;
+			pend = (pos+(uint32_t)(((uint64_t)size*w)/wsum)+MFSBLOCKSIZE/2)&MFSBLOCKNEGMASK;
+			if (pend<pos) {
+				pend = pos;
+			}
+			if (pend>offset+size) {
+				pend = offset+size;
+			}
+		}
+		pt[i].offset = pos;
+		pt[i].size = pend-pos;
+		pt[i].buff = buff+(pos-offset);
+		pt[i].start = now;
+		pt[i].done = (pend==pos)?1:0;
+		pt[i].hedged = 0;
+		pos = pend;
+	}
+	for (i=0 ; i<cnt ; i++) {
+		if (pt[i].done==0) {
+			if (cs_stripe_send(rep+i,rq+i,pt+i,i,chunkid,version,pt[i].offset,pt[i].size,0,now)<0) {
+				syslog(LOG_NOTICE,"readstriped; can't send request to replica %" PRIu32,i);
+				// its part will be taken over by the first replica which finishes
+			}
+		}
+	}
+	lastprogress = now;
+	for (;;) {
+		n = 0;
+		active = 0;
+		for (i=0 ; i<cnt ; i++) {
+			if (rq[i].part>=0) {
+				pfd[n].fd = rep[i].fd;
+				pfd[n].events = POLLIN;
+				pfd[n].revents = 0;
+				pidx[n] = i;
+				n++;
+			}
+			if (pt[i].done==0) {
+				active++;
+			}
+		}
+		if (active==0) {
+			return 0;
+		}
+		if (n==0) {	// parts left, but all replicas are broken
+			return -1;
+		}
+		if (poll(pfd,n,CSHEDGECHECKMSEC)<0) {
+			if (errno==EINTR) {
+				continue;
+			}
+			syslog(LOG_NOTICE,"readstriped; poll error: %s",strerr(errno));
+			break;
+		}
+		now = cs_usec();
+		for (k=0 ; k<n ; k++) {
+			if (pfd[k].revents==0) {
+				continue;
+			}
+			i = pidx[k];
+			p = rq[i].part;
+			lastprogress = now;
+			status = cs_readrecv(rep[i].fd,chunkid,&(rq[i].offset),&(rq[i].size),&(rq[i].buff));
+			if (status>=0 && rep[i].latency==0) {
+				rep[i].latency = (now>rq[i].start)?now-rq[i].start:1;
+			}
+			if (status<0) {
+				cs_stripe_drop(rep+i,rq+i,CS_BROKEN_ERROR);
+			} else if (status>0) {
+				if (rq[i].tmp) {
+					memcpy(pt[p].buff+rq[i].dstoffset,rq[i].tmp,rq[i].reqsize);
+					free(rq[i].tmp);
+					rq[i].tmp = NULL;
+				}
+				rep[i].bytes += rq[i].reqsize;
+				rep[i].usec += now-rq[i].start;
+				rq[i].part = -1;
+				pt[p].done = 1;
+				for (j=0 ; j<cnt ; j++) {
+					if (rq[j].part==p) {	// the other copy of this part lost
+						cs_stripe_drop(rep+j,rq+j,CS_BROKEN_LOST);
+					}
+				}
+			}
+		}
+		if (now-lastprogress>CSMSECTIMEOUT*UINT64_C(1000)) {
+			syslog(LOG_NOTICE,"readstriped; timeout");
+			break;
+		}
+		// hedging - unfinished part is requested again from the fastest idle replica
+		for (p=0 ; p<(int32_t)cnt ; p++) {
+			if (pt[p].done) {
+				continue;
+			}
+			j = cnt;
+			for (i=0 ; i<cnt ; i++) {
+				if (rq[i].part==p) {
+					j = (j==cnt)?i:cnt+1;
+				}
+			}
+			if (j==cnt+1 || (j<cnt && pt[p].hedged)) {	// already has two requests or was hedged once
+				continue;
+			}
+			best = cnt;
+			for (i=0 ; i<cnt ; i++) {
+				if (rq[i].part<0 && rep[i].broken==0 && (best==cnt || (uint64_t)rep[i].usec*rep[best].bytes<(uint64_t)rep[best].usec*rep[i].bytes)) {
+					best = i;
+				}
+			}
+			if (best==cnt) {
+				continue;
+			}
+			if (j==cnt) {	// nobody reads this part (its replica has failed) - whole part again
+				if (cs_stripe_send(rep+best,rq+best,pt+p,p,chunkid,version,pt[p].offset,pt[p].size,0,now)<0) {
+					syslog(LOG_NOTICE,"readstriped; can't send request to replica %" PRIu32,best);
+				}
+				continue;
+			}
+			if (rep[best].bytes==0 || rq[j].size==0) {
+				continue;
+			}
+			expected = (uint64_t)pt[p].size*rep[best].usec/rep[best].bytes;
+			if (now-pt[p].start > CSHEDGEFACTOR*expected + CSHEDGECHECKMSEC*1000) {
+				pt[p].hedged = 1;
+				if (cs_stripe_send(rep+best,rq+best,pt+p,p,chunkid,version,rq[j].offset,rq[j].size,1,now)<0) {
+					syslog(LOG_NOTICE,"readstriped; can't send hedged request to replica %" PRIu32,best);
+				}
+			}
+		}
+	}
+	for (i=0 ; i<cnt ; i++) {
+		if (rq[i].part>=0) {
+			cs_stripe_drop(rep+i,rq+i,CS_BROKEN_ERROR);
+		}
+	}
+	return -1;
+}
+
+int cs_readhedged(csreplica *rep,uint32_t hedgeusec,int (*hedgeconnect)(void *arg),void *arg,uint64_t chunkid,uint32_t version,uint32_t offset,uint32_t size,uint8_t *buff) {
+	struct pollfd pfd[2];
+	uint32_t roffset[2],rsize[2],idx[2];
+	uint8_t *rbuff[2],*tmp;
+	uint8_t active[2],hedged;
+	uint64_t start[2],now,lastprogress;
+	uint32_t i,k,n;
+	int status,ret,msec;
+
+	for (i=0 ; i<2 ; i++) {
+		rep[i].bytes = 0;
+		rep[i].usec = 0;
+		rep[i].latency = 0;
+		rep[i].broken = 0;
+		roffset[i] = offset;
+		rsize[i] = size;
+		active[i] = 0;
+	}
+	rep[1].fd = -1;
+	tmp = NULL;
+	rbuff[0] = buff;
+	rbuff[1] = NULL;
+	ret = -1;
+	hedged = (hedgeusec==0 || hedgeconnect==NULL)?1:0;
+	start[0] = cs_usec();
+	if (cs_readsend(rep[0].fd,chunkid,version,offset,size)<0) {
+		rep[0].broken = CS_BROKEN_ERROR;
+	} else {
+		active[0] = 1;
+	}
+	lastprogress = start[0];
+	now = start[0];
+	for (;;) {
+		// no data from the first replica in time (or it has failed) - the same request goes to the second one
+		if (hedged==0 && (active[0]==0 || now-start[0]>=hedgeusec)) {
+			hedged = 1;
+			rep[1].fd = hedgeconnect(arg);
+			if (rep[1].fd>=0) {
+				tmp = (uint8_t*) malloc(size);
+				rbuff[1] = tmp;
+				start[1] = cs_usec();
+				if (tmp==NULL || cs_readsend(rep[1].fd,chunkid,version,offset,size)<0) {
+					rep[1].broken = CS_BROKEN_ERROR;
+				} else {
+					active[1] = 1;
+				}
+			}
+		}
+		n = 0;
+		for (i=0 ; i<2 ; i++) {
+			if (active[i]) {
+				pfd[n].fd = rep[i].fd;
+				pfd[n].events = POLLIN;
+				pfd[n].revents = 0;
+				idx[n] = i;
+				n++;
+			}
+		}
+		if (n==0) {
+			break;
+		}
+		if (hedged==0) {
+			msec = (start[0]+hedgeusec>now)?(start[0]+hedgeusec-now+999)/1000:0;
+		} else {
+			msec = CSMSECTIMEOUT;
+		}
+		if (poll(pfd,n,msec)<0) {
+			if (errno==EINTR) {
+				continue;
+			}
+			syslog(LOG_NOTICE,"readhedged; poll error: %s",strerr(errno));
+			break;
+		}
+		now = cs_usec();
+		for (k=0 ; k<n && ret<0 ; k++) {
+			if (pfd[k].revents==0) {
+				continue;
+			}
+			i = idx[k];
+			lastprogress = now;
+			status = cs_readrecv(rep[i].fd,chunkid,roffset+i,rsize+i,rbuff+i);
+			if (status>=0 && rep[i].latency==0) {
+				rep[i].latency = (now>start[i])?now-start[i]:1;
+				if (i==0) {	// data is coming - no need to hedge
+					hedged = 1;
+				}
+			}
+			if (status<0) {
+				active[i] = 0;
+				rep[i].broken = CS_BROKEN_ERROR;
+			} else if (status>0) {
+				active[i] = 0;
+				rep[i].bytes = size;
+				rep[i].usec = now-start[i];
+				if (i==1) {
+					memcpy(buff,tmp,size);
+				}
+				ret = i;
+			}
+		}
+		if (ret>=0) {
+			break;
+		}
+		if (now-lastprogress>CSMSECTIMEOUT*UINT64_C(1000)) {
+			syslog(LOG_NOTICE,"readhedged; timeout");
+			break;
+		}
+	}
+	for (i=0 ; i<2 ; i++) {
+		if (active[i]) {
+			rep[i].broken = (ret>=0)?CS_BROKEN_LOST:CS_BROKEN_ERROR;
+		}
+	}
+	if (tmp) {
+		free(tmp);
+	}
+	return ret;
+}
@@ -19,6 +19,32 @@
 #ifndef _CSCOMM_H_
 #define _CSCOMM_H_
 
+#define CS_MAXSTRIPES 8
+
+#define CS_BROKEN_ERROR 1
+#define CS_BROKEN_LOST 2
+
+typedef struct _csreplica {
+	int fd;			// connected socket
+	uint32_t weight;	// relative speed of chunkserver - part of data is proportional to it
+	uint32_t bytes;		// out: data received from this replica
+	uint32_t usec;		// out: time spent receiving it
+	uint32_t latency;	// out: time to the first data packet (0 - nothing received)
+	uint8_t broken;		// out: connection can't be used any more - CS_BROKEN_ERROR or CS_BROKEN_LOST (request was left unfinished, because the other replica was faster)
+} csreplica;
+
+int cs_readsend(int fd,uint64_t chunkid,uint32_t version,uint32_t offset,uint32_t size);
+/* receives one packet of answer ; returns 1 when read is finished, 0 when block was received (offset, size and buff are moved) and -1 on error */
+int cs_readrecv(int fd,uint64_t chunkid,uint32_t *offset,uint32_t *size,uint8_t **buff);
 int cs_readblock(int fd,uint64_t chunkid,uint32_t version,uint32_t offset,uint32_t size,uint8_t *buff);
+/* reads data from all given replicas at once (block aligned parts proportional to their weights) ;
+ * when part of slow replica takes much longer than the fastest idle replica would need, the rest
+ * of it is requested again from that replica and the first answer wins ; returns 0 or -1 */
+int cs_readstriped(csreplica *rep,uint32_t cnt,uint64_t chunkid,uint32_t version,uint32_t offset,uint32_t size,uint8_t *buff);
+/* reads data from rep[0] ; when it doesn't start sending data within hedgeusec (0 - never) or fails
+ * before, 'hedgeconnect' is called for connection to other replica (stored in rep[1].fd, -1 when
+ * not used), the same data is requested from it and the first complete answer wins ;
+ * returns index of replica which has sent data or -1 */
+int cs_readhedged(csreplica *rep,uint32_t hedgeusec,int (*hedgeconnect)(void *arg),void *arg,uint64_t chunkid,uint32_t version,uint32_t offset,uint32_t size,uint8_t *buff);
 
 #endif
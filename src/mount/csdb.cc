@@ -19,28 +19,81 @@
 #include "config.h"
 
 #include <stdlib.h>
+#include <string.h>
 #include <pthread.h>
 #include <inttypes.h>
+#include <poll.h>
+#include <sys/time.h>
+
+#include "sockets.h"
+#include "stats.h"
 
 #define CSDB_HASHSIZE 256
 #define CSDB_HASH(ip,port) (((ip)*0x7b348943+(port))%(CSDB_HASHSIZE))
 
+// histogram of read latencies (all chunkservers) - four buckets for every power of two
+#define CSDB_LATBUCKETS 124
+#define CSDB_LATWINDOW 4096	// all buckets are halved after so many samples (old samples fade out)
+#define CSDB_LATMINSAMPLES 100	// percentiles are not given before so many samples
+#define CSDB_DEFLATENCY 1000	// usec - latency of not measured chunkservers when nothing is known
+
+// pool of idle connections
+#define CSDB_MAXIDLE 16			// per chunkserver
+#define CSDB_MAXIDLETOTAL 256
+#define CSDB_IDLEUSEC 3000000		// chunkserver closes connections idle for 5 seconds
+
 typedef struct _csdbentry {
 	uint32_t ip;
 	uint16_t port;
 	uint32_t readopcnt;
 	uint32_t writeopcnt;
+	uint32_t readspeed;	// KiB/s (EWMA) ; 0 - not measured yet
+	uint32_t latency;	// usec to the first data (EWMA) ; 0 - not measured yet
+	uint32_t errors;	// per mille of failed reads (EWMA)
+	uint32_t idlecnt;
+	int idlefd[CSDB_MAXIDLE];	// the most recently used at the end
+	uint64_t idlesince[CSDB_MAXIDLE];
 	struct _csdbentry *next;
 } csdbentry;
 
 static csdbentry *csdbhtab[CSDB_HASHSIZE];
 static pthread_mutex_t *csdblock;
+static uint32_t lathist[CSDB_LATBUCKETS];	// csdblock
+static uint32_t latcount;			// csdblock
+static uint32_t idletotal;			// csdblock
+
+enum {
+	POOL_REUSED = 0,
+	POOL_CREATED,
+	POOL_DROPPED,
+	STATNODES
+};
+
+static uint64_t *statsptr[STATNODES];
+
+static inline void csdb_stats_add(uint8_t id,uint64_t v) {
+	if (id<STATNODES) {
+		stats_lock();
+		(*statsptr[id])+=v;
+		stats_unlock();
+	}
+}
 
 void csdb_init(void) {
 	uint32_t i;
+	void *s;
 	for (i=0 ; i<CSDB_HASHSIZE ; i++) {
 		csdbhtab[i]=NULL;
 	}
+	for (i=0 ; i<CSDB_LATBUCKETS ; i++) {
+		lathist[i]=0;
+	}
+	latcount=0;
+	idletotal=0;
+	s = stats_get_subnode(NULL,"cspool",0);
+	statsptr[POOL_REUSED] = stats_get_counterptr(stats_get_subnode(s,"reused",0));
+	statsptr[POOL_CREATED] = stats_get_counterptr(stats_get_subnode(s,"created",0));
+	statsptr[POOL_DROPPED] = stats_get_counterptr(stats_get_subnode(s,"dropped",0));
 	csdblock = (pthread_mutex_t*) malloc(sizeof(pthread_mutex_t));
 	pthread_mutex_init(csdblock,NULL);
 }
@@ -54,6 +107,10 @@ void csdb_term(void) {
 	for (i=0 ; i<CSDB_HASHSIZE ; i++) {
 		for (cs = csdbhtab[i] ; cs ; cs = csn) {
 			csn = cs->next;
+			while (cs->idlecnt>0) {
+				cs->idlecnt--;
+				tcpclose(cs->idlefd[cs->idlecnt]);
+			}
 			free(cs);
 		}
 	}
@@ -120,6 +177,10 @@ void csdb_readinc(uint32_t ip,uint16_t port) {
 	e->port = port;
 	e->readopcnt = 1;
 	e->writeopcnt = 0;
+	e->readspeed = 0;
+	e->latency = 0;
+	e->errors = 0;
+	e->idlecnt = 0;
 	e->next = csdbhtab[hash];
 	csdbhtab[hash] = e;
 	pthread_mutex_unlock(csdblock);
@@ -155,6 +216,10 @@ void csdb_writeinc(uint32_t ip,uint16_t port) {
 	e->port = port;
 	e->readopcnt = 0;
 	e->writeopcnt = 1;
+	e->readspeed = 0;
+	e->latency = 0;
+	e->errors = 0;
+	e->idlecnt = 0;
 	e->next = csdbhtab[hash];
 	csdbhtab[hash] = e;
 	pthread_mutex_unlock(csdblock);
@@ -173,3 +238,304 @@ void csdb_writedec(uint32_t ip,uint16_t port) {
 	}
 	pthread_mutex_unlock(csdblock);
 }
+
+uint32_t csdb_getreadspeed(uint32_t ip,uint16_t port) {
+	uint32_t hash = CSDB_HASH(ip,port);
+	uint32_t result = 0;
+	csdbentry *e;
+	pthread_mutex_lock(csdblock);
+	for (e=csdbhtab[hash] ; e ; e=e->next) {
+		if (e->ip == ip && e->port == port) {
+			result = e->readspeed;
+			break;
+		}
+	}
+	pthread_mutex_unlock(csdblock);
+	return result;
+}
+
+void csdb_readspeed(uint32_t ip,uint16_t port,uint32_t bytes,uint32_t usec) {
+	uint32_t hash = CSDB_HASH(ip,port);
+	uint64_t speed;
+	csdbentry *e;
+	if (bytes==0) {
+		return;
+	}
+	speed = ((uint64_t)bytes*1000000/1024)/(usec?usec:1);
+	if (speed==0) {
+		speed = 1;
+	} else if (speed>UINT32_MAX) {
+		speed = UINT32_MAX;
+	}
+	pthread_mutex_lock(csdblock);
+	for (e=csdbhtab[hash] ; e ; e=e->next) {
+		if (e->ip == ip && e->port == port) {
+			if (e->readspeed==0) {
+				e->readspeed = speed;
+			} else {
+				e->readspeed = (7*(uint64_t)e->readspeed+speed)/8;
+			}
+			break;
+		}
+	}
+	pthread_mutex_unlock(csdblock);
+}
+
+static inline uint32_t csdb_latbucket(uint32_t usec) {
+	uint32_t b;
+	if (usec<4) {
+		return usec;
+	}
+	for (b=2 ; b<31 && (usec>>(b+1)) ; b++) {}
+	return 4*(b-1)+((usec>>(b-2))&3);
+}
+
+// upper bound of bucket
+static inline uint32_t csdb_latbucketend(uint32_t bucket) {
+	uint64_t end;
+	if (bucket<4) {
+		return bucket+1;
+	}
+	end = (uint64_t)(5+(bucket&3))<<(bucket/4-1);
+	return (end>UINT32_MAX)?UINT32_MAX:end;
+}
+
+// csdblock: LOCKED
+static inline uint32_t csdb_latpercentile(uint32_t percent) {
+	uint32_t i,sum,limit;
+	if (latcount<CSDB_LATMINSAMPLES) {
+		return 0;
+	}
+	limit = ((uint64_t)latcount*percent+99)/100;
+	sum = 0;
+	for (i=0 ; i<CSDB_LATBUCKETS ; i++) {
+		sum += lathist[i];
+		if (sum>=limit && sum>0) {
+			return csdb_latbucketend(i);
+		}
+	}
+	return csdb_latbucketend(CSDB_LATBUCKETS-1);
+}
+
+void csdb_readstat(uint32_t ip,uint16_t port,uint32_t latency,uint8_t error) {
+	uint32_t hash = CSDB_HASH(ip,port);
+	uint32_t i;
+	csdbentry *e;
+	pthread_mutex_lock(csdblock);
+	for (e=csdbhtab[hash] ; e ; e=e->next) {
+		if (e->ip == ip && e->port == port) {
+			break;
+		}
+	}
+	if (e==NULL) {
+		e = (csdbentry*) malloc(sizeof(csdbentry));
+		e->ip = ip;
+		e->port = port;
+		e->readopcnt = 0;
+		e->writeopcnt = 0;
+		e->readspeed = 0;
+		e->latency = 0;
+		e->errors = 0;
+		e->idlecnt = 0;
+		e->next = csdbhtab[hash];
+		csdbhtab[hash] = e;
+	}
+	e->errors = (7*e->errors+(error?1000:0))/8;
+	if (error==0) {
+		if (latency==0) {
+			latency = 1;
+		}
+		e->latency = (e->latency==0)?latency:(7*(uint64_t)e->latency+latency)/8;
+		lathist[csdb_latbucket(latency)]++;
+		latcount++;
+		if (latcount>=CSDB_LATWINDOW) {
+			latcount = 0;
+			for (i=0 ; i<CSDB_LATBUCKETS ; i++) {
+				lathist[i] >>= 1;
+				latcount += lathist[i];
+			}
+		}
+	}
+	pthread_mutex_unlock(csdblock);
+}
+
+uint32_t csdb_getreadpercentile(uint32_t percent) {
+	uint32_t result;
+	pthread_mutex_lock(csdblock);
+	result = csdb_latpercentile(percent);
+	pthread_mutex_unlock(csdblock);
+	return result;
+}
+
+uint64_t csdb_getreadscore(uint32_t ip,uint16_t port) {
+	uint32_t hash = CSDB_HASH(ip,port);
+	uint64_t opcnt,latency,errors;
+	csdbentry *e;
+	pthread_mutex_lock(csdblock);
+	for (e=csdbhtab[hash] ; e ; e=e->next) {
+		if (e->ip == ip && e->port == port) {
+			break;
+		}
+	}
+	opcnt = (e)?e->readopcnt+e->writeopcnt:0;
+	latency = (e)?e->latency:0;
+	errors = (e)?e->errors:0;
+	if (latency==0) {	// not measured yet - typical latency
+		latency = csdb_latpercentile(50);
+		if (latency==0) {
+			latency = CSDB_DEFLATENCY;
+		}
+	}
+	pthread_mutex_unlock(csdblock);
+	// every operation in progress is one more request in queue ; server which fails all reads is ten times worse
+	return (opcnt+1)*latency*(1000+9*errors)/1000;
+}
+
+static inline uint64_t csdb_usec(void) {
+	struct timeval tv;
+	gettimeofday(&tv,NULL);
+	return tv.tv_sec*UINT64_C(1000000)+tv.tv_usec;
+}
+
+// csdblock: LOCKED ; closes connections idle for too long (they are always the first ones)
+static inline uint32_t csdb_expire(csdbentry *e,uint64_t now) {
+	uint32_t i,n;
+	for (n=0 ; n<e->idlecnt && e->idlesince[n]+CSDB_IDLEUSEC<now ; n++) {
+		tcpclose(e->idlefd[n]);
+	}
+	if (n>0) {
+		for (i=n ; i<e->idlecnt ; i++) {
+			e->idlefd[i-n] = e->idlefd[i];
+			e->idlesince[i-n] = e->idlesince[i];
+		}
+		e->idlecnt -= n;
+		idletotal -= n;
+	}
+	return n;
+}
+
+// csdblock: LOCKED ; closes the first (the oldest) idle connection of given chunkserver
+static inline void csdb_dropfirst(csdbentry *e) {
+	tcpclose(e->idlefd[0]);
+	e->idlecnt--;
+	idletotal--;
+	memmove(e->idlefd,e->idlefd+1,sizeof(int)*e->idlecnt);
+	memmove(e->idlesince,e->idlesince+1,sizeof(uint64_t)*e->idlecnt);
+}
+
+// csdblock: LOCKED ; closes the oldest idle connection of all chunkservers (total limit is reached)
+static inline uint32_t csdb_dropoldest(void) {
+	uint32_t i;
+	csdbentry *e,*oe;
+	oe = NULL;
+	for (i=0 ; i<CSDB_HASHSIZE ; i++) {
+		for (e=csdbhtab[i] ; e ; e=e->next) {
+			if (e->idlecnt>0 && (oe==NULL || e->idlesince[0]<oe->idlesince[0])) {
+				oe = e;
+			}
+		}
+	}
+	if (oe==NULL) {
+		return 0;
+	}
+	csdb_dropfirst(oe);
+	return 1;
+}
+
+int csdb_getconn(uint32_t ip,uint16_t port) {
+	uint32_t hash = CSDB_HASH(ip,port);
+	uint32_t dropped;
+	struct pollfd pfd;
+	csdbentry *e;
+	int fd;
+	fd = -1;
+	dropped = 0;
+	pthread_mutex_lock(csdblock);
+	for (e=csdbhtab[hash] ; e ; e=e->next) {
+		if (e->ip == ip && e->port == port) {
+			break;
+		}
+	}
+	if (e!=NULL) {
+		dropped = csdb_expire(e,csdb_usec());
+		while (e->idlecnt>0 && fd<0) {
+			e->idlecnt--;
+			idletotal--;
+			fd = e->idlefd[e->idlecnt];
+			// idle connection can't have anything to read - otherwise it has been closed by chunkserver (or is out of sync)
+			pfd.fd = fd;
+			pfd.events = POLLIN;
+			pfd.revents = 0;
+			if (poll(&pfd,1,0)!=0) {
+				tcpclose(fd);
+				fd = -1;
+				dropped++;
+			}
+		}
+	}
+	pthread_mutex_unlock(csdblock);
+	if (dropped>0) {
+		csdb_stats_add(POOL_DROPPED,dropped);
+	}
+	csdb_stats_add((fd>=0)?POOL_REUSED:POOL_CREATED,1);
+	return fd;
+}
+
+void csdb_putconn(uint32_t ip,uint16_t port,int fd) {
+	uint32_t hash = CSDB_HASH(ip,port);
+	uint32_t dropped;
+	uint64_t now;
+	csdbentry *e;
+	dropped = 0;
+	now = csdb_usec();
+	pthread_mutex_lock(csdblock);
+	for (e=csdbhtab[hash] ; e ; e=e->next) {
+		if (e->ip == ip && e->port == port) {
+			break;
+		}
+	}
+	if (e!=NULL) {
+		dropped = csdb_expire(e,now);
+		if (e->idlecnt>=CSDB_MAXIDLE) {	// the oldest one goes out
+			csdb_dropfirst(e);
+			dropped++;
+		} else if (idletotal>=CSDB_MAXIDLETOTAL) {	// the oldest one of all chunkservers goes out
+			dropped += csdb_dropoldest();
+		}
+		if (idletotal<CSDB_MAXIDLETOTAL) {
+			e->idlefd[e->idlecnt] = fd;
+			e->idlesince[e->idlecnt] = now;
+			e->idlecnt++;
+			idletotal++;
+			fd = -1;
+		}
+	}
+	pthread_mutex_unlock(csdblock);
+	if (fd>=0) {
+		tcpclose(fd);
+		dropped++;
+	}
+	if (dropped>0) {
+		csdb_stats_add(POOL_DROPPED,dropped);
+	}
+}
+
+void csdb_cleanup(void) {
+	uint32_t i,dropped;
+	uint64_t now;
+	csdbentry *e;
+	dropped = 0;
+	now = csdb_usec();
+	pthread_mutex_lock(csdblock);
+	if (idletotal>0) {
+		for (i=0 ; i<CSDB_HASHSIZE ; i++) {
+			for (e=csdbhtab[i] ; e ; e=e->next) {
+				dropped += csdb_expire(e,now);
+			}
+		}
+	}
+	pthread_mutex_unlock(csdblock);
+	if (dropped>0) {
+		csdb_stats_add(POOL_DROPPED,dropped);
+	}
+}
@@ -30,5 +30,21 @@ void csdb_readinc(uint32_t ip,uint16_t port);
 void csdb_readdec(uint32_t ip,uint16_t port);
 void csdb_writeinc(uint32_t ip,uint16_t port);
 void csdb_writedec(uint32_t ip,uint16_t port);
+/* read transfer speed of chunkserver in KiB/s (moving average) ; 0 - unknown */
+uint32_t csdb_getreadspeed(uint32_t ip,uint16_t port);
+void csdb_readspeed(uint32_t ip,uint16_t port,uint32_t bytes,uint32_t usec);
+/* result of read - latency is time to the first data (usec) */
+void csdb_readstat(uint32_t ip,uint16_t port,uint32_t latency,uint8_t error);
+/* given percentile of read latency of all chunkservers in usec ; 0 - too few samples */
+uint32_t csdb_getreadpercentile(uint32_t percent);
+/* expected cost of read from chunkserver (latency, errors and operations in progress) - the lower the better */
+uint64_t csdb_getreadscore(uint32_t ip,uint16_t port);
+/* pool of idle connections to chunkservers (shared by readers and writers) - returns checked idle
+ * connection or -1 (caller has to connect) */
+int csdb_getconn(uint32_t ip,uint16_t port);
+/* connection after finished request - kept for reuse (for a few seconds) or closed */
+void csdb_putconn(uint32_t ip,uint16_t port,int fd);
+/* closes connections idle for too long - called periodically */
+void csdb_cleanup(void);
 
 #endif
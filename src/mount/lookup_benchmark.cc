@@ -0,0 +1,111 @@
+// Measures how many LOOKUP/GETATTR requests per second the master can answer.
+// Usage: lookup_benchmark master_host master_port [threads [seconds [subfolder]]]
+// Run it with different numbers of threads and MATOCL_READ_WORKERS settings on the master
+// to see how lookup throughput scales.
+// With more than a few threads, requests are coalesced into LOOKUP_MULTI/GETATTR_MULTI packets
+// (masters since 1.6.29), so running it over a high-latency link shows the gain from batching.
+
+#include "config.h"
+
+#include <inttypes.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+#include <unistd.h>
+#include <vector>
+
+#include "MFSCommunication.h"
+#include "datapack.h"
+#include "mastercomm.h"
+
+static std::vector<std::vector<uint8_t> > names;
+static volatile int finished;
+
+static uint64_t now_usec(void) {
+	struct timeval tv;
+	gettimeofday(&tv,NULL);
+	return tv.tv_sec*UINT64_C(1000000)+tv.tv_usec;
+}
+
+static void* lookup_thread(void *arg) {
+	uint64_t *counter = (uint64_t*)arg;
+	uint32_t inode,uid,gid,i;
+	uint8_t attr[35];
+
+	uid = getuid();
+	gid = getgid();
+	i = 0;
+	while (!finished) {
+		const std::vector<uint8_t> &name = names[i % names.size()];
+		if (fs_lookup(MFS_ROOT_ID,name.size(),name.data(),uid,gid,&inode,attr)!=STATUS_OK) {
+			fprintf(stderr,"lookup failed\n");
+			exit(1);
+		}
+		if (fs_getattr(inode,uid,gid,attr)!=STATUS_OK) {
+			fprintf(stderr,"getattr failed\n");
+			exit(1);
+		}
+		*counter += 2;
+		i++;
+	}
+	return NULL;
+}
+
+int main(int argc,char **argv) {
+	uint32_t threads,seconds,i;
+	const uint8_t *dbuff,*rptr;
+	uint32_t dbuffsize;
+	uint64_t start,total;
+	uint8_t nleng;
+
+	if (argc<3) {
+		fprintf(stderr,"usage: %s master_host master_port [threads [seconds [subfolder]]]\n",argv[0]);
+		return 1;
+	}
+	threads = (argc>3)?strtoul(argv[3],NULL,10):1;
+	seconds = (argc>4)?strtoul(argv[4],NULL,10):10;
+	if (threads==0 || seconds==0) {
+		fprintf(stderr,"threads and seconds have to be positive\n");
+		return 1;
+	}
+	if (fs_init_master_connection(NULL,argv[1],argv[2],0,"lookup_benchmark",(argc>5)?argv[5]:"/",NULL,0,0)<0) {
+		fprintf(stderr,"can't connect to master\n");
+		return 1;
+	}
+	fs_init_threads(30);
+
+	// look up names from the root directory (the directory itself if it's empty)
+	if (fs_getdir(MFS_ROOT_ID,getuid(),getgid(),&dbuff,&dbuffsize)!=STATUS_OK) {
+		fprintf(stderr,"can't read root directory\n");
+		return 1;
+	}
+	rptr = dbuff;
+	while (rptr<dbuff+dbuffsize) {
+		nleng = get8bit(&rptr);
+		names.push_back(std::vector<uint8_t>(rptr,rptr+nleng));
+		rptr += nleng+5;
+	}
+	if (names.empty()) {
+		names.push_back(std::vector<uint8_t>(1,'.'));
+	}
+
+	std::vector<pthread_t> th(threads);
+	std::vector<uint64_t> counters(threads*8,0);	// each counter in its own cache line
+	finished = 0;
+	start = now_usec();
+	for (i=0 ; i<threads ; i++) {
+		pthread_create(&th[i],NULL,lookup_thread,&counters[i*8]);
+	}
+	sleep(seconds);
+	finished = 1;
+	total = 0;
+	for (i=0 ; i<threads ; i++) {
+		pthread_join(th[i],NULL);
+		total += counters[i*8];
+	}
+	printf("threads: %" PRIu32 " ; requests: %" PRIu64 " ; requests/s: %.0f\n",threads,total,total*1000000.0/(now_usec()-start));
+	fs_term();
+	return 0;
+}
@@ -144,6 +144,9 @@ struct mfsopts {
 	int passwordask;
 	int donotrememberpassword;
 	unsigned writecachesize;
+	unsigned writechunks;
+	unsigned readaheadsize;
+	unsigned hedgepercentile;
 	unsigned ioretries;
 	double attrcacheto;
 	double entrycacheto;
@@ -189,6 +192,9 @@ static struct fuse_opt mfs_opts_stage2[] = {
 	MFS_OPT("mfsmemlock", memlock, 1),
 #endif
 	MFS_OPT("mfswritecachesize=%u", writecachesize, 0),
+	MFS_OPT("mfswritechunks=%u", writechunks, 0),
+	MFS_OPT("mfsreadaheadsize=%u", readaheadsize, 0),
+	MFS_OPT("mfshedgepercentile=%u", hedgepercentile, 0),
 	MFS_OPT("mfsioretries=%u", ioretries, 0),
 	MFS_OPT("mfsdebug", debug, 1),
 	MFS_OPT("mfsmeta", meta, 1),
@@ -268,6 +274,9 @@ static void usage(const char *progname) {
 "    -o mfsmemlock               try to lock memory\n"
 #endif
 "    -o mfswritecachesize=N      define size of write cache in MiB (default: 128)\n"
+"    -o mfswritechunks=N         define number of chunks of one file written at the same time (default: 4)\n"
+"    -o mfsreadaheadsize=N       define memory limit for data read ahead of sequential readers in MiB (0 - no readahead ; default: 256)\n"
+"    -o mfshedgepercentile=N     read from other replica when chunkserver doesn't answer within N-th percentile of read latency (0 - never ; default: 95)\n"
 "    -o mfsioretries=N           define number of retries before I/O error is returned (default: 30)\n"
 "    -o mfsmaster=HOST           define mfsmaster location (default: mfsmaster)\n"
 "    -o mfsport=PORT             define mfsmaster port number (default: 9421)\n"
@@ -572,8 +581,8 @@ int mainloop(struct fuse_args *args,const char* mp,int mt,int fg) {
 
 	if (mfsopts.meta==0) {
 		csdb_init();
-		read_data_init(mfsopts.ioretries);
-		write_data_init(mfsopts.writecachesize*1024*1024,mfsopts.ioretries);
+		read_data_init(mfsopts.ioretries,mfsopts.readaheadsize*1024*1024,mfsopts.hedgepercentile);
+		write_data_init(mfsopts.writecachesize*1024*1024,mfsopts.ioretries,mfsopts.writechunks);
 	}
 
  	ch = fuse_mount(mp, args);
@@ -854,6 +863,9 @@ int main(int argc, char *argv[]) {
 	mfsopts.cachefiles = 0;
 	mfsopts.cachemode = NULL;
 	mfsopts.writecachesize = 0;
+	mfsopts.writechunks = 0;
+	mfsopts.readaheadsize = 256;
+	mfsopts.hedgepercentile = 95;
 	mfsopts.ioretries = 30;
 	mfsopts.passwordask = 0;
 	mfsopts.attrcacheto = 1.0;
@@ -961,6 +973,25 @@ int main(int argc, char *argv[]) {
 		fprintf(stderr,"write cache size to big (%u MiB) - decresed to 2048 MiB\n",mfsopts.writecachesize);
 		mfsopts.writecachesize=2048;
 	}
+	if (mfsopts.writechunks==0) {
+		mfsopts.writechunks=4;
+	}
+	if (mfsopts.writechunks>16) {
+		fprintf(stderr,"number of chunks written at once to big (%u) - decreased to 16\n",mfsopts.writechunks);
+		mfsopts.writechunks=16;
+	}
+	if (mfsopts.readaheadsize>2048) {
+		fprintf(stderr,"readahead size to big (%u MiB) - decresed to 2048 MiB\n",mfsopts.readaheadsize);
+		mfsopts.readaheadsize=2048;
+	}
+	if (mfsopts.hedgepercentile>0 && mfsopts.hedgepercentile<50) {
+		fprintf(stderr,"hedge percentile to low (%u) - increased to 50\n",mfsopts.hedgepercentile);
+		mfsopts.hedgepercentile=50;
+	}
+	if (mfsopts.hedgepercentile>99) {
+		fprintf(stderr,"hedge percentile to big (%u) - decreased to 99\n",mfsopts.hedgepercentile);
+		mfsopts.hedgepercentile=99;
+	}
 
 	if (mfsopts.nostdmountoptions==0) {
 		fuse_opt_add_arg(&args, "-o" DEFAULT_OPTIONS);
@@ -43,6 +43,7 @@
 #include "strerr.h"
 #include "md5.h"
 #include "datapack.h"
+#include "mastercomm.h"
 
 typedef struct _threc {
 	pthread_t thid;
@@ -66,6 +67,22 @@ typedef struct _threc {
 	struct _threc *next;
 } threc;
 
+// asynchronous request - answer is passed to callback called by fs_async_thread
+typedef struct _asyncreq {
+	uint32_t packetid;
+	uint32_t expected_cmd;
+	uint8_t *obuff;		// whole packet - kept for resending after reconnection
+	uint32_t odataleng;
+	uint8_t *ibuff;
+	uint32_t idataleng;
+	uint8_t sent;
+	uint8_t status;
+	uint32_t tries;
+	fs_async_callback callback;
+	void *arg;
+	struct _asyncreq *next;
+} asyncreq;
+
 typedef struct _acquired_file {
 	uint32_t inode;
 	uint32_t cnt;
@@ -78,10 +95,21 @@ typedef struct _acquired_file {
 
 #define RECEIVE_TIMEOUT 10
 
+// packetids of asynchronous requests have highest bit set (threc packetids are small numbers)
+#define ASYNC_PACKETID_FLAG 0x80000000
+#define ASYNC_MAXINFLIGHT 1024
+#define ASYNC_HASHSIZE 1024
+#define ASYNC_HASHPOS(packetid) ((packetid)&(ASYNC_HASHSIZE-1))
+
 static threc *threchead=NULL;
 
 static acquired_file *afhead=NULL;
 
+static asyncreq *asynchash[ASYNC_HASHSIZE];
+static asyncreq *asyncdonehead,**asyncdonetail;
+static uint32_t asyncinflight;
+static uint32_t asyncnextid;
+
 static int fd;
 static int disconnect;
 static time_t lastwrite;
@@ -89,8 +117,9 @@ static int sessionlost;
 
 static uint32_t maxretries;
 
-static pthread_t rpthid,npthid;
-static pthread_mutex_t fdlock,reclock,aflock;
+static pthread_t rpthid,npthid,apthid;
+static pthread_mutex_t fdlock,reclock,aflock,asynclock;
+static pthread_cond_t asynccond;
 
 static uint32_t sessionid;
 static uint32_t masterversion;
@@ -470,6 +499,201 @@ const uint8_t* fs_sendandreceive_any(threc *rec,uint32_t *received_cmd,uint32_t
 	return NULL;
 }
 
+/* asynchronous requests
+ *
+ * Any number of requests (up to ASYNC_MAXINFLIGHT) can wait for answers at the same time and
+ * answers may come in any order - they are matched by packetid. Requests interrupted by
+ * disconnection are sent again after reconnection (up to maxretries times). Callbacks are
+ * called one by one by fs_async_thread, so they shouldn't block for a long time.
+ */
+
+// asynclock has to be held
+static inline asyncreq* fs_async_find(uint32_t packetid) {
+	asyncreq *ar;
+	for (ar=asynchash[ASYNC_HASHPOS(packetid)] ; ar && ar->packetid!=packetid ; ar=ar->next) {}
+	return ar;
+}
+
+// asynclock has to be held
+static inline void fs_async_done(asyncreq *ar,uint8_t status) {
+	asyncreq **arp;
+	for (arp = asynchash+ASYNC_HASHPOS(ar->packetid) ; *arp!=ar ; arp = &((*arp)->next)) {}
+	*arp = ar->next;
+	ar->status = status;
+	ar->next = NULL;
+	*asyncdonetail = ar;
+	asyncdonetail = &(ar->next);
+	pthread_cond_signal(&asynccond);
+}
+
+// fdlock has to be held
+static void fs_async_send(asyncreq *ar) {
+	if (fd==-1 || disconnect) {
+		return;
+	}
+	if (tcptowrite(fd,ar->obuff,ar->odataleng,1000)!=(int32_t)(ar->odataleng)) {
+		syslog(LOG_WARNING,"tcp send error: %s",strerr(errno));
+		disconnect = 1;
+		return;
+	}
+	ar->sent = 1;
+	ar->tries++;
+	master_stats_add(MASTER_BYTESSENT,ar->odataleng);
+	master_stats_inc(MASTER_PACKETSSENT);
+	lastwrite = time(NULL);
+}
+
+uint8_t fs_async_request(uint32_t cmd,const uint8_t *data,uint32_t leng,uint32_t expected_cmd,fs_async_callback callback,void *arg) {
+	asyncreq *ar;
+	uint8_t *ptr;
+	uint32_t hpos;
+
+	ar = (asyncreq*)malloc(sizeof(asyncreq));
+	if (ar==NULL) {
+		return ERROR_OUTOFMEMORY;
+	}
+	ar->obuff = (uint8_t*)malloc(leng+12);
+	if (ar->obuff==NULL) {
+		free(ar);
+		return ERROR_OUTOFMEMORY;
+	}
+	ar->odataleng = leng+12;
+	ar->ibuff = NULL;
+	ar->idataleng = 0;
+	ar->expected_cmd = expected_cmd;
+	ar->sent = 0;
+	ar->status = STATUS_OK;
+	ar->tries = 0;
+	ar->callback = callback;
+	ar->arg = arg;
+	pthread_mutex_lock(&fdlock);	// lock order: fdlock, asynclock
+	pthread_mutex_lock(&asynclock);
+	if (sessionlost || fterm || asyncinflight>=ASYNC_MAXINFLIGHT) {
+		pthread_mutex_unlock(&asynclock);
+		pthread_mutex_unlock(&fdlock);
+		free(ar->obuff);
+		free(ar);
+		return ERROR_IO;
+	}
+	do {
+		ar->packetid = ASYNC_PACKETID_FLAG | (asyncnextid++);
+	} while (fs_async_find(ar->packetid));	// skip ids still in use after wrap around
+	hpos = ASYNC_HASHPOS(ar->packetid);
+	ar->next = asynchash[hpos];
+	asynchash[hpos] = ar;
+	asyncinflight++;
+	ptr = ar->obuff;
+	put32bit(&ptr,cmd);
+	put32bit(&ptr,leng+4);
+	put32bit(&ptr,ar->packetid);
+	if (leng>0) {
+		memcpy(ptr,data,leng);
+	}
+	fs_async_send(ar);	// if it can't be sent now, then fs_receive_thread will send it after reconnection
+	pthread_mutex_unlock(&asynclock);
+	pthread_mutex_unlock(&fdlock);
+	return STATUS_OK;
+}
+
+// called by fs_receive_thread (fdlock held) after disconnection and after (re)connection
+static void fs_async_connection_changed(void) {
+	asyncreq *ar,*arn;
+	uint32_t hpos;
+	pthread_mutex_lock(&asynclock);
+	for (hpos=0 ; hpos<ASYNC_HASHSIZE ; hpos++) {
+		for (ar=asynchash[hpos] ; ar ; ar=arn) {
+			arn = ar->next;
+			if (fd==-1) {
+				ar->sent = 0;
+				if (sessionlost) {
+					fs_async_done(ar,ERROR_IO);
+				}
+			} else if (ar->sent==0) {
+				if (ar->tries>=maxretries) {
+					fs_async_done(ar,ERROR_IO);
+				} else {
+					fs_async_send(ar);
+				}
+			}
+		}
+	}
+	pthread_mutex_unlock(&asynclock);
+}
+
+// called by fs_receive_thread for answers with ASYNC_PACKETID_FLAG ; returns -1 when connection should be closed
+static int fs_async_receive(uint32_t packetid,uint32_t cmd,uint32_t size) {
+	asyncreq *ar;
+	uint8_t *buff;
+	int32_t r;
+
+	pthread_mutex_lock(&asynclock);
+	ar = fs_async_find(packetid);
+	if (ar==NULL || ar->sent==0) {
+		pthread_mutex_unlock(&asynclock);
+		syslog(LOG_WARNING,"master: got unexpected queryid");
+		return -1;
+	}
+	pthread_mutex_unlock(&asynclock);
+	// only this thread can remove sent requests, so 'ar' can be used without lock
+	buff = NULL;
+	if (size>0) {
+		buff = (uint8_t*)malloc(size);
+		if (buff==NULL) {
+			return -1;
+		}
+		r = tcptoread(fd,buff,size,1000);
+		if (r!=(int32_t)size) {
+			if (r==0) {
+				syslog(LOG_WARNING,"master: connection lost (2)");
+			} else {
+				syslog(LOG_WARNING,"master: tcp recv error: %s (2)",strerr(errno));
+			}
+			free(buff);
+			return -1;
+		}
+		master_stats_add(MASTER_BYTESRCVD,size);
+	}
+	if (cmd!=ar->expected_cmd && cmd!=ANTOAN_UNKNOWN_COMMAND && cmd!=ANTOAN_BAD_COMMAND_SIZE) {
+		free(buff);
+		return -1;
+	}
+	pthread_mutex_lock(&asynclock);
+	ar->ibuff = buff;
+	ar->idataleng = size;
+	fs_async_done(ar,(cmd==ar->expected_cmd)?STATUS_OK:ERROR_ENOTSUP);
+	pthread_mutex_unlock(&asynclock);
+	return 0;
+}
+
+void* fs_async_thread(void *arg) {
+	asyncreq *ar;
+	(void)arg;
+	pthread_mutex_lock(&asynclock);
+	for (;;) {
+		while (asyncdonehead==NULL && fterm==0) {
+			pthread_cond_wait(&asynccond,&asynclock);
+		}
+		if (asyncdonehead==NULL) {
+			pthread_mutex_unlock(&asynclock);
+			return NULL;
+		}
+		ar = asyncdonehead;
+		asyncdonehead = ar->next;
+		if (asyncdonehead==NULL) {
+			asyncdonetail = &asyncdonehead;
+		}
+		asyncinflight--;
+		pthread_mutex_unlock(&asynclock);
+		ar->callback(ar->status,ar->ibuff,ar->idataleng,ar->arg);
+		if (ar->ibuff) {
+			free(ar->ibuff);
+		}
+		free(ar->obuff);
+		free(ar);
+		pthread_mutex_lock(&asynclock);
+	}
+}
+
 int fs_resolve(uint8_t oninit,const char *bindhostname,const char *masterhostname,const char *masterportname) {
 	if (bindhostname) {
 		if (tcpresolve(bindhostname,NULL,&srcip,NULL,1)<0) {
@@ -1098,18 +1322,26 @@ void* fs_receive_thread(void *arg) {
 				pthread_mutex_unlock(&(rec->mutex));
 			}
 			pthread_mutex_unlock(&reclock);
+			fs_async_connection_changed();
 		}
 		if (fd==-1 && sessionid!=0) {
 			fs_reconnect();		// try to register using the same session id
+			if (fd>=0) {
+				fs_async_connection_changed();
+			}
 		}
 		if (fd==-1) {	// still not connected
 			if (sessionlost) {	// if previous session is lost then try to register as a new session
+				fs_async_connection_changed();	// requests from lost session are failed
 				if (fs_connect(0,&connect_args)==0) {
 					sessionlost=0;
 				}
 			} else {	// if other problem occured then try to resolve hostname and portname then try to reconnect using the same session id
 				if (fs_resolve(0,connect_args.bindhostname,connect_args.masterhostname,connect_args.masterportname)==0) {
 					fs_reconnect();
+					if (fd>=0) {
+						fs_async_connection_changed();
+					}
 				}
 			}
 		}
@@ -1153,6 +1385,12 @@ void* fs_receive_thread(void *arg) {
 				continue;
 			}
 		}
+		if (packetid&ASYNC_PACKETID_FLAG) {
+			if (fs_async_receive(packetid,cmd,size)<0) {
+				disconnect=1;
+			}
+			continue;
+		}
 		rec = fs_get_threc_by_id(packetid);
 		if (rec==NULL) {
 			syslog(LOG_WARNING,"master: got unexpected queryid");
@@ -1231,6 +1469,46 @@ int fs_init_master_connection(const char *bindhostname,const char *masterhostnam
 }
 
 // called after fork
+/* Concurrent LOOKUP and GETATTR requests are coalesced into *_MULTI packets (masters since 1.6.29).
+ * As long as less than MULTI_MAXINFLIGHT packets of given kind wait for answers, requests are sent
+ * immediately. Otherwise they are queued and the first queued thread sends all of them (up to
+ * MULTI_MAXCOUNT) in one packet as soon as one of the packets in flight is answered.
+ */
+#define MULTI_MAXINFLIGHT 4
+#define MULTI_MAXCOUNT 256
+
+enum {MULTI_WAITING,MULTI_SEND,MULTI_DONE};
+
+typedef struct _multireq {
+	uint32_t inode;		// parent for LOOKUP
+	uint8_t nleng;		// LOOKUP
+	const uint8_t *name;	// LOOKUP
+	uint32_t uid,gid;
+	uint32_t newinode;	// LOOKUP
+	uint8_t *attr;
+	uint8_t status;
+	uint8_t state;
+	pthread_cond_t cond;
+	struct _multireq *next;
+} multireq;
+
+typedef struct _multiqueue {
+	pthread_mutex_t lock;
+	multireq *head,**tail;
+	uint32_t inflight;
+	uint8_t lookup;		// 1 - LOOKUP, 0 - GETATTR
+} multiqueue;
+
+static multiqueue lookupqueue,getattrqueue;
+
+static void fs_multi_init(multiqueue *q,uint8_t lookup) {
+	pthread_mutex_init(&(q->lock),NULL);
+	q->head = NULL;
+	q->tail = &(q->head);
+	q->inflight = 0;
+	q->lookup = lookup;
+}
+
 void fs_init_threads(uint32_t retries) {
 	pthread_attr_t thattr;
 	maxretries = retries;
@@ -1238,22 +1516,47 @@ void fs_init_threads(uint32_t retries) {
 	pthread_mutex_init(&reclock,NULL);
 	pthread_mutex_init(&fdlock,NULL);
 	pthread_mutex_init(&aflock,NULL);
+	fs_multi_init(&lookupqueue,1);
+	fs_multi_init(&getattrqueue,0);
+	pthread_mutex_init(&asynclock,NULL);
+	pthread_cond_init(&asynccond,NULL);
+	memset(asynchash,0,sizeof(asynchash));
+	asyncdonehead = NULL;
+	asyncdonetail = &asyncdonehead;
+	asyncinflight = 0;
+	asyncnextid = 1;
 	pthread_attr_init(&thattr);
 	pthread_attr_setstacksize(&thattr,0x100000);
 	pthread_create(&rpthid,&thattr,fs_receive_thread,NULL);
 	pthread_create(&npthid,&thattr,fs_nop_thread,NULL);
+	pthread_create(&apthid,&thattr,fs_async_thread,NULL);
 	pthread_attr_destroy(&thattr);
 }
 
 void fs_term(void) {
 	threc *tr,*trn;
 	acquired_file *af,*afn;
+	uint32_t i;
 
 	pthread_mutex_lock(&fdlock);
 	fterm = 1;
 	pthread_mutex_unlock(&fdlock);
 	pthread_join(npthid,NULL);
 	pthread_join(rpthid,NULL);
+	// fail requests without answers, then let fs_async_thread call all remaining callbacks
+	pthread_mutex_lock(&asynclock);
+	for (i=0 ; i<ASYNC_HASHSIZE ; i++) {
+		while (asynchash[i]) {
+			fs_async_done(asynchash[i],ERROR_IO);
+		}
+	}
+	pthread_cond_signal(&asynccond);
+	pthread_mutex_unlock(&asynclock);
+	pthread_join(apthid,NULL);
+	pthread_cond_destroy(&asynccond);
+	pthread_mutex_destroy(&asynclock);
+	pthread_mutex_destroy(&(getattrqueue.lock));
+	pthread_mutex_destroy(&(lookupqueue.lock));
 	pthread_mutex_destroy(&aflock);
 	pthread_mutex_destroy(&fdlock);
 	pthread_mutex_destroy(&reclock);
@@ -1349,7 +1652,7 @@ uint8_t fs_access(uint32_t inode,uint32_t uid,uint32_t gid,uint8_t modemask) {
 	return ret;
 }
 
-uint8_t fs_lookup(uint32_t parent,uint8_t nleng,const uint8_t *name,uint32_t uid,uint32_t gid,uint32_t *inode,uint8_t attr[35]) {
+static uint8_t fs_lookup_single(uint32_t parent,uint8_t nleng,const uint8_t *name,uint32_t uid,uint32_t gid,uint32_t *inode,uint8_t attr[35]) {
 	uint8_t *wptr;
 	const uint8_t *rptr;
 	uint32_t i;
@@ -1385,7 +1688,7 @@ uint8_t fs_lookup(uint32_t parent,uint8_t nleng,const uint8_t *name,uint32_t uid
 	return ret;
 }
 
-uint8_t fs_getattr(uint32_t inode,uint32_t uid,uint32_t gid,uint8_t attr[35]) {
+static uint8_t fs_getattr_single(uint32_t inode,uint32_t uid,uint32_t gid,uint8_t attr[35]) {
 	uint8_t *wptr;
 	const uint8_t *rptr;
 	uint32_t i;
@@ -1415,6 +1718,159 @@ uint8_t fs_getattr(uint32_t inode,uint32_t uid,uint32_t gid,uint8_t attr[35]) {
 	return ret;
 }
 
+// lock has to be held
+static inline void fs_multi_promote(multiqueue *q) {
+	if (q->head && q->head->state==MULTI_WAITING && q->inflight<MULTI_MAXINFLIGHT) {
+		q->head->state = MULTI_SEND;
+		pthread_cond_signal(&(q->head->cond));
+	}
+}
+
+// sends requests from list 'batch' (ended by NULL) and fills their results
+static void fs_multi_send(multiqueue *q,multireq *batch,uint32_t count) {
+	uint8_t *wptr;
+	const uint8_t *rptr;
+	uint32_t i,size;
+	uint8_t status;
+	multireq *r;
+	threc *rec = fs_get_my_threc();
+
+	size = 0;
+	for (r=batch ; r ; r=r->next) {
+		size += (q->lookup)?13+r->nleng:12;
+	}
+	wptr = fs_createpacket(rec,(q->lookup)?CLTOMA_FUSE_LOOKUP_MULTI:CLTOMA_FUSE_GETATTR_MULTI,size);
+	if (wptr==NULL) {
+		rptr = NULL;
+	} else {
+		for (r=batch ; r ; r=r->next) {
+			put32bit(&wptr,r->inode);
+			if (q->lookup) {
+				put8bit(&wptr,r->nleng);
+				memcpy(wptr,r->name,r->nleng);
+				wptr+=r->nleng;
+			}
+			put32bit(&wptr,r->uid);
+			put32bit(&wptr,r->gid);
+		}
+		rptr = fs_sendandreceive(rec,(q->lookup)?MATOCL_FUSE_LOOKUP_MULTI:MATOCL_FUSE_GETATTR_MULTI,&i);
+	}
+	status = STATUS_OK;
+	if (rptr==NULL) {
+		status = ERROR_IO;
+	} else if (i==1) {
+		status = rptr[0];
+	} else if (i!=count*((q->lookup)?40:36)) {
+		pthread_mutex_lock(&fdlock);
+		disconnect = 1;
+		pthread_mutex_unlock(&fdlock);
+		status = ERROR_IO;
+	}
+	for (r=batch ; r ; r=r->next) {
+		if (status!=STATUS_OK) {
+			r->status = status;
+			continue;
+		}
+		r->status = get8bit(&rptr);
+		if (q->lookup) {
+			r->newinode = get32bit(&rptr);
+		}
+		if (r->status==STATUS_OK) {
+			memcpy(r->attr,rptr,35);
+		}
+		rptr+=35;
+	}
+}
+
+static uint8_t fs_multi_execute(multiqueue *q,multireq *mr) {
+	multireq *batch,*r,**rp;
+	uint32_t count;
+
+	pthread_mutex_lock(&(q->lock));
+	if (q->head==NULL && q->inflight<MULTI_MAXINFLIGHT) {
+		q->inflight++;
+		pthread_mutex_unlock(&(q->lock));
+		if (q->lookup) {
+			mr->status = fs_lookup_single(mr->inode,mr->nleng,mr->name,mr->uid,mr->gid,&(mr->newinode),mr->attr);
+		} else {
+			mr->status = fs_getattr_single(mr->inode,mr->uid,mr->gid,mr->attr);
+		}
+		pthread_mutex_lock(&(q->lock));
+		q->inflight--;
+		fs_multi_promote(q);
+		pthread_mutex_unlock(&(q->lock));
+		return mr->status;
+	}
+	pthread_cond_init(&(mr->cond),NULL);
+	mr->state = MULTI_WAITING;
+	mr->next = NULL;
+	*(q->tail) = mr;
+	q->tail = &(mr->next);
+	fs_multi_promote(q);
+	while (mr->state==MULTI_WAITING) {
+		pthread_cond_wait(&(mr->cond),&(q->lock));
+	}
+	if (mr->state==MULTI_SEND) {	// this thread sends queued requests (starting from its own)
+		batch = q->head;
+		count = 0;
+		rp = &(q->head);
+		while (*rp && count<MULTI_MAXCOUNT) {
+			rp = &((*rp)->next);
+			count++;
+		}
+		q->head = *rp;
+		if (q->head==NULL) {
+			q->tail = &(q->head);
+		}
+		*rp = NULL;
+		q->inflight++;
+		fs_multi_promote(q);
+		pthread_mutex_unlock(&(q->lock));
+		fs_multi_send(q,batch,count);
+		pthread_mutex_lock(&(q->lock));
+		for (r=batch ; r ; r=r->next) {
+			if (r!=mr) {
+				r->state = MULTI_DONE;
+				pthread_cond_signal(&(r->cond));
+			}
+		}
+		q->inflight--;
+		fs_multi_promote(q);
+	}
+	pthread_mutex_unlock(&(q->lock));
+	pthread_cond_destroy(&(mr->cond));
+	return mr->status;
+}
+
+uint8_t fs_lookup(uint32_t parent,uint8_t nleng,const uint8_t *name,uint32_t uid,uint32_t gid,uint32_t *inode,uint8_t attr[35]) {
+	multireq mr;
+	if (masterversion<0x01061D) {
+		return fs_lookup_single(parent,nleng,name,uid,gid,inode,attr);
+	}
+	mr.inode = parent;
+	mr.nleng = nleng;
+	mr.name = name;
+	mr.uid = uid;
+	mr.gid = gid;
+	mr.attr = attr;
+	if (fs_multi_execute(&lookupqueue,&mr)==STATUS_OK) {
+		*inode = mr.newinode;
+	}
+	return mr.status;
+}
+
+uint8_t fs_getattr(uint32_t inode,uint32_t uid,uint32_t gid,uint8_t attr[35]) {
+	multireq mr;
+	if (masterversion<0x01061D) {
+		return fs_getattr_single(inode,uid,gid,attr);
+	}
+	mr.inode = inode;
+	mr.uid = uid;
+	mr.gid = gid;
+	mr.attr = attr;
+	return fs_multi_execute(&getattrqueue,&mr);
+}
+
 uint8_t fs_setattr(uint32_t inode,uint32_t uid,uint32_t gid,uint8_t setmask,uint16_t attrmode,uint32_t attruid,uint32_t attrgid,uint32_t attratime,uint32_t attrmtime,uint8_t sugidclearmode,uint8_t attr[35]) {
 	uint8_t *wptr;
 	const uint8_t *rptr;
@@ -1847,6 +2303,50 @@ uint8_t fs_getdir_plus(uint32_t inode,uint32_t uid,uint32_t gid,uint8_t addtocac
 	return ret;
 }
 
+uint8_t fs_getdir_page(uint32_t inode,uint32_t uid,uint32_t gid,uint8_t withattr,uint64_t cursor,uint32_t maxsize,uint64_t *nextcursor,uint32_t *count,const uint8_t **dbuff,uint32_t *dbuffsize) {
+	uint8_t *wptr;
+	const uint8_t *rptr;
+	uint32_t i;
+	uint8_t ret;
+	threc *rec;
+	if (masterversion<0x01061D) {
+		return ERROR_ENOTSUP;
+	}
+	rec = fs_get_my_threc();
+	wptr = fs_createpacket(rec,CLTOMA_FUSE_GETDIR_PAGE,25);
+	if (wptr==NULL) {
+		return ERROR_IO;
+	}
+	put32bit(&wptr,inode);
+	put32bit(&wptr,uid);
+	put32bit(&wptr,gid);
+	put8bit(&wptr,(withattr)?GETDIR_FLAG_WITHATTR:0);
+	put64bit(&wptr,cursor);
+	put32bit(&wptr,maxsize);
+	rptr = fs_sendandreceive(rec,MATOCL_FUSE_GETDIR_PAGE,&i);
+	if (rptr==NULL) {
+		ret = ERROR_IO;
+	} else if (i==1) {
+		ret = rptr[0];
+	} else {
+		if (i>=12) {
+			*nextcursor = get64bit(&rptr);
+			*count = get32bit(&rptr);
+		}
+		if (i<12 || i-12<(uint64_t)(*count)*8) {
+			pthread_mutex_lock(&fdlock);
+			disconnect = 1;
+			pthread_mutex_unlock(&fdlock);
+			ret = ERROR_IO;
+		} else {
+			*dbuff = rptr;
+			*dbuffsize = i-12;
+			ret = STATUS_OK;
+		}
+	}
+	return ret;
+}
+
 // FUSE - I/O
 
 uint8_t fs_opencheck(uint32_t inode,uint32_t uid,uint32_t gid,uint8_t flags,uint8_t attr[35]) {
@@ -1935,6 +2435,63 @@ uint8_t fs_readchunk(uint32_t inode,uint32_t indx,uint64_t *length,uint64_t *chu
 	return ret;
 }
 
+typedef struct _readchunkreq {
+	fs_readchunk_callback callback;
+	void *arg;
+} readchunkreq;
+
+// answer of fs_readchunk_async - parsed the same way as in fs_readchunk
+static void fs_readchunk_answer(uint8_t status,const uint8_t *data,uint32_t leng,void *arg) {
+	readchunkreq *rcr = (readchunkreq*)arg;
+	uint64_t length,chunkid;
+	uint32_t version;
+
+	length = 0;
+	chunkid = 0;
+	version = 0;
+	if (status==STATUS_OK) {
+		if (leng==1) {
+			status = data[0];
+		} else if (leng<20 || ((leng-20)%6)!=0) {
+			pthread_mutex_lock(&fdlock);
+			disconnect = 1;
+			pthread_mutex_unlock(&fdlock);
+			status = ERROR_IO;
+		} else {
+			length = get64bit(&data);
+			chunkid = get64bit(&data);
+			version = get32bit(&data);
+		}
+	}
+	if (status==STATUS_OK && leng>20) {
+		rcr->callback(status,length,chunkid,version,data,leng-20,rcr->arg);
+	} else {
+		rcr->callback(status,length,chunkid,version,NULL,0,rcr->arg);
+	}
+	free(rcr);
+}
+
+uint8_t fs_readchunk_async(uint32_t inode,uint32_t indx,fs_readchunk_callback callback,void *arg) {
+	uint8_t data[8],*wptr;
+	readchunkreq *rcr;
+	uint8_t status;
+
+	rcr = (readchunkreq*)malloc(sizeof(readchunkreq));
+	if (rcr==NULL) {
+		return ERROR_OUTOFMEMORY;
+	}
+	rcr->callback = callback;
+	rcr->arg = arg;
+	wptr = data;
+	put32bit(&wptr,inode);
+	put32bit(&wptr,indx);
+	status = fs_async_request(CLTOMA_FUSE_READ_CHUNK,data,8,MATOCL_FUSE_READ_CHUNK,fs_readchunk_answer,rcr);
+	if (status!=STATUS_OK) {
+		free(rcr);
+	}
+	return status;
+}
+
 uint8_t fs_writechunk(uint32_t inode,uint32_t indx,uint64_t *length,uint64_t *chunkid,uint32_t *version,const uint8_t **csdata,uint32_t *csdatasize) {
 	uint8_t *wptr;
 	const uint8_t *rptr;
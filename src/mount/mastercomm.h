@@ -42,11 +42,16 @@ uint8_t fs_rename(uint32_t parent_src,uint8_t nleng_src,const uint8_t *name_src,
 uint8_t fs_link(uint32_t inode_src,uint32_t parent_dst,uint8_t nleng_dst,const uint8_t *name_dst,uint32_t uid,uint32_t gid,uint32_t *inode,uint8_t attr[35]);
 uint8_t fs_getdir(uint32_t inode,uint32_t uid,uint32_t gid,const uint8_t **dbuff,uint32_t *dbuffsize);
 uint8_t fs_getdir_plus(uint32_t inode,uint32_t uid,uint32_t gid,uint8_t addtocache,const uint8_t **dbuff,uint32_t *dbuffsize);
+// dbuff is: count*[ cursor:64 ] followed by entries in fs_getdir/fs_getdir_plus format ; ERROR_ENOTSUP - master is too old
+uint8_t fs_getdir_page(uint32_t inode,uint32_t uid,uint32_t gid,uint8_t withattr,uint64_t cursor,uint32_t maxsize,uint64_t *nextcursor,uint32_t *count,const uint8_t **dbuff,uint32_t *dbuffsize);
 
 uint8_t fs_opencheck(uint32_t inode,uint32_t uid,uint32_t gid,uint8_t flags,uint8_t attr[35]);
 void fs_release(uint32_t inode);
 
 uint8_t fs_readchunk(uint32_t inode,uint32_t indx,uint64_t *length,uint64_t *chunkid,uint32_t *version,const uint8_t **csdata,uint32_t *csdatasize);
+// csdata is valid only during callback ; callback is called by fs_async_thread and only when STATUS_OK is returned
+typedef void (*fs_readchunk_callback)(uint8_t status,uint64_t length,uint64_t chunkid,uint32_t version,const uint8_t *csdata,uint32_t csdatasize,void *arg);
+uint8_t fs_readchunk_async(uint32_t inode,uint32_t indx,fs_readchunk_callback callback,void *arg);
 uint8_t fs_writechunk(uint32_t inode,uint32_t indx,uint64_t *length,uint64_t *chunkid,uint32_t *version,const uint8_t **csdata,uint32_t *csdatasize);
 uint8_t fs_writeend(uint64_t chunkid, uint32_t inode, uint64_t length);
 
@@ -65,6 +70,11 @@ uint8_t fs_purge(uint32_t inode);
 
 uint8_t fs_custom(uint32_t qcmd,const uint8_t *query,uint32_t queryleng,uint32_t *acmd,uint8_t *answer,uint32_t *answerleng);
 
+// data - answer without msgid (valid only during callback) ; status: STATUS_OK, ERROR_ENOTSUP (unknown command) or ERROR_IO (no answer)
+typedef void (*fs_async_callback)(uint8_t status,const uint8_t *data,uint32_t leng,void *arg);
+// sends request (cmd, data without msgid) without waiting for answer ; callback is called only when STATUS_OK is returned
+uint8_t fs_async_request(uint32_t cmd,const uint8_t *data,uint32_t leng,uint32_t expected_cmd,fs_async_callback callback,void *arg);
+
 // called before fork
 int fs_init_master_connection(const char *bindhostname,const char *masterhostname,const char *masterportname,uint8_t meta,const char *info,const char *subfolder,const uint8_t passworddigest[16],uint8_t donotrememberpassword,uint8_t bgregister);
 // called after fork
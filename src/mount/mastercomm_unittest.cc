@@ -0,0 +1,138 @@
+#include "mastercomm.h"
+
+#include <netinet/in.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <string>
+#include <vector>
+#include <gtest/gtest.h>
+
+#include "MFSCommunication.h"
+#include "datapack.h"
+
+// master which registers one session and answers CLTOMA_FUSE_READ_CHUNK (other packets are ignored)
+static void* fake_master(void *arg) {
+	int lsock = *(int*)arg;
+	int sock = accept(lsock, NULL, NULL);
+	uint8_t header[8];
+	const uint8_t *rptr;
+	uint8_t *wptr;
+
+	while (sock >= 0 && read(sock, header, 8) == 8) {
+		rptr = header;
+		uint32_t cmd = get32bit(&rptr);
+		uint32_t leng = get32bit(&rptr);
+		std::vector<uint8_t> data(leng);
+		if (leng > 0 && recv(sock, data.data(), leng, MSG_WAITALL) != (ssize_t)leng) {
+			break;
+		}
+		std::vector<uint8_t> answer;
+		if (cmd == CLTOMA_FUSE_REGISTER) {
+			answer.resize(8 + 13, 0);
+			wptr = answer.data();
+			put32bit(&wptr, MATOCL_FUSE_REGISTER);
+			put32bit(&wptr, 13);
+			put32bit(&wptr, 1);	// sessionid
+		} else if (cmd == CLTOMA_FUSE_READ_CHUNK) {
+			rptr = data.data();
+			uint32_t msgid = get32bit(&rptr);
+			uint32_t inode = get32bit(&rptr);
+			uint32_t indx = get32bit(&rptr);
+			answer.resize(inode == 1 ? 8 + 4 + 20 + 6 : 8 + 4 + 1);
+			wptr = answer.data();
+			put32bit(&wptr, MATOCL_FUSE_READ_CHUNK);
+			put32bit(&wptr, answer.size() - 8);
+			put32bit(&wptr, msgid);
+			if (inode == 1) {
+				put64bit(&wptr, UINT64_C(5) * MFSCHUNKSIZE);	// file length
+				put64bit(&wptr, 100 + indx);		// chunkid
+				put32bit(&wptr, 7);			// version
+				put32bit(&wptr, 0x7F000001);
+				put16bit(&wptr, 9422);
+			} else {
+				put8bit(&wptr, ERROR_ENOENT);
+			}
+		}
+		if (!answer.empty() && write(sock, answer.data(), answer.size()) != (ssize_t)answer.size()) {
+			break;
+		}
+	}
+	if (sock >= 0) {
+		close(sock);
+	}
+	return NULL;
+}
+
+struct ReadChunkAnswer {
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	bool done;
+	uint8_t status;
+	uint64_t length, chunkid;
+	uint32_t version;
+	std::vector<uint8_t> csdata;
+};
+
+static void readchunk_answer(uint8_t status, uint64_t length, uint64_t chunkid, uint32_t version,
+		const uint8_t *csdata, uint32_t csdatasize, void *arg) {
+	ReadChunkAnswer *a = (ReadChunkAnswer*)arg;
+	pthread_mutex_lock(&a->lock);
+	a->status = status;
+	a->length = length;
+	a->chunkid = chunkid;
+	a->version = version;
+	a->csdata.assign(csdata, csdata + csdatasize);
+	a->done = true;
+	pthread_cond_signal(&a->cond);
+	pthread_mutex_unlock(&a->lock);
+}
+
+static void wait_for(ReadChunkAnswer *a) {
+	pthread_mutex_lock(&a->lock);
+	while (!a->done) {
+		pthread_cond_wait(&a->cond, &a->lock);
+	}
+	pthread_mutex_unlock(&a->lock);
+}
+
+TEST(MasterCommTests, ReadChunkAsync) {
+	struct sockaddr_in sa = {};
+	socklen_t salen = sizeof(sa);
+	int lsock = socket(AF_INET, SOCK_STREAM, 0);
+	ASSERT_GE(lsock, 0);
+	sa.sin_family = AF_INET;
+	sa.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	ASSERT_EQ(0, bind(lsock, (struct sockaddr*)&sa, sizeof(sa)));
+	ASSERT_EQ(0, listen(lsock, 1));
+	ASSERT_EQ(0, getsockname(lsock, (struct sockaddr*)&sa, &salen));
+	pthread_t master;
+	pthread_create(&master, NULL, fake_master, &lsock);
+
+	std::string port = std::to_string(ntohs(sa.sin_port));
+	ASSERT_EQ(0, fs_init_master_connection(NULL, "127.0.0.1", port.c_str(), 0, "test", "/", NULL, 0, 0));
+	fs_init_threads(1);
+
+	ReadChunkAnswer found = {PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER, false, 0, 0, 0, 0, {}};
+	ReadChunkAnswer missing = {PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER, false, 0, 0, 0, 0, {}};
+	// both requests are in flight at the same time
+	ASSERT_EQ(STATUS_OK, fs_readchunk_async(1, 3, readchunk_answer, &found));
+	ASSERT_EQ(STATUS_OK, fs_readchunk_async(2, 0, readchunk_answer, &missing));
+	wait_for(&found);
+	wait_for(&missing);
+
+	EXPECT_EQ(STATUS_OK, found.status);
+	EXPECT_EQ(UINT64_C(5) * MFSCHUNKSIZE, found.length);
+	EXPECT_EQ(103U, found.chunkid);
+	EXPECT_EQ(7U, found.version);
+	ASSERT_EQ(6U, found.csdata.size());
+	const uint8_t *rptr = found.csdata.data();
+	EXPECT_EQ(0x7F000001U, get32bit(&rptr));
+	EXPECT_EQ(9422U, get16bit(&rptr));
+	EXPECT_EQ(ERROR_ENOENT, missing.status);
+	EXPECT_TRUE(missing.csdata.empty());
+
+	fs_term();
+	pthread_join(master, NULL);
+	close(lsock);
+}
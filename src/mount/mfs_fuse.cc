@@ -54,6 +54,11 @@
 #endif
 
 #define READDIR_BUFFSIZE 50000
+// how much of directory is asked for at once (when master can send directories in pages)
+#define READDIR_PAGESIZE 262144
+// master cursors are below 2^34 - upper bits of FUSE offset are for positions inside group of entries with the same cursor
+#define READDIR_CURSORBITS 40
+#define READDIR_CURSORMASK ((UINT64_C(1)<<READDIR_CURSORBITS)-1)
 
 #define MAX_FILE_SIZE (int64_t)(MFS_MAX_FILE_SIZE)
 
@@ -104,6 +109,10 @@ typedef struct _dirbuf {
 	const uint8_t *p;
 	size_t size;
 	void *dcache;
+	uint8_t paged;		// 'p' holds one page of directory (cursors followed by entries)
+	uint32_t pagecount;	// number of entries in page
+	uint64_t pagecursor;	// cursor of the first entry in page
+	uint64_t nextcursor;	// cursor of the next page (0 - this is the last one)
 	pthread_mutex_t lock;
 } dirbuf;
 
@@ -1294,6 +1303,10 @@ void mfs_opendir(fuse_req_t req, fuse_ino_t ino, struct fuse_file_info *fi) {
 		dirinfo->size = 0;
 		dirinfo->dcache = NULL;
 		dirinfo->wasread = 0;
+		dirinfo->paged = 1;
+		dirinfo->pagecount = 0;
+		dirinfo->pagecursor = 0;
+		dirinfo->nextcursor = 0;
 		pthread_mutex_unlock(&(dirinfo->lock));	// make valgrind happy
 		fi->fh = (unsigned long)dirinfo;
 		if (fuse_reply_open(req,fi) == -ENOENT) {
@@ -1305,6 +1318,191 @@ void mfs_opendir(fuse_req_t req, fuse_ino_t ino, struct fuse_file_info *fi) {
 	}
 }
 
+/* reads page of directory starting at given master cursor into dirinfo
+ * returns -1 when master doesn't support it, 1 when error has been sent to FUSE, 0 - ok */
+static int mfs_readdir_fetch(fuse_req_t req, const struct fuse_ctx &ctx, fuse_ino_t ino, size_t size, off_t off, uint64_t cursor, dirbuf *dirinfo) {
+	int status;
+	const uint8_t *dbuff;
+	uint32_t dsize,count;
+	uint64_t nextcursor;
+	status = fs_getdir_page(ino,ctx.uid,ctx.gid,usedircache,cursor,READDIR_PAGESIZE,&nextcursor,&count,&dbuff,&dsize);
+	if (status==ERROR_ENOTSUP) {
+		return -1;
+	}
+	if (status==0) {
+		mfs_stats_inc((usedircache)?OP_GETDIR_FULL:OP_GETDIR_SMALL);
+	}
+	status = mfs_errorconv(status);
+	if (status!=0) {
+		fuse_reply_err(req, status);
+		oplog_printf(ctx,"readdir (%lu,%" PRIu64 ",%" PRIu64 "): %s",(unsigned long int)ino,(uint64_t)size,(uint64_t)off,strerr(status));
+		return 1;
+	}
+	if (dirinfo->dcache) {
+		dcache_release(dirinfo->dcache);
+		dirinfo->dcache = NULL;
+	}
+	if (dirinfo->p) {
+		free((uint8_t*)(dirinfo->p));
+		dirinfo->p = NULL;
+	}
+	dirinfo->p = (const uint8_t*) malloc(dsize);
+	if (dirinfo->p == NULL) {
+		dirinfo->size = 0;
+		dirinfo->pagecount = 0;
+		dirinfo->wasread = 0;
+		fuse_reply_err(req,EINVAL);
+		oplog_printf(ctx,"readdir (%lu,%" PRIu64 ",%" PRIu64 "): %s",(unsigned long int)ino,(uint64_t)size,(uint64_t)off,strerr(EINVAL));
+		return 1;
+	}
+	memcpy((uint8_t*)(dirinfo->p),dbuff,dsize);
+	dirinfo->size = dsize;
+	dirinfo->pagecount = count;
+	dirinfo->pagecursor = cursor;
+	dirinfo->nextcursor = nextcursor;
+	dirinfo->dataformat = usedircache;
+	if (usedircache) {
+		dirinfo->dcache = dcache_new(&ctx,ino,dirinfo->p+8*count,dsize-8*count);
+	}
+	dirinfo->wasread = 1;
+	return 0;
+}
+
+/* number of entries in page with given cursor and index of the first of them */
+static uint32_t mfs_readdir_group(dirbuf *dirinfo,uint64_t cursor,uint32_t *first) {
+	const uint8_t *cptr;
+	uint32_t i,cnt;
+	cptr = dirinfo->p;
+	cnt = 0;
+	for (i=0 ; i<dirinfo->pagecount ; i++) {
+		if (get64bit(&cptr)==cursor) {
+			if (cnt==0) {
+				*first = i;
+			}
+			cnt++;
+		}
+	}
+	return cnt;
+}
+
+/* readdir with directory read from master page by page - FUSE offsets are master cursors
+ * Entries sharing one cursor (same name hash) are consecutive and always in the same page. When
+ * such group doesn't fit into FUSE buffer, its entries (except the last one) get cursor of the group
+ * with number of entries sent so far in bits above READDIR_CURSORBITS, so readdir can stop anywhere.
+ * returns -1 when master doesn't support it (nothing has been sent to FUSE then) */
+static int mfs_readdir_paged(fuse_req_t req, const struct fuse_ctx &ctx, fuse_ino_t ino, size_t size, off_t off, dirbuf *dirinfo) {
+	int status;
+	char buffer[READDIR_BUFFSIZE];
+	char name[MFS_NAME_MAX+1];
+	const uint8_t *cptr,*ptr,*eptr;
+	uint64_t cursor,lastcursor,nextcursor,entryoff;
+	uint32_t i,start,first,skip,cnt,groupidx;
+	uint8_t fetch,end;
+	size_t opos,oleng;
+	uint8_t nleng;
+	uint32_t inode;
+	uint8_t type;
+	struct stat stbuf;
+
+	start = 0;
+	fetch = 1;
+	skip = (uint64_t)off>>READDIR_CURSORBITS;
+	if (skip>0) {
+		// position inside a group - group starts at master cursor of entries with this key ('cursor'-1)
+		cursor = (uint64_t)off&READDIR_CURSORMASK;
+		cnt = (dirinfo->wasread)?mfs_readdir_group(dirinfo,cursor,&first):0;
+		if (cnt==0) {
+			status = mfs_readdir_fetch(req,ctx,ino,size,off,cursor-1,dirinfo);
+			if (status!=0) {
+				return (status<0)?-1:0;
+			}
+			cnt = mfs_readdir_group(dirinfo,cursor,&first);
+		}
+		if (skip<cnt) {
+			start = first+skip;
+			fetch = 0;
+		} else {	// group has been changed in the meantime - continue after it
+			off = cursor;
+		}
+	}
+	if (fetch && dirinfo->wasread && off!=0) {
+		if ((uint64_t)off==dirinfo->pagecursor) {
+			fetch = 0;
+		} else {
+			// continue after the last entry with this cursor
+			cptr = dirinfo->p;
+			for (i=0 ; i<dirinfo->pagecount ; i++) {
+				if (get64bit(&cptr)==(uint64_t)off) {
+					start = i+1;
+				}
+			}
+			if (start>0 && (start<dirinfo->pagecount || dirinfo->nextcursor==0)) {
+				fetch = 0;
+			}
+		}
+	}
+	if (fetch) {
+		status = mfs_readdir_fetch(req,ctx,ino,size,off,off,dirinfo);
+		if (status!=0) {
+			return (status<0)?-1:0;
+		}
+		start = 0;
+	}
+
+	if (size>READDIR_BUFFSIZE) {
+		size=READDIR_BUFFSIZE;
+	}
+	cptr = dirinfo->p;
+	ptr = dirinfo->p+8*dirinfo->pagecount;
+	eptr = dirinfo->p+dirinfo->size;
+	opos = 0;
+	lastcursor = 0;
+	groupidx = 0;
+	end = 0;
+	for (i=0 ; i<dirinfo->pagecount && end==0 && ptr<eptr ; i++) {
+		cursor = get64bit(&cptr);
+		groupidx = (cursor==lastcursor)?groupidx+1:0;
+		lastcursor = cursor;
+		nleng = ptr[0];
+		if (ptr+1+nleng+((dirinfo->dataformat)?39:5)>eptr) {
+			break;
+		}
+		if (i<start) {
+			ptr += 1+nleng+((dirinfo->dataformat)?39:5);
+			continue;
+		}
+		ptr++;
+		memcpy(name,ptr,nleng);
+		name[nleng]=0;
+		ptr+=nleng;
+		inode = get32bit(&ptr);
+		if (dirinfo->dataformat) {
+			mfs_attr_to_stat(inode,ptr,&stbuf);
+			ptr+=35;
+		} else {
+			type = get8bit(&ptr);
+			mfs_type_to_stat(inode,type,&stbuf);
+		}
+		entryoff = cursor;
+		if (i+1<dirinfo->pagecount) {
+			nextcursor = get64bit(&cptr);
+			cptr -= 8;
+			if (nextcursor==cursor) {	// not the last one in group
+				entryoff |= (uint64_t)(groupidx+1)<<READDIR_CURSORBITS;
+			}
+		}
+		oleng = fuse_add_direntry(req, buffer + opos, size - opos, name, &stbuf, entryoff);
+		if (opos+oleng>size) {
+			end=1;
+		} else {
+			opos+=oleng;
+		}
+	}
+	fuse_reply_buf(req,buffer,opos);
+	oplog_printf(ctx,"readdir (%lu,%" PRIu64 ",%" PRIu64 "): OK (%lu)",(unsigned long int)ino,(uint64_t)size,(uint64_t)off,(unsigned long int)opos);
+	return 0;
+}
+
 void mfs_readdir(fuse_req_t req, fuse_ino_t ino, size_t size, off_t off, struct fuse_file_info *fi) {
 	int status;
         dirbuf *dirinfo = (dirbuf *)((unsigned long)(fi->fh));
@@ -1330,6 +1528,15 @@ void mfs_readdir(fuse_req_t req, fuse_ino_t ino, size_t size, off_t off, struct
 		return;
 	}
 	pthread_mutex_lock(&(dirinfo->lock));
+	if (dirinfo->paged) {
+		if (mfs_readdir_paged(req,ctx,ino,size,off,dirinfo)==0) {
+			pthread_mutex_unlock(&(dirinfo->lock));
+			return;
+		}
+		// old master - whole directory is read at once
+		dirinfo->paged = 0;
+		dirinfo->wasread = 0;
+	}
 	if (dirinfo->wasread==0 || (dirinfo->wasread==1 && off==0)) {
 		const uint8_t *dbuff;
 		uint32_t dsize;
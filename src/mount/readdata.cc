@@ -38,6 +38,7 @@
 #include "mastercomm.h"
 #include "cscomm.h"
 #include "csdb.h"
+#include "stats.h"
 
 #define USECTICK 333333
 
@@ -49,6 +50,36 @@
 #define MAPMASK (MAPSIZE-1)
 #define MAPINDX(inode) (inode&MAPMASK)
 
+// readahead - window of requests read by worker threads ahead of sequential reader
+#define RA_REQSIZE (1024*1024)	// size of one request (requests never cross chunk boundaries)
+#define RA_MINWINDOW (2*RA_REQSIZE)
+#define RA_MAXWINDOW (32*1024*1024)
+#define RA_WORKERS 8
+#define RA_IDLEUSEC 1000000	// worker gives idle connections back to pool after this time
+#define RA_STRIPEMIN (4*MFSBLOCKSIZE)	// smaller requests are always read from one replica
+
+#define RA_QUEUED 0
+#define RA_INFLIGHT 1
+#define RA_READY 2
+#define RA_ERROR 3
+
+#define RA_LOCATIONTICKS 15	// prefetched chunk locations are used by workers for this time
+#define RA_MAXLOCATIONS 1024
+
+struct _readrec;
+
+typedef struct _rabuff {
+	uint64_t offset;
+	uint32_t size;			// requested size
+	uint32_t leng;			// valid data (less than size at the end of file)
+	uint32_t inode;
+	uint8_t state;
+	uint8_t *data;
+	struct _readrec *rrec;		// NULL - dropped by reader, worker frees buffer
+	struct _rabuff *next;		// list of reader (sorted and contiguous)
+	struct _rabuff *qnext;		// queue of workers
+} rabuff;
+
 typedef struct _readrec {
 	uint8_t *rbuff;			// this->locked
 	uint32_t rbuffsize;		// this->locked
@@ -60,6 +91,11 @@ typedef struct _readrec {
 	uint32_t ip;			// this->locked
 	uint16_t port;			// this->locked
 	int fd;				// this->locked
+	uint32_t hip;			// this->locked - second best replica (for hedged reads) ; 0 - none
+	uint16_t hport;			// this->locked
+	uint64_t raend;			// glock - end of previous read (sequential detection)
+	uint32_t rawindow;		// glock - 0 = not sequential
+	rabuff *rahead;			// glock
 	uint8_t refcnt;			// glock
 	uint8_t noaccesscnt;		// glock
 	uint8_t valid;			// glock
@@ -76,8 +112,392 @@ static pthread_t pthid;
 static pthread_mutex_t glock;
 
 static uint32_t maxretries;
+static uint32_t hedgepercentile;	// 0 - no hedged reads
 static uint8_t rterm;
 
+static rabuff *raqhead,**raqtail;	// glock
+static pthread_cond_t raqcond;		// new requests in queue
+static pthread_cond_t radonecond;	// request finished
+static uint64_t rasize,ramaxsize;	// glock - memory used by readahead buffers
+static pthread_t rapthid[RA_WORKERS];
+
+// chunk locations of readahead requests - asked for asynchronously as soon as requests are queued
+typedef struct _ralocation {
+	uint32_t inode;
+	uint32_t indx;
+	uint8_t state;			// RA_QUEUED - not sent yet, RA_INFLIGHT, RA_READY or RA_ERROR
+	uint8_t ttl;			// ticks left (RA_READY and RA_ERROR)
+	uint8_t dropped;		// removed from hash while queued or in flight - sender or callback frees it
+	uint64_t fleng;
+	uint64_t chunkid;
+	uint32_t version;
+	uint8_t *csdata;
+	uint32_t csdatasize;
+	struct _ralocation *next;	// hash
+	struct _ralocation *qnext;	// queue of locations to send
+} ralocation;
+
+// locations have their own lock, which is never destroyed - callbacks can be called after read_data_term (by fs_term)
+static pthread_mutex_t lolock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t locond = PTHREAD_COND_INITIALIZER;	// location answered
+static ralocation *ralochash[MAPSIZE];	// lolock
+static ralocation *ralocqhead,**ralocqtail;	// lolock
+static uint32_t ralocations;		// lolock
+
+enum {
+	RA_HITS = 0,
+	RA_MISSES,
+	RA_BYTES,
+	RA_STRIPED,
+	RA_LOCATED,
+	RD_HEDGED,
+	RD_HEDGEWINS,
+	STATNODES
+};
+
+static uint64_t *statsptr[STATNODES];
+
+static inline void read_stats_add(uint8_t id,uint64_t v) {
+	if (id<STATNODES) {
+		stats_lock();
+		(*statsptr[id])+=v;
+		stats_unlock();
+	}
+}
+
+/* readahead chunk locations | lolock: UNLOCKED */
+
+static inline void read_ra_location_free(ralocation *l) {
+	if (l->csdata) {
+		free(l->csdata);
+	}
+	free(l);
+	ralocations--;
+}
+
+// removes location from hash - locations waiting for sending or for answer are freed later
+static inline void read_ra_location_unlink(ralocation **lp) {
+	ralocation *l = *lp;
+	*lp = l->next;
+	if (l->state==RA_QUEUED || l->state==RA_INFLIGHT) {
+		l->dropped = 1;
+	} else {
+		read_ra_location_free(l);
+	}
+}
+
+// called with glock held (lock order: glock, lolock) - location is sent later by read_ra_location_send
+static void read_ra_location_queue(uint32_t inode,uint32_t indx) {
+	ralocation *l;
+	pthread_mutex_lock(&lolock);
+	for (l=ralochash[MAPINDX(inode)] ; l ; l=l->next) {
+		if (l->inode==inode && l->indx==indx) {
+			pthread_mutex_unlock(&lolock);
+			return;
+		}
+	}
+	if (ralocations>=RA_MAXLOCATIONS) {
+		pthread_mutex_unlock(&lolock);
+		return;
+	}
+	l = (ralocation*) malloc(sizeof(ralocation));
+	if (l==NULL) {
+		pthread_mutex_unlock(&lolock);
+		return;
+	}
+	l->inode = inode;
+	l->indx = indx;
+	l->state = RA_QUEUED;
+	l->ttl = RA_LOCATIONTICKS;
+	l->dropped = 0;
+	l->csdata = NULL;
+	l->csdatasize = 0;
+	l->next = ralochash[MAPINDX(inode)];
+	ralochash[MAPINDX(inode)] = l;
+	l->qnext = NULL;
+	*ralocqtail = l;
+	ralocqtail = &(l->qnext);
+	ralocations++;
+	pthread_mutex_unlock(&lolock);
+}
+
+// called by fs_async_thread
+static void read_ra_location_answer(uint8_t status,uint64_t length,uint64_t chunkid,uint32_t version,const uint8_t *csdata,uint32_t csdatasize,void *arg) {
+	ralocation *l = (ralocation*)arg;
+	pthread_mutex_lock(&lolock);
+	if (l->dropped) {
+		read_ra_location_free(l);
+	} else {
+		if (status==STATUS_OK && csdatasize>0) {
+			l->csdata = (uint8_t*) malloc(csdatasize);
+			if (l->csdata==NULL) {
+				status = ERROR_OUTOFMEMORY;
+			} else {
+				memcpy(l->csdata,csdata,csdatasize);
+				l->csdatasize = csdatasize;
+			}
+		}
+		l->fleng = length;
+		l->chunkid = chunkid;
+		l->version = version;
+		l->state = (status==STATUS_OK)?RA_READY:RA_ERROR;
+		l->ttl = RA_LOCATIONTICKS;
+		pthread_cond_broadcast(&locond);
+	}
+	pthread_mutex_unlock(&lolock);
+}
+
+// sends queued locations to master (called without glock)
+static void read_ra_location_send(void) {
+	ralocation *l;
+	pthread_mutex_lock(&lolock);
+	while ((l=ralocqhead)!=NULL) {
+		ralocqhead = l->qnext;
+		if (ralocqhead==NULL) {
+			ralocqtail = &ralocqhead;
+		}
+		if (l->dropped) {
+			read_ra_location_free(l);
+			continue;
+		}
+		l->state = RA_INFLIGHT;
+		pthread_mutex_unlock(&lolock);
+		if (fs_readchunk_async(l->inode,l->indx,read_ra_location_answer,l)==STATUS_OK) {
+			pthread_mutex_lock(&lolock);
+		} else {
+			pthread_mutex_lock(&lolock);
+			if (l->dropped) {
+				read_ra_location_free(l);
+			} else {
+				l->state = RA_ERROR;
+				pthread_cond_broadcast(&locond);
+			}
+		}
+	}
+	pthread_mutex_unlock(&lolock);
+}
+
+// gets prefetched location (waits for answer) ; returns 1 when location is known - csdata has to be freed by caller
+static uint8_t read_ra_location_get(uint32_t inode,uint32_t indx,uint64_t *fleng,uint64_t *chunkid,uint32_t *version,uint8_t **csdata,uint32_t *csdatasize) {
+	ralocation *l;
+	pthread_mutex_lock(&lolock);
+	for (;;) {
+		for (l=ralochash[MAPINDX(inode)] ; l && (l->inode!=inode || l->indx!=indx) ; l=l->next) {}
+		if (l==NULL || l->state==RA_ERROR || rterm) {
+			pthread_mutex_unlock(&lolock);
+			return 0;
+		}
+		if (l->state==RA_READY) {
+			break;
+		}
+		pthread_cond_wait(&locond,&lolock);	// location could be dropped meanwhile, so look for it again
+	}
+	*csdata = NULL;
+	if (l->csdatasize>0) {
+		*csdata = (uint8_t*) malloc(l->csdatasize);
+		if (*csdata==NULL) {
+			pthread_mutex_unlock(&lolock);
+			return 0;
+		}
+		memcpy(*csdata,l->csdata,l->csdatasize);
+	}
+	*fleng = l->fleng;
+	*chunkid = l->chunkid;
+	*version = l->version;
+	*csdatasize = l->csdatasize;
+	pthread_mutex_unlock(&lolock);
+	return 1;
+}
+
+// drops locations of inode (all chunks when indx==UINT32_MAX)
+static void read_ra_location_drop(uint32_t inode,uint32_t indx) {
+	ralocation **lp;
+	pthread_mutex_lock(&lolock);
+	lp = ralochash+MAPINDX(inode);
+	while (*lp) {
+		if ((*lp)->inode==inode && (indx==UINT32_MAX || (*lp)->indx==indx)) {
+			read_ra_location_unlink(lp);
+		} else {
+			lp = &((*lp)->next);
+		}
+	}
+	pthread_cond_broadcast(&locond);
+	pthread_mutex_unlock(&lolock);
+}
+
+// called every tick
+static void read_ra_location_expire(void) {
+	ralocation **lp;
+	uint32_t i;
+	pthread_mutex_lock(&lolock);
+	for (i=0 ; i<MAPSIZE ; i++) {
+		lp = ralochash+i;
+		while (*lp) {
+			if (((*lp)->state==RA_READY || (*lp)->state==RA_ERROR) && ((*lp)->ttl==0 || --((*lp)->ttl)==0)) {
+				read_ra_location_unlink(lp);
+			} else {
+				lp = &((*lp)->next);
+			}
+		}
+	}
+	pthread_mutex_unlock(&lolock);
+}
+
+/* readahead buffers | glock: LOCKED */
+
+static inline void read_ra_free(rabuff *b) {
+	rasize -= b->size;
+	free(b->data);
+	free(b);
+}
+
+// drops all buffers of reader - buffers being read (or waiting for worker) are left to workers
+static void read_ra_drop(readrec *rrec) {
+	rabuff *b,*bn;
+	for (b=rrec->rahead ; b ; b=bn) {
+		bn = b->next;
+		if (b->state==RA_QUEUED || b->state==RA_INFLIGHT) {
+			b->rrec = NULL;
+		} else {
+			read_ra_free(b);
+		}
+	}
+	rrec->rahead = NULL;
+	rrec->rawindow = 0;
+	pthread_cond_broadcast(&radonecond);
+}
+
+// frees buffers which end before 'pos' - each consumed buffer doubles window
+static void read_ra_consume(readrec *rrec,uint64_t pos) {
+	rabuff *b;
+	while ((b=rrec->rahead)!=NULL && b->offset+b->size<=pos && (b->state==RA_READY || b->state==RA_ERROR)) {
+		rrec->rahead = b->next;
+		read_ra_free(b);
+		if (rrec->rawindow<RA_MAXWINDOW) {
+			rrec->rawindow *= 2;
+			if (rrec->rawindow>RA_MAXWINDOW) {
+				rrec->rawindow = RA_MAXWINDOW;
+			}
+		}
+	}
+}
+
+// queues requests up to 'raend+rawindow' (not above file length and global limit)
+static void read_ra_schedule(readrec *rrec) {
+	rabuff *b,**bp;
+	uint64_t pos,wend;
+	uint32_t size,indx;
+	bp = &(rrec->rahead);
+	pos = rrec->raend;
+	while (*bp) {
+		pos = (*bp)->offset+(*bp)->size;
+		bp = &((*bp)->next);
+	}
+	wend = rrec->raend+rrec->rawindow;
+	if (wend>rrec->fleng) {
+		wend = rrec->fleng;
+	}
+	indx = UINT32_MAX;
+	while (pos<wend && rasize+RA_REQSIZE<=ramaxsize) {
+		size = MFSCHUNKSIZE-(pos&MFSCHUNKMASK);
+		if (size>RA_REQSIZE) {
+			size = RA_REQSIZE;
+		}
+		if (pos+size>wend) {
+			size = wend-pos;
+		}
+		b = (rabuff*) malloc(sizeof(rabuff));
+		if (b==NULL) {
+			return;
+		}
+		b->data = (uint8_t*) malloc(size);
+		if (b->data==NULL) {
+			free(b);
+			return;
+		}
+		if (indx!=(pos>>MFSCHUNKBITS)) {	// first request in chunk
+			indx = pos>>MFSCHUNKBITS;
+			read_ra_location_queue(rrec->inode,indx);
+		}
+		b->offset = pos;
+		b->size = size;
+		b->leng = 0;
+		b->inode = rrec->inode;
+		b->state = RA_QUEUED;
+		b->rrec = rrec;
+		b->next = NULL;
+		*bp = b;
+		bp = &(b->next);
+		b->qnext = NULL;
+		*raqtail = b;
+		raqtail = &(b->qnext);
+		rasize += size;
+		pos += size;
+		pthread_cond_signal(&raqcond);
+	}
+}
+
+// copies [offset,offset+size) to rrec->rbuff when all data are in readahead buffers (waits for requests in progress) ; returns 1 on hit
+static uint8_t read_ra_get(readrec *rrec,uint64_t offset,uint32_t size) {
+	rabuff *b;
+	uint64_t pos,end;
+	uint32_t boff,leng;
+	uint8_t hit;
+
+	b = NULL;
+	pthread_mutex_lock(&glock);
+	if (offset!=rrec->raend && (rrec->rahead==NULL || offset<rrec->rahead->offset || offset>=rrec->raend+rrec->rawindow)) {
+		// random access - readahead is started again by next sequential read
+		read_ra_drop(rrec);
+		rrec->raend = offset+size;
+		pthread_mutex_unlock(&glock);
+		return 0;
+	}
+	if (rrec->rawindow==0) {
+		rrec->rawindow = RA_MINWINDOW;
+	}
+	read_ra_consume(rrec,offset);
+	pos = offset;
+	end = offset+size;
+	hit = 1;
+	while (pos<end) {
+		for (b=rrec->rahead ; b && b->offset+b->size<=pos ; b=b->next) {}
+		if (b==NULL || b->offset>pos) {
+			hit = 0;
+		} else if (b->state==RA_QUEUED || b->state==RA_INFLIGHT) {
+			pthread_cond_wait(&radonecond,&glock);	// buffers could be dropped meanwhile, so look for buffer again
+			continue;
+		} else if (b->state==RA_ERROR || pos>=b->offset+b->leng) {	// error or end of file (file could grow) - leave it to normal read
+			hit = 0;
+		} else {
+			boff = pos-b->offset;
+			leng = b->leng-boff;
+			if (leng>end-pos) {
+				leng = end-pos;
+			}
+			memcpy(rrec->rbuff+(pos-offset),b->data+boff,leng);
+			pos += leng;
+			continue;
+		}
+		break;
+	}
+	if (hit==0 && b!=NULL && b->state==RA_ERROR) {
+		read_ra_drop(rrec);
+		rrec->rawindow = RA_MINWINDOW;
+	}
+	rrec->raend = end;
+	read_ra_schedule(rrec);
+	pthread_mutex_unlock(&glock);
+	read_ra_location_send();
+	if (hit) {
+		read_stats_add(RA_HITS,1);
+		read_stats_add(RA_BYTES,size);
+	} else {
+		read_stats_add(RA_MISSES,1);
+	}
+	return hit;
+}
+
 #define TIMEDIFF(tv1,tv2) (((int64_t)((tv1).tv_sec-(tv2).tv_sec))*1000000LL+(int64_t)((tv1).tv_usec-(tv2).tv_usec))
 
 void* read_data_delayed_ops(void *arg) {
@@ -109,11 +529,14 @@ void* read_data_delayed_ops(void *arg) {
 					}
 					free(rrec);
 				} else {
-					if (rrec->fd>=0) {
+					if (rrec->fd>=0 || rrec->rahead) {
 						if (rrec->noaccesscnt==CLOSEDELAYTICKS) {
-							csdb_readdec(rrec->ip,rrec->port);
-							tcpclose(rrec->fd);
-							rrec->fd=-1;
+							if (rrec->fd>=0) {
+								csdb_readdec(rrec->ip,rrec->port);
+								csdb_putconn(rrec->ip,rrec->port,rrec->fd);
+								rrec->fd=-1;
+							}
+							read_ra_drop(rrec);
 						} else {
 							rrec->noaccesscnt++;
 						}
@@ -125,6 +548,8 @@ void* read_data_delayed_ops(void *arg) {
 			}
 		}
 		pthread_mutex_unlock(&glock);
+		read_ra_location_expire();
+		csdb_cleanup();
 		usleep(USECTICK);
 	}
 }
@@ -142,6 +567,11 @@ void* read_data_new(uint32_t inode) {
 	rrec->fd = -1;
 	rrec->ip = 0;
 	rrec->port = 0;
+	rrec->hip = 0;
+	rrec->hport = 0;
+	rrec->raend = 0;
+	rrec->rawindow = 0;
+	rrec->rahead = NULL;
 	rrec->refcnt = 0;
 	rrec->noaccesscnt = 0;
 	rrec->valid = 1;
@@ -170,11 +600,12 @@ void read_data_end(void* rr) {
 	rrec->waiting--;
 	rrec->locked = 1;
 	rrec->valid = 0;
+	read_ra_drop(rrec);
 	pthread_mutex_unlock(&glock);
 
 	if (rrec->fd>=0) {
 		csdb_readdec(rrec->ip,rrec->port);
-		tcpclose(rrec->fd);
+		csdb_putconn(rrec->ip,rrec->port,rrec->fd);
 		rrec->fd=-1;
 	}
 	if (rrec->rbuff!=NULL) {
@@ -190,31 +621,467 @@ void read_data_end(void* rr) {
 	pthread_mutex_unlock(&glock);
 }
 
-void read_data_init(uint32_t retries) {
+// chooses chunkserver with the best score (latency, errors and number of operations) ; skipip/skipport - not this one
+static void read_data_choose_cs(const uint8_t *csdata,uint32_t csdatasize,uint32_t skipip,uint16_t skipport,uint32_t *ip,uint16_t *port) {
+	uint32_t tmpip;
+	uint16_t tmpport;
+	uint64_t score,bestscore;
+	*ip = 0;
+	*port = 0;
+	bestscore = UINT64_MAX;
+	while (csdatasize>=6) {
+		tmpip = get32bit(&csdata);
+		tmpport = get16bit(&csdata);
+		csdatasize-=6;
+		if (tmpip==skipip && tmpport==skipport) {
+			continue;
+		}
+		score = csdb_getreadscore(tmpip,tmpport);
+		if (score<bestscore) {
+			*ip = tmpip;
+			*port = tmpport;
+			bestscore = score;
+		}
+	}
+}
+
+// updates statistics of chunkservers after hedged read (cs_readhedged)
+static void read_data_hedge_stats(const csreplica *rep,uint32_t hedgeusec,uint32_t ip,uint16_t port,uint32_t hip,uint16_t hport) {
+	uint32_t latency;
+	latency = rep[0].latency;
+	if (latency==0 && rep[0].broken==CS_BROKEN_LOST) {	// it hasn't answered until the other replica sent everything
+		latency = hedgeusec+rep[1].usec;
+	}
+	if (latency>0 || rep[0].broken==CS_BROKEN_ERROR) {
+		csdb_readstat(ip,port,latency,(rep[0].broken==CS_BROKEN_ERROR)?1:0);
+	}
+	if (rep[1].fd>=0) {
+		read_stats_add(RD_HEDGED,1);
+		if (rep[1].latency>0 || rep[1].broken==CS_BROKEN_ERROR) {
+			csdb_readstat(hip,hport,rep[1].latency,(rep[1].broken==CS_BROKEN_ERROR)?1:0);
+		}
+		if (rep[1].bytes>0) {
+			read_stats_add(RD_HEDGEWINS,1);
+		}
+	}
+}
+
+// returns delay of hedged read (0 - don't hedge)
+static inline uint32_t read_data_hedge_delay(void) {
+	return (hedgepercentile>0)?csdb_getreadpercentile(hedgepercentile):0;
+}
+
+// returns connected socket (idle one from pool or new) or -1 (connection is not counted in csdb)
+static int read_data_connect(uint32_t ip,uint16_t port,uint32_t tries) {
+	uint32_t srcip;
+	uint32_t cnt;
+	int fd;
+
+	fd = csdb_getconn(ip,port);
+	if (fd>=0) {
+		return fd;
+	}
+	srcip = fs_getsrcip();
+	fd = -1;
+	cnt=0;
+	while (cnt<tries) {
+		fd = tcpsocket();
+		if (fd<0) {
+			syslog(LOG_WARNING,"can't create tcp socket: %s",strerr(errno));
+			break;
+		}
+		if (srcip) {
+			if (tcpnumbind(fd,srcip,0)<0) {
+				syslog(LOG_WARNING,"can't bind to given ip: %s",strerr(errno));
+				tcpclose(fd);
+				fd=-1;
+				break;
+			}
+		}
+		if (tcpnumtoconnect(fd,ip,port,(cnt%2)?(300*(1<<(cnt>>1))):(200*(1<<(cnt>>1))))<0) {
+			cnt++;
+			if (cnt>=tries) {
+				syslog(LOG_WARNING,"can't connect to (%08" PRIX32 ":%" PRIu16 "): %s",ip,port,strerr(errno));
+			}
+			tcpclose(fd);
+			fd=-1;
+		} else {
+			cnt=tries;
+		}
+	}
+	if (fd<0) {
+		return -1;
+	}
+	if (tcpnodelay(fd)<0) {
+		syslog(LOG_WARNING,"can't set TCP_NODELAY: %s",strerr(errno));
+	}
+	return fd;
+}
+
+/* readahead workers */
+
+typedef struct _raconn {
+	int fd;
+	uint32_t ip;
+	uint16_t port;
+} raconn;
+
+// connection is still usable - goes back to pool
+static inline void read_ra_release(raconn *conn) {
+	if (conn->fd>=0) {
+		csdb_readdec(conn->ip,conn->port);
+		csdb_putconn(conn->ip,conn->port,conn->fd);
+		conn->fd = -1;
+	}
+}
+
+static inline void read_ra_disconnect(raconn *conn) {
+	if (conn->fd>=0) {
+		csdb_readdec(conn->ip,conn->port);
+		tcpclose(conn->fd);
+		conn->fd = -1;
+	}
+}
+
+// returns worker's connection to given chunkserver - reuses the existing one or connects in free
+// slot (or in slot of chunkserver which is not one of the current replicas) ; NULL on error
+static raconn* read_ra_getconn(raconn *conns,uint32_t ip,uint16_t port,const uint32_t *ips,const uint16_t *ports,uint32_t cnt) {
+	uint32_t i,j;
+	raconn *conn;
+	conn = NULL;
+	for (i=0 ; i<CS_MAXSTRIPES ; i++) {
+		if (conns[i].fd>=0 && conns[i].ip==ip && conns[i].port==port) {
+			return conns+i;
+		}
+		if (conn==NULL && conns[i].fd<0) {
+			conn = conns+i;
+		}
+	}
+	for (i=0 ; i<CS_MAXSTRIPES && conn==NULL ; i++) {
+		for (j=0 ; j<cnt && (ips[j]!=conns[i].ip || ports[j]!=conns[i].port) ; j++) {}
+		if (j==cnt) {
+			read_ra_release(conns+i);
+			conn = conns+i;
+		}
+	}
+	if (conn==NULL) {
+		return NULL;
+	}
+	conn->fd = read_data_connect(ip,port,2);
+	if (conn->fd<0) {
+		return NULL;
+	}
+	conn->ip = ip;
+	conn->port = port;
+	csdb_readinc(ip,port);
+	return conn;
+}
+
+typedef struct _rahedge {
+	raconn *conns;
+	uint32_t ips[2];
+	uint16_t ports[2];
+	raconn *conn;		// out
+} rahedge;
+
+static int read_ra_hedgeconnect(void *arg) {
+	rahedge *h = (rahedge*)arg;
+	h->conn = read_ra_getconn(h->conns,h->ips[1],h->ports[1],h->ips,h->ports,2);
+	if (h->conn==NULL) {
+		csdb_readstat(h->ips[1],h->ports[1],0,1);
+		return -1;
+	}
+	return h->conn->fd;
+}
+
+// reads request from all replicas at once (parts proportional to their measured speed) ; returns 0 on success, 1 when there are no two usable replicas and -1 on error
+static int read_ra_fetch_striped(raconn *conns,const uint32_t *ips,const uint16_t *ports,uint32_t cnt,uint64_t chunkid,uint32_t version,uint32_t offset,uint32_t size,uint8_t *buff) {
+	raconn *rc[CS_MAXSTRIPES];
+	csreplica rep[CS_MAXSTRIPES];
+	uint32_t i,n,speed,known,sum;
+	int status;
+
+	n = 0;
+	known = 0;
+	sum = 0;
+	for (i=0 ; i<cnt ; i++) {
+		rc[n] = read_ra_getconn(conns,ips[i],ports[i],ips,ports,cnt);
+		if (rc[n]!=NULL) {
+			speed = csdb_getreadspeed(ips[i],ports[i]);
+			rep[n].fd = rc[n]->fd;
+			rep[n].weight = speed;
+			if (speed>0) {
+				known++;
+				sum += (speed<0x1000000)?speed:0x1000000;
+			}
+			n++;
+		}
+	}
+	if (n<2) {
+		return 1;
+	}
+	// not measured chunkservers get average speed of the others (all equal when nothing is known)
+	for (i=0 ; i<n ; i++) {
+		if (rep[i].weight==0) {
+			rep[i].weight = (known>0)?sum/known:1;
+		} else if (rep[i].weight>0x1000000) {
+			rep[i].weight = 0x1000000;
+		}
+	}
+	status = cs_readstriped(rep,n,chunkid,version,offset,size,buff);
+	for (i=0 ; i<n ; i++) {
+		if (rep[i].bytes>0) {
+			csdb_readspeed(rc[i]->ip,rc[i]->port,rep[i].bytes,rep[i].usec);
+		}
+		if (rep[i].latency>0 || rep[i].broken==CS_BROKEN_ERROR) {
+			csdb_readstat(rc[i]->ip,rc[i]->port,rep[i].latency,(rep[i].broken==CS_BROKEN_ERROR)?1:0);
+		}
+		if (rep[i].broken) {
+			read_ra_disconnect(rc[i]);
+		}
+	}
+	if (status==0) {
+		read_stats_add(RA_STRIPED,1);
+	}
+	return status;
+}
+
+// reads one request (without retries - reader reads data again when request fails) ; returns 0 on success
+static int read_ra_fetch(raconn *conns,rabuff *b,uint8_t **locdata) {
+	uint64_t fleng,chunkid;
+	uint32_t version,size;
+	const uint8_t *csdata;
+	uint32_t csdatasize;
+	uint32_t ip;
+	uint16_t port;
+	uint32_t ips[CS_MAXSTRIPES];
+	uint16_t ports[CS_MAXSTRIPES];
+	uint32_t cnt,hedgeusec;
+	csreplica rep[2];
+	rahedge h;
+	raconn *conn;
+	int status;
+
+	if (read_ra_location_get(b->inode,b->offset>>MFSCHUNKBITS,&fleng,&chunkid,&version,locdata,&csdatasize)) {
+		csdata = *locdata;
+		read_stats_add(RA_LOCATED,1);
+	} else if (fs_readchunk(b->inode,b->offset>>MFSCHUNKBITS,&fleng,&chunkid,&version,&csdata,&csdatasize)!=STATUS_OK) {
+		return -1;
+	}
+	if (b->offset>=fleng) {
+		b->leng = 0;
+		return 0;
+	}
+	size = b->size;
+	if (b->offset+size>fleng) {
+		size = fleng-b->offset;
+	}
+	if (chunkid==0 && csdata==NULL && csdatasize==0) {
+		memset(b->data,0,size);
+		b->leng = size;
+		return 0;
+	}
+	if (size>=RA_STRIPEMIN && csdatasize>=12) {
+		for (cnt=0 ; cnt<CS_MAXSTRIPES && (cnt+1)*6<=csdatasize ; cnt++) {
+			ips[cnt] = get32bit(&csdata);
+			ports[cnt] = get16bit(&csdata);
+		}
+		status = read_ra_fetch_striped(conns,ips,ports,cnt,chunkid,version,b->offset&MFSCHUNKMASK,size,b->data);
+		if (status<=0) {
+			if (status==0) {
+				b->leng = size;
+			}
+			return status;
+		}
+		csdata -= cnt*6;
+	}
+	read_data_choose_cs(csdata,csdatasize,0,0,&ip,&port);
+	if (ip==0 || port==0) {
+		return -1;
+	}
+	h.ips[0] = ip;
+	h.ports[0] = port;
+	read_data_choose_cs(csdata,csdatasize,ip,port,h.ips+1,h.ports+1);
+	conn = read_ra_getconn(conns,ip,port,h.ips,h.ports,(h.ips[1]>0)?2:1);
+	if (conn==NULL) {
+		csdb_readstat(ip,port,0,1);
+		return -1;
+	}
+	h.conns = conns;
+	h.conn = NULL;
+	hedgeusec = (h.ips[1]>0)?read_data_hedge_delay():0;
+	rep[0].fd = conn->fd;
+	status = cs_readhedged(rep,hedgeusec,read_ra_hedgeconnect,&h,chunkid,version,b->offset&MFSCHUNKMASK,size,b->data);
+	read_data_hedge_stats(rep,hedgeusec,ip,port,h.ips[1],h.ports[1]);
+	if (rep[0].bytes>0) {
+		csdb_readspeed(ip,port,size,rep[0].usec);
+	}
+	if (rep[1].bytes>0) {
+		csdb_readspeed(h.ips[1],h.ports[1],size,rep[1].usec);
+	}
+	if (rep[0].broken) {
+		read_ra_disconnect(conn);
+	}
+	if (h.conn!=NULL && rep[1].broken) {
+		read_ra_disconnect(h.conn);
+	}
+	if (status<0) {
+		return -1;
+	}
+	b->leng = size;
+	return 0;
+}
+
+void* read_ra_worker(void *arg) {
+	raconn conns[CS_MAXSTRIPES];
+	rabuff *b;
+	uint8_t *locdata;
+	struct timeval tv;
+	struct timespec ts;
+	int status;
+	uint32_t i,connected;
+	(void)arg;
+
+	for (i=0 ; i<CS_MAXSTRIPES ; i++) {
+		conns[i].fd = -1;
+	}
+	pthread_mutex_lock(&glock);
+	for (;;) {
+		while (raqhead==NULL && rterm==0) {
+			for (i=0,connected=0 ; i<CS_MAXSTRIPES ; i++) {
+				if (conns[i].fd>=0) {
+					connected = 1;
+				}
+			}
+			if (connected) {	// close idle connections
+				gettimeofday(&tv,NULL);
+				ts.tv_sec = tv.tv_sec+RA_IDLEUSEC/1000000;
+				ts.tv_nsec = (tv.tv_usec+RA_IDLEUSEC%1000000)*1000;
+				if (ts.tv_nsec>=1000000000) {
+					ts.tv_sec++;
+					ts.tv_nsec-=1000000000;
+				}
+				if (pthread_cond_timedwait(&raqcond,&glock,&ts)==ETIMEDOUT && raqhead==NULL) {
+					pthread_mutex_unlock(&glock);
+					for (i=0 ; i<CS_MAXSTRIPES ; i++) {
+						read_ra_release(conns+i);
+					}
+					pthread_mutex_lock(&glock);
+				}
+			} else {
+				pthread_cond_wait(&raqcond,&glock);
+			}
+		}
+		if (rterm) {
+			break;
+		}
+		b = raqhead;
+		raqhead = b->qnext;
+		if (raqhead==NULL) {
+			raqtail = &raqhead;
+		}
+		if (b->rrec==NULL) {
+			read_ra_free(b);
+			continue;
+		}
+		b->state = RA_INFLIGHT;
+		pthread_mutex_unlock(&glock);
+		locdata = NULL;
+		status = read_ra_fetch(conns,b,&locdata);
+		if (locdata!=NULL) {
+			free(locdata);
+		}
+		if (status!=0) {	// location could be out of date
+			read_ra_location_drop(b->inode,b->offset>>MFSCHUNKBITS);
+		}
+		pthread_mutex_lock(&glock);
+		if (b->rrec==NULL) {
+			read_ra_free(b);
+		} else {
+			b->state = (status==0)?RA_READY:RA_ERROR;
+			pthread_cond_broadcast(&radonecond);
+		}
+	}
+	pthread_mutex_unlock(&glock);
+	for (i=0 ; i<CS_MAXSTRIPES ; i++) {
+		read_ra_release(conns+i);
+	}
+	return arg;
+}
+
+void read_data_init(uint32_t retries,uint32_t readaheadsize,uint32_t hedgepercent) {
 	uint32_t i;
 	pthread_attr_t thattr;
+	void *s;
 
 	rterm = 0;
 	for (i=0 ; i<MAPSIZE ; i++) {
 		rdinodemap[i]=NULL;
 	}
 	maxretries=retries;
+	hedgepercentile=hedgepercent;
+	raqhead = NULL;
+	raqtail = &raqhead;
+	rasize = 0;
+	ramaxsize = readaheadsize;
+	for (i=0 ; i<MAPSIZE ; i++) {
+		ralochash[i]=NULL;
+	}
+	ralocqhead = NULL;
+	ralocqtail = &ralocqhead;
+	ralocations = 0;
+	s = stats_get_subnode(NULL,"readahead",0);
+	statsptr[RA_HITS] = stats_get_counterptr(stats_get_subnode(s,"hits",0));
+	statsptr[RA_MISSES] = stats_get_counterptr(stats_get_subnode(s,"misses",0));
+	statsptr[RA_BYTES] = stats_get_counterptr(stats_get_subnode(s,"bytes",0));
+	statsptr[RA_STRIPED] = stats_get_counterptr(stats_get_subnode(s,"striped",0));
+	statsptr[RA_LOCATED] = stats_get_counterptr(stats_get_subnode(s,"located",0));
+	s = stats_get_subnode(NULL,"hedgedreads",0);
+	statsptr[RD_HEDGED] = stats_get_counterptr(stats_get_subnode(s,"sent",0));
+	statsptr[RD_HEDGEWINS] = stats_get_counterptr(stats_get_subnode(s,"won",0));
 	pthread_mutex_init(&glock,NULL);
+	pthread_cond_init(&raqcond,NULL);
+	pthread_cond_init(&radonecond,NULL);
 	pthread_attr_init(&thattr);
 	pthread_attr_setstacksize(&thattr,0x100000);
 	pthread_create(&pthid,&thattr,read_data_delayed_ops,NULL);
+	if (ramaxsize>0) {
+		for (i=0 ; i<RA_WORKERS ; i++) {
+			pthread_create(rapthid+i,&thattr,read_ra_worker,NULL);
+		}
+	}
 	pthread_attr_destroy(&thattr);
 }
 
 void read_data_term(void) {
 	uint32_t i;
 	readrec *rr,*rrn;
+	rabuff *b;
+	ralocation *l;
 
 	pthread_mutex_lock(&glock);
 	rterm = 1;
+	pthread_cond_broadcast(&raqcond);
 	pthread_mutex_unlock(&glock);
+	pthread_mutex_lock(&lolock);
+	pthread_cond_broadcast(&locond);
+	pthread_mutex_unlock(&lolock);
 	pthread_join(pthid,NULL);
+	if (ramaxsize>0) {
+		for (i=0 ; i<RA_WORKERS ; i++) {
+			pthread_join(rapthid[i],NULL);
+		}
+	}
+	pthread_cond_destroy(&radonecond);
+	pthread_cond_destroy(&raqcond);
 	pthread_mutex_destroy(&glock);
+	// workers are finished, so all buffers are either in queue (dropped ones) or in readers lists
+	while ((b=raqhead)!=NULL) {
+		raqhead = b->qnext;
+		if (b->rrec==NULL) {
+			read_ra_free(b);
+		}
+	}
 	for (i=0 ; i<MAPSIZE ; i++) {
 		for (rr = rdinodemap[i] ; rr ; rr = rrn) {
 			rrn = rr->next;
@@ -224,26 +1091,41 @@ void read_data_term(void) {
 			if (rr->rbuff!=NULL) {
 				free(rr->rbuff);
 			}
+			while ((b=rr->rahead)!=NULL) {
+				rr->rahead = b->next;
+				read_ra_free(b);
+			}
 			pthread_cond_destroy(&(rr->cond));
 			free(rr);
 		}
 		rdinodemap[i] = NULL;
 	}
+	// locations waiting for answers are freed by callbacks
+	pthread_mutex_lock(&lolock);
+	for (i=0 ; i<MAPSIZE ; i++) {
+		while (ralochash[i]) {
+			read_ra_location_unlink(ralochash+i);
+		}
+	}
+	while ((l=ralocqhead)!=NULL) {
+		ralocqhead = l->qnext;
+		read_ra_location_free(l);
+	}
+	ralocqtail = &ralocqhead;
+	pthread_mutex_unlock(&lolock);
 }
 
 static int read_data_refresh_connection(readrec *rrec) {
-	uint32_t ip,tmpip;
-	uint16_t port,tmpport;
-	uint32_t cnt,bestcnt;
+	uint32_t ip;
+	uint16_t port;
 	const uint8_t *csdata;
 	uint32_t csdatasize;
 	uint8_t status;
-	uint32_t srcip;
 
 //	fprintf(stderr,"read_data_refresh_connection (%p)\n",rrec);
 	if (rrec->fd>=0) {
 		csdb_readdec(rrec->ip,rrec->port);
-		tcpclose(rrec->fd);
+		csdb_putconn(rrec->ip,rrec->port,rrec->fd);
 		rrec->fd = -1;
 	}
 	status = fs_readchunk(rrec->inode,rrec->indx,&(rrec->fleng),&(rrec->chunkid),&(rrec->version),&csdata,&csdatasize);
@@ -262,63 +1144,21 @@ static int read_data_refresh_connection(readrec *rrec) {
 		syslog(LOG_WARNING,"file: %" PRIu32 ", index: %" PRIu32 ", chunk: %" PRIu64 ", version: %" PRIu32 " - there are no valid copies",rrec->inode,rrec->indx,rrec->chunkid,rrec->version);
 		return ENXIO;
 	}
-	ip = 0;
-	port = 0;
-	// choose cs
-	bestcnt = 0xFFFFFFFF;
-	while (csdatasize>=6 && bestcnt>0) {
-		tmpip = get32bit(&csdata);
-		tmpport = get16bit(&csdata);
-		csdatasize-=6;
-		cnt = csdb_getopcnt(tmpip,tmpport);
-		if (cnt<bestcnt) {
-			ip = tmpip;
-			port = tmpport;
-			bestcnt = cnt;
-		}
-	}
+	read_data_choose_cs(csdata,csdatasize,0,0,&ip,&port);
 	if (ip==0 || port==0) {	// this always should be false
 		syslog(LOG_WARNING,"file: %" PRIu32 ", index: %" PRIu32 ", chunk: %" PRIu64 ", version: %" PRIu32 " - there are no valid copies",rrec->inode,rrec->indx,rrec->chunkid,rrec->version);
 		return ENXIO;
 	}
 	rrec->ip = ip;
 	rrec->port = port;
+	read_data_choose_cs(csdata,csdatasize,ip,port,&(rrec->hip),&(rrec->hport));
 
-	srcip = fs_getsrcip();
-	cnt=0;
-	while (cnt<10) {
-		rrec->fd = tcpsocket();
-		if (rrec->fd<0) {
-			syslog(LOG_WARNING,"can't create tcp socket: %s",strerr(errno));
-			break;
-		}
-		if (srcip) {
-			if (tcpnumbind(rrec->fd,srcip,0)<0) {
-				syslog(LOG_WARNING,"can't bind to given ip: %s",strerr(errno));
-				tcpclose(rrec->fd);
-				rrec->fd=-1;
-				break;
-			}
-		}
-		if (tcpnumtoconnect(rrec->fd,ip,port,(cnt%2)?(300*(1<<(cnt>>1))):(200*(1<<(cnt>>1))))<0) {
-			cnt++;
-			if (cnt>=10) {
-				syslog(LOG_WARNING,"can't connect to (%08" PRIX32 ":%" PRIu16 "): %s",ip,port,strerr(errno));
-			}
-			tcpclose(rrec->fd);
-			rrec->fd=-1;
-		} else {
-			cnt=10;
-		}
-	}
+	rrec->fd = read_data_connect(ip,port,10);
 	if (rrec->fd<0) {
+		csdb_readstat(ip,port,0,1);
 		return EIO;
 	}
 
-	if (tcpnodelay(rrec->fd)<0) {
-		syslog(LOG_WARNING,"can't set TCP_NODELAY: %s",strerr(errno));
-	}
-
 	csdb_readinc(rrec->ip,rrec->port);
 	pthread_mutex_lock(&glock);
 	rrec->refcnt = 0;
@@ -326,6 +1166,48 @@ static int read_data_refresh_connection(readrec *rrec) {
 	return 0;
 }
 
+static int read_data_hedgeconnect(void *arg) {
+	readrec *rrec = (readrec*)arg;
+	int fd;
+	fd = read_data_connect(rrec->hip,rrec->hport,1);
+	if (fd<0) {
+		csdb_readstat(rrec->hip,rrec->hport,0,1);
+		return -1;
+	}
+	csdb_readinc(rrec->hip,rrec->hport);
+	return fd;
+}
+
+// reads data from current chunkserver (hedged by the second best one) ; returns 0 or -1 (connection has to be closed)
+static int read_data_readblock(readrec *rrec,uint32_t offset,uint32_t size,uint8_t *buff) {
+	csreplica rep[2];
+	uint32_t hedgeusec,tmpip;
+	uint16_t tmpport;
+	int status;
+
+	hedgeusec = (rrec->hip>0)?read_data_hedge_delay():0;
+	rep[0].fd = rrec->fd;
+	status = cs_readhedged(rep,hedgeusec,read_data_hedgeconnect,rrec,rrec->chunkid,rrec->version,offset,size,buff);
+	read_data_hedge_stats(rep,hedgeusec,rrec->ip,rrec->port,rrec->hip,rrec->hport);
+	if (rep[1].fd>=0) {
+		if (status==1) {	// second replica was faster - reader stays with it
+			csdb_readdec(rrec->ip,rrec->port);
+			tcpclose(rrec->fd);
+			rrec->fd = rep[1].fd;
+			tmpip = rrec->ip;
+			tmpport = rrec->port;
+			rrec->ip = rrec->hip;
+			rrec->port = rrec->hport;
+			rrec->hip = tmpip;
+			rrec->hport = tmpport;
+			return 0;
+		}
+		csdb_readdec(rrec->hip,rrec->hport);
+		tcpclose(rep[1].fd);
+	}
+	return (status==0)?0:-1;
+}
+
 void read_inode_ops(uint32_t inode) {	// attributes of inode have been changed - force reconnect
 	readrec *rrec;
 	pthread_mutex_lock(&glock);
@@ -333,9 +1215,11 @@ void read_inode_ops(uint32_t inode) {	// attributes of inode have been changed -
 		if (rrec->inode==inode) {
 			rrec->noaccesscnt=CLOSEDELAYTICKS;	// if no access then close socket as soon as possible
 			rrec->refcnt=REFRESHTICKS;		// force reconnect on forthcoming access
+			read_ra_drop(rrec);			// data read ahead could be changed
 		}
 	}
 	pthread_mutex_unlock(&glock);
+	read_ra_location_drop(inode,UINT32_MAX);
 }
 
 int read_data(void *rr, uint64_t offset, uint32_t *size, uint8_t **buff) {
@@ -363,9 +1247,9 @@ int read_data(void *rr, uint64_t offset, uint32_t *size, uint8_t **buff) {
 	forcereconnect = (rrec->fd>=0 && rrec->refcnt==REFRESHTICKS)?1:0;
 	pthread_mutex_unlock(&glock);
 
-	if (forcereconnect) {
+	if (forcereconnect) {	// chunk location is refreshed - connection to the same chunkserver will be taken from pool
 		csdb_readdec(rrec->ip,rrec->port);
-		tcpclose(rrec->fd);
+		csdb_putconn(rrec->ip,rrec->port,rrec->fd);
 		rrec->fd=-1;
 	}
 
@@ -388,6 +1272,13 @@ int read_data(void *rr, uint64_t offset, uint32_t *size, uint8_t **buff) {
 				return ENOMEM;	// out of memory
 			}
 		}
+		if (ramaxsize>0 && read_ra_get(rrec,offset,*size)) {
+			*buff = rrec->rbuff;
+			pthread_mutex_lock(&glock);
+			rrec->noaccesscnt=0;
+			pthread_mutex_unlock(&glock);
+			return 0;
+		}
 	}
 
 	err = EIO;
@@ -454,7 +1345,7 @@ int read_data(void *rr, uint64_t offset, uint32_t *size, uint8_t **buff) {
 		}
 		if (rrec->chunkid>0) {
 			// fprintf(stderr,"(%d,%" PRIu64 ",%" PRIu32 ",%" PRIu32 ",%" PRIu32 ",%p)\n",rrec->fd,rrec->chunkid,rrec->version,chunkoffset,chunksize,buffptr);
-			if (cs_readblock(rrec->fd,rrec->chunkid,rrec->version,chunkoffset,chunksize,buffptr)<0) {
+			if (read_data_readblock(rrec,chunkoffset,chunksize,buffptr)<0) {
 				syslog(LOG_WARNING,"file: %" PRIu32 ", index: %" PRIu32 ", chunk: %" PRIu64 ", version: %" PRIu32 ", cs: %08" PRIX32 ":%" PRIu16 " - readblock error (try counter: %" PRIu32 ")",rrec->inode,rrec->indx,rrec->chunkid,rrec->version,rrec->ip,rrec->port,cnt);
 				csdb_readdec(rrec->ip,rrec->port);
 				tcpclose(rrec->fd);
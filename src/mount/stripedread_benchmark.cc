@@ -0,0 +1,216 @@
+// Measures single stream read throughput of one client from a chunk stored in 1, 2 and 3 copies
+// (goal 1..3) - the whole request read from one replica (cs_readblock) and split among all
+// replicas (cs_readstriped, used by mfsmount readahead workers).
+// Usage: stripedread_benchmark [mbps [total_mb [slow_factor]]]
+// Replicas are fake chunkservers on loopback, each one sending data at most 'mbps' MiB/s
+// (default 100). With slow_factor>1 the last replica is that many times slower, which shows
+// how measured speeds and hedging keep one slow chunkserver from stalling the reader.
+
+#include "config.h"
+
+#include <inttypes.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+#include "MFSCommunication.h"
+#include "datapack.h"
+#include "sockets.h"
+#include "crc.h"
+#include "cscomm.h"
+
+#define REPLICAS 3
+#define REQSIZE (1024*1024)
+
+typedef struct _fakecs {
+	int lsock;
+	uint16_t port;
+	uint32_t rate;	// bytes per second
+} fakecs;
+
+static fakecs servers[REPLICAS];
+static uint8_t chunkdata[MFSBLOCKSIZE];
+
+static uint64_t now_usec(void) {
+	struct timeval tv;
+	gettimeofday(&tv,NULL);
+	return tv.tv_sec*UINT64_C(1000000)+tv.tv_usec;
+}
+
+typedef struct _connarg {
+	int sock;
+	uint32_t rate;
+} connarg;
+
+// answers CLTOCS_READ requests like chunkserver does, limited to given rate
+static void* fakecs_conn(void *arg) {
+	connarg *ca = (connarg*)arg;
+	uint8_t hdr[28],*wptr;
+	const uint8_t *rptr;
+	uint64_t chunkid,due,now;
+	uint32_t offset,size,bsize,crc;
+
+	crc = mycrc32(0,chunkdata,MFSBLOCKSIZE);
+	due = 0;
+	while (tcptoread(ca->sock,hdr,28,60000)==28) {
+		rptr = hdr+8;
+		chunkid = get64bit(&rptr);
+		rptr += 4;	// version
+		offset = get32bit(&rptr);
+		size = get32bit(&rptr);
+		now = now_usec();
+		if (due<now) {	// idle time doesn't count
+			due = now;
+		}
+		while (size>0) {
+			bsize = MFSBLOCKSIZE-(offset&MFSBLOCKMASK);
+			if (bsize>size) {
+				bsize = size;
+			}
+			wptr = hdr;
+			put32bit(&wptr,CSTOCL_READ_DATA);
+			put32bit(&wptr,20+bsize);
+			put64bit(&wptr,chunkid);
+			put16bit(&wptr,offset>>MFSBLOCKBITS);
+			put16bit(&wptr,offset&MFSBLOCKMASK);
+			put32bit(&wptr,bsize);
+			put32bit(&wptr,(bsize==MFSBLOCKSIZE)?crc:mycrc32(0,chunkdata,bsize));
+			if (tcptowrite(ca->sock,hdr,28,60000)!=28 || tcptowrite(ca->sock,chunkdata,bsize,60000)!=(int32_t)bsize) {
+				break;
+			}
+			offset += bsize;
+			size -= bsize;
+			due += (uint64_t)bsize*1000000/ca->rate;
+			now = now_usec();
+			if (due>now) {
+				usleep(due-now);
+			}
+		}
+		wptr = hdr;
+		put32bit(&wptr,CSTOCL_READ_STATUS);
+		put32bit(&wptr,9);
+		put64bit(&wptr,chunkid);
+		put8bit(&wptr,STATUS_OK);
+		if (tcptowrite(ca->sock,hdr,17,60000)!=17) {
+			break;
+		}
+	}
+	tcpclose(ca->sock);
+	free(ca);
+	return NULL;
+}
+
+static void* fakecs_accept(void *arg) {
+	fakecs *cs = (fakecs*)arg;
+	connarg *ca;
+	pthread_t th;
+	int sock;
+	for (;;) {
+		sock = tcpaccept(cs->lsock);
+		if (sock<0) {
+			continue;
+		}
+		tcpnodelay(sock);
+		ca = (connarg*)malloc(sizeof(connarg));
+		ca->sock = sock;
+		ca->rate = cs->rate;
+		if (pthread_create(&th,NULL,fakecs_conn,ca)==0) {
+			pthread_detach(th);
+		}
+	}
+	return NULL;
+}
+
+static int cs_connect(uint16_t port) {
+	int fd;
+	fd = tcpsocket();
+	if (fd<0 || tcpnumtoconnect(fd,0x7F000001,port,1000)<0) {
+		fprintf(stderr,"can't connect to fake chunkserver\n");
+		exit(1);
+	}
+	tcpnodelay(fd);
+	return fd;
+}
+
+// returns MiB/s
+static double run(uint32_t goal,uint32_t totalmb,uint8_t striped) {
+	csreplica rep[REPLICAS];
+	uint8_t *buff;
+	uint64_t start,usec;
+	uint32_t i,r,offset;
+	int status;
+
+	buff = (uint8_t*)malloc(REQSIZE);
+	for (r=0 ; r<goal ; r++) {
+		rep[r].fd = cs_connect(servers[r].port);
+		rep[r].weight = 0;
+	}
+	start = now_usec();
+	for (i=0 ; i<totalmb ; i++) {
+		offset = (i*REQSIZE)&MFSCHUNKMASK;
+		if (striped && goal>1) {
+			status = cs_readstriped(rep,goal,1,1,offset,REQSIZE,buff);
+			for (r=0 ; r<goal ; r++) {
+				if (rep[r].broken) {	// hedged request lost - connection has to be renewed
+					tcpclose(rep[r].fd);
+					rep[r].fd = cs_connect(servers[r].port);
+				}
+				// the same moving average of speed (KiB/s) as in csdb
+				if (rep[r].bytes>0) {
+					uint32_t speed = ((uint64_t)rep[r].bytes*1000000/1024)/(rep[r].usec?rep[r].usec:1);
+					rep[r].weight = (rep[r].weight==0)?speed:(7*(uint64_t)rep[r].weight+speed)/8;
+				}
+			}
+		} else {
+			status = cs_readblock(rep[i%goal].fd,1,1,offset,REQSIZE,buff);
+		}
+		if (status<0 || buff[REQSIZE-1]!=chunkdata[MFSBLOCKSIZE-1]) {
+			fprintf(stderr,"read error\n");
+			exit(1);
+		}
+	}
+	usec = now_usec()-start;
+	for (r=0 ; r<goal ; r++) {
+		tcpclose(rep[r].fd);
+	}
+	free(buff);
+	return (double)totalmb*1000000.0/(usec?usec:1);
+}
+
+int main(int argc,char **argv) {
+	uint32_t mbps,totalmb,slow,goal,r;
+	uint32_t myip;
+	pthread_t th;
+
+	mbps = (argc>1)?strtoul(argv[1],NULL,10):100;
+	totalmb = (argc>2)?strtoul(argv[2],NULL,10):256;
+	slow = (argc>3)?strtoul(argv[3],NULL,10):1;
+	if (mbps==0 || totalmb==0 || slow==0) {
+		fprintf(stderr,"arguments have to be positive\n");
+		return 1;
+	}
+	signal(SIGPIPE,SIG_IGN);
+	mycrc32_init();
+	for (r=0 ; r<MFSBLOCKSIZE ; r++) {
+		chunkdata[r] = r*7+1;
+	}
+	for (r=0 ; r<REPLICAS ; r++) {
+		servers[r].rate = mbps*1024*1024/((r==REPLICAS-1)?slow:1);
+		servers[r].lsock = tcpsocket();
+		if (servers[r].lsock<0 || tcpnumlisten(servers[r].lsock,0x7F000001,0,100)<0 || tcpgetmyaddr(servers[r].lsock,&myip,&(servers[r].port))<0) {
+			fprintf(stderr,"can't create fake chunkserver\n");
+			return 1;
+		}
+		pthread_create(&th,NULL,fakecs_accept,servers+r);
+		pthread_detach(th);
+	}
+	printf("replica speed: %" PRIu32 " MiB/s (last one %" PRIu32 "x slower) ; read: %" PRIu32 " MiB in %u KiB requests\n",mbps,slow,totalmb,REQSIZE/1024);
+	for (goal=1 ; goal<=REPLICAS ; goal++) {
+		printf("goal: %" PRIu32 " ; one replica per request: %8.1f MiB/s ; striped: %8.1f MiB/s\n",goal,run(goal,totalmb,0),run(goal,totalmb,1));
+	}
+	return 0;
+}
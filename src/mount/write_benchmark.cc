@@ -0,0 +1,79 @@
+// Measures single file sequential write throughput of mfsmount - the file spans several chunks,
+// so it shows the difference between writing chunks one after another (-o mfswritechunks=1)
+// and writing several of them at the same time (-o mfswritechunks=N, default 4).
+// Usage: write_benchmark directory [file_mb [write_kb]]
+// 'directory' has to be on a mounted MooseFS ; the file (default 1024 MiB - 16 chunks) is written
+// in 'write_kb' KiB calls (default 1024) and fsynced, time to fsync's end is measured.
+// Run it twice on the same cluster: on a mount with mfswritechunks=1 and with mfswritechunks=N.
+
+#include "config.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+static uint64_t now_usec(void) {
+	struct timeval tv;
+	gettimeofday(&tv,NULL);
+	return tv.tv_sec*UINT64_C(1000000)+tv.tv_usec;
+}
+
+int main(int argc,char **argv) {
+	char fname[1024];
+	uint8_t *buff;
+	uint32_t filemb,writekb,i;
+	uint64_t total,done,start,usec;
+	ssize_t ret;
+	int fd;
+
+	if (argc<2) {
+		fprintf(stderr,"usage: %s directory [file_mb [write_kb]]\n",argv[0]);
+		return 1;
+	}
+	filemb = (argc>2)?strtoul(argv[2],NULL,10):1024;
+	writekb = (argc>3)?strtoul(argv[3],NULL,10):1024;
+	if (filemb==0 || writekb==0) {
+		fprintf(stderr,"arguments have to be positive\n");
+		return 1;
+	}
+	buff = (uint8_t*)malloc(writekb*1024);
+	if (buff==NULL) {
+		fprintf(stderr,"out of memory\n");
+		return 1;
+	}
+	for (i=0 ; i<writekb*1024 ; i++) {
+		buff[i] = i*7+1;
+	}
+	snprintf(fname,sizeof(fname),"%s/write_benchmark.XXXXXX",argv[1]);
+	fd = mkstemp(fname);
+	if (fd<0) {
+		fprintf(stderr,"can't create file in %s: %s\n",argv[1],strerror(errno));
+		return 1;
+	}
+	total = (uint64_t)filemb*1024*1024;
+	start = now_usec();
+	for (done=0 ; done<total ; done+=ret) {
+		ret = write(fd,buff,(total-done<writekb*1024)?(total-done):writekb*1024);
+		if (ret<=0) {
+			fprintf(stderr,"write error: %s\n",strerror(errno));
+			unlink(fname);
+			return 1;
+		}
+	}
+	if (fsync(fd)<0) {
+		fprintf(stderr,"fsync error: %s\n",strerror(errno));
+		unlink(fname);
+		return 1;
+	}
+	usec = now_usec()-start;
+	close(fd);
+	unlink(fname);
+	free(buff);
+	printf("written: %" PRIu32 " MiB (%" PRIu32 " chunks) in %" PRIu32 " KiB calls ; %.1f MiB/s\n",filemb,(filemb+63)/64,writekb,(double)filemb*1000000.0/(usec?usec:1));
+	return 0;
+}
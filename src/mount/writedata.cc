@@ -49,7 +49,15 @@
 #define EDQUOT ENOSPC
 #endif
 
-#define WORKERS 10
+// number of write workers adapts to load - there are always at least WORKERS_MIN of them, and when
+// all are busy new ones are started (up to WORKERS_MAX) ; worker finishing its job exits when there are
+// WORKERS_SPARE idle workers and more than WORKERS_MIN workers at all
+#define WORKERS_MIN 10
+#define WORKERS_MAX 100
+#define WORKERS_SPARE 4
+
+// limit of chunks of one inode written at the same time
+#define MAXCHUNKJOBS 16
 
 #define WCHASHSIZE 256
 #define WCHASH(inode,indx) (((inode)*0xB239FB71+(indx)*193)%WCHASHSIZE)
@@ -67,6 +75,17 @@ typedef struct cblock_s {
 	struct cblock_s *next,*prev;
 } cblock;
 
+struct inodedata_s;
+
+// chunk of inode being written by one worker (or waiting in queue for it)
+typedef struct chunkjob_s {
+	struct inodedata_s *id;
+	uint32_t chindx;
+	int wakefd;		// pipe of worker writing this chunk (-1 = job in queue)
+	uint8_t waiting;	// worker waits for more data of this chunk
+	uint8_t used;
+} chunkjob;
+
 typedef struct inodedata_s {
 	uint32_t inode;
 	uint64_t maxfleng;
@@ -76,11 +95,10 @@ typedef struct inodedata_s {
 	uint16_t writewaiting;
 	uint16_t lcnt;
 	uint32_t trycnt;
-	uint8_t waitingworker;
-	uint8_t inqueue;
-	int pipe[2];
+	uint8_t jobcnt;			// chunks being written or queued
+	chunkjob jobs[MAXCHUNKJOBS];
 	cblock *datachainhead,*datachaintail;
-	pthread_cond_t flushcond;	// wait for inqueue==0 (flush)
+	pthread_cond_t flushcond;	// wait for jobcnt==0 (flush)
 	pthread_cond_t writecond;	// wait for flushwaiting==0 (write)
 	struct inodedata_s *next;
 } inodedata;
@@ -93,6 +111,7 @@ static cblock *cacheblocks,*freecblockshead;
 static uint32_t freecacheblocks;
 
 static uint32_t maxretries;
+static uint32_t chunksinflight;
 
 static inodedata **idhash;
 
@@ -104,7 +123,13 @@ static uint32_t usedblocks;
 #endif
 
 static pthread_t dqueue_worker_th;
-static pthread_t write_worker_th[WORKERS];
+
+static pthread_mutex_t wlock;
+static pthread_cond_t wcond;		// worker has exited
+static uint32_t workers;		// wlock
+static uint32_t idleworkers;		// wlock
+static uint32_t workerid;		// wlock
+static uint8_t wterm;			// wlock
 
 static void *jqueue,*dqueue;
 
@@ -181,7 +206,7 @@ inodedata* write_find_inodedata(uint32_t inode) {
 inodedata* write_get_inodedata(uint32_t inode) {
 	uint32_t idh = IDHASH(inode);
 	inodedata *id;
-	int pfd[2];
+	uint32_t i;
 
 	for (id=idhash[idh] ; id ; id=id->next) {
 		if (id->inode == inode) {
@@ -189,22 +214,23 @@ inodedata* write_get_inodedata(uint32_t inode) {
 		}
 	}
 
-	if (pipe(pfd)<0) {
-		syslog(LOG_WARNING,"pipe error: %s",strerr(errno));
+	id = (inodedata*) malloc(sizeof(inodedata));
+	if (id==NULL) {
+		syslog(LOG_WARNING,"out of memory");
 		return NULL;
 	}
-	id = (inodedata*) malloc(sizeof(inodedata));
 	id->inode = inode;
 	id->cacheblockcount = 0;
 	id->maxfleng = 0;
 	id->status = 0;
 	id->trycnt = 0;
-	id->pipe[0] = pfd[0];
-	id->pipe[1] = pfd[1];
 	id->datachainhead = NULL;
 	id->datachaintail = NULL;
-	id->waitingworker = 0;
-	id->inqueue = 0;
+	id->jobcnt = 0;
+	for (i=0 ; i<MAXCHUNKJOBS ; i++) {
+		id->jobs[i].id = id;
+		id->jobs[i].used = 0;
+	}
 	id->flushwaiting = 0;
 	id->writewaiting = 0;
 	id->lcnt = 0;
@@ -225,8 +251,6 @@ void write_free_inodedata(inodedata *fid) {
 			*idp = id->next;
 			pthread_cond_destroy(&(id->flushcond));
 			pthread_cond_destroy(&(id->writecond));
-			close(id->pipe[0]);
-			close(id->pipe[1]);
 			free(id);
 			return;
 		}
@@ -235,24 +259,77 @@ void write_free_inodedata(inodedata *fid) {
 }
 
 
+/* chunk jobs */
+
+/* glock: LOCKED */
+static inline chunkjob* write_job_find(inodedata *id,uint32_t chindx) {
+	uint32_t i;
+	for (i=0 ; i<MAXCHUNKJOBS ; i++) {
+		if (id->jobs[i].used && id->jobs[i].chindx==chindx) {
+			return id->jobs+i;
+		}
+	}
+	return NULL;
+}
+
+/* glock: LOCKED */
+static inline chunkjob* write_job_add(inodedata *id,uint32_t chindx) {
+	uint32_t i;
+	for (i=0 ; i<MAXCHUNKJOBS ; i++) {
+		if (id->jobs[i].used==0) {
+			id->jobs[i].used = 1;
+			id->jobs[i].chindx = chindx;
+			id->jobs[i].wakefd = -1;
+			id->jobs[i].waiting = 0;
+			id->jobcnt++;
+			return id->jobs+i;
+		}
+	}
+	return NULL;
+}
+
 /* queues */
 
+void* write_worker(void *arg);
+
+/* wlock: LOCKED */
+static void write_worker_spawn(void) {
+	pthread_attr_t thattr;
+	pthread_t th;
+	pthread_attr_init(&thattr);
+	pthread_attr_setstacksize(&thattr,0x100000);
+	pthread_attr_setdetachstate(&thattr,PTHREAD_CREATE_DETACHED);
+	if (pthread_create(&th,&thattr,write_worker,(void*)(unsigned long)(workerid))==0) {
+		workers++;
+		idleworkers++;	// new worker starts idle
+		workerid++;
+	} else {
+		syslog(LOG_WARNING,"can't create write worker: %s",strerr(errno));
+	}
+	pthread_attr_destroy(&thattr);
+}
+
+/* glock: UNUSED */
+void write_enqueue(chunkjob *job) {
+	pthread_mutex_lock(&wlock);
+	if (idleworkers==0 && workers<WORKERS_MAX && wterm==0) {	// all workers are busy - start another one
+		write_worker_spawn();
+	}
+	pthread_mutex_unlock(&wlock);
+	queue_put(jqueue,0,0,(uint8_t*)job,0);
+}
+
 /* glock: UNUSED */
-void write_delayed_enqueue(inodedata *id,uint32_t cnt) {
+void write_delayed_enqueue(chunkjob *job,uint32_t cnt) {
 	struct timeval tv;
 	if (cnt>0) {
 		gettimeofday(&tv,NULL);
-		queue_put(dqueue,tv.tv_sec,tv.tv_usec,(uint8_t*)id,cnt);
+		queue_put(dqueue,tv.tv_sec,tv.tv_usec,(uint8_t*)job,cnt);
 	} else {
-		queue_put(jqueue,0,0,(uint8_t*)id,0);
+		write_enqueue(job);
 	}
 }
 
-/* glock: UNUSED */
-void write_enqueue(inodedata *id) {
-	queue_put(jqueue,0,0,(uint8_t*)id,0);
-}
-
 /* worker thread | glock: UNUSED */
 void* write_dqueue_worker(void *arg) {
 	struct timeval tv;
@@ -280,14 +357,31 @@ void* write_dqueue_worker(void *arg) {
 			gettimeofday(&tv,NULL);
 			queue_put(dqueue,tv.tv_sec,tv.tv_usec,(uint8_t*)id,cnt);
 		} else {
-			queue_put(jqueue,0,0,id,0);
+			write_enqueue((chunkjob*)id);
 		}
 	}
 	return NULL;
 }
 
+/* glock: LOCKED */
+static void write_cb_remove(inodedata *id,cblock *cb) {
+	if (cb->prev) {
+		cb->prev->next = cb->next;
+	} else {
+		id->datachainhead = cb->next;
+	}
+	if (cb->next) {
+		cb->next->prev = cb->prev;
+	} else {
+		id->datachaintail = cb->prev;
+	}
+}
+
 /* glock: UNLOCKED */
-void write_job_end(inodedata *id,int status,uint32_t delay) {
+void write_job_end(chunkjob *job,int status,uint32_t delay) {
+	inodedata *id = job->id;
+	uint32_t chindx = job->chindx;
+	uint8_t havedata;
 	cblock *cb,*fcb;
 
 	pthread_mutex_lock(&glock);
@@ -297,28 +391,38 @@ void write_job_end(inodedata *id,int status,uint32_t delay) {
 		id->status = status;
 	}
 	status = id->status;
-
-	if (id->datachainhead && status==0) {	// still have some work to do
-		// reset write id
-		for (cb=id->datachainhead ; cb ; cb=cb->next) {
-			cb->writeid = 0;
+	job->wakefd = -1;
+	job->waiting = 0;
+
+	havedata = 0;
+	for (cb=id->datachainhead ; cb ; cb=cb->next) {
+		if (cb->chindx==chindx) {
+			cb->writeid = 0;	// reset write id
+			havedata = 1;
 		}
+	}
+	if (havedata && status==0) {	// still have some work to do
 		if (delay==0) {
 			id->trycnt=0;	// on good write reset try counter
 		}
-		write_delayed_enqueue(id,delay);
-	} else {	// no more work or error occured
-		// if this is an error then release all data blocks
+		write_delayed_enqueue(job,delay);
+	} else {	// no more work in this chunk or error occured
+		job->used = 0;
+		id->jobcnt--;
 		cb = id->datachainhead;
 		while (cb) {
 			fcb = cb;
 			cb = cb->next;
-			write_cb_release(id,fcb);
+			// if this is an error then release data blocks of this chunk (and all of them after the last job)
+			if (status && (fcb->chindx==chindx || id->jobcnt==0)) {
+				write_cb_remove(id,fcb);
+				write_cb_release(id,fcb);
+			} else if (status==0 && id->jobcnt<chunksinflight && write_job_find(id,fcb->chindx)==NULL) {
+				// chunk waiting for free job slot
+				write_enqueue(write_job_add(id,fcb->chindx));
+			}
 		}
-		id->datachainhead=NULL;
-		id->inqueue=0;
-
-		if (id->flushwaiting>0) {
+		if (id->jobcnt==0 && id->flushwaiting>0) {
 			pthread_cond_broadcast(&(id->flushcond));
 		}
 	}
@@ -382,39 +486,81 @@ void* write_worker(void *arg) {
 	struct timeval start,now,lastrcvd,lrdiff;
 
 	uint8_t cnt;
+	uint8_t busy;
 
+	int wpipe[2];
+	chunkjob *job;
 	inodedata *id;
 	cblock *cb,*rcb;
 
 	chainelements = 0;
 
+	if (pipe(wpipe)<0) {
+		syslog(LOG_WARNING,"pipe error: %s",strerr(errno));
+		wpipe[0] = -1;
+		wpipe[1] = -1;
+	}
+
 	(void)arg;
+	busy = 0;
 	for (;;) {
 		for (cnt=0 ; cnt<chainelements ; cnt++) {
 			csdb_writedec(chainip[cnt],chainport[cnt]);
 		}
 		chainelements=0;
 
+		pthread_mutex_lock(&wlock);
+		if (busy) {
+			if (workers>WORKERS_MIN && idleworkers>=WORKERS_SPARE) {	// enough idle workers - this one is not needed
+				busy = 2;
+			} else {
+				idleworkers++;
+				busy = 0;
+			}
+		}
+		pthread_mutex_unlock(&wlock);
+
 		// get next job
-		queue_get(jqueue,&z1,&z2,&data,&z3);
+		if (busy==0) {
+			queue_get(jqueue,&z1,&z2,&data,&z3);
+		} else {
+			data = NULL;
+		}
 		if (data==NULL) {
+			if (wpipe[0]>=0) {
+				close(wpipe[0]);
+				close(wpipe[1]);
+			}
+			pthread_mutex_lock(&wlock);
+			workers--;
+			if (busy==0) {
+				idleworkers--;
+			}
+			pthread_cond_signal(&wcond);
+			pthread_mutex_unlock(&wlock);
 			return NULL;
 		}
-		id = (inodedata*)data;
+		pthread_mutex_lock(&wlock);
+		idleworkers--;
+		pthread_mutex_unlock(&wlock);
+		busy = 1;
+		job = (chunkjob*)data;
+		id = job->id;
+		chindx = job->chindx;
 
 		pthread_mutex_lock(&glock);
-		if (id->datachainhead) {
-			chindx = id->datachainhead->chindx;
+		job->wakefd = wpipe[1];
+		for (cb=id->datachainhead ; cb && cb->chindx!=chindx ; cb=cb->next) {}
+		if (cb) {
 			status = id->status;
 		} else {
-			syslog(LOG_WARNING,"writeworker got inode with no data to write !!!");
-			chindx = 0;
+			syslog(LOG_WARNING,"writeworker got chunk with no data to write !!!");
 			status = EINVAL;	// this should never happen, so status is not important - just anything
 		}
 		pthread_mutex_unlock(&glock);
 
 		if (status) {
-			write_job_end(id,status,0);
+			write_job_end(job,status,0);
 			continue;
 		}
 
@@ -425,25 +571,25 @@ void* write_worker(void *arg) {
 			syslog(LOG_WARNING,"file: %" PRIu32 ", index: %" PRIu32 " - fs_writechunk returns status: %s",id->inode,chindx,mfsstrerr(wrstatus));
 			if (wrstatus!=ERROR_LOCKED) {
 				if (wrstatus==ERROR_ENOENT) {
-					write_job_end(id,EBADF,0);
+					write_job_end(job,EBADF,0);
 				} else if (wrstatus==ERROR_QUOTA) {
-					write_job_end(id,EDQUOT,0);
+					write_job_end(job,EDQUOT,0);
 				} else if (wrstatus==ERROR_NOSPACE) {
-					write_job_end(id,ENOSPC,0);
+					write_job_end(job,ENOSPC,0);
 				} else {
 					id->trycnt++;
 					if (id->trycnt>=maxretries) {
 						if (wrstatus==ERROR_NOCHUNKSERVERS) {
-							write_job_end(id,ENOSPC,0);
+							write_job_end(job,ENOSPC,0);
 						} else {
-							write_job_end(id,EIO,0);
+							write_job_end(job,EIO,0);
 						}
 					} else {
-						write_delayed_enqueue(id,1+((id->trycnt<30)?(id->trycnt/3):10));
+						write_delayed_enqueue(job,1+((id->trycnt<30)?(id->trycnt/3):10));
 					}
 				}
 			} else {
-				write_delayed_enqueue(id,1+((id->trycnt<30)?(id->trycnt/3):10));
+				write_delayed_enqueue(job,1+((id->trycnt<30)?(id->trycnt/3):10));
 			}
 			continue;	// get next job
 		}
@@ -451,9 +597,9 @@ void* write_worker(void *arg) {
 			syslog(LOG_WARNING,"file: %" PRIu32 ", index: %" PRIu32 ", chunk: %" PRIu64 ", version: %" PRIu32 " - there are no valid copies",id->inode,chindx,chunkid,version);
 			id->trycnt+=6;
 			if (id->trycnt>=maxretries) {
-				write_job_end(id,ENXIO,0);
+				write_job_end(job,ENXIO,0);
 			} else {
-				write_delayed_enqueue(id,60);
+				write_delayed_enqueue(job,60);
 			}
 			continue;
 		}
@@ -472,9 +618,10 @@ void* write_worker(void *arg) {
 		chainsize = csdatasize-6;
 		gettimeofday(&start,NULL);
 
-		// make connection to cs
+		// make connection to cs (chunkserver closes connection after write, so it's never given back to pool)
 		srcip = fs_getsrcip();
-		cnt=0;
+		fd = csdb_getconn(ip,port);
+		cnt = (fd>=0)?10:0;
 		while (cnt<10) {
 			fd = tcpsocket();
 			if (fd<0) {
@@ -504,9 +651,9 @@ void* write_worker(void *arg) {
 			fs_writeend(chunkid,id->inode,0);
 			id->trycnt++;
 			if (id->trycnt>=maxretries) {
-				write_job_end(id,EIO,0);
+				write_job_end(job,EIO,0);
 			} else {
-				write_delayed_enqueue(id,1+((id->trycnt<30)?(id->trycnt/3):10));
+				write_delayed_enqueue(job,1+((id->trycnt<30)?(id->trycnt/3):10));
 			}
 			continue;
 		}
@@ -521,7 +668,7 @@ void* write_worker(void *arg) {
 		nextwriteid=1;
 
 		pfd[0].fd = fd;
-		pfd[1].fd = id->pipe[0];
+		pfd[1].fd = wpipe[0];
 		rcvd = 0;
 		sent = 0;
 		waitforstatus=1;
@@ -568,24 +715,19 @@ void* write_worker(void *arg) {
 
 			if (havedata==0 && now.tv_sec<(jobs?5:25) && waitforstatus<15) {
 				pthread_mutex_lock(&glock);
+				// other chunks of this inode can be written at the same time by other workers, so skip their blocks
 				if (cb==NULL) {
-					if (id->datachainhead) {
-						if (id->datachainhead->to-id->datachainhead->from==MFSBLOCKSIZE || waitforstatus<=1) {
-							cb = id->datachainhead;
-							havedata=1;
-						}
-					}
+					for (rcb=id->datachainhead ; rcb && rcb->chindx!=chindx ; rcb=rcb->next) {}
 				} else {
-					if (cb->next) {
-						if (cb->next->chindx==chindx) {
-							if (cb->next->to-cb->next->from==MFSBLOCKSIZE || waitforstatus<=1) {
-								cb = cb->next;
-								havedata=1;
-							}
-						}
-					} else {
-						id->waitingworker=1;
+					for (rcb=cb->next ; rcb && rcb->chindx!=chindx ; rcb=rcb->next) {}
+				}
+				if (rcb) {
+					if (rcb->to-rcb->from==MFSBLOCKSIZE || waitforstatus<=1) {
+						cb = rcb;
+						havedata=1;
 					}
+				} else if (cb) {
+					job->waiting=1;
 				}
 				if (havedata==1) {
 					cb->writeid = nextwriteid++;
@@ -621,10 +763,10 @@ void* write_worker(void *arg) {
 				break;
 			}
 			pthread_mutex_lock(&glock);	// make helgrind happy
-			id->waitingworker=0;
+			job->waiting=0;
 			pthread_mutex_unlock(&glock);	// make helgrind happy
 			if (pfd[1].revents&POLLIN) {	// used just to break poll - so just read all data from pipe to empty it
-				i = read(id->pipe[0],pipebuff,1024);
+				i = read(wpipe[0],pipebuff,1024);
 				if (i<0) { // mainly to make happy static code analyzers
 					syslog(LOG_NOTICE,"read pipe error: %s",strerr(errno));
 				}
@@ -670,7 +812,7 @@ void* write_worker(void *arg) {
 // debug:				syslog(LOG_NOTICE,"writeworker: received status ok for writeid:%" PRIu32,recwriteid);
 					if (recwriteid>0) {
 						pthread_mutex_lock(&glock);
-						for (rcb = id->datachainhead ; rcb && rcb->writeid!=recwriteid ; rcb=rcb->next) {}
+						for (rcb = id->datachainhead ; rcb && (rcb->writeid!=recwriteid || rcb->chindx!=chindx) ; rcb=rcb->next) {}
 						if (rcb==NULL) {
 							syslog(LOG_WARNING,"writeworker: got unexpected status (writeid:%" PRIu32 ")",recwriteid);
 							pthread_mutex_unlock(&glock);
@@ -688,16 +830,7 @@ void* write_worker(void *arg) {
 								cb = NULL;
 							}
 						}
-						if (rcb->prev) {
-							rcb->prev->next = rcb->next;
-						} else {
-							id->datachainhead = rcb->next;
-						}
-						if (rcb->next) {
-							rcb->next->prev = rcb->prev;
-						} else {
-							id->datachaintail = rcb->prev;
-						}
+						write_cb_remove(id,rcb);
 						maxwroffset = (((uint64_t)(chindx))<<MFSCHUNKBITS)+(((uint32_t)(rcb->pos))<<MFSBLOCKBITS)+rcb->to;
 						if (maxwroffset>mfleng) {
 							mfleng=maxwroffset;
@@ -795,7 +928,7 @@ void* write_worker(void *arg) {
 		}
 
 		if (westatus!=STATUS_OK) {
-			write_job_end(id,ENXIO,0);
+			write_job_end(job,ENXIO,0);
 		} else if (status!=0 || wrstatus!=STATUS_OK) {
 			if (wrstatus!=STATUS_OK) {	// convert MFS status to OS errno
 				if (wrstatus==ERROR_NOSPACE) {
@@ -806,24 +939,30 @@ void* write_worker(void *arg) {
 			}
 			id->trycnt++;
 			if (id->trycnt>=maxretries) {
-				write_job_end(id,status,0);
+				write_job_end(job,status,0);
 			} else {
-				write_job_end(id,0,1+((id->trycnt<30)?(id->trycnt/3):10));
+				write_job_end(job,0,1+((id->trycnt<30)?(id->trycnt/3):10));
 			}
 		} else {
 			read_inode_ops(id->inode);
-			write_job_end(id,0,0);
+			write_job_end(job,0,0);
 		}
 	}
 }
 
 /* API | glock: INITIALIZED,UNLOCKED */
-void write_data_init (uint32_t cachesize,uint32_t retries) {
+void write_data_init (uint32_t cachesize,uint32_t retries,uint32_t writechunks) {
 	uint32_t cacheblockcount = (cachesize/MFSBLOCKSIZE);
 	uint32_t i;
 	pthread_attr_t thattr;
 
 	maxretries = retries;
+	if (writechunks<1) {
+		writechunks = 1;
+	} else if (writechunks>MAXCHUNKJOBS) {
+		writechunks = MAXCHUNKJOBS;
+	}
+	chunksinflight = writechunks;
 	if (cacheblockcount<10) {
 		cacheblockcount=10;
 	}
@@ -853,10 +992,19 @@ void write_data_init (uint32_t cachesize,uint32_t retries) {
 #ifdef BUFFER_DEBUG
 	pthread_create(&info_worker_th,&thattr,write_info_worker,NULL);
 #endif
-	for (i=0 ; i<WORKERS ; i++) {
-		pthread_create(write_worker_th+i,&thattr,write_worker,(void*)(unsigned long)(i));
-	}
 	pthread_attr_destroy(&thattr);
+
+	pthread_mutex_init(&wlock,NULL);
+	pthread_cond_init(&wcond,NULL);
+	workers = 0;
+	idleworkers = 0;
+	workerid = 0;
+	wterm = 0;
+	pthread_mutex_lock(&wlock);
+	for (i=0 ; i<WORKERS_MIN ; i++) {
+		write_worker_spawn();
+	}
+	pthread_mutex_unlock(&wlock);
 }
 
 void write_data_term(void) {
@@ -864,12 +1012,17 @@ void write_data_term(void) {
 	inodedata *id,*idn;
 
 	queue_put(dqueue,0,0,NULL,0);
-	for (i=0 ; i<WORKERS ; i++) {
+	pthread_mutex_lock(&wlock);
+	wterm = 1;
+	for (i=0 ; i<workers ; i++) {
 		queue_put(jqueue,0,0,NULL,0);
 	}
-	for (i=0 ; i<WORKERS ; i++) {
-		pthread_join(write_worker_th[i],NULL);
+	while (workers>0) {
+		pthread_cond_wait(&wcond,&wlock);
 	}
+	pthread_mutex_unlock(&wlock);
+	pthread_cond_destroy(&wcond);
+	pthread_mutex_destroy(&wlock);
 	pthread_join(dqueue_worker_th,NULL);
 	queue_delete(dqueue);
 	queue_delete(jqueue);
@@ -878,8 +1031,6 @@ void write_data_term(void) {
 			idn = id->next;
 			pthread_cond_destroy(&(id->flushcond));
 			pthread_cond_destroy(&(id->writecond));
-			close(id->pipe[0]);
-			close(id->pipe[1]);
 			free(id);
 		}
 	}
@@ -907,6 +1058,7 @@ int write_cb_expand(cblock *cb,uint32_t from,uint32_t to,const uint8_t *data) {
 /* glock: UNLOCKED */
 int write_block(inodedata *id,uint32_t chindx,uint16_t pos,uint32_t from,uint32_t to,const uint8_t *data) {
 	cblock *cb;
+	chunkjob *job;
 
 	pthread_mutex_lock(&glock);
 	for (cb=id->datachaintail ; cb ; cb=cb->prev) {
@@ -935,17 +1087,17 @@ int write_block(inodedata *id,uint32_t chindx,uint16_t pos,uint32_t from,uint32_
 		id->datachainhead = cb;
 	}
 	id->datachaintail = cb;
-	if (id->inqueue) {
-		if (id->waitingworker) {
-			if (write(id->pipe[1]," ",1)!=1) {
+	job = write_job_find(id,chindx);
+	if (job) {
+		if (job->waiting && job->wakefd>=0) {
+			if (write(job->wakefd," ",1)!=1) {
 				syslog(LOG_ERR,"can't write to pipe !!!");
 			}
-			id->waitingworker=0;
+			job->waiting=0;
 		}
-	} else {
-		id->inqueue=1;
-		write_enqueue(id);
-	}
+	} else if (id->jobcnt<chunksinflight) {
+		write_enqueue(write_job_add(id,chindx));
+	}	// otherwise this chunk will be started by write_job_end of one of current jobs
 	pthread_mutex_unlock(&glock);
 	return 0;
 }
@@ -1032,7 +1184,7 @@ int write_data_flush(void *vid) {
 //	gettimeofday(&s,NULL);
 	pthread_mutex_lock(&glock);
 	id->flushwaiting++;
-	while (id->inqueue) {
+	while (id->jobcnt>0) {
 //		syslog(LOG_NOTICE,"flush: wait ...");
 		pthread_cond_wait(&(id->flushcond),&glock);
 //		syslog(LOG_NOTICE,"flush: woken up");
@@ -1042,7 +1194,7 @@ int write_data_flush(void *vid) {
 		pthread_cond_broadcast(&(id->writecond));
 	}
 	ret = id->status;
-	if (id->lcnt==0 && id->inqueue==0 && id->flushwaiting==0 && id->writewaiting==0) {
+	if (id->lcnt==0 && id->jobcnt==0 && id->flushwaiting==0 && id->writewaiting==0) {
 		write_free_inodedata(id);
 	}
 	pthread_mutex_unlock(&glock);
@@ -1076,7 +1228,7 @@ int write_data_flush_inode(uint32_t inode) {
 		return 0;
 	}
 	id->flushwaiting++;
-	while (id->inqueue) {
+	while (id->jobcnt>0) {
 //		syslog(LOG_NOTICE,"flush_inode: wait ...");
 		pthread_cond_wait(&(id->flushcond),&glock);
 //		syslog(LOG_NOTICE,"flush_inode: woken up");
@@ -1086,7 +1238,7 @@ int write_data_flush_inode(uint32_t inode) {
 		pthread_cond_broadcast(&(id->writecond));
 	}
 	ret = id->status;
-	if (id->lcnt==0 && id->inqueue==0 && id->flushwaiting==0 && id->writewaiting==0) {
+	if (id->lcnt==0 && id->jobcnt==0 && id->flushwaiting==0 && id->writewaiting==0) {
 		write_free_inodedata(id);
 	}
 	pthread_mutex_unlock(&glock);
@@ -1102,7 +1254,7 @@ int write_data_end(void *vid) {
 	}
 	pthread_mutex_lock(&glock);
 	id->flushwaiting++;
-	while (id->inqueue) {
+	while (id->jobcnt>0) {
 //		syslog(LOG_NOTICE,"write_end: wait ...");
 		pthread_cond_wait(&(id->flushcond),&glock);
 //		syslog(LOG_NOTICE,"write_end: woken up");
@@ -1113,7 +1265,7 @@ int write_data_end(void *vid) {
 	}
 	ret = id->status;
 	id->lcnt--;
-	if (id->lcnt==0 && id->inqueue==0 && id->flushwaiting==0 && id->writewaiting==0) {
+	if (id->lcnt==0 && id->jobcnt==0 && id->flushwaiting==0 && id->writewaiting==0) {
 		write_free_inodedata(id);
 	}
 	pthread_mutex_unlock(&glock);